@@ -55,7 +55,17 @@ export namespace utils {
 			none,
 			interval,
 			ping_size,
-			lru
+			lru,
+			ewma,
+			history,
+			udp_port,
+			tcp_port,
+			probe_rate,
+			byte_rate,
+			max_hops,
+			event_log,
+			capture,
+			metrics
 		};
 		expect_next next = expect_next::none;
 		bool m_help = false;
@@ -72,6 +82,7 @@ export namespace utils {
 module : private;
 
 import <string_view>;
+import WinMTR.ProbeBackend;
 import WinMTRUtils;
 
 
@@ -85,6 +96,9 @@ void utils::CWinMTRCommandLineParser::ParseParam(const WCHAR* pszParam, BOOL bFl
 		else if (L"n"sv == pszParam || L"-numeric"sv == pszParam) {
 			this->dlg.SetUseDNS(false, WinMTRDialog::options_source::cmd_line);
 		}
+		else if (L"p"sv == pszParam || L"-paris"sv == pszParam) {
+			this->dlg.SetParisMode(true, WinMTRDialog::options_source::cmd_line);
+		}
 		else if (L"i"sv == pszParam || L"-interval"sv == pszParam) {
 			this->next = expect_next::interval;
 		}
@@ -94,6 +108,36 @@ void utils::CWinMTRCommandLineParser::ParseParam(const WCHAR* pszParam, BOOL bFl
 		else if (L"s"sv == pszParam || L"-size"sv == pszParam) {
 			this->next = expect_next::ping_size;
 		}
+		else if (L"e"sv == pszParam || L"-ewma"sv == pszParam) {
+			this->next = expect_next::ewma;
+		}
+		else if (L"k"sv == pszParam || L"-history"sv == pszParam) {
+			this->next = expect_next::history;
+		}
+		else if (L"u"sv == pszParam || L"-udp"sv == pszParam) {
+			this->next = expect_next::udp_port;
+		}
+		else if (L"t"sv == pszParam || L"-tcp"sv == pszParam) {
+			this->next = expect_next::tcp_port;
+		}
+		else if (L"r"sv == pszParam || L"-rate"sv == pszParam) {
+			this->next = expect_next::probe_rate;
+		}
+		else if (L"b"sv == pszParam || L"-bandwidth"sv == pszParam) {
+			this->next = expect_next::byte_rate;
+		}
+		else if (L"x"sv == pszParam || L"-maxhops"sv == pszParam) {
+			this->next = expect_next::max_hops;
+		}
+		else if (L"l"sv == pszParam || L"-log"sv == pszParam) {
+			this->next = expect_next::event_log;
+		}
+		else if (L"w"sv == pszParam || L"-capture"sv == pszParam) {
+			this->next = expect_next::capture;
+		}
+		else if (L"M"sv == pszParam || L"-metrics"sv == pszParam) {
+			this->next = expect_next::metrics;
+		}
 		return;
 	}
 	wchar_t* end = nullptr;
@@ -125,6 +169,71 @@ void utils::CWinMTRCommandLineParser::ParseParam(const WCHAR* pszParam, BOOL bFl
 		this->dlg.SetPingSize(parsed, WinMTRDialog::options_source::cmd_line);
 	}
 	break;
+	case expect_next::ewma:
+	{
+		auto parsed = std::wcstod(pszParam, &end);
+		if (parsed > WinMTRUtils::MAX_EWMA_WEIGHT || parsed < WinMTRUtils::MIN_EWMA_WEIGHT) {
+			parsed = WinMTRUtils::DEFAULT_EWMA_WEIGHT;
+		}
+		this->dlg.SetEwmaWeight(parsed, WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::history:
+	{
+		auto parsed = std::wcstol(pszParam, &end, 10);
+		if (parsed > static_cast<long>(WinMTRUtils::MAX_HISTORY_KIB) || parsed < static_cast<long>(WinMTRUtils::MIN_HISTORY_KIB)) {
+			parsed = WinMTRUtils::DEFAULT_HISTORY_KIB;
+		}
+		this->dlg.SetHistoryKiB(static_cast<unsigned>(parsed), WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::udp_port:
+	case expect_next::tcp_port:
+	{
+		const auto udp = this->next == expect_next::udp_port;
+		auto parsed = std::wcstol(pszParam, &end, 10);
+		if (parsed > static_cast<long>(WinMTRUtils::MAX_PROBE_PORT) || parsed < static_cast<long>(WinMTRUtils::MIN_PROBE_PORT)) {
+			parsed = udp ? WinMTRUtils::DEFAULT_UDP_PORT : WinMTRUtils::DEFAULT_TCP_PORT;
+		}
+		this->dlg.SetProbeProtocol(udp ? probe_protocol::udp : probe_protocol::tcp, static_cast<unsigned>(parsed), WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::probe_rate:
+	{
+		auto parsed = std::wcstoul(pszParam, &end, 10);
+		if (parsed > WinMTRUtils::MAX_MAX_PROBE_RATE || parsed < WinMTRUtils::MIN_MAX_PROBE_RATE) {
+			parsed = WinMTRUtils::DEFAULT_MAX_PROBE_RATE;
+		}
+		this->dlg.SetMaxProbeRate(static_cast<unsigned>(parsed), WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::byte_rate:
+	{
+		auto parsed = std::wcstoul(pszParam, &end, 10);
+		if (parsed > WinMTRUtils::MAX_MAX_BYTE_RATE || parsed < WinMTRUtils::MIN_MAX_BYTE_RATE) {
+			parsed = WinMTRUtils::DEFAULT_MAX_BYTE_RATE;
+		}
+		this->dlg.SetMaxByteRate(static_cast<unsigned>(parsed), WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::max_hops:
+	{
+		auto parsed = std::wcstoul(pszParam, &end, 10);
+		if (parsed > WinMTRUtils::MAX_MAX_HOPS || parsed < WinMTRUtils::MIN_MAX_HOPS) {
+			parsed = WinMTRUtils::DEFAULT_MAX_HOPS;
+		}
+		this->dlg.SetMaxHops(static_cast<unsigned>(parsed), WinMTRDialog::options_source::cmd_line);
+	}
+	break;
+	case expect_next::event_log:
+		this->dlg.SetEventLog(pszParam);
+		break;
+	case expect_next::capture:
+		this->dlg.SetCapture(pszParam);
+		break;
+	case expect_next::metrics:
+		this->dlg.SetMetrics(pszParam);
+		break;
 	default:
 		break;
 	}
@@ -18,13 +18,37 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+module;
+// MSVC only, the vtable is never needed before a derived constructor sets it
+#ifdef _WIN32
+#define WINMTR_NOVTABLE __declspec(novtable)
+#else
+#define WINMTR_NOVTABLE
+#endif
 export module WinMTROptionsProvider;
+
+import WinMTR.ProbeBackend;
 /***
 * Note: Implementers must ensure that calling any of the methods is thread safe
 */
-export struct __declspec(novtable) IWinMTROptionsProvider {
+export struct WINMTR_NOVTABLE IWinMTROptionsProvider {
 	virtual unsigned getPingSize() const noexcept = 0;
 	virtual double getInterval() const noexcept = 0;
 	virtual bool getUseDNS() const noexcept = 0;
+	// weight of the newest sample in the per hop EWMA latency
+	virtual double getEwmaWeight() const noexcept = 0;
+	// memory cap for the per hop probe history of one trace, zero for none
+	virtual unsigned getHistoryKiB() const noexcept = 0;
+	// keep every probe of a trace on one flow so load balancers send them down the same path
+	virtual bool getParisMode() const noexcept = 0;
+	// falls back to ICMP on backends that can't send the others
+	virtual probe_protocol getProbeProtocol() const noexcept = 0;
+	// destination port of UDP and TCP probes, UDP counts up from it unless in Paris mode
+	virtual unsigned getProbePort() const noexcept = 0;
+	// caps on everything the probe backend sends, for all hops together
+	virtual unsigned getMaxProbeRate() const noexcept = 0;
+	virtual unsigned getMaxByteRate() const noexcept = 0;
+	// the highest TTL probed, the trace stops short of it at the destination
+	virtual unsigned getMaxHops() const noexcept = 0;
 };
 
@@ -0,0 +1,628 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRAsnDatabase.ixx
+//
+// DESCRIPTION:
+//   Which autonomous system an address belongs to, from an offline copy of
+//   the routing table. Built once from an iptoasn.com style dump and mapped
+//   straight from disk after that, so there is nothing to parse at startup.
+//
+// NOTES:
+//   The prefixes are kept as a poptrie (Asai and Ohara, SIGCOMM 2015): the
+//   first 16 bits index a table directly, below that a 64-way trie whose
+//   nodes keep a bitmap of children and one of leaves and find either with
+//   a popcount, 24 bytes a node. An IPv4 lookup is at most five dependent
+//   reads and never allocates.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.AsnDatabase;
+
+#ifdef _WIN32
+import <atomic>;
+import <cstddef>;
+import <cstdint>;
+import <filesystem>;
+import <memory>;
+import <span>;
+import <string>;
+import <string_view>;
+#endif
+import WinMTR.MappedFile;
+
+export struct asn_record final {
+	std::uint32_t asn = 0;		// zero if nothing covers the address
+	std::string_view org;		// UTF-8, points into the database
+};
+
+//*****************************************************************************
+// CLASS:  asn_database
+//
+// Read only once opened, so safe to share between threads as it is.
+//*****************************************************************************
+export class asn_database final {
+	asn_database(const asn_database&) = delete;
+	asn_database& operator=(const asn_database&) = delete;
+public:
+	// a file of the wrong version, cut short or otherwise broken opens as nothing
+	[[nodiscard]]
+	static std::shared_ptr<const asn_database> open(const std::filesystem::path& path) noexcept;
+
+	// Turns a tab separated range_start, range_end, AS number, country,
+	// description dump, IPv4 and IPv6 mixed, into what open() reads. Rows
+	// for AS 0 are left out, so are ones that don't parse.
+	static bool build(const std::filesystem::path& tsv, const std::filesystem::path& out);
+
+	// the one every trace annotates its hops from, none until one is installed
+	[[nodiscard]]
+	static std::shared_ptr<const asn_database> instance() noexcept
+	{
+		return s_instance.load(std::memory_order_acquire);
+	}
+	static void install(std::shared_ptr<const asn_database> database) noexcept
+	{
+		s_instance.store(std::move(database), std::memory_order_release);
+	}
+
+	// the longest prefix that covers addr
+	[[nodiscard]]
+	asn_record lookup(const SOCKADDR_INET& addr) const noexcept;
+
+	// for display, empty if the AS isn't in the table
+	[[nodiscard]]
+	std::wstring organization(std::uint32_t asn) const;
+	// the same into a string the caller keeps, which only grows
+	void organization(std::uint32_t asn, std::wstring& into) const;
+
+	[[nodiscard]] std::size_t size_bytes() const noexcept;
+
+	~asn_database() noexcept;
+
+	// what the file holds past its header, all of it little endian
+	struct trie_node final {
+		std::uint64_t children;		// bit i set if slot i is another node
+		std::uint64_t leaves;		// bit i set if slot i starts a run of leaves with a new value
+		std::uint32_t leaf_base;
+		std::uint32_t child_base;
+	};
+	struct record_entry final {
+		std::uint32_t asn;
+		std::uint32_t org_offset;
+		std::uint32_t org_size;
+	};
+private:
+	explicit asn_database(std::unique_ptr<const mapped_file> file) noexcept;
+
+	// one address family's part of the file
+	struct trie final {
+		std::span<const std::uint32_t> direct;	// a node, or a leaf value with the top bit set
+		std::span<const trie_node> nodes;
+		std::span<const std::uint32_t> leaves;
+
+		[[nodiscard]]
+		std::uint32_t find(std::uint64_t high, std::uint64_t low, unsigned bits) const noexcept;
+		[[nodiscard]]
+		bool valid(std::size_t records) const noexcept;
+	};
+	[[nodiscard]]
+	asn_record record(std::uint32_t value) const noexcept;
+
+	std::unique_ptr<const mapped_file> m_file;
+	trie m_ipv4;
+	trie m_ipv6;
+	std::span<const record_entry> m_records;	// sorted by AS number
+	std::string_view m_strings;
+
+	static inline std::atomic<std::shared_ptr<const asn_database>> s_instance;
+};
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
+import <bit>;
+import <charconv>;
+import <cstring>;
+import <fstream>;
+import <map>;
+import <system_error>;
+import <tuple>;
+import <utility>;
+import <vector>;
+#endif
+
+namespace {
+	constexpr std::array<char, 8> FILE_MAGIC = { 'W', 'M', 'T', 'R', 'A', 'S', 'N', '1' };
+	// the first bits go straight through a table, the rest six at a time
+	constexpr unsigned DIRECT_BITS = 16;
+	constexpr std::uint32_t DIRECT_LEAF = 0x80000000;
+	constexpr unsigned STRIDE = 6;
+
+	struct file_header final {
+		std::array<char, 8> magic;
+		std::uint32_t records;
+		std::uint32_t string_bytes;
+		std::uint32_t nodes[2];		// IPv4, IPv6
+		std::uint32_t leaves[2];
+	};
+	static_assert(sizeof(file_header) == 32);
+	static_assert(sizeof(asn_database::trie_node) == 24);
+	static_assert(sizeof(asn_database::record_entry) == 12);
+
+	// the STRIDE bits of a left aligned 128 bit key starting at bit, zeros past the end
+	[[nodiscard]]
+	constexpr unsigned chunk(std::uint64_t high, std::uint64_t low, unsigned bit) noexcept
+	{
+		const auto window = bit == 0 ? high
+			: bit < 64 ? (high << bit) | (low >> (64 - bit))
+			: low << (bit - 64);
+		return static_cast<unsigned>(window >> (64 - STRIDE));
+	}
+
+	[[nodiscard]]
+	std::uint64_t load_be64(const std::uint8_t* bytes) noexcept
+	{
+		std::uint64_t value = 0;
+		for (int i = 0; i < 8; ++i) {
+			value = value << 8 | bytes[i];
+		}
+		return value;
+	}
+
+	//*****************************************************************************
+	// CLASS:  prefix_builder
+	//
+	// A plain binary trie of the ranges, which is then folded into the
+	// poptrie's 64-way nodes with every leaf pushed down to where it applies.
+	//*****************************************************************************
+	class prefix_builder final {
+		struct binary_node final {
+			std::array<std::uint32_t, 2> child{};
+			std::uint32_t value = 0;	// record index + 1, zero for none
+		};
+		// what a walk ends on when the trie stops short, no child is ever the root
+		static constexpr auto NONE = ~std::uint32_t{ 0 };
+		std::vector<binary_node> m_trie = std::vector<binary_node>(1);
+		unsigned m_bits;
+	public:
+		explicit prefix_builder(unsigned bits) noexcept
+			:m_bits(bits)
+		{
+		}
+
+		// both ends inclusive, as big endian bytes of the address width
+		void add(std::span<const std::uint8_t> first, std::span<const std::uint8_t> last, std::uint32_t value)
+		{
+			range bounds{ .value = value };
+			for (unsigned bit = 0; bit < m_bits; ++bit) {
+				bounds.first[bit] = first[bit / 8] >> (7 - bit % 8) & 1;
+				bounds.last[bit] = last[bit / 8] >> (7 - bit % 8) & 1;
+			}
+			bounds.first_zeros[m_bits] = bounds.last_ones[m_bits] = true;
+			for (auto bit = m_bits; bit-- > 0;) {
+				bounds.first_zeros[bit] = bounds.first_zeros[bit + 1] && !bounds.first[bit];
+				bounds.last_ones[bit] = bounds.last_ones[bit + 1] && bounds.last[bit];
+			}
+			add(0, 0, true, true, bounds);
+		}
+
+		// every prefix of DIRECT_BITS gets a leaf value or a node of its own
+		void fold(std::vector<std::uint32_t>& direct, std::vector<asn_database::trie_node>& nodes, std::vector<std::uint32_t>& leaves) const
+		{
+			direct.resize(std::size_t{ 1 } << DIRECT_BITS);
+			for (std::uint32_t slot = 0; slot < direct.size(); ++slot) {
+				const auto [node, value] = walk(0, m_trie[0].value, slot, DIRECT_BITS);
+				if (node == NONE) {
+					direct[slot] = DIRECT_LEAF | value;
+					continue;
+				}
+				direct[slot] = static_cast<std::uint32_t>(nodes.size());
+				nodes.emplace_back();
+				fold(node, value, direct[slot], nodes, leaves);
+			}
+		}
+	private:
+		struct range final {
+			std::array<bool, 128> first{};
+			std::array<bool, 128> last{};
+			// whether everything from a bit on is all zeros in first, all ones in last
+			std::array<bool, 129> first_zeros{};
+			std::array<bool, 129> last_ones{};
+			std::uint32_t value;
+		};
+
+		// Only the nodes along the two ends of the range are ever split, the
+		// ones in between are covered whole. on_first and on_last say whether
+		// the node still sits on that end's path.
+		void add(std::uint32_t node, unsigned depth, bool on_first, bool on_last, const range& bounds)
+		{
+			if ((!on_first || bounds.first_zeros[depth]) && (!on_last || bounds.last_ones[depth])) {
+				m_trie[node].value = bounds.value;
+				return;
+			}
+			for (std::uint32_t side = 0; side < 2; ++side) {
+				if ((on_first && side < bounds.first[depth]) || (on_last && side > bounds.last[depth])) {
+					continue;
+				}
+				if (!m_trie[node].child[side]) {
+					const auto created = static_cast<std::uint32_t>(m_trie.size());
+					m_trie.emplace_back();
+					m_trie[node].child[side] = created;
+				}
+				add(m_trie[node].child[side], depth + 1, on_first && side == bounds.first[depth], on_last && side == bounds.last[depth], bounds);
+			}
+		}
+
+		// Follows bits of path down from node, picking up the longest match on
+		// the way. The node it ends on only if there is more below it.
+		[[nodiscard]]
+		std::pair<std::uint32_t, std::uint32_t> walk(std::uint32_t node, std::uint32_t value, std::uint32_t path, unsigned bits) const noexcept
+		{
+			for (auto bit = bits; bit-- > 0;) {
+				node = m_trie[node].child[path >> bit & 1];
+				if (!node) {
+					return { NONE, value };
+				}
+				if (m_trie[node].value) {
+					value = m_trie[node].value;
+				}
+			}
+			if (!m_trie[node].child[0] && !m_trie[node].child[1]) {
+				return { NONE, value };
+			}
+			return { node, value };
+		}
+
+		// the children of one node have to sit next to each other, so do its leaves
+		void fold(std::uint32_t node, std::uint32_t inherited, std::uint32_t at
+			, std::vector<asn_database::trie_node>& nodes, std::vector<std::uint32_t>& leaves) const
+		{
+			std::array<std::uint32_t, 64> below{};
+			std::array<std::uint32_t, 64> values{};
+			std::uint64_t children = 0;
+			for (std::uint32_t slot = 0; slot < 64; ++slot) {
+				std::tie(below[slot], values[slot]) = walk(node, inherited, slot, STRIDE);
+				if (below[slot] != NONE) {
+					children |= std::uint64_t{ 1 } << slot;
+				}
+			}
+			asn_database::trie_node folded{ .children = children, .leaves = 0, .leaf_base = static_cast<std::uint32_t>(leaves.size())
+				, .child_base = static_cast<std::uint32_t>(nodes.size()) };
+			bool first = true;
+			std::uint32_t previous = 0;
+			for (unsigned slot = 0; slot < 64; ++slot) {
+				if (children >> slot & 1) {
+					continue;
+				}
+				if (first || values[slot] != previous) {
+					folded.leaves |= std::uint64_t{ 1 } << slot;
+					leaves.push_back(values[slot]);
+					previous = values[slot];
+					first = false;
+				}
+			}
+			nodes.resize(nodes.size() + std::popcount(children));
+			nodes[at] = folded;
+			for (unsigned slot = 0, child = folded.child_base; slot < 64; ++slot) {
+				if (children >> slot & 1) {
+					fold(below[slot], values[slot], child++, nodes, leaves);
+				}
+			}
+		}
+	};
+
+	template<typename T>
+	[[nodiscard]]
+	std::span<const T> take(const std::byte*& at, std::uint32_t count) noexcept
+	{
+		const std::span<const T> items(reinterpret_cast<const T*>(at), count);
+		at += count * sizeof(T);
+		return items;
+	}
+
+	template<typename T>
+	void write_all(std::ofstream& out, const std::vector<T>& items)
+	{
+		out.write(reinterpret_cast<const char*>(items.data()), static_cast<std::streamsize>(items.size() * sizeof(T)));
+	}
+}
+
+asn_database::asn_database(std::unique_ptr<const mapped_file> file) noexcept
+	:m_file(std::move(file))
+{
+}
+
+asn_database::~asn_database() noexcept = default;
+
+std::size_t asn_database::size_bytes() const noexcept
+{
+	return m_file->bytes().size();
+}
+
+std::shared_ptr<const asn_database> asn_database::open(const std::filesystem::path& path) noexcept
+{
+	auto file = mapped_file::map(path);
+	if (!file) {
+		return nullptr;
+	}
+	const auto bytes = file->bytes();
+	if (bytes.size() < sizeof(file_header)) {
+		return nullptr;
+	}
+	file_header header;
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (header.magic != FILE_MAGIC) {
+		return nullptr;
+	}
+	const auto need = sizeof(file_header)
+		+ 2 * (std::uint64_t{ 1 } << DIRECT_BITS) * sizeof(std::uint32_t)
+		+ (std::uint64_t{ header.nodes[0] } + header.nodes[1]) * sizeof(trie_node)
+		+ std::uint64_t{ header.records } * sizeof(record_entry)
+		+ (std::uint64_t{ header.leaves[0] } + header.leaves[1]) * sizeof(std::uint32_t)
+		+ header.string_bytes;
+	if (need != bytes.size()) {
+		return nullptr;
+	}
+	// written with the same layout, so the view can be used in place
+	auto at = bytes.data() + sizeof(file_header);
+	std::shared_ptr<asn_database> database(new(std::nothrow) asn_database(std::move(file)));
+	if (!database) {
+		return nullptr;
+	}
+	database->m_ipv4.direct = take<std::uint32_t>(at, 1u << DIRECT_BITS);
+	database->m_ipv6.direct = take<std::uint32_t>(at, 1u << DIRECT_BITS);
+	database->m_ipv4.nodes = take<trie_node>(at, header.nodes[0]);
+	database->m_ipv6.nodes = take<trie_node>(at, header.nodes[1]);
+	database->m_records = take<record_entry>(at, header.records);
+	database->m_ipv4.leaves = take<std::uint32_t>(at, header.leaves[0]);
+	database->m_ipv6.leaves = take<std::uint32_t>(at, header.leaves[1]);
+	database->m_strings = std::string_view(reinterpret_cast<const char*>(at), header.string_bytes);
+
+	const auto strings = database->m_strings.size();
+	const auto records_valid = std::ranges::all_of(database->m_records, [strings](const record_entry& entry) noexcept {
+		return std::uint64_t{ entry.org_offset } + entry.org_size <= strings;
+	});
+	if (!records_valid || !database->m_ipv4.valid(header.records) || !database->m_ipv6.valid(header.records)) {
+		return nullptr;
+	}
+	return database;
+}
+
+// checked once on open, so that a lookup can trust every index it follows
+bool asn_database::trie::valid(std::size_t records) const noexcept
+{
+	const auto value_valid = [records](std::uint32_t value) noexcept { return value <= records; };
+	return std::ranges::all_of(direct, [&](std::uint32_t entry) noexcept {
+		return entry & DIRECT_LEAF ? value_valid(entry & ~DIRECT_LEAF) : entry < nodes.size();
+	}) && std::ranges::all_of(nodes, [&](const trie_node& node) noexcept {
+		// every leaf slot needs a run started at or before it
+		const auto first_leaf = std::countr_one(node.children);
+		return (first_leaf == 64 || (node.leaves >> first_leaf & 1))
+			&& std::uint64_t{ node.child_base } + std::popcount(node.children) <= nodes.size()
+			&& std::uint64_t{ node.leaf_base } + std::popcount(node.leaves) <= leaves.size();
+	}) && std::ranges::all_of(leaves, value_valid);
+}
+
+std::uint32_t asn_database::trie::find(std::uint64_t high, std::uint64_t low, unsigned bits) const noexcept
+{
+	const auto entry = direct[high >> (64 - DIRECT_BITS)];
+	if (entry & DIRECT_LEAF) {
+		return entry & ~DIRECT_LEAF;
+	}
+	const auto* node = &nodes[entry];
+	// a child can't point back up in a well formed file, the depth bounds the walk regardless
+	for (auto bit = DIRECT_BITS; bit < bits; bit += STRIDE) {
+		const auto slot = std::uint64_t{ 1 } << chunk(high, low, bit);
+		if (!(node->children & slot)) {
+			// the first leaf slot always starts a run, so the count is never zero here
+			return leaves[node->leaf_base + std::popcount(node->leaves & ((slot << 1) - 1)) - 1];
+		}
+		node = &nodes[node->child_base + std::popcount(node->children & (slot - 1))];
+	}
+	return 0;
+}
+
+asn_record asn_database::record(std::uint32_t value) const noexcept
+{
+	if (!value) {
+		return {};
+	}
+	const auto& entry = m_records[value - 1];
+	return asn_record{ .asn = entry.asn, .org = m_strings.substr(entry.org_offset, entry.org_size) };
+}
+
+asn_record asn_database::lookup(const SOCKADDR_INET& addr) const noexcept
+{
+	if (addr.si_family == AF_INET6) {
+		const auto bytes = reinterpret_cast<const std::uint8_t*>(&addr.Ipv6.sin6_addr);
+		return record(m_ipv6.find(load_be64(bytes), load_be64(bytes + 8), 128));
+	}
+	if (addr.si_family == AF_INET) {
+		const auto bytes = reinterpret_cast<const std::uint8_t*>(&addr.Ipv4.sin_addr);
+		const auto high = std::uint64_t{ bytes[0] } << 56 | std::uint64_t{ bytes[1] } << 48 | std::uint64_t{ bytes[2] } << 40 | std::uint64_t{ bytes[3] } << 32;
+		return record(m_ipv4.find(high, 0, 32));
+	}
+	return {};
+}
+
+std::wstring asn_database::organization(std::uint32_t asn) const
+{
+	std::wstring wide;
+	organization(asn, wide);
+	return wide;
+}
+
+void asn_database::organization(std::uint32_t asn, std::wstring& into) const
+{
+	const auto found = std::ranges::lower_bound(m_records, asn, {}, &record_entry::asn);
+	if (found == m_records.end() || found->asn != asn) {
+		into.clear();
+		return;
+	}
+	const auto org = m_strings.substr(found->org_offset, found->org_size);
+#ifdef _WIN32
+	// never more UTF-16 units than there are UTF-8 bytes
+	into.resize(org.size());
+	const auto length = MultiByteToWideChar(CP_UTF8, 0, org.data(), static_cast<int>(org.size()), into.data(), static_cast<int>(into.size()));
+	into.resize(static_cast<std::size_t>(std::max(length, 0)));
+#else
+	into.assign(org.begin(), org.end());
+#endif
+}
+
+bool asn_database::build(const std::filesystem::path& tsv, const std::filesystem::path& out)
+{
+	std::ifstream in(tsv, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+	struct range final {
+		bool v6;
+		std::array<std::uint8_t, 16> first;
+		std::array<std::uint8_t, 16> last;
+		std::uint32_t asn;
+	};
+	std::vector<range> ranges;
+	std::map<std::uint32_t, std::string> orgs;
+	for (std::string line; std::getline(in, line);) {
+		if (line.ends_with('\r')) {
+			line.pop_back();
+		}
+		std::array<std::string_view, 5> fields;
+		std::size_t field = 0;
+		for (std::string_view rest = line; field < fields.size(); ++field) {
+			const auto tab = rest.find('\t');
+			fields[field] = rest.substr(0, tab);
+			if (tab == std::string_view::npos) {
+				++field;
+				break;
+			}
+			rest.remove_prefix(tab + 1);
+		}
+		if (field < 3) {
+			continue;
+		}
+		range row{};
+		if (std::from_chars(fields[2].data(), fields[2].data() + fields[2].size(), row.asn).ec != std::errc{} || !row.asn) {
+			continue;
+		}
+		row.v6 = fields[0].find(':') != std::string_view::npos;
+		const auto family = row.v6 ? AF_INET6 : AF_INET;
+		const std::string first(fields[0]);
+		const std::string last(fields[1]);
+		if (inet_pton(family, first.c_str(), row.first.data()) != 1 || inet_pton(family, last.c_str(), row.last.data()) != 1) {
+			continue;
+		}
+		orgs.try_emplace(row.asn, fields[4]);
+		ranges.push_back(row);
+	}
+
+	// records sorted by AS number, the leaves refer to them by position + 1
+	std::vector<record_entry> records;
+	std::string strings;
+	std::map<std::uint32_t, std::uint32_t> index;
+	for (const auto& [asn, org] : orgs) {
+		index.emplace(asn, static_cast<std::uint32_t>(records.size() + 1));
+		records.push_back({ .asn = asn, .org_offset = static_cast<std::uint32_t>(strings.size()), .org_size = static_cast<std::uint32_t>(org.size()) });
+		strings += org;
+	}
+
+	std::array<std::vector<std::uint32_t>, 2> direct;
+	std::array<std::vector<trie_node>, 2> nodes;
+	std::array<std::vector<std::uint32_t>, 2> leaves;
+	for (int v6 = 0; v6 < 2; ++v6) {
+		prefix_builder builder(v6 ? 128 : 32);
+		const auto width = v6 ? 16u : 4u;
+		for (const auto& row : ranges) {
+			if (row.v6 == static_cast<bool>(v6)) {
+				builder.add({ row.first.data(), width }, { row.last.data(), width }, index[row.asn]);
+			}
+		}
+		builder.fold(direct[v6], nodes[v6], leaves[v6]);
+	}
+
+	file_header header{ .magic = FILE_MAGIC, .records = static_cast<std::uint32_t>(records.size()), .string_bytes = static_cast<std::uint32_t>(strings.size())
+		, .nodes = { static_cast<std::uint32_t>(nodes[0].size()), static_cast<std::uint32_t>(nodes[1].size()) }
+		, .leaves = { static_cast<std::uint32_t>(leaves[0].size()), static_cast<std::uint32_t>(leaves[1].size()) } };
+	// written next to the old one and swapped in, a reader never sees half a file
+	auto temp = out;
+	temp += L".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		write_all(file, direct[0]);
+		write_all(file, direct[1]);
+		write_all(file, nodes[0]);
+		write_all(file, nodes[1]);
+		write_all(file, records);
+		write_all(file, leaves[0]);
+		write_all(file, leaves[1]);
+		file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+		if (!file.flush()) {
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(temp, out, ec);
+	return !ec;
+}
@@ -0,0 +1,743 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRCapture.ixx
+//
+// DESCRIPTION:
+//   A compact binary capture of every probe outcome, where each trace
+//   started and the names its hops resolved to. A capture is mapped and
+//   fed back through WinMTRNet's own counters, so a long one can be looked
+//   at again without the cost of the text formats.
+//
+// NOTES:
+//   The file is a header followed by records, appended and never rewritten.
+//   Every record starts with the same fixed part and says how long it is,
+//   a reader skips the kinds it doesn't know. The version only goes up for
+//   a change an older reader would get wrong. All of it is little endian,
+//   laid out as the writer has it in memory, like the ASN table.
+//
+//   The trace loops copy their record into the chunk being filled, under a
+//   short lock. A writer thread hands every full chunk to the disk in one
+//   gathered write. With every chunk full the record is dropped and
+//   counted, a slow disk never holds up a probe.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.Capture;
+
+#ifdef _WIN32
+import <atomic>;
+import <chrono>;
+import <condition_variable>;
+import <cstddef>;
+import <cstdint>;
+import <filesystem>;
+import <memory>;
+import <mutex>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <vector>;
+#endif
+import WinMTR.EventLog;
+import WinMTR.MappedFile;
+import WinMTR.ProbeBackend;
+
+export enum class capture_kind : std::uint8_t {
+	trace = 1,		// a trace started, the address is its destination and the TTL its limit
+	probe = 2,		// a probe's outcome, the address is the responder
+	name = 3		// a responder's name was resolved
+};
+
+// one record as read back, the name only for a name record
+export struct capture_record final {
+	capture_kind kind = capture_kind::probe;
+	std::uint32_t session = 0;
+	UCHAR ttl = 0;
+	std::chrono::microseconds time{ 0 };	// since the capture was started
+	SOCKADDR_INET address = {};
+	probe_status status = probe_status::timed_out;
+	std::chrono::microseconds round_trip_time{ 0 };
+	std::wstring_view name;					// good until the cursor reads the next record
+};
+
+// what follows a record's fixed part, the same on every platform
+enum class capture_address : std::uint8_t {
+	none = 0,
+	ipv4 = 4,		// 4 bytes
+	ipv6 = 6		// 16 bytes, the scope is left out
+};
+
+// how every record starts, then comes the address and for a name its UTF-16 code units
+struct capture_head final {
+	capture_kind kind = capture_kind::probe;
+	UCHAR ttl = 0;
+	std::uint16_t size = 0;			// the whole record
+	std::uint32_t session = 0;
+	std::int64_t time = 0;			// microseconds since the capture was started
+	std::uint32_t round_trip = 0;	// microseconds
+	std::uint8_t status = 0;
+	capture_address address = capture_address::none;
+	std::uint16_t reserved = 0;
+};
+static_assert(sizeof(capture_head) == 24);
+
+export struct capture_limits final {
+	std::size_t buffer_bytes = 4u << 20;	// records waiting for the writer
+};
+
+export struct capture_stats final {
+	std::uint64_t records = 0;		// written
+	std::uint64_t bytes = 0;
+	std::uint64_t writes = 0;		// gathered writes it took
+	std::uint64_t dropped = 0;		// every chunk was full, or the file couldn't be written
+};
+
+//*****************************************************************************
+// CLASS:  capture_file
+//
+// A capture mapped read only, as it was when opened. Safe to share between
+// threads, each reads it through a cursor of its own.
+//*****************************************************************************
+export class capture_file final {
+	capture_file(const capture_file&) = delete;
+	capture_file& operator=(const capture_file&) = delete;
+public:
+	// nothing for a file that isn't a capture or is of a later version
+	[[nodiscard]]
+	static std::shared_ptr<const capture_file> open(const std::filesystem::path& path) noexcept;
+
+	// what the records' times count from
+	[[nodiscard]]
+	std::chrono::system_clock::time_point started() const noexcept
+	{
+		return m_started;
+	}
+	// up to the end of the last whole record, a capture cut short by a crash reads up to there
+	[[nodiscard]]
+	std::size_t valid_bytes() const noexcept
+	{
+		return m_end;
+	}
+	[[nodiscard]]
+	std::size_t records() const noexcept
+	{
+		return m_records;
+	}
+	// where each trace's record is, in the order they were started
+	[[nodiscard]]
+	std::vector<std::size_t> traces() const;
+
+	class cursor final {
+	public:
+		// from the first record, or from one found earlier
+		explicit cursor(const capture_file& capture, std::size_t offset = 0) noexcept;
+
+		// false once past the last whole record
+		bool next(capture_record& record);
+		// of the record next() reads next
+		[[nodiscard]]
+		std::size_t offset() const noexcept
+		{
+			return m_offset;
+		}
+	private:
+		const capture_file& m_capture;
+		std::size_t m_offset;
+		std::wstring m_name;
+	};
+
+	~capture_file() noexcept;
+private:
+	explicit capture_file(std::unique_ptr<const mapped_file> file) noexcept;
+
+	std::unique_ptr<const mapped_file> m_file;
+	std::chrono::system_clock::time_point m_started;
+	std::size_t m_begin = 0;
+	std::size_t m_end = 0;
+	std::size_t m_records = 0;
+};
+
+//*****************************************************************************
+// CLASS:  capture_writer
+//
+// Safe to record to from any number of threads. Whatever is still queued
+// is written out when the writer is destroyed.
+//*****************************************************************************
+export class capture_writer final {
+	capture_writer(const capture_writer&) = delete;
+	capture_writer& operator=(const capture_writer&) = delete;
+public:
+	// how long a record waits at most before the writer picks it up
+	static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(250);
+	// what the records are queued in, a gathered write hands over every one that is full
+	static constexpr std::size_t CHUNK_BYTES = 64 * 1024;
+
+	// An existing capture is carried on, cut back to its last whole record
+	// first. Nothing if the file can't be opened, or already holds something
+	// that isn't a capture.
+	[[nodiscard]]
+	static std::shared_ptr<capture_writer> open(const std::filesystem::path& path, capture_limits limits = {}) noexcept;
+
+	// the one every trace records to, none until one is installed
+	[[nodiscard]]
+	static std::shared_ptr<capture_writer> instance() noexcept
+	{
+		return s_instance.load(std::memory_order_acquire);
+	}
+	static void install(std::shared_ptr<capture_writer> writer) noexcept
+	{
+		s_instance.store(std::move(writer), std::memory_order_release);
+	}
+
+	// none of these ever block on the writer, false if the record had to be dropped
+	bool trace(std::uint32_t session, probe_backend::clock::time_point time, const SOCKADDR_INET& destination, int max_hops) noexcept;
+	bool probe(const probe_event& event) noexcept;
+	bool name(std::uint32_t session, probe_backend::clock::time_point time, UCHAR ttl, const SOCKADDR_INET& address, std::wstring_view name) noexcept;
+
+	[[nodiscard]]
+	capture_stats stats() const noexcept;
+
+	~capture_writer() noexcept;
+private:
+	struct chunk final {
+		std::unique_ptr<std::byte[]> data;
+		std::size_t used = 0;
+		std::size_t records = 0;
+	};
+
+	capture_writer(std::chrono::system_clock::time_point started, std::size_t chunks);
+
+	bool push(capture_head head, const SOCKADDR_INET& address, std::wstring_view name) noexcept;
+	[[nodiscard]]
+	std::int64_t since_start(probe_backend::clock::time_point time) const noexcept;
+	void write_loop(std::stop_token stop);
+	// hands the chunks to the disk, false if any of it couldn't be written
+	[[nodiscard]]
+	bool write(const std::vector<chunk>& batch) noexcept;
+
+	// maps the backend's clock onto the capture's, which may have been started by an earlier run
+	const probe_backend::clock::time_point m_steadyEpoch;
+	const std::size_t m_chunks;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable_any m_wake;
+	chunk m_filling;
+	std::vector<chunk> m_full;		// never grow past the chunks there are
+	std::vector<chunk> m_free;
+	std::atomic_uint64_t m_records{ 0 };
+	std::atomic_uint64_t m_bytes{ 0 };
+	std::atomic_uint64_t m_writes{ 0 };
+	std::atomic_uint64_t m_dropped{ 0 };
+
+	// the writer's own from here on
+#ifdef _WIN32
+	HANDLE m_out = INVALID_HANDLE_VALUE;
+#else
+	int m_out = -1;
+	std::vector<iovec> m_iov;
+#endif
+	bool m_broken = false;	// a record may have been torn, nothing after it would be read back
+	std::jthread m_writer;
+
+	static inline std::atomic<std::shared_ptr<capture_writer>> s_instance;
+};
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
+import <cstring>;
+import <limits>;
+import <system_error>;
+import <utility>;
+#endif
+
+namespace {
+	constexpr std::array<char, 8> FILE_MAGIC = { 'W', 'M', 'T', 'R', 'C', 'A', 'P', 'T' };
+	constexpr std::uint16_t FILE_VERSION = 1;
+	// long enough for any host name, the size of a record has to fit in 16 bits
+	constexpr std::size_t MAX_NAME = 1024;
+
+	struct file_header final {
+		std::array<char, 8> magic;
+		std::uint16_t version;
+		std::uint16_t header_bytes;		// the records start here, a later version may have more to say
+		std::uint32_t reserved;
+		std::int64_t started;			// microseconds since the Unix epoch
+	};
+	static_assert(sizeof(file_header) == 24);
+
+	[[nodiscard]]
+	constexpr capture_address code_of(const SOCKADDR_INET& address) noexcept
+	{
+		switch (address.si_family) {
+		case AF_INET: return capture_address::ipv4;
+		case AF_INET6: return capture_address::ipv6;
+		default: return capture_address::none;
+		}
+	}
+
+	[[nodiscard]]
+	constexpr std::size_t address_bytes(capture_address code) noexcept
+	{
+		switch (code) {
+		case capture_address::ipv4: return 4;
+		case capture_address::ipv6: return 16;
+		default: return 0;
+		}
+	}
+
+	[[nodiscard]]
+	std::int64_t unix_micros(std::chrono::system_clock::time_point time) noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+	}
+}
+
+//*****************************************************************************
+// capture_file
+//*****************************************************************************
+capture_file::capture_file(std::unique_ptr<const mapped_file> file) noexcept
+	:m_file(std::move(file))
+{
+}
+
+capture_file::~capture_file() noexcept = default;
+
+std::shared_ptr<const capture_file> capture_file::open(const std::filesystem::path& path) noexcept
+{
+	auto file = mapped_file::map(path);
+	if (!file) {
+		return nullptr;
+	}
+	const auto bytes = file->bytes();
+	if (bytes.size() < sizeof(file_header)) {
+		return nullptr;
+	}
+	file_header header;
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (header.magic != FILE_MAGIC || header.version > FILE_VERSION
+		|| header.header_bytes < sizeof(file_header) || header.header_bytes > bytes.size()) {
+		return nullptr;
+	}
+	std::shared_ptr<capture_file> capture(new(std::nothrow) capture_file(std::move(file)));
+	if (!capture) {
+		return nullptr;
+	}
+	capture->m_started = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(header.started)));
+	capture->m_begin = header.header_bytes;
+	// checked once here, so that a cursor can trust every size it follows
+	auto at = capture->m_begin;
+	std::size_t records = 0;
+	while (bytes.size() - at >= sizeof(capture_head)) {
+		capture_head head;
+		std::memcpy(&head, bytes.data() + at, sizeof(head));
+		if (head.size < sizeof(head) + address_bytes(head.address) || head.size > bytes.size() - at) {
+			break;
+		}
+		at += head.size;
+		++records;
+	}
+	capture->m_end = at;
+	capture->m_records = records;
+	return capture;
+}
+
+std::vector<std::size_t> capture_file::traces() const
+{
+	std::vector<std::size_t> found;
+	cursor records(*this);
+	capture_record record;
+	for (auto at = records.offset(); records.next(record); at = records.offset()) {
+		if (record.kind == capture_kind::trace) {
+			found.push_back(at);
+		}
+	}
+	return found;
+}
+
+capture_file::cursor::cursor(const capture_file& capture, std::size_t offset) noexcept
+	:m_capture(capture)
+	, m_offset(std::max(offset, capture.m_begin))
+{
+}
+
+bool capture_file::cursor::next(capture_record& record)
+{
+	const auto bytes = m_capture.m_file->bytes();
+	// every size up to m_end was checked on open
+	while (m_offset < m_capture.m_end) {
+		const auto* at = bytes.data() + m_offset;
+		capture_head head;
+		std::memcpy(&head, at, sizeof(head));
+		m_offset += head.size;
+		if (head.kind != capture_kind::trace && head.kind != capture_kind::probe && head.kind != capture_kind::name) {
+			continue;
+		}
+		at += sizeof(head);
+		record = capture_record{ .kind = head.kind
+			, .session = head.session
+			, .ttl = head.ttl
+			, .time = std::chrono::microseconds(head.time)
+			, .address = {}
+			, .status = static_cast<probe_status>(std::min<std::uint8_t>(head.status, static_cast<std::uint8_t>(probe_status::general_failure)))
+			, .round_trip_time = std::chrono::microseconds(head.round_trip)
+			, .name = {} };
+		if (head.address == capture_address::ipv4) {
+			record.address.si_family = AF_INET;
+			std::memcpy(&record.address.Ipv4.sin_addr, at, 4);
+		}
+		else if (head.address == capture_address::ipv6) {
+			record.address.si_family = AF_INET6;
+			std::memcpy(&record.address.Ipv6.sin6_addr, at, 16);
+		}
+		at += address_bytes(head.address);
+		if (head.kind == capture_kind::name) {
+			const auto units = (head.size - sizeof(head) - address_bytes(head.address)) / sizeof(std::uint16_t);
+			m_name.resize(units);
+			for (std::size_t i = 0; i < units; ++i) {
+				std::uint16_t unit;
+				std::memcpy(&unit, at + i * sizeof(unit), sizeof(unit));
+				m_name[i] = static_cast<wchar_t>(unit);
+			}
+			record.name = m_name;
+		}
+		return true;
+	}
+	return false;
+}
+
+//*****************************************************************************
+// capture_writer
+//*****************************************************************************
+std::shared_ptr<capture_writer> capture_writer::open(const std::filesystem::path& path, capture_limits limits) noexcept
+{
+	try {
+		// to the microsecond, as the header has it
+		auto started = std::chrono::system_clock::time_point(std::chrono::floor<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()));
+		std::error_code ec;
+		const auto existing = std::filesystem::file_size(path, ec);
+		const auto carry_on = !ec && existing > 0;
+		if (carry_on) {
+			std::size_t valid = 0;
+			{
+				// has to be unmapped again before the file can be cut
+				const auto capture = capture_file::open(path);
+				if (!capture) {
+					return nullptr;
+				}
+				started = capture->started();
+				valid = capture->valid_bytes();
+			}
+			if (valid < existing) {
+				std::filesystem::resize_file(path, valid, ec);
+				if (ec) {
+					return nullptr;
+				}
+			}
+		}
+		const auto chunks = std::max<std::size_t>(limits.buffer_bytes / CHUNK_BYTES, 2);
+		std::shared_ptr<capture_writer> writer(new capture_writer(started, chunks));
+#ifdef _WIN32
+		writer->m_out = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (writer->m_out == INVALID_HANDLE_VALUE) {
+			return nullptr;
+		}
+#else
+		writer->m_out = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (writer->m_out < 0) {
+			return nullptr;
+		}
+#endif
+		if (!carry_on) {
+			const file_header header{ .magic = FILE_MAGIC
+				, .version = FILE_VERSION
+				, .header_bytes = sizeof(file_header)
+				, .reserved = 0
+				, .started = unix_micros(started) };
+			std::vector<chunk> first(1);
+			first.front().data = std::make_unique<std::byte[]>(sizeof(header));
+			std::memcpy(first.front().data.get(), &header, sizeof(header));
+			first.front().used = sizeof(header);
+			if (!writer->write(first)) {
+				return nullptr;
+			}
+		}
+		writer->m_writer = std::jthread([writer = writer.get()](std::stop_token stop) { writer->write_loop(std::move(stop)); });
+		return writer;
+	}
+	catch (const std::exception&) {
+		return nullptr;
+	}
+}
+
+capture_writer::capture_writer(std::chrono::system_clock::time_point started, std::size_t chunks)
+	:m_steadyEpoch(probe_backend::clock::now() - std::chrono::duration_cast<probe_backend::clock::duration>(std::chrono::system_clock::now() - started))
+	, m_chunks(chunks)
+{
+	// all of it up front, so that neither side ever allocates once running
+	m_full.reserve(chunks);
+	m_free.reserve(chunks);
+	for (std::size_t i = 0; i < chunks; ++i) {
+		m_free.push_back({ .data = std::make_unique<std::byte[]>(CHUNK_BYTES) });
+	}
+	m_filling = std::move(m_free.back());
+	m_free.pop_back();
+#ifndef _WIN32
+	m_iov.reserve(chunks);
+#endif
+}
+
+capture_writer::~capture_writer() noexcept
+{
+	m_writer.request_stop();
+	if (m_writer.joinable()) {
+		m_writer.join();
+	}
+#ifdef _WIN32
+	if (m_out != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_out);
+	}
+#else
+	if (m_out >= 0) {
+		::close(m_out);
+	}
+#endif
+}
+
+std::int64_t capture_writer::since_start(probe_backend::clock::time_point time) const noexcept
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(time - m_steadyEpoch).count();
+}
+
+bool capture_writer::trace(std::uint32_t session, probe_backend::clock::time_point time, const SOCKADDR_INET& destination, int max_hops) noexcept
+{
+	return push({ .kind = capture_kind::trace
+		, .ttl = static_cast<UCHAR>(std::clamp(max_hops, 0, 255))
+		, .session = session
+		, .time = since_start(time) }, destination, {});
+}
+
+bool capture_writer::probe(const probe_event& event) noexcept
+{
+	return push({ .kind = capture_kind::probe
+		, .ttl = event.ttl
+		, .session = event.session
+		, .time = since_start(event.time)
+		, .round_trip = static_cast<std::uint32_t>(std::clamp<std::int64_t>(event.round_trip_time.count(), 0, std::numeric_limits<std::uint32_t>::max()))
+		, .status = static_cast<std::uint8_t>(event.status) }, event.responder, {});
+}
+
+bool capture_writer::name(std::uint32_t session, probe_backend::clock::time_point time, UCHAR ttl, const SOCKADDR_INET& address, std::wstring_view name) noexcept
+{
+	return push({ .kind = capture_kind::name
+		, .ttl = ttl
+		, .session = session
+		, .time = since_start(time) }, address, name.substr(0, MAX_NAME));
+}
+
+bool capture_writer::push(capture_head head, const SOCKADDR_INET& address, std::wstring_view name) noexcept
+{
+	head.address = code_of(address);
+	const auto addressBytes = address_bytes(head.address);
+	const auto size = sizeof(head) + addressBytes + name.size() * sizeof(std::uint16_t);
+	head.size = static_cast<std::uint16_t>(size);
+	bool wake = false;
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_filling.used + size > CHUNK_BYTES) {
+			if (m_free.empty()) {
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			m_full.push_back(std::move(m_filling));
+			m_filling = std::move(m_free.back());
+			m_free.pop_back();
+			// the timer picks up a trickle, a burst gets the writer going early
+			wake = m_full.size() == m_chunks / 2;
+		}
+		auto* at = m_filling.data.get() + m_filling.used;
+		std::memcpy(at, &head, sizeof(head));
+		at += sizeof(head);
+		if (head.address == capture_address::ipv4) {
+			std::memcpy(at, &address.Ipv4.sin_addr, addressBytes);
+		}
+		else if (head.address == capture_address::ipv6) {
+			std::memcpy(at, &address.Ipv6.sin6_addr, addressBytes);
+		}
+		at += addressBytes;
+		for (const auto c : name) {
+			const auto unit = static_cast<std::uint16_t>(c);
+			std::memcpy(at, &unit, sizeof(unit));
+			at += sizeof(unit);
+		}
+		m_filling.used += size;
+		++m_filling.records;
+	}
+	if (wake) {
+		m_wake.notify_one();
+	}
+	return true;
+}
+
+capture_stats capture_writer::stats() const noexcept
+{
+	return { .records = m_records.load(std::memory_order_relaxed)
+		, .bytes = m_bytes.load(std::memory_order_relaxed)
+		, .writes = m_writes.load(std::memory_order_relaxed)
+		, .dropped = m_dropped.load(std::memory_order_relaxed) };
+}
+
+void capture_writer::write_loop(std::stop_token stop)
+{
+	// swaps places with m_full, so has to hold as many
+	std::vector<chunk> batch;
+	batch.reserve(m_chunks);
+	for (;;) {
+		const auto stopping = stop.stop_requested();
+		{
+			std::unique_lock lock(m_mutex);
+			if (!stopping) {
+				m_wake.wait_for(lock, stop, FLUSH_INTERVAL, [this] { return m_full.size() >= m_chunks / 2; });
+			}
+			std::swap(batch, m_full);
+			// a chunk that never fills still goes out every interval, and whatever is left once asked to stop
+			if (m_filling.used && (!m_free.empty() || stopping)) {
+				batch.push_back(std::move(m_filling));
+				if (!m_free.empty()) {
+					m_filling = std::move(m_free.back());
+					m_free.pop_back();
+				}
+			}
+		}
+		if (!batch.empty()) {
+			std::uint64_t records = 0;
+			std::uint64_t bytes = 0;
+			for (const auto& written : batch) {
+				records += written.records;
+				bytes += written.used;
+			}
+			if (write(batch)) {
+				m_records.fetch_add(records, std::memory_order_relaxed);
+				m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+			}
+			else {
+				m_dropped.fetch_add(records, std::memory_order_relaxed);
+			}
+			std::scoped_lock lock(m_mutex);
+			for (auto& emptied : batch) {
+				emptied.used = 0;
+				emptied.records = 0;
+				m_free.push_back(std::move(emptied));
+			}
+			batch.clear();
+		}
+		if (stopping) {
+			break;
+		}
+	}
+}
+
+bool capture_writer::write(const std::vector<chunk>& batch) noexcept
+{
+	if (m_broken) {
+		return false;
+	}
+	m_writes.fetch_add(1, std::memory_order_relaxed);
+#ifdef _WIN32
+	// WriteFileGather wants unbuffered, page aligned I/O, the chunks go one at a time
+	for (const auto& part : batch) {
+		DWORD written = 0;
+		if (!WriteFile(m_out, part.data.get(), static_cast<DWORD>(part.used), &written, nullptr) || written != part.used) {
+			m_broken = true;
+			return false;
+		}
+	}
+#else
+	m_iov.clear();
+	for (const auto& part : batch) {
+		m_iov.push_back({ .iov_base = part.data.get(), .iov_len = part.used });
+	}
+	// a short write leaves the rest of the batch to go in the next call
+	for (std::size_t first = 0; first < m_iov.size();) {
+		const auto count = static_cast<int>(std::min<std::size_t>(m_iov.size() - first, IOV_MAX));
+		const auto written = ::writev(m_out, m_iov.data() + first, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			m_broken = true;
+			return false;
+		}
+		for (auto left = static_cast<std::size_t>(written); left && first < m_iov.size();) {
+			auto& part = m_iov[first];
+			const auto taken = std::min(left, part.iov_len);
+			part.iov_base = static_cast<std::byte*>(part.iov_base) + taken;
+			part.iov_len -= taken;
+			left -= taken;
+			if (!part.iov_len) {
+				++first;
+			}
+		}
+	}
+#endif
+	return true;
+}
@@ -30,10 +30,13 @@ module;
 #include <afxcmn.h>
 #endif 
 #pragma warning (disable : 4005)
+#include <winsock2.h>
+#include <ws2ipdef.h>
 #include "resource.h"
 
 export module WinMTR.Dialog:ClassDef;
 
+import <chrono>;
 import <string>;
 import <winrt/Windows.Foundation.h>;
 import <memory>;
@@ -41,9 +44,12 @@ import <mutex>;
 import <optional>;
 import <atomic>;
 import <thread>;
+import <vector>;
 import WinMTROptionsProvider;
 import WinMTRStatusBar;
 import WinMTR.Net;
+import WinMTR.ProbeBackend;
+import WinMTR.ReportWriter;
 
 //*****************************************************************************
 // CLASS:  WinMTRDialog
@@ -63,6 +69,17 @@ public:
 	};
 
 	afx_msg BOOL InitRegistry() noexcept;
+	// the name cache outlives the process only if the registry says so
+	void LoadNameCache() noexcept;
+	void SaveNameCache() noexcept;
+	// the AS column stays empty without a table in the user's local data
+	winrt::fire_and_forget LoadAsnDatabase();
+	// every probe outcome goes to a file as well, if the command line named one
+	void OpenEventLog() noexcept;
+	// and to a binary capture that can be replayed later, if it named one
+	void OpenCapture() noexcept;
+	// and serves every trace's counters to scrapers, if it named where to listen
+	void OpenMetrics() noexcept;
 
 	WinMTRStatusBar	statusBar;
 
@@ -86,9 +103,6 @@ public:
 	};
 
 
-
-	bool InitMTRNet() noexcept;
-
 	int DisplayRedraw();
 	void Transit(STATES new_state);
 
@@ -105,6 +119,9 @@ private:
 	CButton	m_buttonExpT;
 	CButton	m_buttonExpH;
 	std::wstring msz_defaulthostname;
+	std::wstring eventLogPath;
+	std::wstring capturePath;
+	std::wstring metricsEndpoint;
 	std::shared_ptr<WinMTRNet>			wmtrnet;
 	std::mutex tracer_mutex;
 	std::optional<std::jthread> trace_lacky;
@@ -121,24 +138,76 @@ private:
 	bool				hasIntervalFromCmdLine = false;
 	std::atomic_bool				useDNS;
 	bool				hasUseDNSFromCmdLine = false;
+	std::atomic<double>				ewmaWeight;
+	bool				hasEwmaWeightFromCmdLine = false;
+	std::atomic_uint	historyKiB;
+	bool				hasHistoryKiBFromCmdLine = false;
+	std::atomic_bool	parisMode;
+	bool				hasParisModeFromCmdLine = false;
+	std::atomic<probe_protocol>	probeProtocol;
+	std::atomic_uint	probePort;
+	bool				hasProbeProtocolFromCmdLine = false;
+	std::atomic_uint	maxProbeRate;
+	bool				hasMaxProbeRateFromCmdLine = false;
+	std::atomic_uint	maxByteRate;
+	bool				hasMaxByteRateFromCmdLine = false;
+	std::atomic_uint	maxHops;
+	bool				hasMaxHopsFromCmdLine = false;
+	bool				persistNameCache = false;
 	bool				useIPv4 = true;
 	bool				useIPv6 = true;
 	std::atomic_bool	tracing;
+	// the last forward lookup, restarting the same trace doesn't ask the resolver again
+	struct resolved_host final {
+		std::wstring name;
+		int family = AF_UNSPEC;
+		std::vector<SOCKADDR_INET> addresses;
+		std::chrono::steady_clock::time_point expires;
+	};
+	std::mutex			resolved_mutex;
+	resolved_host		resolved;
+	std::atomic_bool	hostResolved{ false };	// set by the trace once it has an address, the timer adds the host to the history
+	std::wstring		tracedHost;	// what the trace was started with, the combo can be edited while it resolves
+
+	// what the exports are rendered into, kept from one export to the next
+	report_snapshot		exportReport;
+	std::wstring		exportText;
 
 	void ClearHistory();
+	// the export of the trace as it is now, valid until the next one
+	const std::wstring& RenderExport(report_format format);
+	void RememberHost(std::wstring_view host);
 	winrt::Windows::Foundation::IAsyncAction pingThread(std::stop_token token, std::wstring shost);
 	winrt::fire_and_forget stopTrace();
 public:
 
 	void SetHostName(std::wstring host);
+	void SetEventLog(std::wstring path);
+	void SetCapture(std::wstring path);
+	void SetMetrics(std::wstring endpoint);
 	void SetInterval(float i, options_source fromCmdLine = options_source::none) noexcept;
 	void SetPingSize(unsigned ps, options_source fromCmdLine = options_source::none) noexcept;
 	void SetMaxLRU(int mlru, options_source fromCmdLine = options_source::none) noexcept;
 	void SetUseDNS(bool udns, options_source fromCmdLine = options_source::none) noexcept;
+	void SetEwmaWeight(double weight, options_source fromCmdLine = options_source::none) noexcept;
+	void SetHistoryKiB(unsigned kib, options_source fromCmdLine = options_source::none) noexcept;
+	void SetParisMode(bool paris, options_source fromCmdLine = options_source::none) noexcept;
+	void SetProbeProtocol(probe_protocol protocol, unsigned port, options_source fromCmdLine = options_source::none) noexcept;
+	void SetMaxProbeRate(unsigned rate, options_source fromCmdLine = options_source::none) noexcept;
+	void SetMaxByteRate(unsigned rate, options_source fromCmdLine = options_source::none) noexcept;
+	void SetMaxHops(unsigned hops, options_source fromCmdLine = options_source::none) noexcept;
 
 	inline double getInterval() const noexcept { return interval; }
 	inline unsigned getPingSize() const noexcept { return pingsize; }
 	inline bool getUseDNS() const noexcept { return useDNS; }
+	inline double getEwmaWeight() const noexcept { return ewmaWeight; }
+	inline unsigned getHistoryKiB() const noexcept { return historyKiB; }
+	inline bool getParisMode() const noexcept { return parisMode; }
+	inline probe_protocol getProbeProtocol() const noexcept { return probeProtocol; }
+	inline unsigned getProbePort() const noexcept { return probePort; }
+	inline unsigned getMaxProbeRate() const noexcept { return maxProbeRate; }
+	inline unsigned getMaxByteRate() const noexcept { return maxByteRate; }
+	inline unsigned getMaxHops() const noexcept { return maxHops; }
 
 protected:
 	void DoDataExchange(CDataExchange* pDX) override;
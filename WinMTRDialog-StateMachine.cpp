@@ -143,6 +143,9 @@ void WinMTRDialog::Transit(STATES new_state)
 		if (sHost.IsEmpty()) [[unlikely]] { // Technically never because this is caught in the calling function
 			sHost = L"localhost";
 		}
+		// a flag the last trace left behind would put this host in the history unresolved
+		hostResolved.store(false, std::memory_order_relaxed);
+		tracedHost = static_cast<LPCWSTR>(sHost);
 		std::unique_lock trace_lock{ tracer_mutex };
 		// create the jthread and stop token all in one go
 		trace_lacky.emplace([this](std::stop_token stop_token, auto sHost) noexcept {
@@ -233,7 +236,11 @@ void WinMTRDialog::OnTimer(UINT_PTR nIDEvent) noexcept
 	call_count += 1;
 	//std::unique_lock lock(traceThreadMutex, std::try_to_lock);
 	const bool is_tracing = tracing.load(std::memory_order_acquire);
+	if (hostResolved.exchange(false, std::memory_order_acq_rel)) {
+		RememberHost(tracedHost);
+	}
 	if (state == STATES::EXIT && !is_tracing) {
+		SaveNameCache();
 		OnOK();
 	}
 
@@ -48,22 +48,28 @@ namespace {
 	constexpr auto DEFAULT_INTERVAL = 1.0;
 	constexpr auto DEFAULT_MAX_LRU = 128;
 	constexpr auto DEFAULT_DNS = true;
+	constexpr auto DEFAULT_PARIS_MODE = false;
 
-#define MTR_NR_COLS 9
+#define MTR_NR_COLS 14
 	constexpr wchar_t MTR_COLS[MTR_NR_COLS][10] = {
 		L"Hostname",
 		L"Nr",
+		L"ASN",
 		L"Loss %",
 		L"Sent",
 		L"Recv",
+		L"Late",
 		L"Best",
 		L"Avrg",
 		L"Worst",
-		L"Last"
+		L"Last",
+		L"StDev",
+		L"Jitter",
+		L"EWMA"
 	};
 
 	constexpr int MTR_COL_LENGTH[MTR_NR_COLS] = {
-			190, 30, 50, 40, 40, 50, 50, 50, 50
+			190, 30, 70, 50, 40, 40, 40, 60, 60, 60, 60, 60, 60, 60
 	};
 	constexpr auto WINMTR_DIALOG_TIMER = 100;
 
@@ -107,7 +113,15 @@ WinMTRDialog::WinMTRDialog(CWnd* pParent) noexcept
 	transition(STATE_TRANSITIONS::IDLE_TO_IDLE),
 	pingsize(DEFAULT_PING_SIZE),
 	maxLRU(DEFAULT_MAX_LRU),
-	useDNS(DEFAULT_DNS)
+	useDNS(DEFAULT_DNS),
+	ewmaWeight(WinMTRUtils::DEFAULT_EWMA_WEIGHT),
+	historyKiB(WinMTRUtils::DEFAULT_HISTORY_KIB),
+	parisMode(DEFAULT_PARIS_MODE),
+	probeProtocol(probe_protocol::icmp),
+	probePort(WinMTRUtils::DEFAULT_UDP_PORT),
+	maxProbeRate(WinMTRUtils::DEFAULT_MAX_PROBE_RATE),
+	maxByteRate(WinMTRUtils::DEFAULT_MAX_BYTE_RATE),
+	maxHops(WinMTRUtils::DEFAULT_MAX_HOPS)
 
 {
 	m_hIcon = AfxGetApp()->LoadIcon(IDR_MAINFRAME);
@@ -226,6 +240,11 @@ BOOL WinMTRDialog::OnInitDialog()
 	RepositionBars(AFX_IDW_CONTROLBAR_FIRST, AFX_IDW_CONTROLBAR_LAST, 0);
 
 	InitRegistry();
+	LoadNameCache();
+	LoadAsnDatabase();
+	OpenEventLog();
+	OpenCapture();
+	OpenMetrics();
 
 	if (m_autostart) {
 		m_comboHost.SetWindowText(msz_defaulthostname.c_str());
@@ -374,10 +393,15 @@ void WinMTRDialog::OnDblclkList([[maybe_unused]] NMHDR* pNMHDR, LRESULT* pResult
 
 		POSITION pos = m_listMTR.GetFirstSelectedItemPosition();
 		if (pos != nullptr) {
-			int nItem = m_listMTR.GetNextSelectedItem(pos);
+			const auto nItem = static_cast<std::size_t>(m_listMTR.GetNextSelectedItem(pos));
+			// rows are paths rather than hops, so go by what is on screen
+			const auto netstate = wmtrnet->getCurrentState();
+			if (nItem >= netstate.size()) {
+				return;
+			}
 			WinMTRProperties wmtrprop;
 
-			if (const auto lstate = wmtrnet->getStateAt(nItem); !isValidAddress(lstate.addr)) {
+			if (const auto& lstate = netstate[nItem]; !isValidAddress(lstate.addr)) {
 				wmtrprop.host.clear();
 				wmtrprop.ip.clear();
 				wmtrprop.comment = lstate.getName();
@@ -386,6 +410,7 @@ void WinMTRDialog::OnDblclkList([[maybe_unused]] NMHDR* pNMHDR, LRESULT* pResult
 
 				wmtrprop.ping_avrg = wmtrprop.ping_last = 0.0;
 				wmtrprop.ping_best = wmtrprop.ping_worst = 0.0;
+				wmtrprop.ping_p50 = wmtrprop.ping_p90 = wmtrprop.ping_p99 = wmtrprop.ping_p999 = 0.0;
 			}
 			else {
 				wmtrprop.host = lstate.getName();
@@ -393,10 +418,14 @@ void WinMTRDialog::OnDblclkList([[maybe_unused]] NMHDR* pNMHDR, LRESULT* pResult
 
 				wmtrprop.comment = L"Host alive."sv;
 
-				wmtrprop.ping_avrg = static_cast<float>(lstate.getAvg());
-				wmtrprop.ping_last = static_cast<float>(lstate.last);
-				wmtrprop.ping_best = static_cast<float>(lstate.best);
-				wmtrprop.ping_worst = static_cast<float>(lstate.worst);
+				wmtrprop.ping_avrg = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.getAvg()));
+				wmtrprop.ping_last = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.last));
+				wmtrprop.ping_best = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.best));
+				wmtrprop.ping_worst = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.worst));
+				wmtrprop.ping_p50 = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.p50));
+				wmtrprop.ping_p90 = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.p90));
+				wmtrprop.ping_p99 = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.p99));
+				wmtrprop.ping_p999 = static_cast<float>(WinMTRUtils::microseconds_to_ms(lstate.p999));
 
 				wmtrprop.pck_loss = lstate.getPercent();
 				wmtrprop.pck_recv = lstate.returned;
@@ -419,6 +448,33 @@ void WinMTRDialog::SetHostName(std::wstring host)
 	msz_defaulthostname = std::move(host);
 }
 
+//*****************************************************************************
+// WinMTRDialog::SetEventLog
+//
+//*****************************************************************************
+void WinMTRDialog::SetEventLog(std::wstring path)
+{
+	eventLogPath = std::move(path);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetCapture
+//
+//*****************************************************************************
+void WinMTRDialog::SetCapture(std::wstring path)
+{
+	capturePath = std::move(path);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetMetrics
+//
+//*****************************************************************************
+void WinMTRDialog::SetMetrics(std::wstring endpoint)
+{
+	metricsEndpoint = std::move(endpoint);
+}
+
 
 //*****************************************************************************
 // WinMTRDialog::SetPingSize
@@ -461,6 +517,77 @@ void WinMTRDialog::SetUseDNS(bool udns, options_source fromCmdLine) noexcept
 	hasUseDNSFromCmdLine = static_cast<bool>(fromCmdLine);
 }
 
+//*****************************************************************************
+// WinMTRDialog::SetEwmaWeight
+//
+//*****************************************************************************
+void WinMTRDialog::SetEwmaWeight(double weight, options_source fromCmdLine) noexcept
+{
+	ewmaWeight = weight;
+	hasEwmaWeightFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetHistoryKiB
+//
+//*****************************************************************************
+void WinMTRDialog::SetHistoryKiB(unsigned kib, options_source fromCmdLine) noexcept
+{
+	historyKiB = kib;
+	hasHistoryKiBFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetParisMode
+//
+//*****************************************************************************
+void WinMTRDialog::SetParisMode(bool paris, options_source fromCmdLine) noexcept
+{
+	parisMode = paris;
+	hasParisModeFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetProbeProtocol
+//
+//*****************************************************************************
+void WinMTRDialog::SetProbeProtocol(probe_protocol protocol, unsigned port, options_source fromCmdLine) noexcept
+{
+	probeProtocol = protocol;
+	probePort = port;
+	hasProbeProtocolFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetMaxProbeRate
+//
+//*****************************************************************************
+void WinMTRDialog::SetMaxProbeRate(unsigned rate, options_source fromCmdLine) noexcept
+{
+	maxProbeRate = rate;
+	hasMaxProbeRateFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetMaxByteRate
+//
+//*****************************************************************************
+void WinMTRDialog::SetMaxByteRate(unsigned rate, options_source fromCmdLine) noexcept
+{
+	maxByteRate = rate;
+	hasMaxByteRateFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetMaxHops
+//
+//*****************************************************************************
+void WinMTRDialog::SetMaxHops(unsigned hops, options_source fromCmdLine) noexcept
+{
+	maxHops = hops;
+	hasMaxHopsFromCmdLine = static_cast<bool>(fromCmdLine);
+}
+
 
 //*****************************************************************************
 // WinMTRDialog::WinMTRDialog
@@ -495,7 +622,7 @@ int WinMTRDialog::DisplayRedraw()
 			name = noResponse;
 		}
 
-		auto result = std::format_to_n(nr_crt, std::size(nr_crt) - 1, WinMTRUtils::int_number_format, i + 1);
+		auto result = std::format_to_n(nr_crt, std::size(nr_crt) - 1, WinMTRUtils::int_number_format, host.ttl);
 		*result.out = '\0';
 		if (m_listMTR.GetItemCount() <= i)
 			m_listMTR.InsertItem(i, name.c_str());
@@ -504,34 +631,58 @@ int WinMTRDialog::DisplayRedraw()
 
 		m_listMTR.SetItem(i, 1, LVIF_TEXT, nr_crt, 0, 0, 0, 0);
 		constexpr auto writable_size = std::size(buf) - 1;
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.getPercent());
-		*result.out = '\0';
+		// blank rather than AS0 when there is no database or it doesn't know the address
+		buf[0] = L'\0';
+		if (host.asn) {
+			result = std::format_to_n(buf, writable_size, WinMTRUtils::asn_format, host.asn);
+			*result.out = '\0';
+		}
 		m_listMTR.SetItem(i, 2, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.xmit);
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.getPercent());
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 3, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.returned);
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.xmit);
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 4, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.best);
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.returned);
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 5, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.getAvg());
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.late);
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 6, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.worst);
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.best));
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 7, LVIF_TEXT, buf, 0, 0, 0, 0);
 
-		result = std::format_to_n(buf, writable_size, WinMTRUtils::int_number_format, host.last);
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.getAvg()));
 		*result.out = '\0';
 		m_listMTR.SetItem(i, 8, LVIF_TEXT, buf, 0, 0, 0, 0);
 
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.worst));
+		*result.out = '\0';
+		m_listMTR.SetItem(i, 9, LVIF_TEXT, buf, 0, 0, 0, 0);
+
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.last));
+		*result.out = '\0';
+		m_listMTR.SetItem(i, 10, LVIF_TEXT, buf, 0, 0, 0, 0);
+
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.stddev));
+		*result.out = '\0';
+		m_listMTR.SetItem(i, 11, LVIF_TEXT, buf, 0, 0, 0, 0);
+
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.jitter));
+		*result.out = '\0';
+		m_listMTR.SetItem(i, 12, LVIF_TEXT, buf, 0, 0, 0, 0);
+
+		result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, WinMTRUtils::microseconds_to_ms(host.ewma));
+		*result.out = '\0';
+		m_listMTR.SetItem(i, 13, LVIF_TEXT, buf, 0, 0, 0, 0);
+
 		i++;
 	}
 
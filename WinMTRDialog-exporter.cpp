@@ -36,76 +36,47 @@ module WinMTR.Dialog:exporter;
 
 import :ClassDef;
 import <string>;
-import <sstream>;
 import <string_view>;
-import <iterator>;
-import <format>;
 import <fstream>;
 
+import WinMTR.ReportWriter;
 import WinMTR.Net;
-import WinMTRSNetHost;
 using namespace std::literals;
 namespace {
-	[[nodiscard]]
-	std::wstring makeTextOutput(const WinMTRNet& wmtrnet) {
-		std::wostringstream out_buf;
-		out_buf << L"|-------------------------------------------------------------------------------------------|\r\n" \
-			L"|                                      WinMTR statistics                                    |\r\n" \
-			L"|                       Host              -   %%  | Sent | Recv | Best | Avrg | Wrst | Last |\r\n" \
-			L"|-------------------------------------------------|------|------|------|------|------|------|\r\n"sv;
-		std::ostream_iterator<wchar_t, wchar_t> out(out_buf);
-		CString noResponse;
-		noResponse.LoadStringW(IDS_STRING_NO_RESPONSE_FROM_HOST);
-
-		for (const auto curr_state = wmtrnet.getCurrentState(); const auto & hop : curr_state) {
-			auto name = hop.getName();
-			if (name.empty()) {
-				name = noResponse;
-			}
-			std::format_to(out, L"| {:40} - {:4} | {:4} | {:4} | {:4} | {:4} | {:4} | {:4} |\r\n"sv,
-				name, hop.getPercent(),
-				hop.xmit, hop.returned, hop.best,
-				hop.getAvg(), hop.worst, hop.last);
-		}
+	// loaded once, the resources don't change while the program runs
+	struct export_strings final {
+		std::wstring no_response;
+		std::wstring program;
+	};
 
-		out_buf << L"|_________________________________________________|______|______|______|______|______|______|\r\n"sv;
-
-		CString cs_tmp;
-		(void)cs_tmp.LoadStringW(IDS_STRING_SB_NAME);
-		out_buf << L"   "sv << cs_tmp.GetString();
-		return out_buf.str();
+	[[nodiscard]]
+	const export_strings& strings()
+	{
+		static const export_strings loaded = [] {
+			CString noResponse;
+			(void)noResponse.LoadStringW(IDS_STRING_NO_RESPONSE_FROM_HOST);
+			CString program;
+			(void)program.LoadStringW(IDS_STRING_SB_NAME);
+			return export_strings{ .no_response = noResponse.GetString(), .program = program.GetString() };
+		}();
+		return loaded;
 	}
-	// jscpd:ignore-start
-	std::wostream& makeHTMLOutput(WinMTRNet& wmtrnet, std::wostream& out) {
-		out << L"<table>" \
-			L"<thead><tr><th>Host</th><th>%%</th><th>Sent</th><th>Recv</th><th>Best</th><th>Avrg</th><th>Wrst</th><th>Last</th></tr></thead><tbody>"sv;
-		std::ostream_iterator<wchar_t, wchar_t> outitr(out);
-
-		CString noResponse;
-		noResponse.LoadStringW(IDS_STRING_NO_RESPONSE_FROM_HOST);
-
-		for (const auto curr_state = wmtrnet.getCurrentState(); const auto & hop : curr_state) {
-			auto name = hop.getName();
-			if (name.empty()) {
-				name = noResponse;
-			}
-			std::format_to(outitr
-				, L"<tr><td>{}</td><td>{}</td><td>{}</td><td>{}</td><td>{}</td><td>{}</td><td>{}</td><td>{}</td></tr>"sv
-				, name
-				, hop.getPercent()
-				, hop.xmit
-				, hop.returned
-				, hop.best
-				, hop.getAvg()
-				, hop.worst
-				, hop.last
-			);
-		}
+}
 
-		out << L"</tbody></table>"sv;
-		return out;
-	}
-	// jscpd:ignore-end
+//*****************************************************************************
+// WinMTRDialog::RenderExport
+//
+// 
+//*****************************************************************************
+const std::wstring& WinMTRDialog::RenderExport(report_format format)
+{
+	// the combo may have been edited since, the table is still the traced host's
+	exportReport.take(*wmtrnet, tracedHost);
+	exportReport.take_diagnostics();
+	exportText.clear();
+	const auto& loaded = strings();
+	exportReport.write(exportText, format, { .no_response = loaded.no_response, .eol = L"\r\n"sv, .footer = loaded.program });
+	return exportText;
 }
 
 //*****************************************************************************
@@ -116,9 +87,8 @@ namespace {
 void WinMTRDialog::OnCTTC() noexcept
 {
 	using namespace winrt::Windows::ApplicationModel::DataTransfer;
-	const auto f_buf = makeTextOutput(*wmtrnet);
 	auto dataPackage = DataPackage();
-	dataPackage.SetText(f_buf);
+	dataPackage.SetText(RenderExport(report_format::text));
 
 	Clipboard::SetContentWithOptions(dataPackage, nullptr);
 }
@@ -132,10 +102,7 @@ void WinMTRDialog::OnCTTC() noexcept
 void WinMTRDialog::OnCHTC() noexcept
 {
 	using namespace winrt::Windows::ApplicationModel::DataTransfer;
-	std::wostringstream out;
-	makeHTMLOutput(*wmtrnet, out);
-	const auto f_buf = out.str();
-	const auto htmlFormat = HtmlFormatHelper::CreateHtmlFormat(f_buf);
+	const auto htmlFormat = HtmlFormatHelper::CreateHtmlFormat(RenderExport(report_format::html));
 	auto dataPackage = DataPackage();
 	dataPackage.SetHtmlFormat(htmlFormat);
 	Clipboard::SetContentWithOptions(dataPackage, nullptr);
@@ -158,10 +125,8 @@ void WinMTRDialog::OnEXPT() noexcept
 		szFilter,
 		this);
 	if (dlg.DoModal() == IDOK) {
-		const auto f_buf = makeTextOutput(*wmtrnet);
-
 		if (std::wfstream fp(dlg.GetPathName(), std::ios::binary | std::ios::out | std::ios::trunc); fp) {
-			fp << f_buf << std::endl;
+			fp << RenderExport(report_format::text) << std::endl;
 		}
 	}
 }
@@ -190,7 +155,7 @@ void WinMTRDialog::OnEXPH() noexcept
 				L"table{border:1px solid #000;border-collapse:collapse;}" \
 				L"tbody tr:nth-child(even){background:#ccc;}</style></head><body>" \
 				L"<h1>WinMTR statistics</h1>"sv;
-			makeHTMLOutput(*wmtrnet, fp) << L"</body></html>"sv << std::endl;
+			fp << RenderExport(report_format::html) << L"</body></html>"sv << std::endl;
 		}
 	}
 }
@@ -34,10 +34,20 @@ module;
 module WinMTR.Dialog:registry;
 import :ClassDef;
 
+import <exception>;
+import <filesystem>;
 import <format>;
 import <string_view>;
+import <winrt/Windows.Foundation.h>;
 import WinMTRVerUtil;
+import WinMTR.AsnDatabase;
+import WinMTR.Capture;
+import WinMTR.Metrics;
+import WinMTR.EventLog;
+import WinMTR.NameCache;
 import WinMTR.Options;
+import WinMTR.ProbeBackend;
+import WinMTRUtils;
 
 using namespace std::literals;
 namespace {
@@ -45,6 +55,18 @@ namespace {
 	const auto NrLRU_REG_KEY = L"NrLRU";
 	const auto config_key_name = LR"(Software\WinMTR\Config)";
 	const auto lru_key_name = LR"(Software\WinMTR\LRU)";
+
+	// per user and per machine, like the names and networks kept in there
+	[[nodiscard]]
+	std::filesystem::path local_data_path(std::wstring_view file)
+	{
+		wchar_t local_app_data[MAX_PATH] = {};
+		const auto length = GetEnvironmentVariableW(L"LOCALAPPDATA", local_app_data, static_cast<DWORD>(std::size(local_app_data)));
+		if (!length || length >= std::size(local_app_data)) {
+			return {};
+		}
+		return std::filesystem::path(local_app_data) / L"WinMTR" / file;
+	}
 }
 //*****************************************************************************
 // WinMTRDialog::InitRegistry
@@ -106,7 +128,82 @@ BOOL WinMTRDialog::InitRegistry() noexcept
 		config_key.SetDWORDValue(L"Interval", tmp_dword);
 	}
 	else {
-		if (!hasIntervalFromCmdLine) interval = (float)tmp_dword / 1000.0;
+		if (!hasIntervalFromCmdLine && tmp_dword) interval = (float)tmp_dword / 1000.0;
+	}
+
+	// stored in thousandths
+	if (config_key.QueryDWORDValue(L"EWMAWeight", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = static_cast<DWORD>(ewmaWeight * 1000);
+		config_key.SetDWORDValue(L"EWMAWeight", tmp_dword);
+	}
+	else {
+		const auto weight = tmp_dword / 1000.0;
+		if (!hasEwmaWeightFromCmdLine && weight >= WinMTRUtils::MIN_EWMA_WEIGHT && weight <= WinMTRUtils::MAX_EWMA_WEIGHT) ewmaWeight = weight;
+	}
+
+	if (config_key.QueryDWORDValue(L"HistoryKiB", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = historyKiB;
+		config_key.SetDWORDValue(L"HistoryKiB", tmp_dword);
+	}
+	else {
+		if (!hasHistoryKiBFromCmdLine && tmp_dword <= WinMTRUtils::MAX_HISTORY_KIB) historyKiB = tmp_dword;
+	}
+
+	if (config_key.QueryDWORDValue(L"ParisMode", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = parisMode ? 1 : 0;
+		config_key.SetDWORDValue(L"ParisMode", tmp_dword);
+	}
+	else {
+		if (!hasParisModeFromCmdLine) parisMode = (BOOL)tmp_dword;
+	}
+
+	// 0 ICMP, 1 UDP, 2 TCP
+	if (config_key.QueryDWORDValue(L"ProbeProtocol", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = static_cast<DWORD>(probeProtocol.load());
+		config_key.SetDWORDValue(L"ProbeProtocol", tmp_dword);
+	}
+	else {
+		if (!hasProbeProtocolFromCmdLine && tmp_dword <= static_cast<DWORD>(probe_protocol::tcp)) probeProtocol = static_cast<probe_protocol>(tmp_dword);
+	}
+
+	if (config_key.QueryDWORDValue(L"ProbePort", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = probePort;
+		config_key.SetDWORDValue(L"ProbePort", tmp_dword);
+	}
+	else {
+		if (!hasProbeProtocolFromCmdLine && tmp_dword >= WinMTRUtils::MIN_PROBE_PORT && tmp_dword <= WinMTRUtils::MAX_PROBE_PORT) probePort = tmp_dword;
+	}
+
+	if (config_key.QueryDWORDValue(L"MaxProbeRate", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = maxProbeRate;
+		config_key.SetDWORDValue(L"MaxProbeRate", tmp_dword);
+	}
+	else {
+		if (!hasMaxProbeRateFromCmdLine && tmp_dword >= WinMTRUtils::MIN_MAX_PROBE_RATE && tmp_dword <= WinMTRUtils::MAX_MAX_PROBE_RATE) maxProbeRate = tmp_dword;
+	}
+
+	if (config_key.QueryDWORDValue(L"MaxByteRate", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = maxByteRate;
+		config_key.SetDWORDValue(L"MaxByteRate", tmp_dword);
+	}
+	else {
+		if (!hasMaxByteRateFromCmdLine && tmp_dword >= WinMTRUtils::MIN_MAX_BYTE_RATE && tmp_dword <= WinMTRUtils::MAX_MAX_BYTE_RATE) maxByteRate = tmp_dword;
+	}
+
+	if (config_key.QueryDWORDValue(L"MaxHops", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = maxHops;
+		config_key.SetDWORDValue(L"MaxHops", tmp_dword);
+	}
+	else {
+		if (!hasMaxHopsFromCmdLine && tmp_dword >= WinMTRUtils::MIN_MAX_HOPS && tmp_dword <= WinMTRUtils::MAX_MAX_HOPS) maxHops = tmp_dword;
+	}
+
+	if (config_key.QueryDWORDValue(L"PersistNameCache", tmp_dword) != ERROR_SUCCESS) {
+		tmp_dword = persistNameCache ? 1 : 0;
+		config_key.SetDWORDValue(L"PersistNameCache", tmp_dword);
+	}
+	else {
+		persistNameCache = tmp_dword;
 	}
 	CRegKey lru_key;
 	if (lru_key.Create(versionKey,
@@ -138,6 +235,123 @@ BOOL WinMTRDialog::InitRegistry() noexcept
 	return TRUE;
 }
 
+//*****************************************************************************
+// WinMTRDialog::LoadNameCache
+//
+//*****************************************************************************
+void WinMTRDialog::LoadNameCache() noexcept
+{
+	if (!persistNameCache) {
+		return;
+	}
+	if (const auto path = local_data_path(L"NameCache.bin"sv); !path.empty()) {
+		// a missing or broken file just means starting out empty
+		(void)name_cache::instance()->load(path);
+	}
+}
+
+//*****************************************************************************
+// WinMTRDialog::SaveNameCache
+//
+//*****************************************************************************
+void WinMTRDialog::SaveNameCache() noexcept
+{
+	if (!persistNameCache) {
+		return;
+	}
+	const auto path = local_data_path(L"NameCache.bin"sv);
+	if (path.empty()) {
+		return;
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+	(void)name_cache::instance()->save(path);
+}
+
+//*****************************************************************************
+// WinMTRDialog::LoadAsnDatabase
+//
+// Maps the AS table if there is one. A newer iptoasn.com dump next to it
+// is built into a new table first, which takes seconds for a full one, so
+// that happens in the background and the hops found until then go without.
+//*****************************************************************************
+winrt::fire_and_forget WinMTRDialog::LoadAsnDatabase()
+{
+	const auto table = local_data_path(L"asn.bin"sv);
+	const auto dump = local_data_path(L"ip2asn-combined.tsv"sv);
+	if (table.empty()) {
+		co_return;
+	}
+	std::error_code ec;
+	const auto dump_time = std::filesystem::last_write_time(dump, ec);
+	const auto have_dump = !ec;
+	const auto table_time = std::filesystem::last_write_time(table, ec);
+	if (have_dump && (ec || table_time < dump_time)) {
+		co_await winrt::resume_background();
+		try {
+			if (!asn_database::build(dump, table)) {
+				co_return;
+			}
+		}
+		catch (const std::exception&) {
+			co_return;
+		}
+	}
+	asn_database::install(asn_database::open(table));
+}
+
+//*****************************************************************************
+// WinMTRDialog::OpenEventLog
+//
+//*****************************************************************************
+void WinMTRDialog::OpenEventLog() noexcept
+{
+	if (eventLogPath.empty()) {
+		return;
+	}
+	auto log = event_log::open(eventLogPath);
+	if (!log) {
+		AfxMessageBox(L"Unable to open the event log!");
+		return;
+	}
+	event_log::install(std::move(log));
+}
+
+//*****************************************************************************
+// WinMTRDialog::OpenCapture
+//
+//*****************************************************************************
+void WinMTRDialog::OpenCapture() noexcept
+{
+	if (capturePath.empty()) {
+		return;
+	}
+	auto writer = capture_writer::open(capturePath);
+	if (!writer) {
+		AfxMessageBox(L"Unable to open the capture file!");
+		return;
+	}
+	capture_writer::install(std::move(writer));
+}
+
+//*****************************************************************************
+// WinMTRDialog::OpenMetrics
+//
+//*****************************************************************************
+void WinMTRDialog::OpenMetrics() noexcept
+{
+	if (metricsEndpoint.empty()) {
+		return;
+	}
+	const auto address = metrics_server::endpoint(metricsEndpoint);
+	auto server = address ? metrics_server::open(*address) : nullptr;
+	if (!server) {
+		AfxMessageBox(L"Unable to serve metrics on that address!");
+		return;
+	}
+	metrics_server::install(std::move(server));
+}
+
 void WinMTRDialog::ClearHistory()
 {
 	DWORD tmp_dword;
@@ -159,6 +373,35 @@ void WinMTRDialog::ClearHistory()
 	m_comboHost.AddString(CString((LPCSTR)IDS_STRING_CLEAR_HISTORY));
 }
 
+//*****************************************************************************
+// WinMTRDialog::RememberHost
+//
+// Adds the host a trace was started with to the history, called once the trace
+// has found an address for it so that names that don't resolve stay out of it.
+//*****************************************************************************
+void WinMTRDialog::RememberHost(std::wstring_view host)
+{
+	CString sHost(host.data(), static_cast<int>(host.size()));
+	sHost.TrimLeft();
+	if (sHost.IsEmpty() || m_comboHost.FindString(-1, sHost) != CB_ERR) {
+		return;
+	}
+	m_comboHost.InsertString(m_comboHost.GetCount() - 1, sHost);
+
+	wchar_t key_name[20];
+	CRegKey lru_key;
+	lru_key.Open(HKEY_CURRENT_USER, lru_key_name, KEY_ALL_ACCESS);
+
+	if (nrLRU >= maxLRU)
+		nrLRU = 0;
+
+	nrLRU++;
+	auto result = std::format_to_n(key_name, std::size(key_name) - 1, reg_host_fmt, nrLRU);
+	*result.out = '\0';
+	lru_key.SetStringValue(key_name, static_cast<LPCWSTR>(sHost));
+	auto tmp_dword = static_cast<DWORD>(nrLRU);
+	lru_key.SetDWORDValue(NrLRU_REG_KEY, tmp_dword);
+}
 
 //*****************************************************************************
 // WinMTRDialog::OnRestart
@@ -189,26 +432,8 @@ void WinMTRDialog::OnRestart() noexcept
 
 	if (state == STATES::IDLE) {
 
-		if (InitMTRNet()) {
-			if (m_comboHost.FindString(-1, sHost) == CB_ERR) {
-				m_comboHost.InsertString(m_comboHost.GetCount() - 1, sHost);
-
-				wchar_t key_name[20];
-				CRegKey lru_key;
-				lru_key.Open(HKEY_CURRENT_USER, lru_key_name, KEY_ALL_ACCESS);
-
-				if (nrLRU >= maxLRU)
-					nrLRU = 0;
-
-				nrLRU++;
-				auto result = std::format_to_n(key_name, std::size(key_name) - 1, reg_host_fmt, nrLRU);
-				*result.out = '\0';
-				lru_key.SetStringValue(key_name, static_cast<LPCWSTR>(sHost));
-				auto tmp_dword = static_cast<DWORD>(nrLRU);
-				lru_key.SetDWORDValue(NrLRU_REG_KEY, tmp_dword);
-			}
-			Transit(STATES::TRACING);
-		}
+		// the name is resolved by the trace itself, the timer adds it to the history once it has been
+		Transit(STATES::TRACING);
 	}
 	else {
 		Transit(STATES::STOPPING);
@@ -230,6 +455,13 @@ void WinMTRDialog::OnOptions()
 	optDlg.SetUseDNS(useDNS);
 	optDlg.SetUseIPv4(useIPv4);
 	optDlg.SetUseIPv6(useIPv6);
+	optDlg.SetProbeProtocol(probeProtocol, probePort);
+	// only offer what the probe backend can send
+	for (const auto protocol : { probe_protocol::icmp, probe_protocol::udp, probe_protocol::tcp }) {
+		if (wmtrnet->supports(protocol)) {
+			optDlg.AddProtocol(protocol);
+		}
+	}
 
 	if (IDOK == optDlg.DoModal()) {
 
@@ -239,6 +471,8 @@ void WinMTRDialog::OnOptions()
 		useDNS = optDlg.GetUseDNS();
 		useIPv4 = optDlg.GetUseIPv4();
 		useIPv6 = optDlg.GetUseIPv6();
+		probeProtocol = optDlg.GetProbeProtocol();
+		probePort = optDlg.GetProbePort();
 
 		/*HKEY hKey;*/
 		DWORD tmp_dword;
@@ -254,6 +488,10 @@ void WinMTRDialog::OnOptions()
 			config_key.SetDWORDValue(L"UseDNS", tmp_dword);
 			tmp_dword = static_cast<DWORD>(interval * 1000);
 			config_key.SetDWORDValue(L"Interval", tmp_dword);
+			tmp_dword = static_cast<DWORD>(probeProtocol.load());
+			config_key.SetDWORDValue(L"ProbeProtocol", tmp_dword);
+			tmp_dword = probePort;
+			config_key.SetDWORDValue(L"ProbePort", tmp_dword);
 		}
 		if (maxLRU < nrLRU) {
 			CRegKey lru_key;
@@ -40,63 +40,27 @@ import <optional>;
 import <mutex>;
 import <format>;
 import <string_view>;
+import <chrono>;
+import <vector>;
 import <winrt/Windows.Foundation.h>;
 
 using namespace std::literals;
 
+namespace {
+	// GetAddrInfoEx doesn't pass the record's TTL on, so this stands in for it
+	constexpr auto RESOLVED_HOST_TTL = 60s;
+}
+
 //*****************************************************************************
-// WinMTRDialog::InitMTRNet
+// WinMTRDialog::pingThread
 //
-// 
+// Resolves the host once, without holding up the UI, and hands every address
+// the resolver came up with to the trace, which picks the family to follow.
 //*****************************************************************************
-bool WinMTRDialog::InitMTRNet() noexcept
-{
-	CString sHost;
-	m_comboHost.GetWindowTextW(sHost);
-
-	if (sHost.IsEmpty()) [[unlikely]] { // Technically never because this is caught in the calling function
-		sHost = L"localhost";
-	}
-
-	SOCKADDR_INET addrstore{};
-	for (auto af : { AF_INET, AF_INET6 }) {
-		INT addrSize = sizeof(addrstore);
-		if (auto res = WSAStringToAddressW(
-			sHost.GetBuffer()
-			, af
-			, nullptr
-			, reinterpret_cast<LPSOCKADDR>(&addrstore)
-			, &addrSize);
-			!res) {
-			return true;
-		}
-	}
-
-	const auto buf = std::format(L"Resolving host {}..."sv, sHost.GetString());
-	statusBar.SetPaneText(0, buf.c_str());
-	std::unique_ptr<ADDRINFOEXW, addrinfo_deleter> holder;
-	ADDRINFOEXW hint = { .ai_family = AF_UNSPEC };
-	if (const auto result = GetAddrInfoExW(
-		sHost
-		, nullptr
-		, NS_ALL
-		, nullptr
-		, &hint
-		, std::out_ptr(holder)
-		, nullptr
-		, nullptr
-		, nullptr
-		, nullptr); result != ERROR_SUCCESS) {
-		statusBar.SetPaneText(0, CString((LPCTSTR)IDS_STRING_SB_NAME));
-		AfxMessageBox(IDS_STRING_UNABLE_TO_RESOLVE_HOSTNAME);
-		return false;
-	}
-
-	return true;
-}
-
 winrt::Windows::Foundation::IAsyncAction WinMTRDialog::pingThread(std::stop_token stop_token, std::wstring sHost)
 {
+	// time to the first probe counts from here, the lookup included
+	const auto requested = std::chrono::steady_clock::now();
 	if (tracing.exchange(true)) {
 		throw new std::runtime_error("Tracing started twice!");
 	}
@@ -118,7 +82,8 @@ winrt::Windows::Foundation::IAsyncAction WinMTRDialog::pingThread(std::stop_toke
 			, reinterpret_cast<LPSOCKADDR>(&addrstore)
 			, &addrSize);
 			!res) {
-			co_await this->wmtrnet->DoTrace(stop_token, std::move(addrstore));
+			hostResolved = true;
+			co_await this->wmtrnet->DoTrace(stop_token, { addrstore }, requested);
 			co_return;
 		}
 	}
@@ -130,14 +95,26 @@ winrt::Windows::Foundation::IAsyncAction WinMTRDialog::pingThread(std::stop_toke
 	else if (!this->useIPv6) {
 		hintFamily = AF_INET;
 	}
-	timeval timeout{ .tv_sec = 30 };
-	auto result = co_await GetAddrInfoAsync(sHost, &timeout, hintFamily);
-	if (!result || result->empty()) {
-		AfxMessageBox(IDS_STRING_UNABLE_TO_RESOLVE_HOSTNAME);
-		co_return;
+	std::vector<SOCKADDR_INET> candidates;
+	{
+		std::scoped_lock lock(resolved_mutex);
+		if (resolved.name == sHost && resolved.family == hintFamily && requested < resolved.expires) {
+			candidates = resolved.addresses;
+		}
+	}
+	if (candidates.empty()) {
+		timeval timeout{ .tv_sec = 30 };
+		auto result = co_await GetAddrInfoAsync(sHost, &timeout, hintFamily);
+		if (!result || result->empty()) {
+			AfxMessageBox(IDS_STRING_UNABLE_TO_RESOLVE_HOSTNAME);
+			co_return;
+		}
+		candidates = std::move(*result);
+		std::scoped_lock lock(resolved_mutex);
+		resolved = { .name = sHost, .family = hintFamily, .addresses = candidates, .expires = std::chrono::steady_clock::now() + RESOLVED_HOST_TTL };
 	}
-	addrstore = result->front();
-	co_await this->wmtrnet->DoTrace(stop_token, std::move(addrstore));
+	hostResolved = true;
+	co_await this->wmtrnet->DoTrace(stop_token, std::move(candidates), requested);
 }
 
 winrt::fire_and_forget WinMTRDialog::stopTrace()
@@ -0,0 +1,493 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTREventLog.ixx
+//
+// DESCRIPTION:
+//   Writes one record per probe outcome to a file, as NDJSON or CSV, for
+//   anything that wants the raw events rather than the summary tables.
+//
+// NOTES:
+//   The trace loops only append their event to a buffer reserved up front,
+//   under a short lock. A writer thread swaps that buffer for an empty one
+//   and formats and writes the batch. When the buffer is full the event is
+//   dropped and counted, a slow disk never holds up a probe. The file is
+//   rotated once it reaches a size or an age, the rotated one gets the time
+//   it was started at in its name.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.EventLog;
+
+#ifdef _WIN32
+import <atomic>;
+import <chrono>;
+import <condition_variable>;
+import <cstddef>;
+import <cstdint>;
+import <filesystem>;
+import <fstream>;
+import <memory>;
+import <mutex>;
+import <string>;
+import <thread>;
+import <vector>;
+#endif
+import WinMTR.ProbeBackend;
+
+// what the trace loops hand over, formatting waits for the writer
+export struct probe_event final {
+	probe_backend::clock::time_point time;	// when the outcome was known
+	SOCKADDR_INET responder = {};			// nothing for a timeout
+	std::chrono::microseconds round_trip_time{ 0 };
+	std::uint32_t session = 0;
+	UCHAR ttl = 0;
+	probe_status status = probe_status::timed_out;
+};
+
+export enum class event_format {
+	ndjson,
+	csv
+};
+
+export struct event_log_limits final {
+	std::size_t queue = 65536;					// events waiting for the writer
+	std::uint64_t max_bytes = 64ull << 20;		// a file is rotated once it has this much, zero for no limit
+	std::chrono::seconds max_age = std::chrono::hours(1);	// or once it is this old, zero for no limit
+};
+
+export struct event_log_stats final {
+	std::uint64_t written = 0;
+	std::uint64_t dropped = 0;		// the ring was full, or the file couldn't be written
+	std::uint64_t rotations = 0;
+};
+
+//*****************************************************************************
+// CLASS:  event_log
+//
+// Safe to push to from any number of threads. Whatever is still queued is
+// written out when the log is destroyed.
+//*****************************************************************************
+export class event_log final {
+	event_log(const event_log&) = delete;
+	event_log& operator=(const event_log&) = delete;
+public:
+	// how long an event waits at most before the writer picks it up
+	static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(250);
+
+	// CSV for a .csv path, NDJSON for anything else, nothing if the file can't be opened
+	[[nodiscard]]
+	static std::shared_ptr<event_log> open(std::filesystem::path path, event_log_limits limits = {}) noexcept;
+
+	// the one every trace writes to, none until one is installed
+	[[nodiscard]]
+	static std::shared_ptr<event_log> instance() noexcept
+	{
+		return s_instance.load(std::memory_order_acquire);
+	}
+	static void install(std::shared_ptr<event_log> log) noexcept
+	{
+		s_instance.store(std::move(log), std::memory_order_release);
+	}
+
+	// never blocks on the writer, false if the event had to be dropped
+	bool push(const probe_event& event) noexcept;
+
+	[[nodiscard]]
+	event_log_stats stats() const noexcept;
+
+	~event_log() noexcept;
+private:
+	event_log(std::filesystem::path path, event_format format, event_log_limits limits);
+
+	void write_loop(std::stop_token stop);
+	// formats a batch onto m_text and writes it, rotating first if it is time
+	void write(const std::vector<probe_event>& batch);
+	void format(const probe_event& event);
+	void rotate();
+	// opens the file for appending, a new one starts with the CSV header
+	[[nodiscard]]
+	bool start_file();
+
+	const std::filesystem::path m_path;
+	const event_format m_format;
+	const event_log_limits m_limits;
+	// maps the backend's clock onto the wall clock the records are stamped with
+	const probe_backend::clock::time_point m_steadyEpoch;
+	const std::chrono::system_clock::time_point m_systemEpoch;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable_any m_wake;
+	std::vector<probe_event> m_pending;		// never grows past what was reserved
+	std::atomic_uint64_t m_dropped{ 0 };
+	std::atomic_uint64_t m_written{ 0 };
+	std::atomic_uint64_t m_rotations{ 0 };
+
+	// the writer's own from here on
+	std::ofstream m_out;
+	std::uint64_t m_fileBytes = 0;
+	std::chrono::system_clock::time_point m_fileStarted;
+	std::string m_text;
+	std::jthread m_writer;
+
+	static inline std::atomic<std::shared_ptr<event_log>> s_instance;
+};
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
+import <cctype>;
+import <charconv>;
+import <string_view>;
+import <system_error>;
+import <utility>;
+#endif
+
+namespace {
+	using namespace std::string_view_literals;
+
+	constexpr auto CSV_HEADER = "time,session,ttl,responder,rtt_us,status\n"sv;
+
+	[[nodiscard]]
+	constexpr std::string_view status_name(probe_status status) noexcept
+	{
+		switch (status) {
+		case probe_status::success: return "success"sv;
+		case probe_status::ttl_expired: return "ttl_expired"sv;
+		case probe_status::timed_out: return "timed_out"sv;
+		case probe_status::buffer_too_small: return "buffer_too_small"sv;
+		case probe_status::dest_net_unreachable: return "dest_net_unreachable"sv;
+		case probe_status::dest_host_unreachable: return "dest_host_unreachable"sv;
+		case probe_status::dest_prot_unreachable: return "dest_prot_unreachable"sv;
+		case probe_status::dest_port_unreachable: return "dest_port_unreachable"sv;
+		case probe_status::no_resources: return "no_resources"sv;
+		case probe_status::bad_option: return "bad_option"sv;
+		case probe_status::hw_error: return "hw_error"sv;
+		case probe_status::packet_too_big: return "packet_too_big"sv;
+		case probe_status::bad_request: return "bad_request"sv;
+		case probe_status::bad_route: return "bad_route"sv;
+		case probe_status::ttl_expired_reassembly: return "ttl_expired_reassembly"sv;
+		case probe_status::param_problem: return "param_problem"sv;
+		case probe_status::source_quench: return "source_quench"sv;
+		case probe_status::option_too_big: return "option_too_big"sv;
+		case probe_status::bad_destination: return "bad_destination"sv;
+		case probe_status::general_failure: break;
+		}
+		return "general_failure"sv;
+	}
+
+	void append_number(std::string& out, std::uint64_t value, int width = 0)
+	{
+		std::array<char, 20> digits;
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		for (auto length = static_cast<int>(end - digits.data()); length < width; ++length) {
+			out += '0';
+		}
+		out.append(digits.data(), end);
+	}
+
+	// UTC, ISO 8601 down to the microsecond
+	void append_time(std::string& out, std::chrono::system_clock::time_point time)
+	{
+		using namespace std::chrono;
+		const auto micros = time_point_cast<microseconds>(time);
+		const auto day = floor<days>(micros);
+		const year_month_day date{ day };
+		const hh_mm_ss clock{ micros - day };
+		append_number(out, static_cast<std::uint64_t>(static_cast<int>(date.year())), 4);
+		out += '-';
+		append_number(out, static_cast<unsigned>(date.month()), 2);
+		out += '-';
+		append_number(out, static_cast<unsigned>(date.day()), 2);
+		out += 'T';
+		append_number(out, static_cast<std::uint64_t>(clock.hours().count()), 2);
+		out += ':';
+		append_number(out, static_cast<std::uint64_t>(clock.minutes().count()), 2);
+		out += ':';
+		append_number(out, static_cast<std::uint64_t>(clock.seconds().count()), 2);
+		out += '.';
+		append_number(out, static_cast<std::uint64_t>(clock.subseconds().count()), 6);
+		out += 'Z';
+	}
+
+	// empty for anything that isn't an address, timeouts have no responder
+	void append_address(std::string& out, const SOCKADDR_INET& addr)
+	{
+		std::array<char, INET6_ADDRSTRLEN> text{};
+		const char* printed = nullptr;
+		if (addr.si_family == AF_INET) {
+			printed = inet_ntop(AF_INET, &addr.Ipv4.sin_addr, text.data(), text.size());
+		}
+		else if (addr.si_family == AF_INET6) {
+			printed = inet_ntop(AF_INET6, &addr.Ipv6.sin6_addr, text.data(), text.size());
+		}
+		if (printed) {
+			out += printed;
+		}
+	}
+
+	// what a rotated file is called, the time its first record was written in its name
+	[[nodiscard]]
+	std::filesystem::path rotated_name(const std::filesystem::path& path, std::chrono::system_clock::time_point started, int attempt)
+	{
+		std::string stamp;
+		append_time(stamp, started);
+		// colons aren't allowed in Windows file names, and the fraction adds nothing here
+		stamp.resize(stamp.find('.'));
+		std::erase(stamp, ':');
+		std::erase(stamp, '-');
+		auto name = path.stem();
+		name += "-";
+		name += stamp;
+		if (attempt) {
+			name += "-";
+			name += std::to_string(attempt);
+		}
+		name += path.extension();
+		return path.parent_path() / name;
+	}
+}
+
+std::shared_ptr<event_log> event_log::open(std::filesystem::path path, event_log_limits limits) noexcept
+{
+	try {
+		auto extension = path.extension().string();
+		std::ranges::transform(extension, extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		const auto format = extension == ".csv" ? event_format::csv : event_format::ndjson;
+		std::shared_ptr<event_log> log(new event_log(std::move(path), format, limits));
+		// an existing log is carried on
+		if (!log->start_file()) {
+			return nullptr;
+		}
+		log->m_writer = std::jthread([log = log.get()](std::stop_token stop) { log->write_loop(std::move(stop)); });
+		return log;
+	}
+	catch (const std::exception&) {
+		return nullptr;
+	}
+}
+
+event_log::event_log(std::filesystem::path path, event_format format, event_log_limits limits)
+	:m_path(std::move(path))
+	, m_format(format)
+	, m_limits(limits)
+	, m_steadyEpoch(probe_backend::clock::now())
+	, m_systemEpoch(std::chrono::system_clock::now())
+{
+	m_pending.reserve(std::max<std::size_t>(limits.queue, 1));
+}
+
+event_log::~event_log() noexcept
+{
+	m_writer.request_stop();
+	if (m_writer.joinable()) {
+		m_writer.join();
+	}
+}
+
+bool event_log::push(const probe_event& event) noexcept
+{
+	bool wake = false;
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_pending.size() == m_pending.capacity()) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		m_pending.push_back(event);
+		// the timer picks up a trickle, a burst gets the writer going early
+		wake = m_pending.size() == m_pending.capacity() / 2;
+	}
+	if (wake) {
+		m_wake.notify_one();
+	}
+	return true;
+}
+
+event_log_stats event_log::stats() const noexcept
+{
+	return { .written = m_written.load(std::memory_order_relaxed)
+		, .dropped = m_dropped.load(std::memory_order_relaxed)
+		, .rotations = m_rotations.load(std::memory_order_relaxed) };
+}
+
+void event_log::write_loop(std::stop_token stop)
+{
+	// the two swap places, so both have to hold as much
+	std::vector<probe_event> batch;
+	batch.reserve(m_pending.capacity());
+	for (;;) {
+		const auto stopping = stop.stop_requested();
+		{
+			std::unique_lock lock(m_mutex);
+			if (!stopping) {
+				m_wake.wait_for(lock, stop, FLUSH_INTERVAL, [this] { return m_pending.size() >= m_pending.capacity() / 2; });
+			}
+			std::swap(batch, m_pending);
+		}
+		if (!batch.empty()) {
+			write(batch);
+			batch.clear();
+		}
+		// one more pass once asked to stop, so nothing pushed before that is lost
+		if (stopping) {
+			break;
+		}
+	}
+	m_out.flush();
+}
+
+void event_log::write(const std::vector<probe_event>& batch)
+{
+	const auto now = std::chrono::system_clock::now();
+	const auto full = m_limits.max_bytes && m_fileBytes >= m_limits.max_bytes;
+	const auto old = m_limits.max_age > std::chrono::seconds::zero() && now - m_fileStarted >= m_limits.max_age;
+	if (full || old) {
+		rotate();
+	}
+	m_text.clear();
+	for (const auto& event : batch) {
+		format(event);
+	}
+	if (!m_out || !m_out.write(m_text.data(), static_cast<std::streamsize>(m_text.size())).flush()) {
+		m_dropped.fetch_add(batch.size(), std::memory_order_relaxed);
+		// try again with a fresh file next time, the disk may have come back
+		m_out.close();
+		m_out.clear();
+		(void)start_file();
+		return;
+	}
+	m_fileBytes += m_text.size();
+	m_written.fetch_add(batch.size(), std::memory_order_relaxed);
+}
+
+void event_log::format(const probe_event& event)
+{
+	const auto time = m_systemEpoch + std::chrono::duration_cast<std::chrono::system_clock::duration>(event.time - m_steadyEpoch);
+	if (m_format == event_format::csv) {
+		append_time(m_text, time);
+		m_text += ',';
+		append_number(m_text, event.session);
+		m_text += ',';
+		append_number(m_text, event.ttl);
+		m_text += ',';
+		append_address(m_text, event.responder);
+		m_text += ',';
+		append_number(m_text, static_cast<std::uint64_t>(std::max<std::int64_t>(event.round_trip_time.count(), 0)));
+		m_text += ',';
+		m_text += status_name(event.status);
+		m_text += '\n';
+		return;
+	}
+	m_text += R"({"time":")"sv;
+	append_time(m_text, time);
+	m_text += R"(","session":)"sv;
+	append_number(m_text, event.session);
+	m_text += R"(,"ttl":)"sv;
+	append_number(m_text, event.ttl);
+	m_text += R"(,"responder":)"sv;
+	if (event.responder.si_family == AF_INET || event.responder.si_family == AF_INET6) {
+		m_text += '"';
+		append_address(m_text, event.responder);
+		m_text += '"';
+	}
+	else {
+		m_text += "null"sv;
+	}
+	m_text += R"(,"rtt_us":)"sv;
+	append_number(m_text, static_cast<std::uint64_t>(std::max<std::int64_t>(event.round_trip_time.count(), 0)));
+	m_text += R"(,"status":")"sv;
+	m_text += status_name(event.status);
+	m_text += "\"}\n"sv;
+}
+
+void event_log::rotate()
+{
+	m_out.close();
+	m_out.clear();
+	// two rotations within a second would otherwise overwrite each other
+	for (int attempt = 0; attempt < 100; ++attempt) {
+		const auto target = rotated_name(m_path, m_fileStarted, attempt);
+		std::error_code ec;
+		if (!std::filesystem::exists(target, ec)) {
+			std::filesystem::rename(m_path, target, ec);
+			if (!ec) {
+				m_rotations.fetch_add(1, std::memory_order_relaxed);
+			}
+			break;
+		}
+	}
+	(void)start_file();
+}
+
+bool event_log::start_file()
+{
+	m_out.open(m_path, std::ios::binary | std::ios::app);
+	m_fileStarted = std::chrono::system_clock::now();
+	std::error_code ec;
+	m_fileBytes = std::filesystem::file_size(m_path, ec);
+	if (ec) {
+		m_fileBytes = 0;
+	}
+	if (m_out && !m_fileBytes && m_format == event_format::csv) {
+		m_out.write(CSV_HEADER.data(), static_cast<std::streamsize>(CSV_HEADER.size()));
+		m_fileBytes = CSV_HEADER.size();
+	}
+	return static_cast<bool>(m_out);
+}
@@ -0,0 +1,147 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRHistogram.ixx
+//
+// DESCRIPTION:
+//   A fixed size, log-linear latency histogram in the style of HdrHistogram.
+//   Values below SUB_BUCKETS land in their own bucket, above that every power
+//   of two is split into SUB_BUCKETS equal buckets, so the reported
+//   percentiles are within 1/SUB_BUCKETS of the recorded value.
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#endif
+export module WinMTR.Histogram;
+
+#ifdef _WIN32
+import <array>;
+import <atomic>;
+import <bit>;
+import <cstddef>;
+import <cstdint>;
+#endif
+
+export struct latency_percentiles final {
+	std::uint32_t p50 = 0;
+	std::uint32_t p90 = 0;
+	std::uint32_t p99 = 0;
+	std::uint32_t p999 = 0;
+};
+
+//*****************************************************************************
+// CLASS:  latency_histogram
+//
+// Single writer, any number of readers. Readers see every bucket as of some
+// point during the read, which is good enough for percentiles.
+//*****************************************************************************
+export class latency_histogram final {
+public:
+	static constexpr unsigned SUB_BUCKET_BITS = 4;
+	static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+	// anything at or above 2^MAX_VALUE_BITS is counted in the top bucket
+	static constexpr unsigned MAX_VALUE_BITS = 24;
+	static constexpr std::size_t BUCKETS = SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+	[[nodiscard]]
+	static constexpr std::size_t bucket_of(std::uint32_t value) noexcept
+	{
+		if (value < SUB_BUCKETS) {
+			return value;
+		}
+		const auto magnitude = static_cast<unsigned>(std::bit_width(value)) - 1;
+		if (magnitude >= MAX_VALUE_BITS) {
+			return BUCKETS - 1;
+		}
+		const auto shift = magnitude - SUB_BUCKET_BITS;
+		const auto sub = (value >> shift) & (SUB_BUCKETS - 1);
+		return SUB_BUCKETS + shift * SUB_BUCKETS + sub;
+	}
+
+	// the middle of the range of values that share the bucket
+	[[nodiscard]]
+	static constexpr std::uint32_t value_of(std::size_t bucket) noexcept
+	{
+		if (bucket < SUB_BUCKETS) {
+			return static_cast<std::uint32_t>(bucket);
+		}
+		const auto shift = static_cast<unsigned>((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+		const auto sub = static_cast<std::uint32_t>((bucket - SUB_BUCKETS) % SUB_BUCKETS);
+		const auto lowest = (SUB_BUCKETS + sub) << shift;
+		return lowest + ((1u << shift) >> 1);
+	}
+
+	void record(std::uint32_t value) noexcept
+	{
+		// a plain load and store is enough with one writer and saves the locked add
+		auto& count = m_counts[bucket_of(value)];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// only while nobody records
+	void reset() noexcept
+	{
+		for (auto& count : m_counts) {
+			count.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	[[nodiscard]]
+	latency_percentiles percentiles() const noexcept
+	{
+		std::array<std::uint32_t, BUCKETS> counts;
+		std::uint64_t total = 0;
+		for (std::size_t i = 0; i < BUCKETS; ++i) {
+			counts[i] = m_counts[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+		latency_percentiles result;
+		if (!total) {
+			return result;
+		}
+
+		// rank of each percentile, rounded up so p99.9 of 10 samples is the largest one
+		const std::array<std::uint64_t, 4> ranks = {
+			(total * 500 + 999) / 1000,
+			(total * 900 + 999) / 1000,
+			(total * 990 + 999) / 1000,
+			(total * 999 + 999) / 1000
+		};
+		const std::array<std::uint32_t*, 4> targets = { &result.p50, &result.p90, &result.p99, &result.p999 };
+		std::size_t next = 0;
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < BUCKETS && next < ranks.size(); ++i) {
+			seen += counts[i];
+			while (next < ranks.size() && seen >= ranks[next]) {
+				*targets[next++] = value_of(i);
+			}
+		}
+		return result;
+	}
+private:
+	std::array<std::atomic_uint32_t, BUCKETS> m_counts{};
+};
@@ -27,18 +27,12 @@ module;
 export module WinMTRICMPUtils;
 
 import <concepts>;
-import <coroutine>;
 import <span>;
 import <type_traits>;
 import <algorithm>;
-import <ppl.h>;
-import <ppltasks.h>;
-import <pplawait.h>;
 import <winrt/base.h>;
 import "WinMTRICMPPIOdef.h";
 
-constexpr auto ECHO_REPLY_TIMEOUT = 5000;
-
 export
 template<class T>
 struct ping_reply {
@@ -273,126 +267,6 @@ struct icmp_ping_traits<sockaddr_in6> {
 	}
 };
 
-export
-template<icmp_pingable traits>
-struct icmp_ping final {
-	struct wait_traits
-	{
-		using type = PTP_WAIT;
-
-		static void close(type value) noexcept
-		{
-			CloseThreadpoolWait(value);
-		}
-
-		static constexpr type invalid() noexcept
-		{
-			return nullptr;
-		}
-	};
-	using coro_handle = std::coroutine_handle<>;
-	icmp_ping(HANDLE icmpHandle, HANDLE waitevent, traits::addrtype addr, UCHAR ttl, std::span<std::byte> requestData, std::span<std::byte> replyData) noexcept
-		:m_reqData(requestData)
-		, m_replyData(replyData)
-		, m_waitHandle(waitevent)
-		, m_handle(icmpHandle)
-		, m_addr(addr)
-		, m_ttl(ttl)
-	{
-
-	}
-
-	void await_suspend(coro_handle resume_handle)
-	{
-		m_resume = resume_handle;
-		IP_OPTION_INFORMATION	stIPInfo = {
-			.Ttl = m_ttl,
-			.Flags = IP_FLAG_DF
-		};
-		auto local = traits::get_anyaddr();
-
-		const auto io_res = traits::pingmethod(
-			m_handle
-			, m_waitHandle
-			, nullptr
-			, this
-			, local
-			, m_addr
-			, m_reqData.data()
-			, static_cast<WORD>(m_reqData.size())
-			, &stIPInfo
-			, m_replyData.data()
-			, static_cast<DWORD>(m_replyData.size())
-			, ECHO_REPLY_TIMEOUT);
-
-		if (io_res != ERROR_SUCCESS) [[unlikely]] {
-			winrt::throw_hresult(HRESULT_FROM_WIN32(io_res));
-		}
-		if (const auto err = GetLastError(); err != ERROR_IO_PENDING) [[unlikely]] {
-			winrt::throw_last_error();
-		}
-
-		
-		//
-		// Set the timer to fire in 5 seconds.
-		//
-		ULARGE_INTEGER ulDueTime{
-			.QuadPart = static_cast<ULONGLONG>(-(5ll * 10ll * 1000ll * 1000ll))
-		};
-		FILETIME FileDueTime{
-			.dwLowDateTime = ulDueTime.LowPart,
-			.dwHighDateTime = ulDueTime.HighPart
-		};
-		m_tpwait.attach(CreateThreadpoolWait(&WaitCallback, this, nullptr));
-		if (!m_tpwait) [[unlikely]] {
-			winrt::throw_last_error();
-		}
-
-		SetThreadpoolWait(m_tpwait.get(), m_waitHandle, &FileDueTime);
-
-	}
-
-	auto await_resume() const noexcept
-	{
-		return traits::parsemethod(m_replyData.data(), static_cast<DWORD>(m_replyData.size()));
-	}
-
-	bool await_ready() const noexcept
-	{
-		return false;
-	}
-private:
-	static void CALLBACK WaitCallback(
-		PTP_CALLBACK_INSTANCE Instance,
-		PVOID                 Context,
-		PTP_WAIT              Wait,
-		TP_WAIT_RESULT        WaitResult
-	) noexcept {
-		auto context = static_cast<icmp_ping<traits>*>(Context);
-		concurrency::create_task([context]() noexcept {
-			context->m_resume();
-			}, context->m_context);
-	}
-
-	concurrency::task_continuation_context m_context = concurrency::task_continuation_context::get_current_winrt_context();
-	coro_handle m_resume{ nullptr };
-	std::span<std::byte> m_reqData;
-	std::span<std::byte> m_replyData;
-	winrt::handle_type<wait_traits> m_tpwait;
-	HANDLE m_waitHandle;
-	HANDLE m_handle;
-	traits::addrtype m_addr;
-	DWORD m_replysize = 0;
-	UCHAR m_ttl;
-};
-
-
-export
-template<class T, class addrtype = std::remove_pointer_t<std::remove_cvref_t<T>>, class traits = icmp_ping_traits<addrtype>>
-inline auto IcmpSendEchoAsync(HANDLE icmpHandle, HANDLE waitevent, T addr, UCHAR ttl, std::span<std::byte> requestData, std::span<std::byte> replyData) noexcept {
-	return icmp_ping<traits>{icmpHandle, waitevent, traits::to_addr_from_storage(addr), ttl, requestData, replyData};
-}
-
 export
 template<class T>
 [[nodiscard]]
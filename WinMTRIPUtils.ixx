@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 module;
+#ifdef _WIN32
 #pragma warning (disable : 4005)
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN
@@ -32,11 +33,22 @@ module;
 #define NOMINMAX
 #include <winsock2.h>
 #include <Ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <concepts>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#endif
 export module WinMTRIPUtils;
 
+#ifdef _WIN32
 import <type_traits>;
 import <concepts>;
+import <cstring>;
 import <string>;
+#endif
 
 export template<class T>
 concept socket_type = requires(T a) {
@@ -74,12 +86,30 @@ inline constexpr bool isValidAddress(const T& addr) noexcept {
 	return (family == AF_INET || family == AF_INET6);
 }
 
+// the same host: the family and the address alone, ports, scopes and flow labels aside,
+// which is as much of it as a capture keeps
+export [[nodiscard]]
+inline bool same_address(const SOCKADDR_INET& lhs, const SOCKADDR_INET& rhs) noexcept {
+	if (lhs.si_family != rhs.si_family) {
+		return false;
+	}
+	switch (lhs.si_family) {
+	case AF_INET:
+		return std::memcmp(&lhs.Ipv4.sin_addr, &rhs.Ipv4.sin_addr, sizeof(lhs.Ipv4.sin_addr)) == 0;
+	case AF_INET6:
+		return std::memcmp(&lhs.Ipv6.sin6_addr, &rhs.Ipv6.sin6_addr, sizeof(lhs.Ipv6.sin6_addr)) == 0;
+	default:
+		return true;
+	}
+}
+
 export template<socket_addr_type T>
 [[nodiscard]]
 auto addr_to_string(const T & addr) noexcept -> std::wstring {
 	if (!isValidAddress(addr)) {
 		return {};
 	}
+#ifdef _WIN32
 	// remove const at cost of a copy
 	std::remove_cv_t<T> laddr = addr;
 	std::wstring out;
@@ -91,4 +121,25 @@ auto addr_to_string(const T & addr) noexcept -> std::wstring {
 		out.resize(addrstrsize - 1);
 	}
 	return out;
+#else
+	// spelled the way WSAAddressToStringW has it, scope and port included
+	sockaddr_in6 laddr{};
+	std::memcpy(&laddr, &addr, getAddressSize(addr));
+	const auto ipv6 = getAddressFamily(addr) == AF_INET6;
+	const auto port = ntohs(laddr.sin6_port);
+	char text[INET6_ADDRSTRLEN] = {};
+	const void* bytes = ipv6 ? static_cast<const void*>(&laddr.sin6_addr) : static_cast<const void*>(&reinterpret_cast<const sockaddr_in&>(laddr).sin_addr);
+	if (!inet_ntop(ipv6 ? AF_INET6 : AF_INET, bytes, text, sizeof(text))) {
+		return {};
+	}
+	std::string out(text);
+	if (ipv6 && laddr.sin6_scope_id) {
+		out += '%' + std::to_string(laddr.sin6_scope_id);
+	}
+	if (port) {
+		out = ipv6 ? '[' + out + "]:" + std::to_string(port) : out + ':' + std::to_string(port);
+	}
+	// nothing but digits, hex and punctuation
+	return std::wstring(out.begin(), out.end());
+#endif
 }
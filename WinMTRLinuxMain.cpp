@@ -0,0 +1,67 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRLinuxMain.cpp
+//
+//
+// DESCRIPTION:
+//   The entry point of the Linux build, which is report mode and nothing
+//   else. The same arguments as WinMTR /R, --report itself can be left out.
+//
+// NOTES:
+//    Sending ICMP needs ping_group_range to cover the user, or CAP_NET_RAW
+//    for UDP and TCP probes, like any other traceroute.
+//    Only the report goes to stdout, so it can be piped to a parser, what
+//    went wrong goes to stderr.
+//
+//*****************************************************************************
+#include <clocale>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+import WinMTR.Report;
+
+int main(int argc, char* argv[])
+{
+	// the report is wide, the terminal's locale says how it is spelled
+	std::setlocale(LC_ALL, "");
+	std::vector<std::wstring> arguments;
+	for (int i = 1; i < argc; ++i) {
+		const auto length = std::mbstowcs(nullptr, argv[i], 0);
+		if (length == static_cast<std::size_t>(-1)) {
+			std::wcerr << L"Argument " << i << L" isn't valid in the current locale\n";
+			return static_cast<int>(report_status::usage);
+		}
+		std::wstring& argument = arguments.emplace_back(length, L'\0');
+		(void)std::mbstowcs(argument.data(), argv[i], length);
+	}
+	const std::vector<std::wstring_view> args(arguments.begin(), arguments.end());
+
+	std::wstring error;
+	const auto request = parse_report_args(args, error);
+	if (!request) {
+		std::wcerr << error << L"\n";
+		return static_cast<int>(report_status::usage);
+	}
+	return static_cast<int>(run_report(*request, std::wcout, std::wcerr));
+}
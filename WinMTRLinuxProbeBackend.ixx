@@ -0,0 +1,927 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRLinuxProbeBackend.ixx
+//
+// DESCRIPTION:
+//   Probe backend for the Linux collectors. Uses the unprivileged ICMP
+//   datagram sockets (net.ipv4.ping_group_range must include the caller),
+//   one per address family. Echo replies are read with recvmmsg, and the
+//   TTL exceeded / unreachable errors come back through the IP_RECVERR error
+//   queue, again drained in batches with recvmmsg.
+//
+//   UDP and TCP probes get a socket each, a connected UDP socket or a
+//   non-blocking TCP connect, so whatever comes back on it is theirs. The
+//   TTL exceeded errors come through the same kind of error queue, the
+//   destination answers with port unreachable, a reply, SYN-ACK or RST.
+//
+// NOTES:
+//    Not part of the Windows build. Everything is driven from one epoll set.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#error "WinMTRLinuxProbeBackend.ixx is only for Linux builds"
+#endif
+#include "WinMTRPosixCompat.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <linux/errqueue.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <span>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+export module WinMTR.ProbeBackend.Linux;
+
+export import WinMTR.ProbeBackend;
+
+// The echo request the backend sends as sequence, header and payload, into
+// packet. The kernel fills in the checksum and identifier.
+export void write_echo_request(std::vector<std::byte>& packet, ADDRESS_FAMILY af, std::uint16_t sequence, std::uint16_t flow, std::span<const std::byte> payload);
+
+//*****************************************************************************
+// CLASS:  linux_icmp_backend
+//
+// Awaiting coroutines are resumed on the backend's I/O thread, so they must
+// hop off it before doing anything slow.
+//*****************************************************************************
+export class linux_icmp_backend final : public probe_backend {
+	linux_icmp_backend(const linux_icmp_backend&) = delete;
+	linux_icmp_backend& operator=(const linux_icmp_backend&) = delete;
+public:
+	using clock = std::chrono::steady_clock;
+
+	linux_icmp_backend();
+	~linux_icmp_backend() noexcept override;
+
+	[[nodiscard]]
+	static std::shared_ptr<linux_icmp_backend> instance();
+
+	[[nodiscard]]
+	bool supports(probe_protocol) const noexcept override
+	{
+		return true;
+	}
+
+	[[nodiscard]]
+	std::uint64_t probes_sent() const noexcept override
+	{
+		return m_probesSent.load(std::memory_order_relaxed);
+	}
+
+	void submit(probe_request& request) override;
+	void schedule(probe_delay& delay) override;
+private:
+	static constexpr auto RECV_BATCH = 32u;
+	static constexpr auto MAX_PACKET = 1500u;
+	static constexpr auto CONTROL_SIZE = 512u;
+	// epoll tags of the shared descriptors, UDP and TCP probes are tagged with generation << 16 | sequence
+	static constexpr std::uint64_t WAKE_TAG = ~0ull;
+	static constexpr std::uint64_t ICMP4_TAG = ~1ull;
+	static constexpr std::uint64_t ICMP6_TAG = ~2ull;
+	// UDP and TCP source ports come from the flow, in the dynamic range
+	static constexpr auto SOURCE_PORT_BASE = 49152u;
+	static constexpr auto SOURCE_PORT_SPAN = 16384u;
+
+	class unique_fd final {
+		int m_fd = -1;
+	public:
+		unique_fd() noexcept = default;
+		explicit unique_fd(int fd) noexcept :m_fd(fd) {}
+		unique_fd(const unique_fd&) = delete;
+		unique_fd& operator=(const unique_fd&) = delete;
+		~unique_fd() noexcept { reset(); }
+
+		void reset(int fd = -1) noexcept
+		{
+			if (m_fd >= 0) {
+				::close(m_fd);
+			}
+			m_fd = fd;
+		}
+
+		[[nodiscard]] int get() const noexcept { return m_fd; }
+		[[nodiscard]] int release() noexcept { return std::exchange(m_fd, -1); }
+		explicit operator bool() const noexcept { return m_fd >= 0; }
+	};
+
+	// indexed by ICMP sequence number, which is all we get back to match on
+	// because the kernel owns the echo identifier of a datagram socket, UDP
+	// and TCP probes take a slot the same way but are matched by their socket
+	struct in_flight final {
+		probe_request* waiter = nullptr;
+		clock::time_point sent;
+		std::chrono::system_clock::time_point sent_wall;	// same clock as the kernel's receive timestamps
+		std::uint32_t generation = 0;
+		probe_protocol protocol = probe_protocol::icmp;
+		unique_fd socket;	// UDP and TCP only
+		late_reply_counter late;	// kept past the timeout until the late window closes
+	};
+
+	// either a probe's timeout or, when delay is set, a plain timer
+	struct deadline final {
+		clock::time_point when;
+		std::uint16_t sequence;
+		std::uint32_t generation;
+		probe_delay* delay = nullptr;
+
+		[[nodiscard]]
+		bool operator>(const deadline& rhs) const noexcept
+		{
+			return when > rhs.when;
+		}
+	};
+
+	struct recv_batch final {
+		std::array<std::array<std::byte, MAX_PACKET>, RECV_BATCH> data;
+		std::array<std::array<std::byte, CONTROL_SIZE>, RECV_BATCH> control;
+		std::array<sockaddr_storage, RECV_BATCH> names;
+		std::array<iovec, RECV_BATCH> iov;
+		std::array<mmsghdr, RECV_BATCH> msgs;
+	};
+
+	void run(std::stop_token stop_token) noexcept;
+	void cancel_all() noexcept;
+	void wake() noexcept;
+	void start_probe(probe_request& request) noexcept;
+	void start_transport(probe_request& request) noexcept;
+	void fail(probe_request& request, int err) noexcept;
+	void drain(int fd, ADDRESS_FAMILY af, bool error_queue) noexcept;
+	void transport_event(std::uint64_t tag, std::uint32_t events) noexcept;
+	[[nodiscard]]
+	bool read_error_queue(std::uint16_t sequence, clock::time_point now) noexcept;
+	void finish(std::uint16_t sequence, probe_status status, const SOCKADDR_INET& responder, clock::time_point when, std::optional<std::chrono::system_clock::time_point> stamped) noexcept;
+	void expire_deadlines() noexcept;
+	void resume_completed() noexcept;
+	[[nodiscard]]
+	int next_wait() const noexcept;
+	[[nodiscard]]
+	int socket_for(ADDRESS_FAMILY af) noexcept;
+	[[nodiscard]]
+	bool allocate_sequence(std::uint16_t& sequence) noexcept;
+	[[nodiscard]]
+	bool watch(int fd, std::uint32_t events, std::uint64_t tag) noexcept;
+
+	unique_fd m_wake;
+	unique_fd m_epoll;
+	std::mutex m_submitMutex;
+	std::vector<probe_request*> m_submitted;
+	std::vector<probe_delay*> m_submittedDelays;
+	// set by the I/O thread on its way out, after that nothing more gets queued to it
+	bool m_stopping = false;
+
+	// everything below this point is only touched from the I/O thread
+	unique_fd m_icmp4;
+	unique_fd m_icmp6;
+	std::vector<in_flight> m_inFlight;
+	std::uint16_t m_nextSequence = 0;
+	std::priority_queue<deadline, std::vector<deadline>, std::greater<>> m_deadlines;
+	std::vector<probe_request*> m_pending;
+	std::vector<probe_delay*> m_pendingDelays;
+	std::vector<std::coroutine_handle<>> m_completed;
+	std::vector<std::coroutine_handle<>> m_resuming;
+	std::vector<std::byte> m_sendBuffer;
+	std::unique_ptr<recv_batch> m_batch;
+
+	std::atomic_uint64_t m_probesSent{ 0 };
+	std::jthread m_ioThread;
+};
+
+module : private;
+
+namespace {
+	[[nodiscard]]
+	constexpr probe_status from_icmp4(std::uint8_t type, std::uint8_t code) noexcept {
+		switch (type) {
+		case ICMP_TIME_EXCEEDED:
+			return code == ICMP_EXC_FRAGTIME ? probe_status::ttl_expired_reassembly : probe_status::ttl_expired;
+		case ICMP_DEST_UNREACH:
+			switch (code) {
+			case ICMP_NET_UNREACH:
+			case ICMP_NET_UNKNOWN:
+			case ICMP_NET_ANO:
+			case ICMP_NET_UNR_TOS:
+				return probe_status::dest_net_unreachable;
+			case ICMP_PROT_UNREACH:
+				return probe_status::dest_prot_unreachable;
+			case ICMP_PORT_UNREACH:
+				return probe_status::dest_port_unreachable;
+			case ICMP_FRAG_NEEDED:
+				return probe_status::packet_too_big;
+			case ICMP_SR_FAILED:
+				return probe_status::bad_route;
+			default:
+				return probe_status::dest_host_unreachable;
+			}
+		case ICMP_PARAMETERPROB:
+			return probe_status::param_problem;
+		case ICMP_SOURCE_QUENCH:
+			return probe_status::source_quench;
+		default:
+			return probe_status::general_failure;
+		}
+	}
+
+	[[nodiscard]]
+	constexpr probe_status from_icmp6(std::uint8_t type, std::uint8_t code) noexcept {
+		switch (type) {
+		case ICMP6_TIME_EXCEEDED:
+			return code == ICMP6_TIME_EXCEED_REASSEMBLY ? probe_status::ttl_expired_reassembly : probe_status::ttl_expired;
+		case ICMP6_DST_UNREACH:
+			switch (code) {
+			case ICMP6_DST_UNREACH_NOROUTE:
+				return probe_status::dest_net_unreachable;
+			case ICMP6_DST_UNREACH_NOPORT:
+				return probe_status::dest_port_unreachable;
+			case ICMP6_DST_UNREACH_BEYONDSCOPE:
+				return probe_status::bad_route;
+			default:
+				return probe_status::dest_host_unreachable;
+			}
+		case ICMP6_PACKET_TOO_BIG:
+			return probe_status::packet_too_big;
+		case ICMP6_PARAM_PROB:
+			return probe_status::param_problem;
+		default:
+			return probe_status::general_failure;
+		}
+	}
+
+	[[nodiscard]]
+	constexpr probe_status from_errno(int err) noexcept {
+		switch (err) {
+		case ENETUNREACH:
+			return probe_status::dest_net_unreachable;
+		case EHOSTUNREACH:
+			return probe_status::dest_host_unreachable;
+		case EMSGSIZE:
+			return probe_status::packet_too_big;
+		case ENOBUFS:
+			return probe_status::no_resources;
+		default:
+			return probe_status::general_failure;
+		}
+	}
+
+	// SO_TIMESTAMPNS, when the kernel took the packet off the wire
+	[[nodiscard]]
+	std::optional<std::chrono::system_clock::time_point> kernel_timestamp(const msghdr& msg) noexcept {
+		for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&msg), cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				timespec stamp;
+				std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+				const auto since_epoch = std::chrono::seconds(stamp.tv_sec) + std::chrono::nanoseconds(stamp.tv_nsec);
+				return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch));
+			}
+		}
+		return std::nullopt;
+	}
+
+	[[nodiscard]]
+	SOCKADDR_INET to_sockaddr_inet(const sockaddr* addr) noexcept {
+		SOCKADDR_INET result = {};
+		if (addr->sa_family == AF_INET) {
+			std::memcpy(&result.Ipv4, addr, sizeof(sockaddr_in));
+		}
+		else if (addr->sa_family == AF_INET6) {
+			std::memcpy(&result.Ipv6, addr, sizeof(sockaddr_in6));
+		}
+		return result;
+	}
+
+	// what the IP_RECVERR cmsg of an error queue message says, and who said it
+	[[nodiscard]]
+	std::optional<probe_status> error_status(const msghdr& msg, SOCKADDR_INET& offender) noexcept {
+		for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&msg), cmsg)) {
+			const bool is_recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+				|| (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+			if (!is_recverr) {
+				continue;
+			}
+			const auto ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+			offender = to_sockaddr_inet(SO_EE_OFFENDER(ee));
+			switch (ee->ee_origin) {
+			case SO_EE_ORIGIN_ICMP:
+				return from_icmp4(ee->ee_type, ee->ee_code);
+			case SO_EE_ORIGIN_ICMP6:
+				return from_icmp6(ee->ee_type, ee->ee_code);
+			case SO_EE_ORIGIN_LOCAL:
+				return from_errno(static_cast<int>(ee->ee_errno));
+			default:
+				return probe_status::general_failure;
+			}
+		}
+		return std::nullopt;
+	}
+
+	// both echo headers put the sequence number in the same place
+	[[nodiscard]]
+	std::uint16_t read_sequence(std::span<const std::byte> icmp) noexcept {
+		std::uint16_t sequence = 0;
+		std::memcpy(&sequence, icmp.data() + 6, sizeof(sequence));
+		return ntohs(sequence);
+	}
+}
+
+linux_icmp_backend::linux_icmp_backend()
+	:m_wake(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+	, m_epoll(::epoll_create1(EPOLL_CLOEXEC))
+	, m_inFlight(std::size_t{ 1 } << 16)
+	, m_batch(std::make_unique<recv_batch>())
+{
+	if (!m_wake || !m_epoll || !watch(m_wake.get(), EPOLLIN, WAKE_TAG)) [[unlikely]] {
+		throw std::system_error(errno, std::system_category());
+	}
+	// only once everything it polls exists
+	m_ioThread = std::jthread([this](std::stop_token stop_token) noexcept { this->run(stop_token); });
+}
+
+linux_icmp_backend::~linux_icmp_backend() noexcept
+{
+	m_ioThread.request_stop();
+	wake();
+	m_ioThread.join();
+}
+
+std::shared_ptr<linux_icmp_backend> linux_icmp_backend::instance()
+{
+	static std::mutex instance_mutex;
+	static std::weak_ptr<linux_icmp_backend> current;
+	std::unique_lock lock(instance_mutex);
+	auto backend = current.lock();
+	if (!backend) {
+		backend = std::make_shared<linux_icmp_backend>();
+		current = backend;
+	}
+	return backend;
+}
+
+void linux_icmp_backend::submit(probe_request& request)
+{
+	{
+		std::unique_lock lock(m_submitMutex);
+		if (m_stopping) [[unlikely]] {
+			throw std::system_error(ECANCELED, std::system_category());
+		}
+		m_submitted.push_back(&request);
+	}
+	wake();
+}
+
+void linux_icmp_backend::schedule(probe_delay& delay)
+{
+	{
+		std::unique_lock lock(m_submitMutex);
+		if (m_stopping) [[unlikely]] {
+			throw std::system_error(ECANCELED, std::system_category());
+		}
+		m_submittedDelays.push_back(&delay);
+	}
+	wake();
+}
+
+void linux_icmp_backend::wake() noexcept
+{
+	const std::uint64_t one = 1;
+	[[maybe_unused]] const auto written = ::write(m_wake.get(), &one, sizeof(one));
+}
+
+void linux_icmp_backend::run(std::stop_token stop_token) noexcept
+{
+	std::array<epoll_event, RECV_BATCH> events;
+	while (!stop_token.stop_requested()) {
+		const auto ready = ::epoll_wait(m_epoll.get(), events.data(), static_cast<int>(events.size()), next_wait());
+		if (ready < 0 && errno != EINTR) [[unlikely]] {
+			break;
+		}
+
+		for (int i = 0; i < ready; ++i) {
+			const auto tag = events[i].data.u64;
+			const auto revents = events[i].events;
+			if (tag == WAKE_TAG) {
+				std::uint64_t count = 0;
+				[[maybe_unused]] const auto read = ::read(m_wake.get(), &count, sizeof(count));
+				{
+					std::unique_lock lock(m_submitMutex);
+					std::swap(m_pending, m_submitted);
+					std::swap(m_pendingDelays, m_submittedDelays);
+				}
+				for (auto request : m_pending) {
+					start_probe(*request);
+				}
+				m_pending.clear();
+				const auto now = clock::now();
+				for (auto delay : m_pendingDelays) {
+					m_deadlines.push({ now + delay->duration(), 0, 0, delay });
+				}
+				m_pendingDelays.clear();
+			}
+			// EPOLLERR is how epoll says the error queue has something in it
+			else if (tag == ICMP4_TAG || tag == ICMP6_TAG) {
+				const auto fd = tag == ICMP4_TAG ? m_icmp4.get() : m_icmp6.get();
+				const auto af = tag == ICMP4_TAG ? AF_INET : AF_INET6;
+				if (revents & EPOLLIN) drain(fd, af, false);
+				if (revents & EPOLLERR) drain(fd, af, true);
+			}
+			else {
+				transport_event(tag, revents);
+			}
+		}
+		expire_deadlines();
+		resume_completed();
+	}
+	{
+		std::unique_lock lock(m_submitMutex);
+		m_stopping = true;
+		std::swap(m_pending, m_submitted);
+		std::swap(m_pendingDelays, m_submittedDelays);
+	}
+	cancel_all();
+}
+
+void linux_icmp_backend::cancel_all() noexcept
+{
+	// every waiter still gets its resume before the descriptors close, the
+	// probes as cancelled and the delays as if they were up
+	for (auto request : m_pending) {
+		request->result().error = ECANCELED;
+		m_completed.push_back(request->resume_handle());
+	}
+	m_pending.clear();
+	for (auto delay : m_pendingDelays) {
+		m_completed.push_back(delay->resume_handle());
+	}
+	m_pendingDelays.clear();
+	for (auto& slot : m_inFlight) {
+		if (auto waiter = std::exchange(slot.waiter, nullptr); waiter) {
+			waiter->result().error = ECANCELED;
+			m_completed.push_back(waiter->resume_handle());
+		}
+		slot.socket.reset();
+		slot.late.reset();
+	}
+	while (!m_deadlines.empty()) {
+		if (const auto delay = m_deadlines.top().delay; delay) {
+			m_completed.push_back(delay->resume_handle());
+		}
+		m_deadlines.pop();
+	}
+	resume_completed();
+}
+
+bool linux_icmp_backend::watch(int fd, std::uint32_t events, std::uint64_t tag) noexcept
+{
+	epoll_event event{ .events = events, .data = {.u64 = tag } };
+	return ::epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+int linux_icmp_backend::next_wait() const noexcept
+{
+	if (m_deadlines.empty()) {
+		return -1;
+	}
+	const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(m_deadlines.top().when - clock::now());
+	return static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+}
+
+int linux_icmp_backend::socket_for(ADDRESS_FAMILY af) noexcept
+{
+	auto& sock = af == AF_INET ? m_icmp4 : m_icmp6;
+	if (sock) {
+		return sock.get();
+	}
+	const int on = 1;
+	if (af == AF_INET) {
+		sock.reset(::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP));
+		if (sock && ::setsockopt(sock.get(), SOL_IP, IP_RECVERR, &on, sizeof(on))) {
+			sock.reset();
+		}
+	}
+	else if (af == AF_INET6) {
+		sock.reset(::socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMPV6));
+		if (sock && ::setsockopt(sock.get(), SOL_IPV6, IPV6_RECVERR, &on, sizeof(on))) {
+			sock.reset();
+		}
+	}
+	else {
+		errno = EAFNOSUPPORT;
+	}
+	if (sock) {
+		// best effort, without it round trips are timed when the I/O thread gets to them
+		[[maybe_unused]] const auto stamped = ::setsockopt(sock.get(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+		if (!watch(sock.get(), EPOLLIN, af == AF_INET ? ICMP4_TAG : ICMP6_TAG)) [[unlikely]] {
+			sock.reset();
+		}
+	}
+	return sock.get();
+}
+
+bool linux_icmp_backend::allocate_sequence(std::uint16_t& sequence) noexcept
+{
+	for (std::size_t tries = 0; tries < m_inFlight.size(); ++tries) {
+		sequence = m_nextSequence++;
+		if (!m_inFlight[sequence].waiter && !m_inFlight[sequence].late) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void write_echo_request(std::vector<std::byte>& packet, ADDRESS_FAMILY af, std::uint16_t sequence, std::uint16_t flow, std::span<const std::byte> payload)
+{
+	// type, code, checksum, identifier, sequence
+	packet.assign(8 + payload.size(), std::byte{ 0 });
+	packet[0] = static_cast<std::byte>(af == AF_INET ? ICMP_ECHO : ICMP6_ECHO_REQUEST);
+	const auto net_sequence = htons(sequence);
+	std::memcpy(packet.data() + 6, &net_sequence, sizeof(net_sequence));
+	std::ranges::copy(payload, packet.begin() + 8);
+	// Routers that hash ICMP look at the checksum, so hold it to one value per
+	// flow: the first two payload bytes cancel the sequence number out of the
+	// one's complement sum and put the flow in its place.
+	if (payload.size() >= 2) {
+		const auto compensation = static_cast<std::uint16_t>((std::uint32_t{ flow } + 0xffffu - sequence) % 0xffffu);
+		packet[8] = static_cast<std::byte>(compensation >> 8);
+		packet[9] = static_cast<std::byte>(compensation & 0xff);
+	}
+}
+
+void linux_icmp_backend::start_probe(probe_request& request) noexcept
+{
+	if (request.key().protocol != probe_protocol::icmp) {
+		start_transport(request);
+		return;
+	}
+	const auto& dest = request.dest();
+	const auto af = dest.si_family;
+	const auto fd = socket_for(af);
+	if (fd < 0) [[unlikely]] {
+		request.result().error = errno;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+
+	std::uint16_t sequence = 0;
+	if (!allocate_sequence(sequence)) [[unlikely]] {
+		request.result().error = ENOBUFS;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+
+	const int hops = request.key().ttl;
+	const auto hop_result = af == AF_INET
+		? ::setsockopt(fd, SOL_IP, IP_TTL, &hops, sizeof(hops))
+		: ::setsockopt(fd, SOL_IPV6, IPV6_UNICAST_HOPS, &hops, sizeof(hops));
+	if (hop_result) [[unlikely]] {
+		request.result().error = errno;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+
+	write_echo_request(m_sendBuffer, af, sequence, request.key().flow, request.payload());
+
+	const auto addrlen = af == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+	const auto wall = std::chrono::system_clock::now();
+	const auto now = clock::now();
+	if (::sendto(fd, m_sendBuffer.data(), m_sendBuffer.size(), 0, reinterpret_cast<const sockaddr*>(&dest), static_cast<socklen_t>(addrlen)) < 0) [[unlikely]] {
+		fail(request, errno);
+		return;
+	}
+
+	auto& slot = m_inFlight[sequence];
+	slot.waiter = &request;
+	slot.sent = now;
+	slot.sent_wall = wall;
+	slot.protocol = probe_protocol::icmp;
+	slot.late = request.late();
+	++slot.generation;
+	m_probesSent.fetch_add(1, std::memory_order_relaxed);
+	m_deadlines.push({ now + request.timeout(), sequence, slot.generation });
+}
+
+void linux_icmp_backend::start_transport(probe_request& request) noexcept
+{
+	const auto& dest = request.dest();
+	const auto af = dest.si_family;
+	const auto& key = request.key();
+	const auto tcp = key.protocol == probe_protocol::tcp;
+
+	std::uint16_t sequence = 0;
+	if (!allocate_sequence(sequence)) [[unlikely]] {
+		request.result().error = ENOBUFS;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+
+	unique_fd sock(::socket(af, (tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, tcp ? IPPROTO_TCP : IPPROTO_UDP));
+	const int on = 1;
+	const int hops = key.ttl;
+	const bool ready = sock && (af == AF_INET
+		? !::setsockopt(sock.get(), SOL_IP, IP_TTL, &hops, sizeof(hops)) && !::setsockopt(sock.get(), SOL_IP, IP_RECVERR, &on, sizeof(on))
+		: !::setsockopt(sock.get(), SOL_IPV6, IPV6_UNICAST_HOPS, &hops, sizeof(hops)) && !::setsockopt(sock.get(), SOL_IPV6, IPV6_RECVERR, &on, sizeof(on)));
+	if (!ready) [[unlikely]] {
+		request.result().error = errno;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+	[[maybe_unused]] const auto stamped = ::setsockopt(sock.get(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	if (tcp) {
+		// close with a RST, a completed handshake must not leave the port in TIME_WAIT
+		const linger abort{ .l_onoff = 1, .l_linger = 0 };
+		[[maybe_unused]] const auto lingered = ::setsockopt(sock.get(), SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+	}
+
+	// The source port carries the flow, offset by the TTL so the loops of a
+	// trace never share a 5-tuple. If it is taken the kernel picks one.
+	const auto port = htons(static_cast<std::uint16_t>(SOURCE_PORT_BASE + (key.flow * 256u + key.ttl) % SOURCE_PORT_SPAN));
+	SOCKADDR_INET local = {};
+	local.si_family = af;
+	if (af == AF_INET) {
+		local.Ipv4.sin_port = port;
+	}
+	else {
+		local.Ipv6.sin6_port = port;
+	}
+	const auto addrlen = static_cast<socklen_t>(af == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+	[[maybe_unused]] const auto bound = ::bind(sock.get(), reinterpret_cast<const sockaddr*>(&local), addrlen);
+
+	auto& slot = m_inFlight[sequence];
+	slot.sent_wall = std::chrono::system_clock::now();
+	slot.sent = clock::now();
+	int err = 0;
+	if (::connect(sock.get(), reinterpret_cast<const sockaddr*>(&dest), addrlen) < 0) {
+		err = errno;
+	}
+	else if (!tcp) {
+		const auto payload = request.payload();
+		if (::send(sock.get(), payload.data(), payload.size(), 0) < 0) {
+			err = errno;
+		}
+	}
+	// on loopback a refused connection can come back before connect does
+	const auto answered = tcp && (err == 0 || err == ECONNREFUSED);
+	if (err && err != EINPROGRESS && !answered) [[unlikely]] {
+		fail(request, err);
+		return;
+	}
+
+	slot.waiter = &request;
+	slot.protocol = key.protocol;
+	slot.late = request.late();
+	++slot.generation;
+	m_probesSent.fetch_add(1, std::memory_order_relaxed);
+	if (answered) {
+		finish(sequence, probe_status::success, dest, clock::now(), std::nullopt);
+		return;
+	}
+	const auto tag = (std::uint64_t{ slot.generation } << 16) | sequence;
+	if (!watch(sock.get(), tcp ? EPOLLOUT : EPOLLIN, tag)) [[unlikely]] {
+		slot.waiter = nullptr;
+		slot.late.reset();
+		request.result().error = errno;
+		m_completed.push_back(request.resume_handle());
+		return;
+	}
+	slot.socket.reset(sock.release());
+	m_deadlines.push({ slot.sent + request.timeout(), sequence, slot.generation });
+}
+
+void linux_icmp_backend::fail(probe_request& request, int err) noexcept
+{
+	if (from_errno(err) == probe_status::general_failure) {
+		request.result().error = err;
+	}
+	else {
+		// routing failures are an answer about the path, not a broken socket
+		request.result().reply_count = 1;
+		request.result().status = from_errno(err);
+	}
+	m_completed.push_back(request.resume_handle());
+}
+
+void linux_icmp_backend::drain(int fd, ADDRESS_FAMILY af, bool error_queue) noexcept
+{
+	auto& batch = *m_batch;
+	for (;;) {
+		for (unsigned i = 0; i < RECV_BATCH; ++i) {
+			batch.iov[i] = { .iov_base = batch.data[i].data(), .iov_len = batch.data[i].size() };
+			batch.msgs[i] = {};
+			batch.msgs[i].msg_hdr.msg_name = &batch.names[i];
+			batch.msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+			batch.msgs[i].msg_hdr.msg_iov = &batch.iov[i];
+			batch.msgs[i].msg_hdr.msg_iovlen = 1;
+			batch.msgs[i].msg_hdr.msg_control = batch.control[i].data();
+			batch.msgs[i].msg_hdr.msg_controllen = batch.control[i].size();
+		}
+		const auto flags = MSG_DONTWAIT | (error_queue ? MSG_ERRQUEUE : 0);
+		const auto received = ::recvmmsg(fd, batch.msgs.data(), RECV_BATCH, flags, nullptr);
+		if (received <= 0) {
+			return;
+		}
+		const auto now = clock::now();
+		for (int i = 0; i < received; ++i) {
+			const auto& msg = batch.msgs[i];
+			const std::span<const std::byte> icmp{ batch.data[i].data(), msg.msg_len };
+			if (icmp.size() < 8) {
+				continue;
+			}
+			const auto sequence = read_sequence(icmp);
+			// the slot may belong to a UDP or TCP probe, which is matched by its socket instead
+			if (m_inFlight[sequence].protocol != probe_protocol::icmp) {
+				continue;
+			}
+			if (!error_queue) {
+				const auto type = static_cast<std::uint8_t>(icmp[0]);
+				if (type != (af == AF_INET ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY)) {
+					continue;
+				}
+				finish(sequence, probe_status::success, to_sockaddr_inet(reinterpret_cast<const sockaddr*>(&batch.names[i])), now, kernel_timestamp(msg.msg_hdr));
+				continue;
+			}
+
+			// the error queue hands back our own echo request, with the ICMP
+			// error that killed it and the router that sent it in a cmsg
+			SOCKADDR_INET offender = {};
+			if (const auto status = error_status(msg.msg_hdr, offender)) {
+				finish(sequence, *status, offender, now, kernel_timestamp(msg.msg_hdr));
+			}
+		}
+		if (static_cast<unsigned>(received) < RECV_BATCH) {
+			return;
+		}
+	}
+}
+
+void linux_icmp_backend::transport_event(std::uint64_t tag, std::uint32_t events) noexcept
+{
+	const auto sequence = static_cast<std::uint16_t>(tag & 0xffff);
+	auto& slot = m_inFlight[sequence];
+	// either waiting for its answer or, past the timeout, for a late one
+	if ((!slot.waiter && !slot.late) || !slot.socket || slot.generation != static_cast<std::uint32_t>(tag >> 16)) {
+		return;
+	}
+	const auto now = clock::now();
+	// the error queue names the router that dropped the probe, SO_ERROR only says something did
+	if ((events & EPOLLERR) && read_error_queue(sequence, now)) {
+		return;
+	}
+	const auto dest = slot.waiter ? slot.waiter->dest() : SOCKADDR_INET{};
+	if (slot.protocol == probe_protocol::tcp) {
+		int err = 0;
+		socklen_t length = sizeof(err);
+		if (::getsockopt(slot.socket.get(), SOL_SOCKET, SO_ERROR, &err, &length)) {
+			err = errno;
+		}
+		// SYN-ACK or RST, either way the destination answered
+		if (!err || err == ECONNREFUSED) {
+			finish(sequence, probe_status::success, dest, now, std::nullopt);
+		}
+		else if (err == EHOSTUNREACH || err == ENETUNREACH) {
+			// what an expired TTL looks like without its error queue entry, let the deadline have it
+			slot.socket.reset();
+		}
+		else {
+			finish(sequence, from_errno(err), {}, now, std::nullopt);
+		}
+		return;
+	}
+	// some service actually answered the UDP probe
+	std::byte ignored{};
+	[[maybe_unused]] const auto read = ::recv(slot.socket.get(), &ignored, sizeof(ignored), MSG_DONTWAIT);
+	finish(sequence, probe_status::success, dest, now, std::nullopt);
+}
+
+bool linux_icmp_backend::read_error_queue(std::uint16_t sequence, clock::time_point now) noexcept
+{
+	auto& slot = m_inFlight[sequence];
+	auto& batch = *m_batch;
+	// one probe on the socket, so one message is all there can be
+	batch.iov[0] = { .iov_base = batch.data[0].data(), .iov_len = batch.data[0].size() };
+	msghdr msg = {};
+	msg.msg_name = &batch.names[0];
+	msg.msg_namelen = sizeof(sockaddr_storage);
+	msg.msg_iov = &batch.iov[0];
+	msg.msg_iovlen = 1;
+	msg.msg_control = batch.control[0].data();
+	msg.msg_controllen = batch.control[0].size();
+	if (::recvmsg(slot.socket.get(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		return false;
+	}
+	SOCKADDR_INET offender = {};
+	auto status = error_status(msg, offender);
+	if (!status) {
+		return false;
+	}
+	// only the destination itself says the port is closed
+	if (slot.protocol == probe_protocol::udp && *status == probe_status::dest_port_unreachable) {
+		status = probe_status::success;
+	}
+	finish(sequence, *status, offender, now, kernel_timestamp(msg));
+	return true;
+}
+
+void linux_icmp_backend::finish(std::uint16_t sequence, probe_status status, const SOCKADDR_INET& responder, clock::time_point when, std::optional<std::chrono::system_clock::time_point> stamped) noexcept
+{
+	auto& slot = m_inFlight[sequence];
+	// a late reply for a probe the deadline already gave up on
+	if (!slot.waiter) {
+		if (slot.late) {
+			slot.late->fetch_add(1, std::memory_order_relaxed);
+			slot.late.reset();
+			slot.socket.reset();
+		}
+		return;
+	}
+	slot.socket.reset();
+	slot.late.reset();
+	auto& result = slot.waiter->result();
+	result.reply_count = 1;
+	result.status = status;
+	result.responder = responder;
+	// the kernel timestamp leaves out the poll wakeup, unless the wall clock stepped in between
+	const auto measured = stamped && *stamped >= slot.sent_wall ? *stamped - slot.sent_wall : when - slot.sent;
+	result.round_trip_time = std::chrono::floor<std::chrono::microseconds>(measured);
+	m_completed.push_back(std::exchange(slot.waiter, nullptr)->resume_handle());
+}
+
+void linux_icmp_backend::expire_deadlines() noexcept
+{
+	const auto now = clock::now();
+	while (!m_deadlines.empty() && m_deadlines.top().when <= now) {
+		const auto expired = m_deadlines.top();
+		m_deadlines.pop();
+		if (expired.delay) {
+			m_completed.push_back(expired.delay->resume_handle());
+			continue;
+		}
+		auto& slot = m_inFlight[expired.sequence];
+		if (slot.generation != expired.generation) {
+			continue;
+		}
+		// answered already, or the end of the late window
+		if (!slot.waiter) {
+			slot.socket.reset();
+			slot.late.reset();
+			continue;
+		}
+		auto& result = slot.waiter->result();
+		result.reply_count = 0;
+		result.status = probe_status::timed_out;
+		m_completed.push_back(std::exchange(slot.waiter, nullptr)->resume_handle());
+		// keep the slot, and the socket, for an answer that is merely slow
+		if (slot.late && slot.sent + LATE_REPLY_WINDOW > now) {
+			m_deadlines.push({ slot.sent + LATE_REPLY_WINDOW, expired.sequence, slot.generation });
+		}
+		else {
+			slot.socket.reset();
+			slot.late.reset();
+		}
+	}
+}
+
+void linux_icmp_backend::resume_completed() noexcept
+{
+	// swap out first, a resumed coroutine may well submit its next probe right away
+	m_resuming.clear();
+	std::swap(m_resuming, m_completed);
+	for (auto handle : m_resuming) {
+		handle();
+	}
+	m_resuming.clear();
+}
@@ -44,8 +44,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "WinMTRGlobal.h"
 #include <locale>
+#include <cstdio>
+#include <fcntl.h>
+#include <io.h>
+#include <iostream>
+#include <span>
+#include <string_view>
+#include <vector>
 #include "WinMTRMain.h"
 import WinMTR.Help;
+import WinMTR.Report;
 import <winrt/Windows.Foundation.h>;
 import WinMTR.CommandLineParser;
 import WinMTR.Dialog;
@@ -105,6 +113,12 @@ BOOL WinMTRMain::InitInstance()
 		return FALSE;
 	}*/
 
+	// no window at all for a report, it goes to the console or wherever stdout is redirected
+	if (const std::vector<std::wstring_view> args(__wargv + 1, __wargv + __argc); is_report_mode(args)) {
+		RunReport(args);
+		return FALSE;
+	}
+
 	AfxEnableControlContainer();
 	
 #ifdef _AFXDLL
@@ -130,3 +144,50 @@ BOOL WinMTRMain::InitInstance()
 	return FALSE;
 }
 
+//*****************************************************************************
+// WinMTRMain::ExitInstance
+//
+// 
+//*****************************************************************************
+int WinMTRMain::ExitInstance()
+{
+	const auto status = CWinApp::ExitInstance();
+	return m_report ? m_reportStatus : status;
+}
+
+//*****************************************************************************
+// WinMTRMain::RunReport
+//
+// A GUI program starts without a console. Redirected output is used as it
+// is, otherwise the report and its errors go to the console of whoever
+// started us. Only the report goes to stdout, errors go to stderr.
+//*****************************************************************************
+void WinMTRMain::RunReport(std::span<const std::wstring_view> args)
+{
+	m_report = true;
+	const auto redirected = [](DWORD handle) noexcept {
+		return GetFileType(GetStdHandle(handle)) != FILE_TYPE_UNKNOWN;
+	};
+	const auto outRedirected = redirected(STD_OUTPUT_HANDLE);
+	const auto errRedirected = redirected(STD_ERROR_HANDLE);
+	if ((!outRedirected || !errRedirected) && AttachConsole(ATTACH_PARENT_PROCESS)) {
+		FILE* console = nullptr;
+		if (!outRedirected) {
+			(void)_wfreopen_s(&console, L"CONOUT$", L"w", stdout);
+		}
+		if (!errRedirected) {
+			(void)_wfreopen_s(&console, L"CONOUT$", L"w", stderr);
+		}
+	}
+	(void)_setmode(_fileno(stdout), _O_U8TEXT);
+	(void)_setmode(_fileno(stderr), _O_U8TEXT);
+
+	std::wstring error;
+	const auto request = parse_report_args(args, error);
+	if (!request) {
+		std::wcerr << error << L"\n";
+		m_reportStatus = static_cast<int>(report_status::usage);
+		return;
+	}
+	m_reportStatus = static_cast<int>(run_report(*request, std::wcout, std::wcerr));
+}
@@ -34,6 +34,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define WINMTRMAIN_H_
 
 #include <afxwin.h>
+#include <span>
+#include <string_view>
 
 //*****************************************************************************
 // CLASS:  WinMTRMain
@@ -47,10 +49,15 @@ public:
 	WinMTRMain();
 
 	virtual BOOL InitInstance() override final;
+	virtual int ExitInstance() override final;
 
 	DECLARE_MESSAGE_MAP()
 
 private:
+	// report mode runs in InitInstance and hands its status to ExitInstance
+	bool m_report = false;
+	int m_reportStatus = 0;
+	void RunReport(std::span<const std::wstring_view> args);
 
 };
 
@@ -0,0 +1,154 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRMappedFile.ixx
+//
+// DESCRIPTION:
+//   A file mapped read only, for the formats that are read in place rather
+//   than parsed: the ASN table and probe captures.
+//
+// NOTES:
+//   The mapping covers the file as it was when opened, a writer may go on
+//   appending to it without the mapping seeing any of that.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NOSERVICE
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <span>
+#endif
+export module WinMTR.MappedFile;
+
+#ifdef _WIN32
+import <cstddef>;
+import <filesystem>;
+import <memory>;
+import <span>;
+#endif
+
+//*****************************************************************************
+// CLASS:  mapped_file
+//
+// Read only, so safe to share between threads as it is.
+//*****************************************************************************
+export class mapped_file final {
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+public:
+	// nothing for a file that can't be opened, or is empty
+	[[nodiscard]]
+	static std::unique_ptr<const mapped_file> map(const std::filesystem::path& path) noexcept;
+
+	[[nodiscard]]
+	std::span<const std::byte> bytes() const noexcept
+	{
+		return { m_data, m_size };
+	}
+
+	~mapped_file() noexcept;
+private:
+	mapped_file() noexcept = default;
+
+	const std::byte* m_data = nullptr;
+	std::size_t m_size = 0;
+#ifdef _WIN32
+	HANDLE m_section = nullptr;
+#endif
+};
+
+module : private;
+
+mapped_file::~mapped_file() noexcept
+{
+#ifdef _WIN32
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_section) {
+		CloseHandle(m_section);
+	}
+#else
+	if (m_data) {
+		::munmap(const_cast<std::byte*>(m_data), m_size);
+	}
+#endif
+}
+
+std::unique_ptr<const mapped_file> mapped_file::map(const std::filesystem::path& path) noexcept
+{
+	std::unique_ptr<mapped_file> file(new(std::nothrow) mapped_file());
+	if (!file) {
+		return nullptr;
+	}
+#ifdef _WIN32
+	// a capture can be read while it is still being written
+	const auto handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER size{};
+	if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+		file->m_section = CreateFileMappingW(handle, nullptr, PAGE_READONLY, size.HighPart, size.LowPart, nullptr);
+	}
+	// the section keeps the file open by itself
+	CloseHandle(handle);
+	if (!file->m_section) {
+		return nullptr;
+	}
+	file->m_data = static_cast<const std::byte*>(MapViewOfFile(file->m_section, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size.QuadPart)));
+	file->m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+	const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat info {};
+	if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+		if (const auto view = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0); view != MAP_FAILED) {
+			file->m_data = static_cast<const std::byte*>(view);
+			file->m_size = static_cast<std::size_t>(info.st_size);
+		}
+	}
+	::close(fd);
+#endif
+	if (!file->m_data) {
+		return nullptr;
+	}
+	return file;
+}
@@ -0,0 +1,644 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRMetrics.ixx
+//
+// DESCRIPTION:
+//   Serves the counters of every running trace over HTTP in the OpenMetrics
+//   text format, one series per session, hop and path, for Prometheus or
+//   anything else that scrapes it.
+//
+// NOTES:
+//   A scrape reads the hops the way the dialog does, through the seqlocks,
+//   so the trace loops never wait on it. The rows, the label text and the
+//   response are all kept from one scrape to the next, once the buffers
+//   have grown to the biggest scrape so far a scrape allocates next to
+//   nothing. One thread answers one connection at a time, which is plenty
+//   for a scraper every few seconds.
+//
+//*****************************************************************************
+module;
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+export module WinMTR.Metrics;
+
+import <atomic>;
+import <chrono>;
+import <cstddef>;
+import <cstdint>;
+import <memory>;
+import <optional>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <vector>;
+import WinMTR.Net;
+import WinMTRSNetHost;
+import winmtr.helper;
+
+//*****************************************************************************
+// CLASS:  metrics_snapshot
+//
+// What a scrape reads, and the buffers it reads into. One thread at a time.
+//*****************************************************************************
+export class metrics_snapshot final {
+public:
+	// every running trace as of now, what was taken before is overwritten
+	void take();
+	// the last take in OpenMetrics text, appended to out
+	void write(std::string& out) const;
+
+	[[nodiscard]]
+	std::size_t sessions() const noexcept
+	{
+		return m_sessions;
+	}
+	[[nodiscard]]
+	std::size_t rows() const noexcept
+	{
+		return m_used;
+	}
+private:
+	std::vector<WinMTRNet::running_trace> m_running;
+	// rows past m_used are left over from a bigger scrape, kept for their names' buffers
+	std::vector<s_nethost> m_rows;
+	std::size_t m_used = 0;
+	std::size_t m_sessions = 0;
+	// the labels every series of a row starts with, row after row
+	std::string m_labels;
+	std::vector<std::size_t> m_labelEnds;
+};
+
+export struct metrics_stats final {
+	std::uint64_t scrapes = 0;
+	std::uint64_t refused = 0;		// not a GET of /metrics, or not sent in time
+	std::chrono::microseconds last_scrape{ 0 };	// taking and writing the last snapshot, without the socket
+};
+
+//*****************************************************************************
+// CLASS:  metrics_server
+//
+// Listens from open until it is destroyed, destroying it waits for the
+// connection being answered, if any.
+//*****************************************************************************
+export class metrics_server final {
+	metrics_server(const metrics_server&) = delete;
+	metrics_server& operator=(const metrics_server&) = delete;
+public:
+	// the port registered for Prometheus exporters that have no port of their own
+	static constexpr std::uint16_t DEFAULT_PORT = 9464;
+	// how long the listener takes at most to notice it is being stopped
+	static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(250);
+	// a client gets this long to send its request and take the answer
+	static constexpr auto CLIENT_TIMEOUT = std::chrono::seconds(2);
+	// a request line and headers longer than this are refused
+	static constexpr std::size_t MAX_REQUEST = 8192;
+
+	// [address:]port, the address in brackets for IPv6, loopback if there is none
+	[[nodiscard]]
+	static std::optional<SOCKADDR_INET> endpoint(std::wstring_view text) noexcept;
+	// nothing if address can't be listened on
+	[[nodiscard]]
+	static std::shared_ptr<metrics_server> open(const SOCKADDR_INET& address) noexcept;
+
+	// the one the dialog serves, none until one is installed
+	[[nodiscard]]
+	static std::shared_ptr<metrics_server> instance() noexcept
+	{
+		return s_instance.load(std::memory_order_acquire);
+	}
+	static void install(std::shared_ptr<metrics_server> server) noexcept
+	{
+		s_instance.store(std::move(server), std::memory_order_release);
+	}
+
+	~metrics_server() noexcept;
+
+	// where it listens, with the port the system picked if it was opened on port zero
+	[[nodiscard]]
+	SOCKADDR_INET address() const noexcept
+	{
+		return m_address;
+	}
+	[[nodiscard]]
+	metrics_stats stats() const noexcept;
+private:
+	metrics_server() = default;
+
+	void serve(std::stop_token stop);
+	// false if the client didn't get a scrape
+	bool answer(SOCKET client);
+	bool send_all(SOCKET client, std::string_view data, std::chrono::steady_clock::time_point deadline) noexcept;
+
+	winmtr::helper::WSAHelper m_wsa{ MAKEWORD(2, 2) };
+	SOCKET m_listener = INVALID_SOCKET;
+	SOCKADDR_INET m_address = {};
+	// the server thread's own
+	metrics_snapshot m_snapshot;
+	std::string m_request;
+	std::string m_head;
+	std::string m_body;
+	std::atomic_uint64_t m_scrapes{ 0 };
+	std::atomic_uint64_t m_refused{ 0 };
+	std::atomic_int64_t m_lastScrape{ 0 };
+	std::jthread m_thread;
+
+	static inline std::atomic<std::shared_ptr<metrics_server>> s_instance;
+};
+
+module : private;
+
+import <algorithm>;
+import <array>;
+import <charconv>;
+import <system_error>;
+import <utility>;
+
+namespace {
+	using namespace std::string_view_literals;
+
+	constexpr auto CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8"sv;
+
+	void append_number(std::string& out, std::uint64_t value)
+	{
+		std::array<char, 20> digits;
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		out.append(digits.data(), end);
+	}
+
+	// shortest text that reads back as the same double
+	void append_number(std::string& out, double value)
+	{
+		std::array<char, 32> digits;
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		out.append(digits.data(), end);
+	}
+
+	[[nodiscard]]
+	constexpr double to_seconds(std::uint64_t microseconds) noexcept
+	{
+		return static_cast<double>(microseconds) / 1e6;
+	}
+
+	void append_address(std::string& out, const SOCKADDR_INET& addr)
+	{
+		std::array<char, INET6_ADDRSTRLEN> text{};
+		const char* printed = nullptr;
+		if (addr.si_family == AF_INET) {
+			printed = inet_ntop(AF_INET, &addr.Ipv4.sin_addr, text.data(), text.size());
+		}
+		else if (addr.si_family == AF_INET6) {
+			printed = inet_ntop(AF_INET6, &addr.Ipv6.sin6_addr, text.data(), text.size());
+		}
+		if (printed) {
+			out += printed;
+		}
+	}
+
+	void append_escaped(std::string& out, char c)
+	{
+		switch (c) {
+		case '\\': out += "\\\\"sv; break;
+		case '"': out += "\\\""sv; break;
+		case '\n': out += "\\n"sv; break;
+		default: out += c; break;
+		}
+	}
+
+	// a label value is UTF-8, a lone surrogate comes out as U+FFFD
+	void append_label_value(std::string& out, std::wstring_view text)
+	{
+		for (std::size_t i = 0; i < text.size(); ++i) {
+			auto c = static_cast<char32_t>(text[i]);
+			if constexpr (sizeof(wchar_t) == 2) {
+				if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+					c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<char32_t>(text[++i]) - 0xDC00);
+				}
+			}
+			if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+				c = 0xFFFD;
+			}
+			if (c < 0x80) {
+				append_escaped(out, static_cast<char>(c));
+			}
+			else if (c < 0x800) {
+				out += static_cast<char>(0xC0 | (c >> 6));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			}
+			else if (c < 0x10000) {
+				out += static_cast<char>(0xE0 | (c >> 12));
+				out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			}
+			else {
+				out += static_cast<char>(0xF0 | (c >> 18));
+				out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+				out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (c & 0x3F));
+			}
+		}
+	}
+
+	void append_family(std::string& out, std::string_view name, std::string_view type, std::string_view help, std::string_view unit = {})
+	{
+		out += "# TYPE "sv;
+		out += name;
+		out += ' ';
+		out += type;
+		if (!unit.empty()) {
+			out += "\n# UNIT "sv;
+			out += name;
+			out += ' ';
+			out += unit;
+		}
+		out += "\n# HELP "sv;
+		out += name;
+		out += ' ';
+		out += help;
+		out += '\n';
+	}
+
+	// the sample's name and labels up to where its value goes
+	void append_series(std::string& out, std::string_view name, std::string_view labels, std::string_view more = {})
+	{
+		out += name;
+		out += '{';
+		out += labels;
+		out += more;
+		out += "} "sv;
+	}
+
+	// wait for the socket to be ready, or for the deadline
+	[[nodiscard]]
+	bool ready(SOCKET socket, SHORT events, std::chrono::steady_clock::time_point deadline) noexcept
+	{
+		const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0) {
+			return false;
+		}
+		WSAPOLLFD fd{ .fd = socket, .events = events, .revents = 0 };
+		return WSAPoll(&fd, 1, static_cast<INT>(left)) > 0 && fd.revents & events;
+	}
+}
+
+void metrics_snapshot::take()
+{
+	WinMTRNet::running(m_running);
+	m_sessions = m_running.size();
+	m_used = 0;
+	m_labels.clear();
+	m_labelEnds.clear();
+	for (const auto& trace : m_running) {
+		const auto first = m_used;
+		trace.net->getCurrentState(m_rows, m_used);
+		for (auto row = first; row < m_used; ++row) {
+			const auto& hop = m_rows[row];
+			m_labels += "session=\""sv;
+			append_number(m_labels, static_cast<std::uint64_t>(trace.session));
+			m_labels += "\",target=\""sv;
+			append_address(m_labels, trace.destination);
+			m_labels += "\",ttl=\""sv;
+			append_number(m_labels, static_cast<std::uint64_t>(hop.ttl));
+			m_labels += "\",path=\""sv;
+			append_number(m_labels, static_cast<std::uint64_t>(hop.path));
+			m_labels += '"';
+			m_labelEnds.push_back(m_labels.size());
+		}
+	}
+	// a trace that ends before the next scrape shouldn't wait for it to be freed
+	m_running.clear();
+}
+
+void metrics_snapshot::write(std::string& out) const
+{
+	// every sample of a family has to come before the next family starts
+	const auto each_row = [this](auto&& write_row) {
+		std::size_t start = 0;
+		for (std::size_t row = 0; row < m_used; ++row) {
+			const std::string_view labels(m_labels.data() + start, m_labelEnds[row] - start);
+			start = m_labelEnds[row];
+			write_row(m_rows[row], labels);
+		}
+	};
+
+	append_family(out, "winmtr_sessions"sv, "gauge"sv, "Traces running."sv);
+	out += "winmtr_sessions "sv;
+	append_number(out, static_cast<std::uint64_t>(m_sessions));
+	out += '\n';
+
+	append_family(out, "winmtr_probes_sent"sv, "counter"sv, "Probes sent with the hop's TTL and counted on the path."sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		append_series(out, "winmtr_probes_sent_total"sv, labels);
+		append_number(out, static_cast<std::uint64_t>(hop.xmit));
+		out += '\n';
+	});
+	append_family(out, "winmtr_probes_received"sv, "counter"sv, "Replies from the path's responder."sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		append_series(out, "winmtr_probes_received_total"sv, labels);
+		append_number(out, static_cast<std::uint64_t>(hop.returned));
+		out += '\n';
+	});
+	append_family(out, "winmtr_late_replies"sv, "counter"sv, "Replies after their probe timed out."sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		append_series(out, "winmtr_late_replies_total"sv, labels);
+		append_number(out, static_cast<std::uint64_t>(hop.late));
+		out += '\n';
+	});
+	append_family(out, "winmtr_loss_ratio"sv, "gauge"sv, "Probes without a reply, on time or late, of those sent."sv, "ratio"sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		append_series(out, "winmtr_loss_ratio"sv, labels);
+		append_number(out, hop.xmit ? static_cast<double>(std::max(hop.xmit - hop.returned - hop.late, 0)) / hop.xmit : 0.0);
+		out += '\n';
+	});
+	append_family(out, "winmtr_rtt_seconds"sv, "summary"sv, "Round trip time, the quantiles from the hop's histogram."sv, "seconds"sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		// a quantile of nothing is no sample at all rather than a zero
+		if (hop.returned) {
+			const std::array quantiles{ std::pair{ ",quantile=\"0.5\""sv, hop.p50 }
+				, std::pair{ ",quantile=\"0.9\""sv, hop.p90 }
+				, std::pair{ ",quantile=\"0.99\""sv, hop.p99 }
+				, std::pair{ ",quantile=\"0.999\""sv, hop.p999 } };
+			for (const auto& [quantile, value] : quantiles) {
+				append_series(out, "winmtr_rtt_seconds"sv, labels, quantile);
+				append_number(out, to_seconds(static_cast<std::uint64_t>(value)));
+				out += '\n';
+			}
+		}
+		append_series(out, "winmtr_rtt_seconds_sum"sv, labels);
+		append_number(out, to_seconds(hop.total));
+		out += '\n';
+		append_series(out, "winmtr_rtt_seconds_count"sv, labels);
+		append_number(out, static_cast<std::uint64_t>(hop.returned));
+		out += '\n';
+	});
+	append_family(out, "winmtr_rtt_last_seconds"sv, "gauge"sv, "Round trip time of the latest reply."sv, "seconds"sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		if (hop.returned) {
+			append_series(out, "winmtr_rtt_last_seconds"sv, labels);
+			append_number(out, to_seconds(static_cast<std::uint64_t>(hop.last)));
+			out += '\n';
+		}
+	});
+	append_family(out, "winmtr_jitter_seconds"sv, "gauge"sv, "RFC 3550 interarrival jitter of the round trip."sv, "seconds"sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		if (hop.returned) {
+			append_series(out, "winmtr_jitter_seconds"sv, labels);
+			append_number(out, hop.jitter / 1e6);
+			out += '\n';
+		}
+	});
+	append_family(out, "winmtr_responder"sv, "info"sv, "The path's last responder, its name and origin AS if known."sv);
+	each_row([&out](const s_nethost& hop, std::string_view labels) {
+		if (hop.addr.si_family != AF_INET && hop.addr.si_family != AF_INET6) {
+			return;
+		}
+		out += "winmtr_responder_info{"sv;
+		out += labels;
+		out += ",responder=\""sv;
+		append_address(out, hop.addr);
+		out += '"';
+		if (!hop.name.empty()) {
+			out += ",name=\""sv;
+			append_label_value(out, hop.name);
+			out += '"';
+		}
+		if (hop.asn) {
+			out += ",asn=\""sv;
+			append_number(out, static_cast<std::uint64_t>(hop.asn));
+			out += '"';
+		}
+		out += "} 1\n"sv;
+	});
+	out += "# EOF\n"sv;
+}
+
+std::optional<SOCKADDR_INET> metrics_server::endpoint(std::wstring_view text) noexcept
+{
+	SOCKADDR_INET address{};
+	address.Ipv4.sin_family = AF_INET;
+	address.Ipv4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	auto port = text;
+	if (const auto colon = text.rfind(L':'); colon != std::wstring_view::npos) {
+		auto host = text.substr(0, colon);
+		port = text.substr(colon + 1);
+		if (host.size() >= 2 && host.front() == L'[' && host.back() == L']') {
+			host = host.substr(1, host.size() - 2);
+		}
+		std::array<char, INET6_ADDRSTRLEN> narrow{};
+		if (host.size() >= narrow.size()) {
+			return std::nullopt;
+		}
+		for (std::size_t i = 0; i < host.size(); ++i) {
+			if (host[i] >= 0x80) {
+				return std::nullopt;
+			}
+			narrow[i] = static_cast<char>(host[i]);
+		}
+		if (!host.empty() && inet_pton(AF_INET, narrow.data(), &address.Ipv4.sin_addr) != 1) {
+			address = {};
+			address.Ipv6.sin6_family = AF_INET6;
+			if (inet_pton(AF_INET6, narrow.data(), &address.Ipv6.sin6_addr) != 1) {
+				return std::nullopt;
+			}
+		}
+	}
+	// zero is allowed, the system picks one and address() says which
+	unsigned number = 0;
+	if (port.empty() || port.size() > 5) {
+		return std::nullopt;
+	}
+	for (const auto digit : port) {
+		if (digit < L'0' || digit > L'9') {
+			return std::nullopt;
+		}
+		number = number * 10 + static_cast<unsigned>(digit - L'0');
+	}
+	if (number > 65535) {
+		return std::nullopt;
+	}
+	// the port is at the same place in both families
+	address.Ipv4.sin_port = htons(static_cast<USHORT>(number));
+	return address;
+}
+
+std::shared_ptr<metrics_server> metrics_server::open(const SOCKADDR_INET& address) noexcept
+{
+	try {
+		std::shared_ptr<metrics_server> server(new metrics_server());
+		if (!server->m_wsa) {
+			return nullptr;
+		}
+		server->m_listener = socket(address.si_family, SOCK_STREAM, IPPROTO_TCP);
+		if (server->m_listener == INVALID_SOCKET) {
+			return nullptr;
+		}
+		// nobody else gets to listen on the same port and see the scrapes
+		BOOL exclusive = TRUE;
+		(void)setsockopt(server->m_listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, reinterpret_cast<const char*>(&exclusive), sizeof(exclusive));
+		const auto length = address.si_family == AF_INET6 ? sizeof(address.Ipv6) : sizeof(address.Ipv4);
+		if (bind(server->m_listener, reinterpret_cast<const sockaddr*>(&address), static_cast<int>(length)) == SOCKET_ERROR
+			|| listen(server->m_listener, SOMAXCONN) == SOCKET_ERROR) {
+			return nullptr;
+		}
+		auto bound = static_cast<int>(sizeof(server->m_address));
+		if (getsockname(server->m_listener, reinterpret_cast<sockaddr*>(&server->m_address), &bound) == SOCKET_ERROR) {
+			server->m_address = address;
+		}
+		server->m_thread = std::jthread([server = server.get()](std::stop_token stop) { server->serve(std::move(stop)); });
+		return server;
+	}
+	catch (const std::exception&) {
+		return nullptr;
+	}
+}
+
+metrics_server::~metrics_server() noexcept
+{
+	m_thread.request_stop();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+	if (m_listener != INVALID_SOCKET) {
+		closesocket(m_listener);
+	}
+}
+
+metrics_stats metrics_server::stats() const noexcept
+{
+	return { .scrapes = m_scrapes.load(std::memory_order_relaxed)
+		, .refused = m_refused.load(std::memory_order_relaxed)
+		, .last_scrape = std::chrono::microseconds(m_lastScrape.load(std::memory_order_relaxed)) };
+}
+
+void metrics_server::serve(std::stop_token stop)
+{
+	while (!stop.stop_requested()) {
+		WSAPOLLFD listening{ .fd = m_listener, .events = POLLRDNORM, .revents = 0 };
+		if (WSAPoll(&listening, 1, static_cast<INT>(POLL_INTERVAL.count())) <= 0) {
+			continue;
+		}
+		const auto client = accept(m_listener, nullptr, nullptr);
+		if (client == INVALID_SOCKET) {
+			continue;
+		}
+		try {
+			if (!answer(client)) {
+				m_refused.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		catch (const std::exception&) {
+			m_refused.fetch_add(1, std::memory_order_relaxed);
+		}
+		closesocket(client);
+	}
+}
+
+bool metrics_server::answer(SOCKET client)
+{
+	// nonblocking, so a client that stops reading can't hold the thread past its deadline
+	u_long nonblocking = 1;
+	if (ioctlsocket(client, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+		return false;
+	}
+	const auto deadline = std::chrono::steady_clock::now() + CLIENT_TIMEOUT;
+	m_request.clear();
+	std::size_t headers = std::string::npos;
+	while ((headers = m_request.find("\r\n\r\n"sv)) == std::string::npos) {
+		if (m_request.size() >= MAX_REQUEST || !ready(client, POLLRDNORM, deadline)) {
+			return false;
+		}
+		std::array<char, 1024> buffer;
+		const auto received = recv(client, buffer.data(), static_cast<int>(buffer.size()), 0);
+		if (received <= 0) {
+			return false;
+		}
+		m_request.append(buffer.data(), static_cast<std::size_t>(received));
+	}
+
+	// the request line is all that matters, whatever the headers say
+	const std::string_view request(m_request.data(), m_request.find("\r\n"sv));
+	const auto method = request.substr(0, request.find(' '));
+	auto target = request.substr(std::min(method.size() + 1, request.size()));
+	target = target.substr(0, target.find(' '));
+	target = target.substr(0, target.find('?'));
+	std::string_view status = "200 OK"sv;
+	m_body.clear();
+	if (method != "GET"sv) {
+		status = "405 Method Not Allowed"sv;
+	}
+	else if (target != "/metrics"sv) {
+		status = "404 Not Found"sv;
+	}
+	else {
+		const auto started = std::chrono::steady_clock::now();
+		m_snapshot.take();
+		m_snapshot.write(m_body);
+		m_lastScrape.store(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count(), std::memory_order_relaxed);
+	}
+
+	m_head.clear();
+	m_head += "HTTP/1.1 "sv;
+	m_head += status;
+	m_head += "\r\nContent-Type: "sv;
+	m_head += m_body.empty() ? "text/plain; charset=utf-8"sv : CONTENT_TYPE;
+	m_head += "\r\nContent-Length: "sv;
+	append_number(m_head, static_cast<std::uint64_t>(m_body.size()));
+	if (method != "GET"sv) {
+		m_head += "\r\nAllow: GET"sv;
+	}
+	m_head += "\r\nConnection: close\r\n\r\n"sv;
+	if (!send_all(client, m_head, deadline) || !send_all(client, m_body, deadline)) {
+		return false;
+	}
+	if (m_body.empty()) {
+		return false;
+	}
+	m_scrapes.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool metrics_server::send_all(SOCKET client, std::string_view data, std::chrono::steady_clock::time_point deadline) noexcept
+{
+	while (!data.empty()) {
+		if (!ready(client, POLLWRNORM, deadline)) {
+			return false;
+		}
+		const auto sent = send(client, data.data(), static_cast<int>(std::min<std::size_t>(data.size(), 1u << 20)), 0);
+		if (sent == SOCKET_ERROR) {
+			if (WSAGetLastError() == WSAEWOULDBLOCK) {
+				continue;
+			}
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(sent));
+	}
+	return true;
+}
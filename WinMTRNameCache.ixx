@@ -0,0 +1,605 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRNameCache.ixx
+//
+// DESCRIPTION:
+//   The reverse DNS names of hop addresses, shared by every trace in the
+//   process. A router that twenty sessions run through, or that a restarted
+//   trace finds again, is only looked up once.
+//
+// NOTES:
+//   A bounded LRU. Answers are kept for a positive TTL, addresses without a
+//   PTR record for a shorter negative one, and lookups for an address that
+//   is already being resolved wait on that query instead of starting their
+//   own. The query itself is left to a ptr_resolver, which reports back
+//   through complete(). By default that asks the system's DNS server
+//   directly over UDP, or getnameinfo if there is no server to be found.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <netdb.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.NameCache;
+
+#ifdef _WIN32
+import <array>;
+import <chrono>;
+import <coroutine>;
+import <cstddef>;
+import <cstdint>;
+import <cstring>;
+import <filesystem>;
+import <list>;
+import <memory>;
+import <mutex>;
+import <string>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+#endif
+
+// how long an answer is kept, at most the record's own TTL when the resolver knows it
+export constexpr auto NAME_CACHE_POSITIVE_TTL = std::chrono::hours(1);
+// no PTR record, asking again soon is unlikely to change that
+export constexpr auto NAME_CACHE_NEGATIVE_TTL = std::chrono::minutes(5);
+// the resolver failed for some other reason, which may well be gone in a moment,
+// and the least any answer is kept so a zero TTL doesn't mean a query per ping
+export constexpr auto NAME_CACHE_FAILURE_TTL = std::chrono::seconds(30);
+export constexpr std::size_t NAME_CACHE_CAPACITY = 4096;
+
+// null when the address has no name
+export using cached_name = std::shared_ptr<const std::wstring>;
+
+export struct name_cache_stats final {
+	std::uint64_t hits = 0;			// answered from the cache, negative answers included
+	std::uint64_t negative_hits = 0;
+	std::uint64_t joined = 0;		// waited for a query another lookup had already started
+	std::uint64_t misses = 0;		// had to start a query
+	std::uint64_t evictions = 0;
+	std::size_t entries = 0;
+
+	// the share of lookups that didn't cost a query of their own
+	[[nodiscard]]
+	double hit_rate() const noexcept
+	{
+		const auto lookups = hits + joined + misses;
+		return lookups ? static_cast<double>(hits + joined) / static_cast<double>(lookups) : 0.0;
+	}
+};
+
+export class name_cache;
+
+//*****************************************************************************
+// CLASS:  ptr_resolver
+//
+// Must call name_cache::complete() exactly once for every start(), from any
+// thread, inside start() included.
+//*****************************************************************************
+export class ptr_resolver {
+public:
+	virtual ~ptr_resolver() noexcept = default;
+	virtual void start(name_cache& cache, const SOCKADDR_INET& addr) noexcept = 0;
+};
+
+//*****************************************************************************
+// CLASS:  name_lookup
+//
+// The awaitable for one address, it doesn't suspend on a hit. Resumes on
+// whatever thread the resolver completes on otherwise.
+//*****************************************************************************
+export class name_lookup final {
+	name_cache& m_cache;
+	SOCKADDR_INET m_addr;
+	cached_name m_name;
+	std::coroutine_handle<> m_resume{ nullptr };
+	friend class name_cache;
+public:
+	name_lookup(name_cache& cache, const SOCKADDR_INET& addr) noexcept
+		:m_cache(cache)
+		, m_addr(addr)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> resume_handle);
+
+	cached_name await_resume() noexcept
+	{
+		return std::move(m_name);
+	}
+};
+
+//*****************************************************************************
+// CLASS:  name_cache
+//
+// Safe to share between threads, one per process through instance().
+//*****************************************************************************
+export class name_cache final {
+	name_cache(const name_cache&) = delete;
+	name_cache& operator=(const name_cache&) = delete;
+public:
+	using clock = std::chrono::steady_clock;
+
+	explicit name_cache(std::unique_ptr<ptr_resolver> resolver, std::size_t capacity = NAME_CACHE_CAPACITY) noexcept
+		:m_resolver(std::move(resolver))
+		, m_capacity(capacity)
+	{
+	}
+
+	~name_cache() noexcept
+	{
+		// it may still complete what it has in flight, while the rest is intact
+		m_resolver.reset();
+	}
+
+	// lives as long as the process, so a trace started later still finds what an earlier one looked up
+	[[nodiscard]]
+	static std::shared_ptr<name_cache> instance();
+
+	[[nodiscard]]
+	name_lookup lookup(const SOCKADDR_INET& addr) noexcept
+	{
+		return name_lookup{ *this, addr };
+	}
+
+	// the resolver's answer, a null name for none, kept for ttl
+	void complete(const SOCKADDR_INET& addr, cached_name name, clock::duration ttl);
+
+	[[nodiscard]]
+	name_cache_stats stats() const;
+
+	// Everything that hasn't expired yet, so a restart doesn't have to ask
+	// again. Both only return false if the file couldn't be used at all.
+	bool save(const std::filesystem::path& path) const;
+	bool load(const std::filesystem::path& path);
+private:
+	friend class name_lookup;
+
+	// the address alone, ports and scopes don't change the name
+	struct address_key final {
+		ADDRESS_FAMILY family = AF_UNSPEC;
+		std::array<std::uint8_t, 16> bytes{};
+
+		[[nodiscard]]
+		bool operator==(const address_key&) const noexcept = default;
+	};
+
+	struct address_hash final {
+		[[nodiscard]]
+		std::size_t operator()(const address_key& key) const noexcept
+		{
+			// FNV-1a
+			std::uint64_t hash = 14695981039346656037ull ^ key.family;
+			for (const auto byte : key.bytes) {
+				hash = (hash ^ byte) * 1099511628211ull;
+			}
+			return static_cast<std::size_t>(hash);
+		}
+	};
+
+	struct entry final {
+		address_key key;
+		cached_name name;
+		clock::time_point expires;
+		bool pending = false;
+		std::vector<name_lookup*> waiters;	// only while pending
+	};
+
+	[[nodiscard]]
+	static address_key key_of(const SOCKADDR_INET& addr) noexcept;
+	// true if the lookup was answered on the spot and must not suspend
+	bool join(name_lookup& lookup);
+	// drops the least recently used answers until it fits, never a pending query
+	void trim() noexcept;
+
+	std::unique_ptr<ptr_resolver> m_resolver;
+	std::size_t m_capacity;
+	mutable std::mutex m_mutex;
+	// most recently used first
+	std::list<entry> m_lru;
+	std::unordered_map<address_key, std::list<entry>::iterator, address_hash> m_index;
+	name_cache_stats m_stats;
+};
+
+bool name_lookup::await_suspend(std::coroutine_handle<> resume_handle)
+{
+	m_resume = resume_handle;
+	return !m_cache.join(*this);
+}
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <fstream>;
+import <iterator>;
+import <system_error>;
+#endif
+import WinMTR.PtrResolver;
+
+namespace {
+	constexpr std::array<char, 8> FILE_MAGIC = { 'W', 'M', 'T', 'R', 'P', 'T', 'R', '1' };
+
+	[[nodiscard]]
+	socklen_t address_size(const SOCKADDR_INET& addr) noexcept
+	{
+		return static_cast<socklen_t>(addr.si_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+	}
+
+	//*****************************************************************************
+	// CLASS:  system_ptr_resolver
+	//
+	// getnameinfo blocks, so every query gets a thread-pool callback of its
+	// own. NI_NAMEREQD so that no name comes back as no name rather than as
+	// the address spelled out.
+	//*****************************************************************************
+	class system_ptr_resolver final : public ptr_resolver {
+		struct query final {
+			name_cache* cache;
+			SOCKADDR_INET addr;
+		};
+	public:
+		void start(name_cache& cache, const SOCKADDR_INET& addr) noexcept override
+		{
+			auto pending = std::make_unique<query>(&cache, addr);
+#ifdef _WIN32
+			if (TrySubmitThreadpoolCallback(&system_ptr_resolver::callback, pending.get(), nullptr)) [[likely]] {
+				pending.release();
+				return;
+			}
+			cache.complete(addr, nullptr, NAME_CACHE_FAILURE_TTL);
+#else
+			std::thread([pending = std::move(pending)]() noexcept {
+				resolve(*pending);
+			}).detach();
+#endif
+		}
+	private:
+#ifdef _WIN32
+		static void CALLBACK callback([[maybe_unused]] PTP_CALLBACK_INSTANCE instance, PVOID context) noexcept
+		{
+			const std::unique_ptr<query> pending(static_cast<query*>(context));
+			resolve(*pending);
+		}
+
+		static void resolve(query& pending) noexcept
+		{
+			wchar_t buf[NI_MAXHOST] = {};
+			const auto result = GetNameInfoW(reinterpret_cast<const sockaddr*>(&pending.addr), address_size(pending.addr)
+				, buf, static_cast<DWORD>(std::size(buf)), nullptr, 0, NI_NAMEREQD);
+			finish(pending, result, buf, result == EAI_NONAME);
+		}
+#else
+		static void resolve(query& pending) noexcept
+		{
+			char buf[NI_MAXHOST] = {};
+			const auto result = ::getnameinfo(reinterpret_cast<const sockaddr*>(&pending.addr), address_size(pending.addr)
+				, buf, sizeof(buf), nullptr, 0, NI_NAMEREQD);
+			// host names are ASCII, punycode included
+			wchar_t wide[NI_MAXHOST] = {};
+			std::copy(std::begin(buf), std::end(buf), std::begin(wide));
+			finish(pending, result, wide, result == EAI_NONAME);
+		}
+#endif
+
+		static void finish(query& pending, int result, const wchar_t* name, bool no_name) noexcept
+		{
+			if (!result) {
+				pending.cache->complete(pending.addr, std::make_shared<const std::wstring>(name), NAME_CACHE_POSITIVE_TTL);
+			}
+			else {
+				pending.cache->complete(pending.addr, nullptr, no_name ? NAME_CACHE_NEGATIVE_TTL : NAME_CACHE_FAILURE_TTL);
+			}
+		}
+	};
+
+	//*****************************************************************************
+	// CLASS:  dns_ptr_resolver
+	//
+	// Puts the cache's queries to a dns_ptr_client, which has them all in
+	// flight at once without a thread each and knows the records' TTLs.
+	//*****************************************************************************
+	class dns_ptr_resolver final : public ptr_resolver {
+		// owns itself until the client is done with it
+		struct query final : ptr_request {
+			name_cache* cache;
+			SOCKADDR_INET addr;
+
+			query(name_cache* cache, const SOCKADDR_INET& addr) noexcept
+				:cache(cache)
+				, addr(addr)
+			{
+			}
+
+			void done(ptr_answer answer) noexcept override
+			{
+				const std::unique_ptr<query> self(this);
+				switch (answer.outcome) {
+				case ptr_outcome::name:
+					cache->complete(addr, std::make_shared<const std::wstring>(std::move(answer.name))
+						, std::clamp<name_cache::clock::duration>(answer.ttl, NAME_CACHE_FAILURE_TTL, NAME_CACHE_POSITIVE_TTL));
+					break;
+				case ptr_outcome::no_name:
+					cache->complete(addr, nullptr, answer.ttl == std::chrono::seconds::zero() ? NAME_CACHE_NEGATIVE_TTL
+						: std::clamp<name_cache::clock::duration>(answer.ttl, NAME_CACHE_FAILURE_TTL, NAME_CACHE_NEGATIVE_TTL));
+					break;
+				case ptr_outcome::failed:
+					cache->complete(addr, nullptr, NAME_CACHE_FAILURE_TTL);
+					break;
+				}
+			}
+		};
+
+		dns_ptr_client m_client;
+	public:
+		explicit dns_ptr_resolver(const SOCKADDR_INET& server)
+			:m_client(server)
+		{
+		}
+
+		void start(name_cache& cache, const SOCKADDR_INET& addr) noexcept override
+		{
+			try {
+				m_client.start(addr, *std::make_unique<query>(&cache, addr).release());
+			}
+			catch (const std::bad_alloc&) {
+				cache.complete(addr, nullptr, NAME_CACHE_FAILURE_TTL);
+			}
+		}
+	};
+
+	[[nodiscard]]
+	std::unique_ptr<ptr_resolver> default_resolver()
+	{
+		if (const auto server = dns_ptr_client::system_server()) {
+			try {
+				return std::make_unique<dns_ptr_resolver>(*server);
+			}
+			catch (const std::system_error&) {
+				// no socket to the server, the system resolver may still get somewhere
+			}
+		}
+		return std::make_unique<system_ptr_resolver>();
+	}
+}
+
+std::shared_ptr<name_cache> name_cache::instance()
+{
+	static const auto cache = std::make_shared<name_cache>(default_resolver());
+	return cache;
+}
+
+name_cache::address_key name_cache::key_of(const SOCKADDR_INET& addr) noexcept
+{
+	address_key key{ .family = addr.si_family };
+	if (addr.si_family == AF_INET6) {
+		std::memcpy(key.bytes.data(), &addr.Ipv6.sin6_addr, sizeof(addr.Ipv6.sin6_addr));
+	}
+	else {
+		std::memcpy(key.bytes.data(), &addr.Ipv4.sin_addr, sizeof(addr.Ipv4.sin_addr));
+	}
+	return key;
+}
+
+bool name_cache::join(name_lookup& lookup)
+{
+	const auto key = key_of(lookup.m_addr);
+	const auto now = clock::now();
+	{
+		std::scoped_lock lock(m_mutex);
+		if (const auto found = m_index.find(key); found != m_index.end()) {
+			auto& cached = *found->second;
+			m_lru.splice(m_lru.begin(), m_lru, found->second);
+			if (cached.pending) {
+				++m_stats.joined;
+				cached.waiters.push_back(&lookup);
+				return false;
+			}
+			if (cached.expires > now) {
+				++m_stats.hits;
+				if (!cached.name) {
+					++m_stats.negative_hits;
+				}
+				lookup.m_name = cached.name;
+				return true;
+			}
+			// stale, ask again in its place
+			cached.name.reset();
+			cached.pending = true;
+			cached.waiters.push_back(&lookup);
+		}
+		else {
+			m_lru.push_front({ .key = key, .pending = true, .waiters = { &lookup } });
+			m_index.emplace(key, m_lru.begin());
+			trim();
+		}
+		++m_stats.misses;
+	}
+	// the lookup may already be resumed and gone by the time this returns
+	const auto addr = lookup.m_addr;
+	m_resolver->start(*this, addr);
+	return false;
+}
+
+void name_cache::complete(const SOCKADDR_INET& addr, cached_name name, clock::duration ttl)
+{
+	const auto key = key_of(addr);
+	std::vector<name_lookup*> waiters;
+	{
+		std::scoped_lock lock(m_mutex);
+		const auto found = m_index.find(key);
+		if (found == m_index.end()) [[unlikely]] {
+			return;
+		}
+		auto& cached = *found->second;
+		cached.name = name;
+		cached.expires = clock::now() + ttl;
+		cached.pending = false;
+		waiters.swap(cached.waiters);
+		trim();
+	}
+	for (auto waiter : waiters) {
+		waiter->m_name = name;
+		// the waiter's frame, and the waiter with it, may be gone after this
+		waiter->m_resume.resume();
+	}
+}
+
+void name_cache::trim() noexcept
+{
+	for (auto victim = m_lru.end(); m_index.size() > m_capacity && victim != m_lru.begin();) {
+		--victim;
+		if (victim->pending) {
+			continue;
+		}
+		m_index.erase(victim->key);
+		victim = m_lru.erase(victim);
+		++m_stats.evictions;
+	}
+}
+
+name_cache_stats name_cache::stats() const
+{
+	std::scoped_lock lock(m_mutex);
+	auto snapshot = m_stats;
+	snapshot.entries = m_index.size();
+	return snapshot;
+}
+
+// A flat file: the magic, then per answer the family, 16 address bytes, the
+// expiry in system clock seconds and the name's length in wchar_t followed by
+// the name, a length of all ones for no name.
+bool name_cache::save(const std::filesystem::path& path) const
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+	file.write(FILE_MAGIC.data(), FILE_MAGIC.size());
+	const auto now = clock::now();
+	const auto wall = std::chrono::system_clock::now();
+	std::scoped_lock lock(m_mutex);
+	// oldest first, so that loading them back in order restores the LRU order
+	for (auto cached = m_lru.rbegin(); cached != m_lru.rend(); ++cached) {
+		if (cached->pending || cached->expires <= now) {
+			continue;
+		}
+		const std::uint16_t family = cached->key.family;
+		const std::int64_t expires = std::chrono::duration_cast<std::chrono::seconds>((wall + std::chrono::duration_cast<std::chrono::system_clock::duration>(cached->expires - now)).time_since_epoch()).count();
+		const std::uint32_t length = cached->name ? static_cast<std::uint32_t>(cached->name->size()) : UINT32_MAX;
+		file.write(reinterpret_cast<const char*>(&family), sizeof(family));
+		file.write(reinterpret_cast<const char*>(cached->key.bytes.data()), cached->key.bytes.size());
+		file.write(reinterpret_cast<const char*>(&expires), sizeof(expires));
+		file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		if (cached->name) {
+			file.write(reinterpret_cast<const char*>(cached->name->data()), static_cast<std::streamsize>(cached->name->size() * sizeof(wchar_t)));
+		}
+	}
+	return static_cast<bool>(file);
+}
+
+bool name_cache::load(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::array<char, FILE_MAGIC.size()> magic{};
+	if (!file.read(magic.data(), magic.size()) || magic != FILE_MAGIC) {
+		return false;
+	}
+	const auto now = clock::now();
+	const auto wall = std::chrono::system_clock::now();
+	for (;;) {
+		std::uint16_t family = 0;
+		address_key key;
+		std::int64_t expires = 0;
+		std::uint32_t length = 0;
+		if (!file.read(reinterpret_cast<char*>(&family), sizeof(family))
+			|| !file.read(reinterpret_cast<char*>(key.bytes.data()), key.bytes.size())
+			|| !file.read(reinterpret_cast<char*>(&expires), sizeof(expires))
+			|| !file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+			break;
+		}
+		cached_name name;
+		if (length != UINT32_MAX) {
+			if (length > NI_MAXHOST) {
+				break;
+			}
+			std::wstring text(length, L'\0');
+			if (!file.read(reinterpret_cast<char*>(text.data()), static_cast<std::streamsize>(length * sizeof(wchar_t)))) {
+				break;
+			}
+			name = std::make_shared<const std::wstring>(std::move(text));
+		}
+		const auto left = std::chrono::system_clock::time_point(std::chrono::seconds(expires)) - wall;
+		if ((family != AF_INET && family != AF_INET6) || left <= std::chrono::system_clock::duration::zero()) {
+			continue;
+		}
+		key.family = family;
+		std::scoped_lock lock(m_mutex);
+		// whatever this run already knows is at least as fresh
+		if (m_index.contains(key)) {
+			continue;
+		}
+		m_lru.push_front({ .key = key, .name = std::move(name), .expires = now + std::chrono::duration_cast<clock::duration>(left) });
+		m_index.emplace(key, m_lru.begin());
+		trim();
+	}
+	return true;
+}
@@ -18,6 +18,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 module;
+#ifdef _WIN32
 #pragma warning (disable : 4005)
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN
@@ -31,21 +32,61 @@ module;
 #define NOMINMAX
 #include <winsock2.h>
 #include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#endif
 export module WinMTR.Net:ClassDef;
 
+#ifdef _WIN32
 import <optional>;
+import <algorithm>;
 import <atomic>;
-import <array>;
 import <mutex>;
+import <vector>;
+import <array>;
 import <memory>;
 import <stop_token>;
-import <winrt/base.h>;
-import <winrt/Windows.Foundation.h>;
+import <cstddef>;
+import <cstdint>;
+import <cmath>;
+import <chrono>;
+import <coroutine>;
+import <new>;
+import <string>;
+import <string_view>;
+#endif
 import WinMTRSNetHost;
 import WinMTROptionsProvider;
+#ifdef _WIN32
+import WinMTR.ProbeEngine;
+#else
+import WinMTR.ProbeBackend.Linux;
+#endif
+import WinMTR.Capture;
+import WinMTR.EventLog;
+import WinMTR.SeqLock;
+import WinMTR.Histogram;
+import WinMTR.ProbeHistory;
+export import WinMTR.Task;
+#ifdef _WIN32
 import winmtr.helper;
-
-struct trace_thread;
+#endif
 
 //*****************************************************************************
 // CLASS:  WinMTRNet
@@ -57,85 +98,410 @@ export class WinMTRNet final : public std::enable_shared_from_this<WinMTRNet> {
 	WinMTRNet& operator=(const WinMTRNet&) = delete;
 public:
 
-	WinMTRNet(const IWinMTROptionsProvider* wp)
+#ifdef _WIN32
+	WinMTRNet(const IWinMTROptionsProvider* wp, std::shared_ptr<probe_backend> pb = probe_engine::instance())
+#else
+	WinMTRNet(const IWinMTROptionsProvider* wp, std::shared_ptr<probe_backend> pb = linux_icmp_backend::instance())
+#endif
 		:host(),
 		last_remote_addr(),
 		options(wp),
-		wsaHelper(MAKEWORD(2, 2)),
+		backend(std::move(pb)),
+		session(backend->new_session()),
 		tracing() {
 
+#ifdef _WIN32
 		if (!wsaHelper) [[unlikely]] {
 			//AfxMessageBox(IDP_SOCKETS_INIT_FAILED);
 			return;
 		}
+#endif
 	}
 	~WinMTRNet() noexcept = default;
 
 
+	// The resolver's order is the order of preference. With both families in
+	// the list the first address of each is probed at once and the trace
+	// follows whichever answers first, as in RFC 8305. The time to the first
+	// probe counts from requested, on the backend's clock.
 	[[nodiscard("The task should be awaited")]]
-	winrt::Windows::Foundation::IAsyncAction	DoTrace(std::stop_token stop_token, SOCKADDR_INET address);
+	trace_action	DoTrace(std::stop_token stop_token, std::vector<SOCKADDR_INET> candidates, probe_backend::clock::time_point requested);
 
-	void	ResetHops() noexcept
+	// only while no trace is running
+	void	ResetHops()
 	{
-		for (auto& h : this->host) {
-			h = s_nethost();
-		}
+		ResetHops(static_cast<int>(options->getMaxHops()), backend->now());
 	}
+	// Only while no trace is running. Counts the trace whose record is at
+	// from as it was counted live, the names it resolved included.
+	void	Replay(const capture_file& recorded, std::size_t from);
+	// the destination's hop count once discovery found it, a guess from the responders until then
 	[[nodiscard]]
 	int		GetMax() const;
-
+	// probes the TTLs past the destination didn't send, less what finding the destination took
 	[[nodiscard]]
-	std::vector<s_nethost> getCurrentState() const;
-	s_nethost getStateAt(int at) const
+	std::int64_t getProbesSaved() const noexcept
+	{
+		return static_cast<std::int64_t>(probes_skipped.load(std::memory_order_relaxed)) - static_cast<std::int64_t>(discovery_probes.load(std::memory_order_relaxed));
+	}
+	// from the trace being asked for to its first probe going out, empty until then
+	[[nodiscard]]
+	std::optional<std::chrono::microseconds> getTimeToFirstProbe() const noexcept
+	{
+		const auto elapsed = first_probe.load(std::memory_order_relaxed);
+		return elapsed < 0 ? std::nullopt : std::optional(std::chrono::microseconds(elapsed));
+	}
+	// whether anything but a guess from the responders says where the destination is
+	[[nodiscard]]
+	bool	getDestinationReached() const noexcept
+	{
+		return hop_count.load(std::memory_order_relaxed) != 0;
+	}
+	// the family that answered first when both were raced, AF_UNSPEC if there was no race or nobody answered
+	[[nodiscard]]
+	int		getRaceWinner() const noexcept
+	{
+		return race_winner.load(std::memory_order_relaxed);
+	}
+	[[nodiscard]]
+	bool	supports(probe_protocol protocol) const noexcept
 	{
-		std::unique_lock lock(ghMutex);
-		return host[at];
+		return backend->supports(protocol);
 	}
 
-	static constexpr auto MAX_HOPS = 30;
+	[[nodiscard]]
+	std::vector<s_nethost> getCurrentState() const;
+	// the same rows written over state from rows on, what is there already is
+	// reused for its buffers, rows ends up past the last one
+	void	getCurrentState(std::vector<s_nethost>& state, std::size_t& rows) const;
+	// one row per responder, hop by hop
+	[[nodiscard]]
+	s_nethost getStateAt(int at, int path = 0) const;
+	void	getStateAt(int at, int path, s_nethost& state) const;
+	// the probes of the last window only, empty if the history is switched off
+	[[nodiscard]]
+	window_summary getWindowAt(int at, std::chrono::seconds window) const;
+
+	// a trace going on somewhere in the process
+	struct running_trace final {
+		std::shared_ptr<const WinMTRNet> net;
+		std::uint32_t session = 0;
+		SOCKADDR_INET destination = {};
+	};
+	// Every trace running right now, over whatever traces held, for whoever
+	// reports on all of them at once. Never waits on a trace, only on
+	// another trace starting or ending.
+	static void running(std::vector<running_trace>& traces);
+
+	// all a TTL can say, a trace only allocates the hops it probes
+	static constexpr auto MAX_HOPS = 255;
+	// responders kept apart per hop, any beyond that share the last row
+	static constexpr auto MAX_PATHS = 8;
 private:
-	std::array<s_nethost, WinMTRNet::MAX_HOPS>	host;
+	// weak, a WinMTRNet nobody holds any more is skipped rather than kept alive
+	struct listed final {
+		std::weak_ptr<const WinMTRNet> net;
+		const WinMTRNet* owner = nullptr;
+		std::uint32_t session = 0;
+		SOCKADDR_INET destination = {};
+	};
+	// lists a trace in running() for as long as it is in scope
+	class running_entry final {
+		running_entry(const running_entry&) = delete;
+		running_entry& operator=(const running_entry&) = delete;
+	public:
+		running_entry(const WinMTRNet& net, const SOCKADDR_INET& destination)
+			:m_net(&net)
+		{
+			std::scoped_lock lock(s_running_mutex);
+			s_running.push_back({ .net = net.weak_from_this(), .owner = m_net, .session = net.session, .destination = destination });
+		}
+		~running_entry() noexcept
+		{
+			std::scoped_lock lock(s_running_mutex);
+			std::erase_if(s_running, [this](const listed& entry) noexcept { return entry.owner == m_net; });
+		}
+	private:
+		const WinMTRNet* m_net;
+	};
+	static inline std::mutex s_running_mutex;
+	static inline std::vector<listed> s_running;
+
+	// Where the racers of a destination race report back. DoTrace waits on
+	// it and is resumed by the first answer or, failing that, the last timeout,
+	// whichever of the two sides gets there second does the resuming.
+	class destination_race final {
+	public:
+		explicit destination_race(int racers) noexcept : m_pending(racers) {}
+
+		void finish(int racer, bool answered) noexcept
+		{
+			if (answered) {
+				int none = -1;
+				m_winner.compare_exchange_strong(none, racer, std::memory_order_acq_rel);
+			}
+			if ((answered || m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) && !m_decided.exchange(true, std::memory_order_acq_rel)) {
+				arrive();
+			}
+		}
+
+		// what DoTrace awaits, resumes with the racer that answered first or -1 if none did
+		struct awaiter final {
+			destination_race* race;
+
+			[[nodiscard]] bool await_ready() const noexcept { return false; }
+			bool await_suspend(std::coroutine_handle<> waiter) noexcept
+			{
+				race->m_waiter = waiter;
+				return !race->m_gate.exchange(true, std::memory_order_acq_rel);
+			}
+			[[nodiscard]] int await_resume() const noexcept { return race->m_winner.load(std::memory_order_acquire); }
+		};
+		[[nodiscard]] awaiter decided() noexcept { return { this }; }
+	private:
+		void arrive() noexcept
+		{
+			if (m_gate.exchange(true, std::memory_order_acq_rel)) {
+				m_waiter.resume();
+			}
+		}
+
+		std::atomic_int m_pending;
+		std::atomic_int m_winner{ -1 };
+		std::atomic_bool m_decided{ false };
+		std::atomic_bool m_gate{ false };
+		std::coroutine_handle<> m_waiter;
+	};
+
+	// the hot part of s_nethost
+	struct hop_counters final {
+		int xmit = 0;
+		int returned = 0;
+		std::uint64_t total = 0;	// microseconds, like everything else in here
+		int last = 0;
+		int best = 0;
+		int worst = 0;
+		double mean = 0.0;		// Welford's running mean and sum of squared deviations
+		double m2 = 0.0;
+		double jitter = 0.0;
+		double ewma = 0.0;
+	};
+
+	// one responder at a hop, load balancers can put several behind one TTL
+	struct path_slot final {
+		seqlock<hop_counters> counters;
+		seqlock<SOCKADDR_INET> addr;
+		std::atomic<std::shared_ptr<const std::wstring>> name;
+		std::atomic_uint32_t asn{ 0 };
+		latency_histogram histogram;
+		// a probe that timed out is counted on the path the last answer came from, so is its late answer
+		late_reply_counter late = std::make_shared<std::atomic_uint32_t>(0);
+
+		void reset() noexcept
+		{
+			counters.store({});
+			addr.store({});
+			name.store(nullptr);
+			asn.store(0, std::memory_order_relaxed);
+			histogram.reset();
+			late->store(0, std::memory_order_relaxed);
+		}
+	};
+
+	// Each hop is written by its own trace loop only, apart from the names
+	// which the resolver fills in later, so the seqlocks never see two
+	// writers and nobody, reader or writer, ever blocks.
+	//
+	// Path 0 always exists. The others are allocated the first time another
+	// responder shows up and published through path_count, readers never
+	// look past it and the slots are never freed before the WinMTRNet is.
+	struct alignas(std::hardware_destructive_interference_size) hop_slot final {
+		std::array<std::unique_ptr<path_slot>, MAX_PATHS> paths{ std::make_unique<path_slot>() };
+		std::atomic_int path_count{ 1 };
+		int current = 0;	// the path the latest answer came from, trace loop only
+		std::atomic<std::shared_ptr<probe_history>> history;
+	};
+
+	// Allocated from the first hop up and published through hop_slots,
+	// readers never look past it and the slots live as long as we do.
+	std::array<std::unique_ptr<hop_slot>, WinMTRNet::MAX_HOPS>	host;
+	std::atomic_int		hop_slots{ 0 };
+	std::atomic_int		hop_loops{ 0 };	// trace loops this trace started, from TTL 1 up
+	std::atomic_int		max_hops{ 1 };	// this trace's limit, from the options
+	probe_backend::clock::time_point trace_epoch;
+	// the trace loops started so far, a loop that finds the path grew adds more
+	std::mutex			workers_mutex;
+	std::vector<trace_action> workers;
+	std::stop_token		trace_stop;
 	SOCKADDR_INET last_remote_addr;
-	mutable std::recursive_mutex	ghMutex;
-	std::optional<winrt::Windows::Foundation::IAsyncAction> tracer;
-	std::optional<winrt::apartment_context> context;
 	const IWinMTROptionsProvider* options;
-	winmtr::helper::WSAHelper wsaHelper;
+#ifdef _WIN32
+	winmtr::helper::WSAHelper wsaHelper{ MAKEWORD(2, 2) };
+#endif
+	std::shared_ptr<probe_backend> backend;
+	std::uint32_t session;
 	std::atomic_bool	tracing;
+	std::atomic_int		hop_count{ 0 };	// TTL the destination answered at, zero while unknown
+	std::atomic_bool	rediscovering{ false };
+	std::atomic_uint64_t	probes_skipped{ 0 };
+	std::atomic_uint64_t	discovery_probes{ 0 };
+	std::uint16_t		discovery_round{ 0 };	// only one discovery runs at a time, rediscovering sees to that
+	probe_backend::clock::time_point trace_requested;
+	std::atomic_int64_t	first_probe{ -1 };	// microseconds after trace_requested, negative until a probe went out
+	std::atomic_int		race_winner{ AF_UNSPEC };
+	// where every probe outcome goes besides the counters, taken once per trace
+	std::shared_ptr<event_log> events;
+	std::shared_ptr<capture_writer> capture;
+	bool		replaying = false;	// nothing is looked up while a capture is counted again
 
+	void	ResetHops(int limit, probe_backend::clock::time_point epoch)
+	{
+		max_hops = std::clamp(limit, 1, MAX_HOPS);
+		trace_epoch = epoch;
+		const auto allocated = hop_slots.load(std::memory_order_relaxed);
+		for (int i = 0; i < allocated; ++i) {
+			auto& h = *host[i];
+			// paths found by an earlier trace are kept, a reader may still be looking at them
+			for (auto& path : h.paths) {
+				if (path) {
+					path->reset();
+				}
+			}
+			h.path_count.store(1, std::memory_order_release);
+			h.current = 0;
+			h.history.store(NewHistory());
+		}
+	}
 	[[nodiscard]]
-	SOCKADDR_INET GetAddr(int at) const
+	SOCKADDR_INET GetAddr(int at, int path) const noexcept
+	{
+		return host[at]->paths[path]->addr.load();
+	}
+	// every reply comes through here, only a new address goes on to the resolver
+	void	SetAddr(int at, int path, SOCKADDR_INET addr) noexcept;
+	detached_action	ResolveName(int at, int path);
+	void	SetName(int at, int path, std::wstring_view n)
 	{
-		std::unique_lock lock(ghMutex);
-		return host[at].addr;
+		auto& name = host[at]->paths[path]->name;
+		// a hop that keeps sending the same error shouldn't cost an allocation per probe
+		if (const auto current = name.load(); current && *current == n) {
+			return;
+		}
+		name.store(std::make_shared<const std::wstring>(n));
 	}
-	winrt::fire_and_forget	SetAddr(int at, SOCKADDR_INET addr);
-	void	SetName(int at, std::wstring n)
+	void	SetName(int at, int path, std::shared_ptr<const std::wstring> n)
 	{
-		std::unique_lock lock(ghMutex);
-		host[at].name = std::move(n);
+		host[at]->paths[path]->name.store(std::move(n));
 	}
+	// the path a probe is counted on, trace loop only
+	[[nodiscard]]
+	int		PathFor(int at, const probe_result& reply);
+	// everything a probe's outcome goes into, live or replayed
+	void	Tally(int at, const probe_result& reply, probe_backend::clock::time_point when);
 
-	void addNewReturn(int at, int last)
+	void addNewReturn(int at, int path, std::chrono::microseconds round_trip) noexcept
 	{
-		std::unique_lock lock(ghMutex);
-		host[at].last = last;
-		host[at].total += last;
-		if (host[at].best > last || host[at].xmit == 1) {
-			host[at].best = last;
-		};
-		if (host[at].worst < last) {
-			host[at].worst = last;
+		const auto last = static_cast<int>(round_trip.count());
+		const auto weight = options->getEwmaWeight();
+		auto& slot = *host[at]->paths[path];
+		slot.counters.update([last, weight](hop_counters& h) noexcept {
+			const auto sample = static_cast<double>(last);
+			if (h.returned) {
+				// RFC 3550 6.4.1, the change in round trip stands in for the change in transit time
+				h.jitter += (std::abs(sample - h.last) - h.jitter) / 16.0;
+				h.ewma += weight * (sample - h.ewma);
+			}
+			else {
+				h.ewma = sample;
+			}
+			const auto delta = sample - h.mean;
+			h.mean += delta / (h.returned + 1);
+			h.m2 += delta * (sample - h.mean);
+			h.last = last;
+			h.total += last;
+			if (!h.returned || h.best > last) {
+				h.best = last;
+			}
+			if (h.worst < last) {
+				h.worst = last;
+			}
+			h.returned++;
+		});
+		slot.histogram.record(static_cast<std::uint32_t>(last));
+	}
+	void	AddXmit(int at, int path, const probe_result& reply, probe_backend::clock::time_point when) noexcept
+	{
+		host[at]->paths[path]->counters.update([](hop_counters& h) noexcept {
+			h.xmit++;
+		});
+		const auto history = host[at]->history.load(std::memory_order_acquire);
+		if (!history && !events && !capture) [[likely]] {
+			return;
+		}
+		const auto status = reply.reply_count ? reply.status : probe_status::timed_out;
+		if (history) {
+			history->record(when, status, reply.round_trip_time);
+		}
+		const probe_event event{ .time = when
+			, .responder = reply.reply_count ? reply.responder : SOCKADDR_INET{}
+			, .round_trip_time = reply.round_trip_time
+			, .session = session
+			, .ttl = static_cast<UCHAR>(at + 1)
+			, .status = status };
+		if (events) {
+			(void)events->push(event);
+		}
+		if (capture) {
+			(void)capture->probe(event);
 		}
-		host[at].returned++;
 	}
-	void	AddXmit(int at)
+
+	// every kind of probe calls this before it sends, only the first of a trace counts
+	void	NoteProbe() noexcept
 	{
-		std::unique_lock lock(ghMutex);
-		host[at].xmit++;
+		if (first_probe.load(std::memory_order_relaxed) >= 0) [[likely]] {
+			return;
+		}
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(backend->now() - trace_requested).count();
+		std::int64_t none = -1;
+		first_probe.compare_exchange_strong(none, std::max<std::int64_t>(elapsed, 0), std::memory_order_relaxed);
 	}
+	// traces the one destination, once the race has picked it
+	[[nodiscard("The task should be awaited")]]
+	trace_action	DoTrace(std::stop_token stop_token, SOCKADDR_INET address);
+	// probes one candidate of a race for the destination and reports back to it
+	detached_action	RaceTo(std::shared_ptr<destination_race> race, int racer, SOCKADDR_INET address);
 
-	template<class T>
 	[[nodiscard("The task should be awaited")]]
-	winrt::Windows::Foundation::IAsyncAction handleICMP(T remote_addr, std::stop_token stop_token, trace_thread& current);
+	trace_action handleICMP(SOCKADDR_INET remote_addr, std::stop_token stop_token, UCHAR ttl);
+	// the memory cap is for the whole trace, split evenly between the hops it may probe
+	[[nodiscard]]
+	std::shared_ptr<probe_history> NewHistory() const
+	{
+		const auto capacity = std::size_t{ options->getHistoryKiB() } * 1024 / probe_history::SAMPLE_SIZE / static_cast<std::size_t>(max_hops.load(std::memory_order_relaxed));
+		return capacity ? std::make_shared<probe_history>(capacity, trace_epoch) : nullptr;
+	}
+	// starts the loops for every TTL up to ttl that doesn't have one yet, and their hop slots
+	void	SpawnHops(int ttl);
+	// the hop slots up to ttl, with workers_mutex held or no trace running
+	void	AllocateHops(int ttl);
+	// probes every TTL at once, a few rounds at most, and sets hop_count from the nearest that reached the destination
+	[[nodiscard("The task should be awaited")]]
+	trace_action Discover(SOCKADDR_INET remote_addr, std::stop_token stop_token);
+	[[nodiscard("The task should be awaited")]]
+	trace_action DiscoverAt(SOCKADDR_INET remote_addr, UCHAR ttl, std::uint16_t sequence, std::atomic_int& found);
+	// lowers hop_count to ttl, or sets it if still unknown
+	void	ReachedAt(int ttl) noexcept
+	{
+		auto hops = hop_count.load(std::memory_order_relaxed);
+		while ((!hops || ttl < hops) && !hop_count.compare_exchange_weak(hops, ttl, std::memory_order_relaxed)) {
+		}
+	}
+	// what the trace actually sends, the backend may not do what the options ask for
+	[[nodiscard]]
+	probe_protocol ProbeProtocol() const noexcept
+	{
+		const auto protocol = options->getProbeProtocol();
+		return backend->supports(protocol) ? protocol : probe_protocol::icmp;
+	}
 };
\ No newline at end of file
@@ -18,6 +18,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 module;
+#ifdef _WIN32
 #pragma warning (disable : 4005)
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN
@@ -30,14 +31,37 @@ module;
 #define NOSERVICE
 #define NOMINMAX
 #include <winsock2.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
 module WinMTR.Net:Getters;
 
+#ifdef _WIN32
+import <cstddef>;
 import <cstring>;
+import <memory>;
+import <mutex>;
+import <algorithm>;
 import <vector>;
 import <iterator>;
-import <mutex>;
+import <array>;
+import <cmath>;
+import <chrono>;
+#endif
 import WinMTRSNetHost;
 import WinMTRIPUtils;
+import WinMTR.Histogram;
+import WinMTR.ProbeHistory;
 import :ClassDef;
 
 [[nodiscard]]
@@ -46,34 +70,120 @@ inline bool operator==(const SOCKADDR_INET& lhs, const SOCKADDR_INET& rhs) noexc
 }
 
 
+// every path is consistent in itself, paths are not consistent with each other
 [[nodiscard]]
 std::vector<s_nethost> WinMTRNet::getCurrentState() const
 {
-	std::unique_lock lock(ghMutex);
-	auto max = GetMax();
-	auto end = std::cbegin(host);
-	std::advance(end, max);
-	return std::vector<s_nethost>(std::cbegin(host), end);
+	std::vector<s_nethost> state;
+	state.reserve(GetMax());
+	std::size_t rows = 0;
+	getCurrentState(state, rows);
+	return state;
+}
+
+void WinMTRNet::getCurrentState(std::vector<s_nethost>& state, std::size_t& rows) const
+{
+	const auto max = GetMax();
+	for (int i = 0; i < max; ++i) {
+		const auto paths = host[i]->path_count.load(std::memory_order_acquire);
+		for (int path = 0; path < paths; ++path, ++rows) {
+			if (rows == state.size()) {
+				state.emplace_back();
+			}
+			getStateAt(i, path, state[rows]);
+		}
+	}
+}
+
+[[nodiscard]]
+s_nethost WinMTRNet::getStateAt(int at, int path) const
+{
+	s_nethost state;
+	getStateAt(at, path, state);
+	return state;
+}
+
+void WinMTRNet::getStateAt(int at, int path, s_nethost& state) const
+{
+	const auto& slot = *host[at]->paths[path];
+	const auto counters = slot.counters.load();
+	const auto percentiles = slot.histogram.percentiles();
+	state.addr = slot.addr.load();
+	state.asn = slot.asn.load(std::memory_order_relaxed);
+	state.ttl = at + 1;
+	state.path = path;
+	state.xmit = counters.xmit;
+	state.returned = counters.returned;
+	state.total = counters.total;
+	state.last = counters.last;
+	state.best = counters.best;
+	state.worst = counters.worst;
+	state.p50 = static_cast<int>(percentiles.p50);
+	state.p90 = static_cast<int>(percentiles.p90);
+	state.p99 = static_cast<int>(percentiles.p99);
+	state.p999 = static_cast<int>(percentiles.p999);
+	state.stddev = counters.returned > 1 ? std::sqrt(counters.m2 / (counters.returned - 1)) : 0.0;
+	state.jitter = counters.jitter;
+	state.ewma = counters.ewma;
+	// assigned rather than copied, so a reused row keeps its buffer
+	if (const auto name = slot.name.load(); name) {
+		state.name.assign(*name);
+	}
+	else {
+		state.name.clear();
+	}
+	state.late = static_cast<int>(slot.late->load(std::memory_order_relaxed));
+}
+
+void WinMTRNet::running(std::vector<running_trace>& traces)
+{
+	traces.clear();
+	std::scoped_lock lock(s_running_mutex);
+	for (const auto& entry : s_running) {
+		if (auto net = entry.net.lock()) {
+			traces.push_back({ .net = std::move(net), .session = entry.session, .destination = entry.destination });
+		}
+	}
+}
+
+[[nodiscard]]
+window_summary WinMTRNet::getWindowAt(int at, std::chrono::seconds window) const
+{
+	const auto history = host[at]->history.load(std::memory_order_acquire);
+	if (!history) {
+		return {};
+	}
+	return history->summarize(backend->now() - window);
 }
 
 [[nodiscard]]
 int WinMTRNet::GetMax() const
 {
-	std::unique_lock lock(ghMutex);
-	int max = MAX_HOPS;
+	// the loops may not have caught up with a fresh hop count yet
+	const auto allocated = hop_slots.load(std::memory_order_acquire);
+	if (const auto hops = hop_count.load(std::memory_order_relaxed)) {
+		return std::min(hops, allocated);
+	}
+	std::array<SOCKADDR_INET, MAX_HOPS> addrs;
+	int max = allocated;
+	for (int i = 0; i < allocated; ++i) {
+		addrs[i] = host[i]->paths[0]->addr.load();
+	}
 
-	// first match: traced address responds on ping requests, and the address is in the hosts list
-	for (int i = 1; const auto & h : host) {
-		if (h.addr == last_remote_addr) {
-			max = i;
-			break;
+	// first match: traced address responds on ping requests, and the address is in the hosts list, on any path
+	for (int i = 0; i < allocated && max == allocated; ++i) {
+		const auto paths = host[i]->path_count.load(std::memory_order_acquire);
+		for (int path = 0; path < paths; ++path) {
+			if (host[i]->paths[path]->addr.load() == last_remote_addr) {
+				max = i + 1;
+				break;
+			}
 		}
-		++i;
 	}
 
 	// second match:  traced address doesn't responds on ping requests
-	if (max == MAX_HOPS) {
-		while ((max > 1) && (host[max - 1].addr == host[max - 2].addr && isValidAddress(host[max - 1].addr))) max--;
+	if (max == allocated) {
+		while ((max > 1) && (addrs[max - 1] == addrs[max - 2] && isValidAddress(addrs[max - 1]))) max--;
 	}
 	return max;
 }
\ No newline at end of file
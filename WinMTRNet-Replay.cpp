@@ -0,0 +1,106 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOAPISET
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <chrono>
+#endif
+module WinMTR.Net:Replay;
+
+#ifdef _WIN32
+import <chrono>;
+#endif
+import WinMTRIPUtils;
+import WinMTR.Capture;
+import WinMTR.ProbeBackend;
+import :ClassDef;
+
+void WinMTRNet::Replay(const capture_file& recorded, std::size_t from)
+{
+	capture_file::cursor records(recorded, from);
+	capture_record record;
+	if (!records.next(record) || record.kind != capture_kind::trace) {
+		return;
+	}
+	const auto traced = record.session;
+	// the capture's own clock stands in for the backend's
+	const auto at_time = [](const capture_record& r) noexcept {
+		return probe_backend::clock::time_point(std::chrono::duration_cast<probe_backend::clock::duration>(r.time));
+	};
+	ResetHops(record.ttl, at_time(record));
+	last_remote_addr = record.address;
+	hop_count = 0;
+	probes_skipped = 0;
+	discovery_probes = 0;
+	first_probe = -1;
+	race_winner = AF_UNSPEC;
+	// nothing counted again is recorded again
+	events = nullptr;
+	capture = nullptr;
+	replaying = true;
+	const auto limit = max_hops.load(std::memory_order_relaxed);
+	while (records.next(record)) {
+		// other traces of the same time are in between
+		if (record.session != traced) {
+			continue;
+		}
+		// the same session traced again, which is a trace of its own
+		if (record.kind == capture_kind::trace) {
+			break;
+		}
+		if (!record.ttl || record.ttl > limit) {
+			continue;
+		}
+		const auto at = record.ttl - 1;
+		AllocateHops(record.ttl);
+		if (record.kind == capture_kind::probe) {
+			const auto timed_out = record.status == probe_status::timed_out;
+			Tally(at, probe_result{ .responder = timed_out ? SOCKADDR_INET{} : record.address
+				, .reply_count = timed_out ? 0u : 1u
+				, .status = record.status
+				, .round_trip_time = record.round_trip_time }, at_time(record));
+			continue;
+		}
+		// the name goes on whichever path the address ended up on
+		const auto& hop = *host[at];
+		const auto paths = hop.path_count.load(std::memory_order_relaxed);
+		for (int path = 0; path < paths; ++path) {
+			const auto known = hop.paths[path]->addr.load_exclusive();
+			if (same_address(known, record.address)) {
+				SetName(at, path, record.name);
+				break;
+			}
+		}
+	}
+	replaying = false;
+}
@@ -18,6 +18,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 module;
+#ifdef _WIN32
 #pragma warning (disable : 4005)
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN
@@ -31,11 +32,26 @@ module;
 #define NOMINMAX
 #include <winsock2.h>
 #include <WS2tcpip.h>
-#include <Ipexport.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string_view>
+#include <vector>
+#endif
 module WinMTR.Net:Tracing;
 
 
-#ifdef DEBUG
+// OutputDebugStringW has no counterpart elsewhere
+#if defined(DEBUG) && defined(_WIN32)
 import <sstream>;
 #define TRACE_MSG(msg)										\
 	{														\
@@ -47,110 +63,234 @@ import <sstream>;
 #define TRACE_MSG(msg)
 #endif
 
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
 import <string_view>;
-import <mutex>;
 import <cstring>;
+import <memory>;
+import <mutex>;
+import <vector>;
 import <winrt/Windows.Foundation.h>;
-import "WinMTRICMPPIOdef.h";
+#endif
 import WinMTRIPUtils;
-import WinMTRICMPUtils;
+import WinMTR.ProbeBackend;
+import WinMTR.AsnDatabase;
+import WinMTR.NameCache;
+import WinMTR.ProbeHistory;
+import WinMTR.RttEstimator;
 import :ClassDef;
 
-struct ICMPHandleTraits
-{
-	using type = HANDLE;
+namespace {
+	// discovery gives up on a TTL sooner than the trace does, a slow destination is still caught by its own loop
+	constexpr auto DISCOVERY_TIMEOUT = std::chrono::milliseconds(1000);
+	constexpr auto DISCOVERY_ROUNDS = 3;
+	// discovery rounds take their sequences from here up, clear of the race's below 0xFFFF and of where the loops count from
+	constexpr std::uint16_t DISCOVERY_SEQUENCE = 0xFE00;
+	constexpr std::uint16_t DISCOVERY_SEQUENCES = 0x100;
+	// the loops count from 1 up to just short of discovery's and start over, never onto 0 or the sequences kept for the others
+	[[nodiscard]]
+	constexpr std::uint16_t next_loop_sequence(std::uint16_t sequence) noexcept {
+		return sequence + 1u < DISCOVERY_SEQUENCE ? static_cast<std::uint16_t>(sequence + 1u) : std::uint16_t{ 1 };
+	}
+	static_assert(next_loop_sequence(0) == 1 && next_loop_sequence(DISCOVERY_SEQUENCE - 1) == 1);
+	// each family gets this long to answer the race before the trace settles for the resolver's first choice
+	constexpr auto RACE_TIMEOUT = DISCOVERY_TIMEOUT;
+	// how many probes in a row the destination's TTL has to expire before the path counts as longer
+	constexpr auto EXPIRED_AT_DESTINATION = 3;
 
-	static void close(type value) noexcept
+	// UDP and TCP probes carry the destination port in the address
+	void set_port(SOCKADDR_INET& addr, unsigned port) noexcept
 	{
-		WINRT_VERIFY_(TRUE, ::IcmpCloseHandle(value));
+		if (addr.si_family == AF_INET) {
+			addr.Ipv4.sin_port = htons(static_cast<USHORT>(port));
+		}
+		else {
+			addr.Ipv6.sin6_port = htons(static_cast<USHORT>(port));
+		}
 	}
 
+	// what one probe costs the byte rate, headers included
 	[[nodiscard]]
-	static type invalid() noexcept
+	std::size_t wire_size(ADDRESS_FAMILY family, probe_protocol protocol, std::size_t payload) noexcept
 	{
-		return INVALID_HANDLE_VALUE;
+		return (family == AF_INET6 ? 40u : 20u) + (protocol == probe_protocol::tcp ? 20u : 8u + payload);
 	}
-};
-
-using IcmpHandle = winrt::handle_type<ICMPHandleTraits>;
+}
 
-struct trace_thread final {
-	trace_thread(const trace_thread&) = delete;
-	trace_thread& operator=(const trace_thread&) = delete;
-	trace_thread(trace_thread&&) = default;
-	trace_thread& operator=(trace_thread&&) = default;
+[[nodiscard("The task should be awaited")]]
+trace_action WinMTRNet::DoTrace(std::stop_token stop_token, std::vector<SOCKADDR_INET> candidates, probe_backend::clock::time_point requested)
+{
+	trace_requested = requested;
+	first_probe = -1;
+	race_winner = AF_UNSPEC;
+	if (candidates.empty()) {
+		co_return;
+	}
+	auto address = candidates.front();
+	const auto ipv6 = std::ranges::find(candidates, AF_INET6, &SOCKADDR_INET::si_family);
+	const auto ipv4 = std::ranges::find(candidates, AF_INET, &SOCKADDR_INET::si_family);
+	if (ipv6 != candidates.end() && ipv4 != candidates.end() && !stop_token.stop_requested()) {
+		// the first racer is the resolver's first choice, which wins a tie
+		const std::array racers{ address, address.si_family == AF_INET6 ? *ipv4 : *ipv6 };
+		auto race = std::make_shared<destination_race>(static_cast<int>(racers.size()));
+		for (int racer = 0; racer < static_cast<int>(racers.size()); ++racer) {
+			RaceTo(race, racer, racers[racer]);
+		}
+		if (const auto winner = co_await race->decided(); winner >= 0) {
+			address = racers[winner];
+			race_winner = address.si_family;
+		}
+		TRACE_MSG(L"Race won by family " << address.si_family);
+	}
+	co_await DoTrace(stop_token, address);
+}
 
-	trace_thread(ADDRESS_FAMILY af, UCHAR ttl) noexcept
-		:ttl(ttl)
-	{
-		if (af == AF_INET) {
-			icmpHandle.attach(IcmpCreateFile());
+detached_action WinMTRNet::RaceTo(std::shared_ptr<destination_race> race, int racer, SOCKADDR_INET address)
+{
+	// the loser may still be waiting on its answer long after the trace moved on
+	auto sharedThis = shared_from_this();
+	// a family that can't be sent to has lost, DoTrace still waits for it to say so
+	auto answered = false;
+	try {
+		co_await backend->resume_after({});
+		const std::vector<std::byte> payload{ options->getPingSize(), static_cast<std::byte>(32) };
+		// as far out as the trace will go, and a sequence of its own so nothing the trace sends next can be mistaken for the answer
+		const probe_key key{ .session = session
+			, .ttl = static_cast<UCHAR>(std::clamp(static_cast<int>(options->getMaxHops()), 1, MAX_HOPS))
+			, .sequence = static_cast<std::uint16_t>(0xFFFF - racer)
+			, .flow = static_cast<std::uint16_t>(session)
+			, .protocol = ProbeProtocol() };
+		if (key.protocol != probe_protocol::icmp) {
+			set_port(address, options->getProbePort());
 		}
-		else if (af == AF_INET6) {
-			icmpHandle.attach(Icmp6CreateFile());
+		const auto paced = backend->pace(wire_size(address.si_family, key.protocol, payload.size()), options->getMaxProbeRate(), options->getMaxByteRate());
+		if (paced.wait > probe_backend::clock::duration::zero()) {
+			co_await backend->resume_after(paced.wait);
 		}
+		NoteProbe();
+		const auto reply = co_await backend->send(key, address, payload, RACE_TIMEOUT, nullptr, paced);
+		answered = reply.reply_count && reply.status == probe_status::success;
 	}
-	IcmpHandle icmpHandle;
-	UCHAR		ttl;
-};
+#ifdef _WIN32
+	catch (winrt::hresult_error const&) {
+		// the backend couldn't take the probe, this family lost
+	}
+#endif
+	catch (std::exception const&) {
+		// a family without a route fails its send, it lost too
+	}
+	race->finish(racer, answered);
+}
 
 [[nodiscard("The task should be awaited")]]
-winrt::Windows::Foundation::IAsyncAction WinMTRNet::DoTrace(std::stop_token stop_token, SOCKADDR_INET address)
+trace_action WinMTRNet::DoTrace(std::stop_token stop_token, SOCKADDR_INET address)
 {
 	tracing = true;
 	ResetHops();
+	events = event_log::instance();
+	capture = capture_writer::instance();
+	probes_skipped = 0;
+	discovery_probes = 0;
+	// the hop count found last time holds for as long as the destination does, the loops notice if the path changes
+	const auto rediscover = !hop_count || hop_count > max_hops || std::memcmp(&address, &last_remote_addr, sizeof(address)) != 0;
 	last_remote_addr = address;
-
-	auto threadMaker = [&address, this, stop_token](UCHAR i) {
-		trace_thread current{ address.si_family, static_cast<UCHAR>(i + 1) };
-		using namespace std::string_view_literals;
-		TRACE_MSG(L"Thread with TTL="sv << current.ttl << L" started."sv);
-		if (address.si_family == AF_INET) {
-			return this->handleICMP(address.Ipv4, stop_token, current);
-		}
-		else if (address.si_family == AF_INET6) {
-			return this->handleICMP(address.Ipv6, stop_token, current);
-		}
-		winrt::throw_hresult(HRESULT_FROM_WIN32(WSAEOPNOTSUPP));
-	};
+	// scrapes see the trace until it winds down
+	const running_entry entry(*this, address);
+	if (capture) {
+		(void)capture->trace(session, trace_epoch, address, max_hops);
+	}
+	{
+		std::scoped_lock lock(workers_mutex);
+		workers.clear();
+		hop_loops.store(0, std::memory_order_relaxed);
+		trace_stop = stop_token;
+	}
 
 	std::stop_callback callback{ stop_token, [this]() noexcept {
 		this->tracing = false;
 	TRACE_MSG(L"Cancellation");
 		} };
-	//// one thread per TTL value
-	co_await std::invoke([]<UCHAR ...threads>(std::integer_sequence<UCHAR, threads...>, auto threadMaker) {
-		return winrt::when_all(std::invoke(threadMaker, threads)...);
-	}, std::make_integer_sequence<UCHAR, MAX_HOPS>{}, threadMaker);
+	if (rediscover) {
+		co_await Discover(address, stop_token);
+	}
+	// one worker per TTL up to the destination, or up to the limit while it is unknown, all of them share the backend's sockets
+	const auto hops = hop_count.load(std::memory_order_relaxed);
+	SpawnHops(hops ? hops : max_hops.load(std::memory_order_relaxed));
+	// workers spawned later go on the end, so this only runs out once every one of them has finished
+	for (std::size_t i = 0;; ++i) {
+		trace_action worker{ nullptr };
+		{
+			std::scoped_lock lock(workers_mutex);
+			if (i == workers.size()) {
+				break;
+			}
+			worker = workers[i];
+		}
+		co_await worker;
+	}
 	TRACE_MSG(L"Tracing Ended");
 }
 
-template<class T>
-requires std::is_same_v<sockaddr_in, T> || std::is_same_v<sockaddr_in6, T>
-constexpr SOCKADDR_INET to_sockaddr_inet(T addr) noexcept {
-	if constexpr (std::is_same_v<sockaddr_in, T>) {
-		return { .Ipv4 = addr };
+void WinMTRNet::SpawnHops(int ttl)
+{
+	ttl = std::min(ttl, max_hops.load(std::memory_order_relaxed));
+	std::scoped_lock lock(workers_mutex);
+	if (!tracing) {
+		return;
 	}
-	else {
-		return { .Ipv6 = addr };
+	// every loop needs its slot before it starts
+	AllocateHops(ttl);
+	// a new loop suspends before it gets anywhere near the lock
+	for (auto next = static_cast<int>(workers.size()) + 1; next <= ttl; ++next) {
+		using namespace std::string_view_literals;
+		TRACE_MSG(L"Thread with TTL="sv << next << L" started."sv);
+		workers.push_back(handleICMP(last_remote_addr, trace_stop, static_cast<UCHAR>(next)));
+	}
+	hop_loops.store(static_cast<int>(workers.size()), std::memory_order_relaxed);
+}
+
+void WinMTRNet::AllocateHops(int ttl)
+{
+	for (auto allocated = hop_slots.load(std::memory_order_relaxed); allocated < ttl; ++allocated) {
+		host[allocated] = std::make_unique<hop_slot>();
+		host[allocated]->history.store(NewHistory());
+		hop_slots.store(allocated + 1, std::memory_order_release);
 	}
 }
 
-template<class T>
 [[nodiscard("The task should be awaited")]]
-winrt::Windows::Foundation::IAsyncAction WinMTRNet::handleICMP(T remote_addr, std::stop_token stop_token, trace_thread& current) {
+trace_action WinMTRNet::handleICMP(SOCKADDR_INET remote_addr, std::stop_token stop_token, UCHAR ttl) {
 	using namespace std::literals;
-	using traits = icmp_ping_traits<T>;
-	trace_thread mine = std::move(current);
-	T local_addr = remote_addr;
-	co_await winrt::resume_background();
+	// hop onto the backend's threads, a simulated backend only advances its clock once every worker is waiting on it
+	co_await this->backend->resume_after({});
 	using namespace std::string_view_literals;
 	const auto				nDataLen = this->options->getPingSize();
 	std::vector<std::byte>	achReqData{ nDataLen, static_cast<std::byte>(32) }; //whitespaces
-	std::vector<std::byte> achRepData{ reply_reply_buffer_size<T>(nDataLen) };
-	winrt::handle wait_handle{ CreateEventW(nullptr, FALSE, FALSE, nullptr) };
+	probe_key key{ .session = this->session, .ttl = ttl };
+	// Paris traceroute: one flow for every probe of the trace, so each hop is found on the same path as the one before it
+	const auto paris = this->options->getParisMode();
+	key.flow = static_cast<std::uint16_t>(this->session);
+	key.protocol = this->ProbeProtocol();
+	// UDP walks the port range like classic traceroute unless the flow has to stay put
+	constexpr unsigned UDP_PORT_SPAN = 100;
+	const auto firstPort = this->options->getProbePort();
+	const auto portFor = [&](std::uint16_t sequence) noexcept {
+		auto port = firstPort;
+		if (key.protocol == probe_protocol::udp && !paris) {
+			port += (sequence - 1u) % UDP_PORT_SPAN;
+			if (port > 65535u) {
+				port -= UDP_PORT_SPAN;
+			}
+		}
+		return port;
+	};
+	// how long this hop is worth waiting for, anything slower is counted as late instead of lost
+	rtt_estimator rto{ MIN_PROBE_TIMEOUT, DEFAULT_PROBE_TIMEOUT };
+	auto& hop = *this->host[ttl - 1];
+	const auto probeBytes = wire_size(remote_addr.si_family, key.protocol, nDataLen);
+	int expiredAtDestination = 0;
 
-	T* addr = reinterpret_cast<T*>(&local_addr);
 	while (this->tracing) {
 
 		// this is a backup for if the atomic above doesn't work
@@ -159,9 +299,14 @@ winrt::Windows::Foundation::IAsyncAction WinMTRNet::handleICMP(T remote_addr, st
 			this->tracing = false;
 			co_return;
 		}
-			// For some strange reason, ICMP API is not filling the TTL for icmp echo reply
-			// Check if the current thread should be closed
-		if (mine.ttl > this->GetMax()) break;
+		// Past the destination there is nothing to learn, but the loop stays
+		// around in case the path grows. Until discovery knows better the
+		// responders have to do for a guess.
+		if (const auto hops = this->hop_count.load(std::memory_order_relaxed); hops ? ttl > hops : ttl > this->GetMax()) {
+			this->probes_skipped.fetch_add(1, std::memory_order_relaxed);
+			co_await this->backend->resume_after(std::chrono::duration_cast<probe_backend::clock::duration>(this->options->getInterval() * 1s));
+			continue;
+		}
 
 		// NOTE: some servers does not respond back everytime, if TTL expires in transit; e.g. :
 		// ping -n 20 -w 5000 -l 64 -i 7 www.chinapost.com.tw  -> less that half of the replies are coming back from 219.80.240.93
@@ -170,125 +315,254 @@ winrt::Windows::Foundation::IAsyncAction WinMTRNet::handleICMP(T remote_addr, st
 		// - as soon as we get a hop, we start pinging directly that hop, with a greater TTL
 		// - a drawback would be that, some servers are configured to reply for TTL transit expire, but not to ping requests, so,
 		// for these servers we'll have 100% loss
-		const auto dwReplyCount = co_await IcmpSendEchoAsync(mine.icmpHandle.get(), wait_handle.get(), addr, mine.ttl, achReqData, achRepData);
-		this->AddXmit(mine.ttl - 1);
-		if (dwReplyCount) {
-			auto icmp_echo_reply = reinterpret_cast<traits::reply_type_ptr>(achRepData.data());
-			TRACE_MSG(L"TTL "sv << mine.ttl << L" Status "sv << icmp_echo_reply->Status << L" Reply count "sv << dwReplyCount);
-
-			switch (icmp_echo_reply->Status) {
-			case IP_SUCCESS:
-			[[likely]] case IP_TTL_EXPIRED_TRANSIT:
-				this->addNewReturn(mine.ttl - 1, icmp_echo_reply->RoundTripTime);
-				{
-					auto naddr = traits::to_addr_from_ping(icmp_echo_reply);
-					this->SetAddr(mine.ttl - 1, to_sockaddr_inet(naddr));
-				}
-				break;
-			case IP_BUF_TOO_SMALL:
-				this->SetName(current.ttl - 1, L"Reply buffer too small."s);
-				break;
-			case IP_DEST_NET_UNREACHABLE:
-				this->SetName(current.ttl - 1, L"Destination network unreachable."s);
-				break;
-			case IP_DEST_HOST_UNREACHABLE:
-				this->SetName(current.ttl - 1, L"Destination host unreachable."s);
-				break;
-			case IP_DEST_PROT_UNREACHABLE:
-				this->SetName(current.ttl - 1, L"Destination protocol unreachable."s);
-				break;
-			case IP_DEST_PORT_UNREACHABLE:
-				this->SetName(current.ttl - 1, L"Destination port unreachable."s);
-				break;
-			case IP_NO_RESOURCES:
-				this->SetName(current.ttl - 1, L"Insufficient IP resources were available."s);
-				break;
-			case IP_BAD_OPTION:
-				this->SetName(current.ttl - 1, L"Bad IP option was specified."s);
-				break;
-			case IP_HW_ERROR:
-				this->SetName(current.ttl - 1, L"Hardware error occurred."s);
-				break;
-			case IP_PACKET_TOO_BIG:
-				this->SetName(current.ttl - 1, L"Packet was too big."s);
-				break;
-			case IP_REQ_TIMED_OUT:
-				this->SetName(current.ttl - 1, L"Request timed out."s);
-				break;
-			case IP_BAD_REQ:
-				this->SetName(current.ttl - 1, L"Bad request."s);
-				break;
-			case IP_BAD_ROUTE:
-				this->SetName(current.ttl - 1, L"Bad route."s);
-				break;
-			case IP_TTL_EXPIRED_REASSEM:
-				this->SetName(current.ttl - 1, L"The time to live expired during fragment reassembly."s);
-				break;
-			case IP_PARAM_PROBLEM:
-				this->SetName(current.ttl - 1, L"Parameter problem."s);
-				break;
-			case IP_SOURCE_QUENCH:
-				this->SetName(current.ttl - 1, L"Datagrams are arriving too fast to be processed and datagrams may have been discarded."s);
-				break;
-			case IP_OPTION_TOO_BIG:
-				this->SetName(current.ttl - 1, L"An IP option was too big."s);
-				break;
-			case IP_BAD_DESTINATION:
-				this->SetName(current.ttl - 1, L"Bad destination."s);
-				break;
-			case IP_GENERAL_FAILURE:
-			default:
-				this->SetName(current.ttl - 1, L"General failure."s);
+		key.sequence = next_loop_sequence(key.sequence);
+		if (!paris) {
+			key.flow = key.sequence;
+		}
+		if (key.protocol != probe_protocol::icmp) {
+			set_port(remote_addr, portFor(key.sequence));
+		}
+		// the shared token bucket has the last word on how fast anything goes out
+		const auto paced = this->backend->pace(probeBytes, this->options->getMaxProbeRate(), this->options->getMaxByteRate());
+		if (paced.wait > probe_backend::clock::duration::zero()) {
+			co_await this->backend->resume_after(paced.wait);
+			if (!this->tracing) {
+				this->backend->rate_limit().refund(paced);
 				break;
 			}
-			const auto intervalInSec = this->options->getInterval() * 1s;
-			const auto roundTripDuration = std::chrono::milliseconds(icmp_echo_reply->RoundTripTime);
-			if (intervalInSec > roundTripDuration) {
-				using namespace winrt;
-				const auto sleepTime = intervalInSec - roundTripDuration;
-				co_await std::chrono::duration_cast<winrt::Windows::Foundation::TimeSpan>(sleepTime);
+		}
+		const auto timeout = rto.timeout();
+		const auto sent = this->backend->now();
+		this->NoteProbe();
+		// the TTLs past the destination that have no loop of their own skip a probe with every one of its loop
+		if (ttl == this->hop_count.load(std::memory_order_relaxed)) {
+			this->probes_skipped.fetch_add(std::max(0, this->max_hops.load(std::memory_order_relaxed) - this->hop_loops.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+		}
+		// a late answer goes where the timeout will, on the path the last answer came from
+		const auto reply = co_await this->backend->send(key, remote_addr, achReqData, timeout, hop.paths[hop.current]->late, paced);
+		this->Tally(ttl - 1, reply, this->backend->now());
+		if (reply.reply_count) {
+			if (reply.status == probe_status::success || reply.status == probe_status::ttl_expired) [[likely]] {
+				rto.sample(reply.round_trip_time);
 			}
+			// a nearer destination is known right away, a farther one takes another discovery
+			if (reply.status == probe_status::success) {
+				expiredAtDestination = 0;
+			}
+			else if (reply.status == probe_status::ttl_expired && ttl == this->hop_count.load(std::memory_order_relaxed)
+				&& ++expiredAtDestination >= EXPIRED_AT_DESTINATION && !this->rediscovering.exchange(true)) {
+				expiredAtDestination = 0;
+				co_await this->Discover(remote_addr, stop_token);
+				this->rediscovering = false;
+				const auto hops = this->hop_count.load(std::memory_order_relaxed);
+				this->SpawnHops(hops ? hops : this->max_hops.load(std::memory_order_relaxed));
+			}
+		}
+		else {
+			rto.back_off();
+		}
+		// The interval runs from when the probe went out, so the time spent
+		// waiting on the answer or the timeout counts towards it. Time the
+		// token bucket held the probe back doesn't, that is the cap at work.
+		const auto next = sent + std::chrono::duration_cast<probe_backend::clock::duration>(this->options->getInterval() * 1s);
+		if (const auto now = this->backend->now(); next > now) {
+			co_await this->backend->resume_after(next - now);
 		}
 
 	} /* end ping loop */
 	co_return;
 }
 
-winrt::fire_and_forget	WinMTRNet::SetAddr(int at, SOCKADDR_INET addr)
+[[nodiscard("The task should be awaited")]]
+trace_action WinMTRNet::Discover(SOCKADDR_INET remote_addr, std::stop_token stop_token)
 {
-	{
-		std::unique_lock lock(ghMutex);
-		if (isValidAddress(host[at].addr) || !isValidAddress(addr)) {
+	for (int round = 0; round < DISCOVERY_ROUNDS && this->tracing && !stop_token.stop_requested(); ++round) {
+		std::atomic_int found{ 0 };
+		// a reply that turns up after its round timed out must not be taken for this round's
+		const auto sequence = static_cast<std::uint16_t>(DISCOVERY_SEQUENCE + this->discovery_round++ % DISCOVERY_SEQUENCES);
+		const auto limit = this->max_hops.load(std::memory_order_relaxed);
+		std::vector<trace_action> probes;
+		probes.reserve(limit);
+		for (int ttl = 1; ttl <= limit; ++ttl) {
+			probes.push_back(this->DiscoverAt(remote_addr, static_cast<UCHAR>(ttl), sequence, found));
+		}
+		// they all run at once, this only collects them
+		for (auto& probe : probes) {
+			co_await probe;
+		}
+		if (const auto hops = found.load(std::memory_order_relaxed)) {
+			this->hop_count = hops;
 			co_return;
 		}
-		host[at].addr = addr;
-		//TRACE_MSG(L"Start DnsResolverThread for new address " << addr << L". Old addr value was " << host[at].addr);
 	}
-	if (!options->getUseDNS()) {
-		co_return;
+	// it never answered, the loops fall back on guessing from the responders
+	this->hop_count = 0;
+}
+
+[[nodiscard("The task should be awaited")]]
+trace_action WinMTRNet::DiscoverAt(SOCKADDR_INET remote_addr, UCHAR ttl, std::uint16_t sequence, std::atomic_int& found)
+{
+	co_await this->backend->resume_after({});
+	const std::vector<std::byte> payload{ this->options->getPingSize(), static_cast<std::byte>(32) };
+	// one flow for every TTL, so the hop count belongs to a single path
+	const probe_key key{ .session = this->session, .ttl = ttl, .sequence = sequence, .flow = static_cast<std::uint16_t>(this->session), .protocol = this->ProbeProtocol() };
+	if (key.protocol != probe_protocol::icmp) {
+		set_port(remote_addr, this->options->getProbePort());
+	}
+	const auto paced = this->backend->pace(wire_size(remote_addr.si_family, key.protocol, payload.size()), this->options->getMaxProbeRate(), this->options->getMaxByteRate());
+	if (paced.wait > probe_backend::clock::duration::zero()) {
+		co_await this->backend->resume_after(paced.wait);
 	}
+	this->discovery_probes.fetch_add(1, std::memory_order_relaxed);
+	this->NoteProbe();
+	const auto reply = co_await this->backend->send(key, remote_addr, payload, DISCOVERY_TIMEOUT, nullptr, paced);
+	if (reply.reply_count && reply.status == probe_status::success) {
+		auto nearest = found.load(std::memory_order_relaxed);
+		while ((!nearest || ttl < nearest) && !found.compare_exchange_weak(nearest, ttl, std::memory_order_relaxed)) {
+		}
+	}
+}
+
+int WinMTRNet::PathFor(int at, const probe_result& reply)
+{
+	auto& hop = *host[at];
+	// timeouts and errors can't tell which way they went, count them on the way the last answer came
+	if (!reply.reply_count || !probe_history::replied(reply.status) || !isValidAddress(reply.responder)) {
+		return hop.current;
+	}
+	const auto count = hop.path_count.load(std::memory_order_relaxed);
+	for (int i = 0; i < count; ++i) {
+		const auto known = hop.paths[i]->addr.load_exclusive();
+		if (same_address(known, reply.responder)) {
+			return hop.current = i;
+		}
+	}
+	// the first responder takes over the row that has been counting the timeouts so far
+	if (!isValidAddress(hop.paths[0]->addr.load_exclusive())) {
+		return hop.current = 0;
+	}
+	if (count == MAX_PATHS) {
+		return hop.current = MAX_PATHS - 1;
+	}
+	if (!hop.paths[count]) {
+		hop.paths[count] = std::make_unique<path_slot>();
+	}
+	hop.path_count.store(count + 1, std::memory_order_release);
+	return hop.current = count;
+}
+
+void WinMTRNet::Tally(int at, const probe_result& reply, probe_backend::clock::time_point when)
+{
+	using namespace std::string_view_literals;
+	const auto path = PathFor(at, reply);
+	AddXmit(at, path, reply, when);
+	if (reply.reply_count) {
+		TRACE_MSG(L"TTL "sv << at + 1 << L" Status "sv << static_cast<int>(reply.status) << L" Reply count "sv << reply.reply_count);
+
+		switch (reply.status) {
+		case probe_status::success:
+		[[likely]] case probe_status::ttl_expired:
+			addNewReturn(at, path, reply.round_trip_time);
+			SetAddr(at, path, reply.responder);
+			break;
+		case probe_status::buffer_too_small:
+			SetName(at, path, L"Reply buffer too small."sv);
+			break;
+		case probe_status::dest_net_unreachable:
+			SetName(at, path, L"Destination network unreachable."sv);
+			break;
+		case probe_status::dest_host_unreachable:
+			SetName(at, path, L"Destination host unreachable."sv);
+			break;
+		case probe_status::dest_prot_unreachable:
+			SetName(at, path, L"Destination protocol unreachable."sv);
+			break;
+		case probe_status::dest_port_unreachable:
+			SetName(at, path, L"Destination port unreachable."sv);
+			break;
+		case probe_status::no_resources:
+			SetName(at, path, L"Insufficient IP resources were available."sv);
+			break;
+		case probe_status::bad_option:
+			SetName(at, path, L"Bad IP option was specified."sv);
+			break;
+		case probe_status::hw_error:
+			SetName(at, path, L"Hardware error occurred."sv);
+			break;
+		case probe_status::packet_too_big:
+			SetName(at, path, L"Packet was too big."sv);
+			break;
+		case probe_status::timed_out:
+			SetName(at, path, L"Request timed out."sv);
+			break;
+		case probe_status::bad_request:
+			SetName(at, path, L"Bad request."sv);
+			break;
+		case probe_status::bad_route:
+			SetName(at, path, L"Bad route."sv);
+			break;
+		case probe_status::ttl_expired_reassembly:
+			SetName(at, path, L"The time to live expired during fragment reassembly."sv);
+			break;
+		case probe_status::param_problem:
+			SetName(at, path, L"Parameter problem."sv);
+			break;
+		case probe_status::source_quench:
+			SetName(at, path, L"Datagrams are arriving too fast to be processed and datagrams may have been discarded."sv);
+			break;
+		case probe_status::option_too_big:
+			SetName(at, path, L"An IP option was too big."sv);
+			break;
+		case probe_status::bad_destination:
+			SetName(at, path, L"Bad destination."sv);
+			break;
+		case probe_status::general_failure:
+		default:
+			SetName(at, path, L"General failure."sv);
+			break;
+		}
+		if (reply.status == probe_status::success) {
+			ReachedAt(at + 1);
+		}
+	}
+}
+
+void WinMTRNet::SetAddr(int at, int path, SOCKADDR_INET addr) noexcept
+{
+	// only the trace loop for this hop gets here, so nobody can store in between
+	auto& slot = *host[at]->paths[path];
+	if (isValidAddress(slot.addr.load_exclusive()) || !isValidAddress(addr)) [[likely]] {
+		return;
+	}
+	slot.addr.store(addr);
+	// the table is mapped, so this is a few reads and nothing to wait for
+	if (const auto asns = asn_database::instance()) {
+		slot.asn.store(asns->lookup(addr).asn, std::memory_order_relaxed);
+	}
+	//TRACE_MSG(L"Start DnsResolverThread for new address " << addr << L". Old addr value was " << host[at]->addr);
+	if (!replaying && options->getUseDNS()) {
+		ResolveName(at, path);
+	}
+}
+
+detached_action	WinMTRNet::ResolveName(int at, int path)
+{
 	auto local_at = at;
+	auto local_path = path;
 	// this could happen after a cleanup is called, so keep this alive until the coroutine returns
 	auto sharedThis = shared_from_this();
-	co_await winrt::resume_background();
-	wchar_t buf[NI_MAXHOST] = {};
-	auto tempaddr = sharedThis->GetAddr(local_at);
-
-	if (const auto nresult = GetNameInfoW(
-		reinterpret_cast<sockaddr*>(&tempaddr)
-		, static_cast<socklen_t>(getAddressSize(tempaddr))
-		, buf
-		, static_cast<DWORD>(std::size(buf))
-		, nullptr
-		, 0
-		, 0);
-		// zero on success
-		!nresult) {
-		sharedThis->SetName(local_at, buf);
+	// the next trace can't take its place before this one's loops are done, and they still are
+	const auto recorder = sharedThis->capture;
+	const auto tempaddr = sharedThis->GetAddr(local_at, local_path);
+	// every trace in the process asks the same cache, a router is only looked up once for all of them
+	auto name = co_await name_cache::instance()->lookup(tempaddr);
+	if (!name) {
+		name = std::make_shared<const std::wstring>(addr_to_string(tempaddr));
 	}
-	else {
-		sharedThis->SetName(local_at, addr_to_string(tempaddr));
+	if (recorder) {
+		(void)recorder->name(sharedThis->session, sharedThis->backend->now(), static_cast<UCHAR>(local_at + 1), tempaddr, *name);
 	}
+	sharedThis->SetName(local_at, local_path, std::move(name));
 
 	TRACE_MSG(L"DNS resolver thread stopped.");
 }
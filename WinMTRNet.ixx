@@ -30,4 +30,5 @@ export import :ClassDef;
 module : private;
 
 import :Getters;
+import :Replay;
 import :Tracing;
@@ -34,6 +34,9 @@ module;
 #include "resource.h"
 export module WinMTR.Options;
 
+import <vector>;
+import WinMTR.ProbeBackend;
+
 //*****************************************************************************
 // CLASS:  WinMTROptions
 //
@@ -50,6 +53,9 @@ public:
 	inline void SetMaxLRU(int mlru) noexcept { maxLRU = mlru; };
 	inline void SetUseIPv4(bool uip4) noexcept { useIPv4 = uip4; }
 	inline void SetUseIPv6(bool uip6) noexcept { useIPv6 = uip6; }
+	inline void SetProbeProtocol(probe_protocol p, unsigned port) noexcept { protocol = p; probePort = port; }
+	// the choices offered, in the order they are added
+	inline void AddProtocol(probe_protocol p) { protocols.push_back(p); }
 
 	inline auto GetInterval() const noexcept { return interval; };
 	inline auto GetPingSize() const noexcept { return pingsize; };
@@ -57,6 +63,8 @@ public:
 	inline auto GetUseDNS() const noexcept { return useDNS; }
 	inline auto GetUseIPv4() const noexcept { return useIPv4; }
 	inline auto GetUseIPv6() const noexcept { return useIPv6; }
+	inline auto GetProbeProtocol() const noexcept { return protocol; }
+	inline auto GetProbePort() const noexcept { return probePort; }
 
 	enum { IDD = IDD_DIALOG_OPTIONS };
 	CEdit	m_editSize;
@@ -65,6 +73,8 @@ public:
 	CButton	m_checkDNS;
 	CButton m_useIPv4;
 	CButton m_useIPv6;
+	CComboBox m_comboProtocol;
+	CEdit	m_editPort;
 
 protected:
 	void DoDataExchange(CDataExchange* pDX) override;
@@ -82,6 +92,9 @@ private:
 	bool     useDNS = false;
 	bool	 useIPv4 = true;
 	bool	 useIPv6 = true;
+	probe_protocol protocol = probe_protocol::icmp;
+	unsigned probePort = 0;
+	std::vector<probe_protocol> protocols;
 
 public:
 	afx_msg void OnBnClickedIpv4Check();
@@ -141,6 +154,8 @@ void WinMTROptions::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_CHECK_DNS, m_checkDNS);
 	DDX_Control(pDX, IDC_USEIPV6_CHECK, m_useIPv6);
 	DDX_Control(pDX, IDC_IPV4_CHECK, m_useIPv4);
+	DDX_Control(pDX, IDC_COMBO_PROTOCOL, m_comboProtocol);
+	DDX_Control(pDX, IDC_EDIT_PORT, m_editPort);
 }
 
 
@@ -156,7 +171,7 @@ BOOL WinMTROptions::OnInitDialog()
 	wchar_t strtmp[20] = {};
 	constexpr auto writable_size = std::size(strtmp) - 1;
 	
-	auto result = std::format_to_n(std::begin(strtmp), writable_size, WinMTRUtils::float_number_format, interval);
+	auto result = std::format_to_n(std::begin(strtmp), writable_size, WinMTRUtils::interval_number_format, interval);
 	*result.out = '\0';
 	m_editInterval.SetWindowText(strtmp);
 
@@ -171,6 +186,21 @@ BOOL WinMTROptions::OnInitDialog()
 	m_checkDNS.SetCheck(useDNS);
 	m_useIPv4.SetCheck(useIPv4);
 	m_useIPv6.SetCheck(useIPv6);
+
+	for (const auto p : protocols) {
+		const auto index = m_comboProtocol.AddString(p == probe_protocol::udp ? L"UDP" : p == probe_protocol::tcp ? L"TCP" : L"ICMP");
+		m_comboProtocol.SetItemData(index, static_cast<DWORD_PTR>(p));
+		if (p == protocol) {
+			m_comboProtocol.SetCurSel(index);
+		}
+	}
+	if (m_comboProtocol.GetCurSel() == CB_ERR) {
+		m_comboProtocol.SetCurSel(0);
+	}
+
+	result = std::format_to_n(std::begin(strtmp), writable_size, WinMTRUtils::int_number_format, probePort);
+	*result.out = '\0';
+	m_editPort.SetWindowText(strtmp);
 	
 	m_editInterval.SetFocus();
 	return FALSE;
@@ -203,6 +233,16 @@ void WinMTROptions::OnOK()
 	useIPv4 = m_useIPv4.GetCheck();
 	useIPv6 = m_useIPv6.GetCheck();
 
+	if (const auto selected = m_comboProtocol.GetCurSel(); selected != CB_ERR) {
+		protocol = static_cast<probe_protocol>(m_comboProtocol.GetItemData(selected));
+	}
+	m_editPort.GetWindowText(tmpstr, 20);
+	end = nullptr;
+	probePort = wcstoul(tmpstr, &end, 10);
+	if (probePort < WinMTRUtils::MIN_PROBE_PORT || probePort > WinMTRUtils::MAX_PROBE_PORT) {
+		probePort = protocol == probe_protocol::tcp ? WinMTRUtils::DEFAULT_TCP_PORT : WinMTRUtils::DEFAULT_UDP_PORT;
+	}
+
 	CDialog::OnOK();
 }
 
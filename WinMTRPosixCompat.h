@@ -0,0 +1,55 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRPosixCompat.h
+//
+//
+// DESCRIPTION:
+//   The handful of Win32 networking names the portable parts of the tracing
+//   core use, spelled for POSIX so they can be built on the Linux collectors.
+//
+// NOTES:
+//    Only include this outside of _WIN32
+//
+//*****************************************************************************
+#pragma once
+#ifndef WINMTR_POSIX_COMPAT_H_
+#define WINMTR_POSIX_COMPAT_H_
+
+#ifdef _WIN32
+#error "WinMTRPosixCompat.h is for non-Windows builds only"
+#endif
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using ADDRESS_FAMILY = sa_family_t;
+using UCHAR = unsigned char;
+using USHORT = unsigned short;
+using SOCKADDR_STORAGE = sockaddr_storage;
+
+typedef union _SOCKADDR_INET {
+	sockaddr_in Ipv4;
+	sockaddr_in6 Ipv6;
+	ADDRESS_FAMILY si_family;
+} SOCKADDR_INET, * PSOCKADDR_INET;
+
+#endif // ifndef WINMTR_POSIX_COMPAT_H_
@@ -0,0 +1,334 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRProbeBackend.ixx
+//
+// DESCRIPTION:
+//   The interface the per-hop trace loop sends its probes through. Nothing in
+//   here is tied to the Windows ICMP API so that other backends (raw sockets
+//   on Linux, simulated networks) can be dropped in underneath WinMTRNet.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <utility>
+#endif
+#ifdef _RESUMABLE_ENABLE_LEGACY_AWAIT_ADAPTERS
+#error "don't compile with /await"
+#endif
+export module WinMTR.ProbeBackend;
+
+#ifdef _WIN32
+import <atomic>;
+import <chrono>;
+import <coroutine>;
+import <cstddef>;
+import <cstdint>;
+import <memory>;
+import <span>;
+import <system_error>;
+import <utility>;
+#endif
+export import WinMTR.TokenBucket;
+
+// the ceiling of the adaptive timeout, and what a probe waits when nobody asks otherwise
+export inline constexpr auto DEFAULT_PROBE_TIMEOUT = std::chrono::milliseconds(5000);
+export inline constexpr auto MIN_PROBE_TIMEOUT = std::chrono::milliseconds(250);
+// how long after sending backends keep listening for a probe its timeout gave up on
+export inline constexpr auto LATE_REPLY_WINDOW = DEFAULT_PROBE_TIMEOUT;
+
+// counts the answers that came in after their probe timed out, shared so
+// that a backend can hold on to it after the trace that asked is gone
+export using late_reply_counter = std::shared_ptr<std::atomic_uint32_t>;
+
+// what became of a probe, independent of how the backend learned about it
+export enum class probe_status {
+	success,
+	ttl_expired,
+	timed_out,
+	buffer_too_small,
+	dest_net_unreachable,
+	dest_host_unreachable,
+	dest_prot_unreachable,
+	dest_port_unreachable,
+	no_resources,
+	bad_option,
+	hw_error,
+	packet_too_big,
+	bad_request,
+	bad_route,
+	ttl_expired_reassembly,
+	param_problem,
+	source_quench,
+	option_too_big,
+	bad_destination,
+	general_failure
+};
+
+// what goes on the wire, UDP and TCP take their destination port from the probe's address
+export enum class probe_protocol : std::uint8_t {
+	icmp,
+	udp,
+	tcp
+};
+
+// identifies a single probe, backends hand this back untouched with the reply
+export struct probe_key final {
+	std::uint32_t session = 0;
+	UCHAR ttl = 0;
+	std::uint16_t sequence = 0;
+	// Probes with the same flow should hash onto the same path through a load
+	// balancer. Backends that can choose the header fields routers hash on
+	// keep them constant per flow, the Windows ICMP API can't and ignores it.
+	std::uint16_t flow = 0;
+	probe_protocol protocol = probe_protocol::icmp;
+};
+
+export struct probe_result final {
+	probe_key key;
+	SOCKADDR_INET responder = {};
+	unsigned reply_count = 0;		// zero means no reply arrived before the deadline
+	probe_status status = probe_status::timed_out;
+	std::chrono::microseconds round_trip_time{ 0 };
+	int error = 0;					// platform error code if the probe could not be sent at all
+};
+
+export class probe_backend;
+
+//*****************************************************************************
+// CLASS:  probe_delay
+//
+// Suspends the awaiting coroutine on the backend's own timers, so that a
+// simulated backend can run the trace loop against a virtual clock.
+//*****************************************************************************
+export class probe_delay final {
+	probe_backend& m_backend;
+	std::chrono::steady_clock::duration m_duration;
+	std::coroutine_handle<> m_resume{ nullptr };
+public:
+	probe_delay(probe_backend& backend, std::chrono::steady_clock::duration duration) noexcept
+		:m_backend(backend)
+		, m_duration(duration)
+	{
+	}
+
+	[[nodiscard]] probe_backend& backend() const noexcept { return m_backend; }
+	[[nodiscard]] std::chrono::steady_clock::duration duration() const noexcept { return m_duration; }
+
+	void complete() noexcept
+	{
+		m_resume();
+	}
+
+	[[nodiscard]]
+	std::coroutine_handle<> resume_handle() const noexcept
+	{
+		return m_resume;
+	}
+
+	// always suspends, even for a zero delay, it doubles as a hop onto the backend's threads
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> resume_handle);
+
+	void await_resume() const noexcept
+	{
+	}
+};
+
+//*****************************************************************************
+// CLASS:  probe_request
+//
+// The awaitable for one probe. It lives in the awaiting coroutine's frame
+// until the backend calls complete(), backends fill in result() before that.
+//*****************************************************************************
+export class probe_request final {
+	probe_backend& m_backend;
+	probe_key m_key;
+	SOCKADDR_INET m_dest;
+	std::span<const std::byte> m_payload;
+	std::chrono::milliseconds m_timeout;
+	late_reply_counter m_late;
+	token_bucket::reservation m_paced;
+	std::coroutine_handle<> m_resume{ nullptr };
+	probe_result m_result;
+public:
+	probe_request(probe_backend& backend, probe_key key, const SOCKADDR_INET& dest, std::span<const std::byte> payload, std::chrono::milliseconds timeout, late_reply_counter late, token_bucket::reservation paced) noexcept
+		:m_backend(backend)
+		, m_key(key)
+		, m_dest(dest)
+		, m_payload(payload)
+		, m_timeout(timeout)
+		, m_late(std::move(late))
+		, m_paced(paced)
+	{
+		m_result.key = key;
+	}
+
+	[[nodiscard]] probe_backend& backend() const noexcept { return m_backend; }
+	[[nodiscard]] const probe_key& key() const noexcept { return m_key; }
+	[[nodiscard]] const SOCKADDR_INET& dest() const noexcept { return m_dest; }
+	[[nodiscard]] std::span<const std::byte> payload() const noexcept { return m_payload; }
+	[[nodiscard]] std::chrono::milliseconds timeout() const noexcept { return m_timeout; }
+	// may be empty, then nobody wants to hear about late answers
+	[[nodiscard]] const late_reply_counter& late() const noexcept { return m_late; }
+	[[nodiscard]] probe_result& result() noexcept { return m_result; }
+
+	// hands control back to the awaiting coroutine on the calling thread
+	void complete() noexcept
+	{
+		m_resume();
+	}
+
+	[[nodiscard]]
+	std::coroutine_handle<> resume_handle() const noexcept
+	{
+		return m_resume;
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> resume_handle);
+
+	probe_result await_resume() const;
+};
+
+//*****************************************************************************
+// CLASS:  probe_backend
+//
+// Implementers must make submit() and schedule() safe to call from any
+// thread, and must resume every submitted request and delay exactly once,
+// either through complete() or by scheduling resume_handle() somewhere else.
+// A reply that turns up after the request's timeout but within
+// LATE_REPLY_WINDOW of sending should bump the request's late() counter.
+//*****************************************************************************
+export class probe_backend {
+	std::atomic_uint32_t m_lastSession{ 0 };
+public:
+	using clock = std::chrono::steady_clock;
+
+	virtual ~probe_backend() noexcept = default;
+
+	[[nodiscard]]
+	std::uint32_t new_session() noexcept
+	{
+		return ++m_lastSession;
+	}
+
+	[[nodiscard]]
+	probe_request send(probe_key key, const SOCKADDR_INET& dest, std::span<const std::byte> payload, std::chrono::milliseconds timeout = DEFAULT_PROBE_TIMEOUT, late_reply_counter late = nullptr, token_bucket::reservation paced = {}) noexcept
+	{
+		return probe_request{ *this, key, dest, payload, timeout, std::move(late), paced };
+	}
+
+	[[nodiscard]]
+	probe_delay resume_after(clock::duration duration) noexcept
+	{
+		return probe_delay{ *this, duration };
+	}
+
+	// the time as the backend sees it, which need not be the wall clock
+	[[nodiscard]]
+	virtual clock::time_point now() const noexcept
+	{
+		return clock::now();
+	}
+
+	// the process' bucket, a backend on a clock of its own needs one on that clock
+	[[nodiscard]]
+	virtual token_bucket& rate_limit() noexcept
+	{
+		return token_bucket::process();
+	}
+
+	// How long to hold back a probe of the given size on the wire, zero rates
+	// don't limit. Pass what it returns on to send(), which refunds it if the
+	// probe never goes out.
+	[[nodiscard]]
+	token_bucket::reservation pace(std::size_t bytes, double probes_per_second, double bytes_per_second) noexcept
+	{
+		return rate_limit().reserve(now(), probes_per_second, bytes_per_second, bytes);
+	}
+
+	// UDP and TCP count as having reached the destination on any answer from
+	// it, port unreachable and RST included, so they report success there
+	[[nodiscard]]
+	virtual bool supports(probe_protocol protocol) const noexcept
+	{
+		return protocol == probe_protocol::icmp;
+	}
+
+	[[nodiscard]]
+	virtual std::uint64_t probes_sent() const noexcept = 0;
+
+	virtual void submit(probe_request& request) = 0;
+	virtual void schedule(probe_delay& delay) = 0;
+};
+
+void probe_delay::await_suspend(std::coroutine_handle<> resume_handle)
+{
+	m_resume = resume_handle;
+	m_backend.schedule(*this);
+}
+
+void probe_request::await_suspend(std::coroutine_handle<> resume_handle)
+{
+	m_resume = resume_handle;
+	m_backend.submit(*this);
+}
+
+probe_result probe_request::await_resume() const
+{
+	if (m_result.error) [[unlikely]] {
+		// nothing went out, so nothing counts against the caps
+		m_backend.rate_limit().refund(m_paced);
+		throw std::system_error(m_result.error, std::system_category());
+	}
+	return m_result;
+}
@@ -0,0 +1,645 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRProbeEngine.ixx
+//
+// DESCRIPTION:
+//   Multiplexes every probe of every trace onto one ICMP handle per address
+//   family. All sends and completions happen on a single I/O thread that sits
+//   in an alertable wait; replies come back as APCs whose context identifies
+//   the (session, TTL, sequence) that sent them, and timeouts are driven from
+//   one shared deadline heap instead of a thread-pool wait per probe.
+//
+// NOTES:
+//   Once the pools have grown to the most probes ever in flight at once,
+//   sending, completing and resuming a probe allocate nothing: the slots
+//   keep their buffers, and the trace loops go back to the pool through one
+//   thread-pool work item and a ring of handles made with the engine. Every
+//   submit() and schedule() takes its place in that ring up front, growing
+//   it if it has to, so the I/O thread always has somewhere to put a handle
+//   and never runs a trace loop itself.
+//
+//   Nothing waiting on the engine outlives it suspended: on the way out the
+//   probes still in flight resume as aborted and pending delays as elapsed.
+//
+//*****************************************************************************
+module;
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#ifdef _RESUMABLE_ENABLE_LEGACY_AWAIT_ADAPTERS
+#error "don't compile with /await"
+#endif
+export module WinMTR.ProbeEngine;
+
+import <atomic>;
+import <chrono>;
+import <coroutine>;
+import <cstddef>;
+import <cstdint>;
+import <functional>;
+import <memory>;
+import <mutex>;
+import <queue>;
+import <span>;
+import <thread>;
+import <vector>;
+import <winrt/base.h>;
+import "WinMTRICMPPIOdef.h";
+import WinMTRICMPUtils;
+export import WinMTR.ProbeBackend;
+
+//*****************************************************************************
+// CLASS:  probe_engine
+//
+// The Windows ICMP backend. One per process, shared by every WinMTRNet
+// through instance().
+//*****************************************************************************
+export class probe_engine final : public probe_backend {
+	probe_engine(const probe_engine&) = delete;
+	probe_engine& operator=(const probe_engine&) = delete;
+public:
+	using clock = std::chrono::steady_clock;
+
+	probe_engine();
+	~probe_engine() noexcept override;
+
+	[[nodiscard]]
+	static std::shared_ptr<probe_engine> instance();
+
+	[[nodiscard]]
+	std::uint64_t probes_sent() const noexcept override
+	{
+		return m_probesSent.load(std::memory_order_relaxed);
+	}
+
+	void submit(probe_request& request) override;
+	void schedule(probe_delay& delay) override;
+private:
+
+	struct icmp_handle_traits
+	{
+		using type = HANDLE;
+
+		static void close(type value) noexcept
+		{
+			WINRT_VERIFY_(TRUE, ::IcmpCloseHandle(value));
+		}
+
+		[[nodiscard]]
+		static type invalid() noexcept
+		{
+			return INVALID_HANDLE_VALUE;
+		}
+	};
+	using icmp_handle = winrt::handle_type<icmp_handle_traits>;
+
+	// owned by the engine so the ICMP API always has somewhere to write, even
+	// after the deadline has already given up on the probe
+	struct probe_slot final {
+		probe_engine* engine = nullptr;
+		probe_request* waiter = nullptr;
+		std::uint32_t generation = 0;
+		ADDRESS_FAMILY family = AF_UNSPEC;
+		clock::time_point sent;
+		late_reply_counter late;
+		std::vector<std::byte> request;
+		std::vector<std::byte> reply;
+	};
+
+	// handles waiting for the pool, as many places as the ring had when the engine was made
+	static constexpr std::size_t RESUME_RING = 1024;
+
+	// either a probe's timeout or, when delay is set, a plain timer
+	struct deadline final {
+		clock::time_point when;
+		probe_slot* slot;
+		std::uint32_t generation;
+		probe_delay* delay = nullptr;
+
+		[[nodiscard]]
+		bool operator>(const deadline& rhs) const noexcept
+		{
+			return when > rhs.when;
+		}
+	};
+
+	// a place in the ring for one handle, the ring grows if every place is taken
+	void reserve_resume();
+	void release_resume() noexcept;
+	void run(std::stop_token stop_token) noexcept;
+	void cancel_all() noexcept;
+	void start_probe(probe_request& request) noexcept;
+	void expire_deadlines() noexcept;
+	void complete(probe_slot& slot, clock::time_point received) noexcept;
+	[[nodiscard]]
+	DWORD next_wait() const noexcept;
+	[[nodiscard]]
+	HANDLE handle_for(ADDRESS_FAMILY af) noexcept;
+	[[nodiscard]]
+	probe_slot* acquire_slot();
+
+	static void CALLBACK submit_apc(ULONG_PTR param) noexcept;
+	static void CALLBACK schedule_apc(ULONG_PTR param) noexcept;
+	static void CALLBACK wake_apc([[maybe_unused]] ULONG_PTR param) noexcept {}
+	static void NTAPI reply_apc(PVOID context, PIO_STATUS_BLOCK status_block, ULONG reserved) noexcept;
+	static void CALLBACK resume_callback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work) noexcept;
+	void resume(std::coroutine_handle<> handle) noexcept;
+
+	// everything below this point is only touched from the I/O thread
+	icmp_handle m_icmp4;
+	icmp_handle m_icmp6;
+	std::vector<std::unique_ptr<probe_slot>> m_slots;
+	std::vector<probe_slot*> m_freeSlots;
+	std::priority_queue<deadline, std::vector<deadline>, std::greater<>> m_deadlines;
+
+	// set by the I/O thread on its way out, after that nothing more gets queued to it
+	std::mutex m_submitMutex;
+	bool m_stopping = false;
+
+	// filled by the I/O thread, emptied by the pool, never fuller than m_resumeReserved
+	std::mutex m_resumeMutex;
+	std::vector<std::coroutine_handle<>> m_resumeRing;
+	std::size_t m_resumeHead = 0;
+	std::size_t m_resumeCount = 0;
+	std::size_t m_resumeReserved = 0;
+	PTP_WORK m_resumeWork = nullptr;
+
+	std::atomic_uint64_t m_probesSent{ 0 };
+	std::jthread m_ioThread;
+};
+
+module : private;
+
+import <type_traits>;
+import <algorithm>;
+import <new>;
+import <utility>;
+
+namespace {
+	template<class T>
+	requires std::is_same_v<sockaddr_in, T> || std::is_same_v<sockaddr_in6, T>
+	constexpr SOCKADDR_INET to_sockaddr_inet(T addr) noexcept {
+		if constexpr (std::is_same_v<sockaddr_in, T>) {
+			return { .Ipv4 = addr };
+		}
+		else {
+			return { .Ipv6 = addr };
+		}
+	}
+
+	[[nodiscard]]
+	constexpr probe_status to_probe_status(ULONG status) noexcept {
+		switch (status) {
+		case IP_SUCCESS:
+			return probe_status::success;
+		case IP_TTL_EXPIRED_TRANSIT:
+			return probe_status::ttl_expired;
+		case IP_REQ_TIMED_OUT:
+			return probe_status::timed_out;
+		case IP_BUF_TOO_SMALL:
+			return probe_status::buffer_too_small;
+		case IP_DEST_NET_UNREACHABLE:
+			return probe_status::dest_net_unreachable;
+		case IP_DEST_HOST_UNREACHABLE:
+			return probe_status::dest_host_unreachable;
+		case IP_DEST_PROT_UNREACHABLE:
+			return probe_status::dest_prot_unreachable;
+		case IP_DEST_PORT_UNREACHABLE:
+			return probe_status::dest_port_unreachable;
+		case IP_NO_RESOURCES:
+			return probe_status::no_resources;
+		case IP_BAD_OPTION:
+			return probe_status::bad_option;
+		case IP_HW_ERROR:
+			return probe_status::hw_error;
+		case IP_PACKET_TOO_BIG:
+			return probe_status::packet_too_big;
+		case IP_BAD_REQ:
+			return probe_status::bad_request;
+		case IP_BAD_ROUTE:
+			return probe_status::bad_route;
+		case IP_TTL_EXPIRED_REASSEM:
+			return probe_status::ttl_expired_reassembly;
+		case IP_PARAM_PROBLEM:
+			return probe_status::param_problem;
+		case IP_SOURCE_QUENCH:
+			return probe_status::source_quench;
+		case IP_OPTION_TOO_BIG:
+			return probe_status::option_too_big;
+		case IP_BAD_DESTINATION:
+			return probe_status::bad_destination;
+		case IP_GENERAL_FAILURE:
+		default:
+			return probe_status::general_failure;
+		}
+	}
+
+	template<class T>
+	void parse_reply(std::span<std::byte> replyData, probe_result& result) noexcept {
+		using traits = icmp_ping_traits<T>;
+		result.reply_count = traits::parsemethod(replyData.data(), static_cast<DWORD>(replyData.size()));
+		if (!result.reply_count) {
+			result.status = probe_status::timed_out;
+			return;
+		}
+		const auto reply = reinterpret_cast<traits::reply_type_ptr>(replyData.data());
+		result.status = to_probe_status(reply->Status);
+		result.round_trip_time = std::chrono::milliseconds(reply->RoundTripTime);
+		result.responder = to_sockaddr_inet(traits::to_addr_from_ping(reply));
+	}
+
+	template<class T>
+	DWORD send_echo(HANDLE icmpHandle, PIO_APC_ROUTINE apc, PVOID context, T dest, UCHAR ttl, DWORD timeout, std::span<std::byte> request, std::span<std::byte> reply) noexcept {
+		using traits = icmp_ping_traits<T>;
+		IP_OPTION_INFORMATION	stIPInfo = {
+			.Ttl = ttl,
+			.Flags = IP_FLAG_DF
+		};
+		const auto io_res = traits::pingmethod(
+			icmpHandle
+			, nullptr
+			, apc
+			, context
+			, traits::get_anyaddr()
+			, traits::to_addr_from_storage(&dest)
+			, request.data()
+			, static_cast<WORD>(request.size())
+			, &stIPInfo
+			, reply.data()
+			, static_cast<DWORD>(reply.size())
+			, timeout);
+		if (io_res != ERROR_SUCCESS) [[unlikely]] {
+			return io_res;
+		}
+		if (const auto err = GetLastError(); err != ERROR_IO_PENDING) [[unlikely]] {
+			return err;
+		}
+		return ERROR_SUCCESS;
+	}
+}
+
+probe_engine::probe_engine()
+	:m_resumeRing(RESUME_RING)
+	, m_resumeWork(CreateThreadpoolWork(&probe_engine::resume_callback, this, nullptr))
+{
+	if (!m_resumeWork) [[unlikely]] {
+		winrt::throw_last_error();
+	}
+	m_ioThread = std::jthread([this](std::stop_token stop_token) noexcept { this->run(stop_token); });
+}
+
+probe_engine::~probe_engine() noexcept
+{
+	m_ioThread.request_stop();
+	// kick the I/O thread out of its alertable wait so it sees the stop request
+	QueueUserAPC(&probe_engine::wake_apc, m_ioThread.native_handle(), 0);
+	m_ioThread.join();
+	// the I/O thread resumed everything still waiting on its way out, let those finish
+	WaitForThreadpoolWorkCallbacks(m_resumeWork, FALSE);
+	CloseThreadpoolWork(m_resumeWork);
+}
+
+std::shared_ptr<probe_engine> probe_engine::instance()
+{
+	static std::mutex instance_mutex;
+	static std::weak_ptr<probe_engine> current;
+	std::unique_lock lock(instance_mutex);
+	auto engine = current.lock();
+	if (!engine) {
+		engine = std::make_shared<probe_engine>();
+		current = engine;
+	}
+	return engine;
+}
+
+void probe_engine::submit(probe_request& request)
+{
+	std::scoped_lock lock(m_submitMutex);
+	if (m_stopping) [[unlikely]] {
+		throw winrt::hresult_canceled();
+	}
+	reserve_resume();
+	if (!QueueUserAPC(&probe_engine::submit_apc, m_ioThread.native_handle(), reinterpret_cast<ULONG_PTR>(&request))) [[unlikely]] {
+		release_resume();
+		winrt::throw_last_error();
+	}
+}
+
+void CALLBACK probe_engine::submit_apc(ULONG_PTR param) noexcept
+{
+	auto& request = *reinterpret_cast<probe_request*>(param);
+	static_cast<probe_engine&>(request.backend()).start_probe(request);
+}
+
+void probe_engine::schedule(probe_delay& delay)
+{
+	std::scoped_lock lock(m_submitMutex);
+	if (m_stopping) [[unlikely]] {
+		throw winrt::hresult_canceled();
+	}
+	reserve_resume();
+	if (!QueueUserAPC(&probe_engine::schedule_apc, m_ioThread.native_handle(), reinterpret_cast<ULONG_PTR>(&delay))) [[unlikely]] {
+		release_resume();
+		winrt::throw_last_error();
+	}
+}
+
+void CALLBACK probe_engine::schedule_apc(ULONG_PTR param) noexcept
+{
+	auto& delay = *reinterpret_cast<probe_delay*>(param);
+	auto& engine = static_cast<probe_engine&>(delay.backend());
+	if (engine.m_stopping) [[unlikely]] {
+		engine.resume(delay.resume_handle());
+		return;
+	}
+	try {
+		engine.m_deadlines.push({ clock::now() + delay.duration(), nullptr, 0, &delay });
+	}
+	catch (const std::bad_alloc&) {
+		// a delay that can't be timed is over early, better than never
+		engine.resume(delay.resume_handle());
+	}
+}
+
+void probe_engine::run(std::stop_token stop_token) noexcept
+{
+	while (!stop_token.stop_requested()) {
+		// completions and new probes are both delivered as APCs while we sleep here
+		SleepEx(next_wait(), TRUE);
+		expire_deadlines();
+	}
+	{
+		std::scoped_lock lock(m_submitMutex);
+		m_stopping = true;
+	}
+	// run whatever got queued before the flag went up, those fail straight away
+	while (SleepEx(0, TRUE) == WAIT_IO_COMPLETION) {
+	}
+	cancel_all();
+	m_icmp4.close();
+	m_icmp6.close();
+}
+
+void probe_engine::cancel_all() noexcept
+{
+	// every waiter still gets its resume, the probes as aborted and the delays as if they were up
+	for (const auto& slot : m_slots) {
+		if (auto waiter = std::exchange(slot->waiter, nullptr); waiter) {
+			waiter->result().error = ERROR_OPERATION_ABORTED;
+			resume(waiter->resume_handle());
+		}
+		slot->late.reset();
+	}
+	while (!m_deadlines.empty()) {
+		const auto pending = m_deadlines.top();
+		m_deadlines.pop();
+		if (pending.delay) {
+			resume(pending.delay->resume_handle());
+		}
+	}
+}
+
+DWORD probe_engine::next_wait() const noexcept
+{
+	if (m_deadlines.empty()) {
+		return INFINITE;
+	}
+	const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(m_deadlines.top().when - clock::now());
+	return static_cast<DWORD>(std::max(remaining.count(), 0ll));
+}
+
+HANDLE probe_engine::handle_for(ADDRESS_FAMILY af) noexcept
+{
+	if (af == AF_INET) {
+		if (!m_icmp4) {
+			m_icmp4.attach(IcmpCreateFile());
+		}
+		return m_icmp4.get();
+	}
+	if (af == AF_INET6) {
+		if (!m_icmp6) {
+			m_icmp6.attach(Icmp6CreateFile());
+		}
+		return m_icmp6.get();
+	}
+	SetLastError(WSAEOPNOTSUPP);
+	return INVALID_HANDLE_VALUE;
+}
+
+probe_engine::probe_slot* probe_engine::acquire_slot()
+{
+	if (m_freeSlots.empty()) {
+		// the free list can always take every slot back without growing
+		m_freeSlots.reserve(m_slots.size() + 1);
+		auto& slot = m_slots.emplace_back(std::make_unique<probe_slot>());
+		slot->engine = this;
+		return slot.get();
+	}
+	auto slot = m_freeSlots.back();
+	m_freeSlots.pop_back();
+	return slot;
+}
+
+void probe_engine::start_probe(probe_request& request) noexcept
+{
+	if (m_stopping) [[unlikely]] {
+		request.result().error = ERROR_OPERATION_ABORTED;
+		resume(request.resume_handle());
+		return;
+	}
+	const auto& dest = request.dest();
+	const auto af = dest.si_family;
+	const auto icmpHandle = handle_for(af);
+	if (icmpHandle == INVALID_HANDLE_VALUE) [[unlikely]] {
+		request.result().error = static_cast<int>(GetLastError());
+		resume(request.resume_handle());
+		return;
+	}
+
+	// the buffers only grow for a bigger probe than any before, or when more are in flight than ever
+	probe_slot* slot = nullptr;
+	try {
+		slot = acquire_slot();
+		const auto payload = request.payload();
+		slot->request.assign(payload.begin(), payload.end());
+		const auto size = static_cast<unsigned>(slot->request.size());
+		slot->reply.resize(af == AF_INET ? reply_reply_buffer_size<sockaddr_in>(size) : reply_reply_buffer_size<sockaddr_in6>(size));
+	}
+	catch (const std::bad_alloc&) {
+		if (slot) {
+			m_freeSlots.push_back(slot);
+		}
+		request.result().error = ERROR_NOT_ENOUGH_MEMORY;
+		resume(request.resume_handle());
+		return;
+	}
+	slot->waiter = &request;
+	slot->family = af;
+	++slot->generation;
+	slot->late = request.late();
+	// the API keeps listening past our own deadline, for as long as a late answer still counts
+	const auto timeout = static_cast<DWORD>((slot->late ? std::max(request.timeout(), LATE_REPLY_WINDOW) : request.timeout()).count());
+	const auto ttl = request.key().ttl;
+	slot->sent = clock::now();
+	const auto err = af == AF_INET
+		? send_echo(icmpHandle, &probe_engine::reply_apc, slot, dest.Ipv4, ttl, timeout, slot->request, slot->reply)
+		: send_echo(icmpHandle, &probe_engine::reply_apc, slot, dest.Ipv6, ttl, timeout, slot->request, slot->reply);
+
+	if (err != ERROR_SUCCESS) [[unlikely]] {
+		// the ICMP API never saw it, so no APC will come back for this slot
+		slot->waiter = nullptr;
+		slot->late.reset();
+		m_freeSlots.push_back(slot);
+		request.result().error = static_cast<int>(err);
+		resume(request.resume_handle());
+		return;
+	}
+	m_probesSent.fetch_add(1, std::memory_order_relaxed);
+	try {
+		m_deadlines.push({ clock::now() + request.timeout(), slot, slot->generation });
+	}
+	catch (const std::bad_alloc&) {
+		// it still completes, only as late as the API's own timeout
+	}
+}
+
+void probe_engine::expire_deadlines() noexcept
+{
+	const auto now = clock::now();
+	while (!m_deadlines.empty() && m_deadlines.top().when <= now) {
+		const auto expired = m_deadlines.top();
+		m_deadlines.pop();
+		if (expired.delay) {
+			resume(expired.delay->resume_handle());
+			continue;
+		}
+		auto& slot = *expired.slot;
+		// stale entry, the reply beat the deadline or the slot was reused
+		if (slot.generation != expired.generation || !slot.waiter) {
+			continue;
+		}
+		auto waiter = std::exchange(slot.waiter, nullptr);
+		waiter->result().reply_count = 0;
+		waiter->result().status = probe_status::timed_out;
+		resume(waiter->resume_handle());
+		// the slot goes back on the free list once the ICMP API lets go of it in reply_apc
+	}
+}
+
+void NTAPI probe_engine::reply_apc(PVOID context, [[maybe_unused]] PIO_STATUS_BLOCK status_block, [[maybe_unused]] ULONG reserved) noexcept
+{
+	// before anything else, this is the receive timestamp
+	const auto received = clock::now();
+	auto slot = static_cast<probe_slot*>(context);
+	slot->engine->complete(*slot, received);
+}
+
+void probe_engine::complete(probe_slot& slot, clock::time_point received) noexcept
+{
+	if (auto waiter = std::exchange(slot.waiter, nullptr); waiter) {
+		if (slot.family == AF_INET) {
+			parse_reply<sockaddr_in>(slot.reply, waiter->result());
+		}
+		else {
+			parse_reply<sockaddr_in6>(slot.reply, waiter->result());
+		}
+		// the API only reports whole milliseconds, our own clock does better
+		auto& result = waiter->result();
+		if (result.reply_count) {
+			const auto measured = std::chrono::floor<std::chrono::microseconds>(received - slot.sent);
+			result.round_trip_time = std::max(result.round_trip_time, measured);
+		}
+		resume(waiter->resume_handle());
+	}
+	else if (slot.late) {
+		// the deadline already gave up on this one, see whether anything came after all
+		probe_result late;
+		if (slot.family == AF_INET) {
+			parse_reply<sockaddr_in>(slot.reply, late);
+		}
+		else {
+			parse_reply<sockaddr_in6>(slot.reply, late);
+		}
+		if (late.reply_count && late.status != probe_status::timed_out) {
+			slot.late->fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	slot.late.reset();
+	m_freeSlots.push_back(&slot);
+}
+
+void probe_engine::reserve_resume()
+{
+	std::scoped_lock lock(m_resumeMutex);
+	if (m_resumeReserved == m_resumeRing.size()) [[unlikely]] {
+		// only when more wait on the engine than ever did before, the queued handles keep their order
+		std::vector<std::coroutine_handle<>> grown(m_resumeRing.size() * 2);
+		for (std::size_t i = 0; i < m_resumeCount; ++i) {
+			grown[i] = m_resumeRing[(m_resumeHead + i) % m_resumeRing.size()];
+		}
+		m_resumeRing.swap(grown);
+		m_resumeHead = 0;
+	}
+	++m_resumeReserved;
+}
+
+void probe_engine::release_resume() noexcept
+{
+	std::scoped_lock lock(m_resumeMutex);
+	--m_resumeReserved;
+}
+
+void probe_engine::resume(std::coroutine_handle<> handle) noexcept
+{
+	// never run the trace loop on the I/O thread, it has to get back to its wait
+	{
+		std::scoped_lock lock(m_resumeMutex);
+		// the submit() or schedule() that led here took a place, so there is one
+		m_resumeRing[(m_resumeHead + m_resumeCount) % m_resumeRing.size()] = handle;
+		++m_resumeCount;
+	}
+	// one callback per submission, each takes one handle off the ring
+	SubmitThreadpoolWork(m_resumeWork);
+}
+
+void CALLBACK probe_engine::resume_callback([[maybe_unused]] PTP_CALLBACK_INSTANCE instance, PVOID context, [[maybe_unused]] PTP_WORK work) noexcept
+{
+	auto& engine = *static_cast<probe_engine*>(context);
+	std::coroutine_handle<> handle;
+	{
+		std::scoped_lock lock(engine.m_resumeMutex);
+		handle = std::exchange(engine.m_resumeRing[engine.m_resumeHead], nullptr);
+		engine.m_resumeHead = (engine.m_resumeHead + 1) % engine.m_resumeRing.size();
+		--engine.m_resumeCount;
+		--engine.m_resumeReserved;
+	}
+	handle();
+}
@@ -0,0 +1,170 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRProbeHistory.ixx
+//
+// DESCRIPTION:
+//   A fixed capacity ring of the most recent probes of one hop, eight bytes
+//   each, for questions the running totals can't answer, like the loss over
+//   the last minute.
+//
+// NOTES:
+//   A sample packs the milliseconds since the trace started (32 bits, so 49
+//   days), the probe_status (5 bits) and the round trip in microseconds
+//   (27 bits, so a bit over two minutes).
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#endif
+export module WinMTR.ProbeHistory;
+
+#ifdef _WIN32
+import <algorithm>;
+import <atomic>;
+import <bit>;
+import <chrono>;
+import <cstddef>;
+import <cstdint>;
+import <memory>;
+#endif
+export import WinMTR.ProbeBackend;
+
+export struct window_summary final {
+	unsigned sent = 0;
+	unsigned returned = 0;
+	std::chrono::microseconds average{ 0 };	// over the probes that returned
+
+	[[nodiscard]]
+	int getPercent() const noexcept
+	{
+		return sent == 0 ? 0 : static_cast<int>(100 - (100 * returned / sent));
+	}
+};
+
+//*****************************************************************************
+// CLASS:  probe_history
+//
+// One writer, the hop's trace loop, and any number of readers. A reader
+// racing the writer around a full ring may see a few of the oldest samples
+// replaced by newer ones, which only ever narrows the window it reports.
+//*****************************************************************************
+export class probe_history final {
+	using clock = probe_backend::clock;
+public:
+	static constexpr std::size_t SAMPLE_SIZE = sizeof(std::uint64_t);
+
+	// capacity is rounded down to a power of two
+	probe_history(std::size_t capacity, clock::time_point epoch)
+		:m_mask(std::bit_floor(std::max<std::size_t>(capacity, 1)) - 1)
+		, m_epoch(epoch)
+		, m_samples(std::make_unique<std::atomic_uint64_t[]>(m_mask + 1))
+	{
+	}
+
+	[[nodiscard]]
+	std::size_t capacity() const noexcept
+	{
+		return m_mask + 1;
+	}
+
+	[[nodiscard]]
+	std::size_t size() const noexcept
+	{
+		return static_cast<std::size_t>(std::min<std::uint64_t>(m_written.load(std::memory_order_acquire), capacity()));
+	}
+
+	void record(clock::time_point when, probe_status status, std::chrono::microseconds round_trip) noexcept
+	{
+		const auto written = m_written.load(std::memory_order_relaxed);
+		m_samples[written & m_mask].store(pack(offset_of(when), status, round_trip), std::memory_order_relaxed);
+		m_written.store(written + 1, std::memory_order_release);
+	}
+
+	// everything recorded at or after since
+	[[nodiscard]]
+	window_summary summarize(clock::time_point since) const noexcept
+	{
+		window_summary summary;
+		const auto from = since <= m_epoch ? 0 : offset_of(since);
+		const auto written = m_written.load(std::memory_order_acquire);
+		const auto available = std::min<std::uint64_t>(written, capacity());
+		std::uint64_t total = 0;
+		// newest first, so the walk stops at the edge of the window
+		for (std::uint64_t i = 1; i <= available; ++i) {
+			const auto sample = m_samples[(written - i) & m_mask].load(std::memory_order_relaxed);
+			if (offset(sample) < from) {
+				break;
+			}
+			++summary.sent;
+			if (replied(status(sample))) {
+				++summary.returned;
+				total += round_trip(sample);
+			}
+		}
+		if (summary.returned) {
+			summary.average = std::chrono::microseconds(total / summary.returned);
+		}
+		return summary;
+	}
+
+	[[nodiscard]]
+	static constexpr bool replied(probe_status status) noexcept
+	{
+		return status == probe_status::success || status == probe_status::ttl_expired;
+	}
+private:
+	static constexpr unsigned STATUS_BITS = 5;
+	static constexpr unsigned RTT_BITS = 27;
+	static constexpr std::uint64_t RTT_MAX = (1ull << RTT_BITS) - 1;
+
+	[[nodiscard]]
+	std::uint32_t offset_of(clock::time_point when) const noexcept
+	{
+		const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(when - m_epoch).count();
+		return static_cast<std::uint32_t>(std::clamp<std::chrono::milliseconds::rep>(elapsed, 0, UINT32_MAX));
+	}
+
+	[[nodiscard]]
+	static constexpr std::uint64_t pack(std::uint32_t offset, probe_status status, std::chrono::microseconds round_trip) noexcept
+	{
+		const auto rtt = std::min<std::uint64_t>(static_cast<std::uint64_t>(std::max<std::int64_t>(round_trip.count(), 0)), RTT_MAX);
+		return (static_cast<std::uint64_t>(offset) << 32)
+			| (static_cast<std::uint64_t>(status) << RTT_BITS)
+			| rtt;
+	}
+
+	[[nodiscard]] static constexpr std::uint32_t offset(std::uint64_t sample) noexcept { return static_cast<std::uint32_t>(sample >> 32); }
+	[[nodiscard]] static constexpr probe_status status(std::uint64_t sample) noexcept { return static_cast<probe_status>((sample >> RTT_BITS) & ((1u << STATUS_BITS) - 1)); }
+	[[nodiscard]] static constexpr std::uint64_t round_trip(std::uint64_t sample) noexcept { return sample & RTT_MAX; }
+
+	std::size_t m_mask;
+	clock::time_point m_epoch;
+	std::unique_ptr<std::atomic_uint64_t[]> m_samples;
+	std::atomic_uint64_t m_written{ 0 };
+};
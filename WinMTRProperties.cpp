@@ -58,6 +58,10 @@ WinMTRProperties::WinMTRProperties(CWnd* pParent) noexcept : CDialog(WinMTRPrope
 ,ping_best()
 ,ping_avrg()
 ,ping_worst()
+,ping_p50()
+,ping_p90()
+,ping_p99()
+,ping_p999()
 ,pck_sent()
 ,pck_recv()
 ,pck_loss()
@@ -85,6 +89,11 @@ void WinMTRProperties::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_EDIT_PBEST, m_editBest);
 	DDX_Control(pDX, IDC_EDIT_PWORST, m_editWorst);
 	DDX_Control(pDX, IDC_EDIT_PAVRG, m_editAvrg);
+
+	DDX_Control(pDX, IDC_EDIT_PP50, m_editP50);
+	DDX_Control(pDX, IDC_EDIT_PP90, m_editP90);
+	DDX_Control(pDX, IDC_EDIT_PP99, m_editP99);
+	DDX_Control(pDX, IDC_EDIT_PP999, m_editP999);
 }
 
 
@@ -112,19 +121,32 @@ BOOL WinMTRProperties::OnInitDialog()
 	*result.out = '\0';
 	m_editRecv.SetWindowText(buf);
 
-	result = std::format_to_n(buf, writable_size, WinMTRUtils::float_number_format, ping_last);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_last);
 	*result.out = '\0';
 	m_editLast.SetWindowText(buf);
-	result = std::format_to_n(buf, writable_size, WinMTRUtils::float_number_format, ping_best);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_best);
 	*result.out = '\0';
 	m_editBest.SetWindowText(buf);
-	result = std::format_to_n(buf, writable_size, WinMTRUtils::float_number_format, ping_worst);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_worst);
 	*result.out = '\0';
 	m_editWorst.SetWindowText(buf);
-	result = std::format_to_n(buf, writable_size, WinMTRUtils::float_number_format, ping_avrg);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_avrg);
 	*result.out = '\0';
 	m_editAvrg.SetWindowText(buf);
 
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_p50);
+	*result.out = '\0';
+	m_editP50.SetWindowText(buf);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_p90);
+	*result.out = '\0';
+	m_editP90.SetWindowText(buf);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_p99);
+	*result.out = '\0';
+	m_editP99.SetWindowText(buf);
+	result = std::format_to_n(buf, writable_size, WinMTRUtils::rtt_number_format, ping_p999);
+	*result.out = '\0';
+	m_editP999.SetWindowText(buf);
+
 	return FALSE;
 }
 
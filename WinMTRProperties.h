@@ -61,6 +61,11 @@ public:
 	float	ping_avrg;
 	float	ping_worst;
 
+	float	ping_p50;
+	float	ping_p90;
+	float	ping_p99;
+	float	ping_p999;
+
 	int		pck_sent;
 	int		pck_recv;
 	int		pck_loss;
@@ -74,7 +79,11 @@ public:
 			m_editLast,
 			m_editBest,
 			m_editWorst,
-			m_editAvrg;
+			m_editAvrg,
+			m_editP50,
+			m_editP90,
+			m_editP99,
+			m_editP999;
 	
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX);
@@ -0,0 +1,685 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRPtrResolver.ixx
+//
+// DESCRIPTION:
+//   Reverse DNS lookups sent straight to a DNS server over one UDP socket.
+//   Any number of queries are in flight at once and none of them holds a
+//   thread while it waits, where getnameinfo parks a thread-pool thread on
+//   every lookup until the system resolver gives up.
+//
+// NOTES:
+//   One thread receives the answers and runs the timeouts. Queries carry a
+//   random ID and their question has to come back verbatim, the socket is
+//   connected so only the server can answer at all. TTLs come from the PTR
+//   record, or from the SOA of a negative answer as in RFC 2308.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.PtrResolver;
+
+#ifdef _WIN32
+import <array>;
+import <chrono>;
+import <coroutine>;
+import <cstddef>;
+import <cstdint>;
+import <deque>;
+import <mutex>;
+import <optional>;
+import <random>;
+import <span>;
+import <string>;
+import <thread>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+#endif
+
+// per attempt, doubled on every retry
+export constexpr auto PTR_QUERY_TIMEOUT = std::chrono::milliseconds(1000);
+export constexpr auto PTR_QUERY_ATTEMPTS = 3;
+// past this the queries wait their turn, the server has to keep up too
+export constexpr std::size_t PTR_MAX_IN_FLIGHT = 256;
+
+export enum class ptr_outcome : std::uint8_t {
+	name,		// a PTR record
+	no_name,	// NXDOMAIN or no PTR record, the TTL says for how long
+	failed		// no usable answer, timed out included
+};
+
+export struct ptr_answer final {
+	ptr_outcome outcome = ptr_outcome::failed;
+	std::wstring name;				// without the trailing dot
+	std::chrono::seconds ttl{ 0 };
+};
+
+//*****************************************************************************
+// CLASS:  ptr_request
+//
+// Whatever waits on an answer. done() is called exactly once, on the
+// client's own thread or, if the query never got out, on the caller's.
+//*****************************************************************************
+export class ptr_request {
+public:
+	virtual void done(ptr_answer answer) noexcept = 0;
+protected:
+	~ptr_request() = default;
+};
+
+export class dns_ptr_client;
+
+//*****************************************************************************
+// CLASS:  ptr_lookup
+//
+// The awaitable for one address, it lives in the awaiting coroutine's frame
+// until the client is done with it.
+//*****************************************************************************
+export class ptr_lookup final : public ptr_request {
+	dns_ptr_client& m_client;
+	SOCKADDR_INET m_addr;
+	ptr_answer m_answer;
+	std::coroutine_handle<> m_resume{ nullptr };
+public:
+	ptr_lookup(dns_ptr_client& client, const SOCKADDR_INET& addr) noexcept
+		:m_client(client)
+		, m_addr(addr)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> resume_handle);
+
+	ptr_answer await_resume() noexcept
+	{
+		return std::move(m_answer);
+	}
+
+	void done(ptr_answer answer) noexcept override
+	{
+		m_answer = std::move(answer);
+		m_resume();
+	}
+};
+
+//*****************************************************************************
+// CLASS:  dns_ptr_client
+//
+// Safe to share between threads. Throws std::system_error from the
+// constructor if it can't get a socket to the server.
+//*****************************************************************************
+export class dns_ptr_client final {
+	dns_ptr_client(const dns_ptr_client&) = delete;
+	dns_ptr_client& operator=(const dns_ptr_client&) = delete;
+public:
+	using clock = std::chrono::steady_clock;
+#ifdef _WIN32
+	using native_socket = SOCKET;
+#else
+	using native_socket = int;
+#endif
+
+	explicit dns_ptr_client(const SOCKADDR_INET& server);
+	~dns_ptr_client() noexcept;
+
+	// the first DNS server the system is configured with, if any
+	[[nodiscard]]
+	static std::optional<SOCKADDR_INET> system_server();
+
+	void start(const SOCKADDR_INET& addr, ptr_request& request);
+
+	[[nodiscard]]
+	ptr_lookup lookup(const SOCKADDR_INET& addr) noexcept
+	{
+		return ptr_lookup{ *this, addr };
+	}
+private:
+	struct in_flight final {
+		ptr_request* request = nullptr;
+		std::vector<std::uint8_t> query;
+		clock::time_point deadline;
+		int attempts = 0;
+	};
+	using finished = std::pair<ptr_request*, ptr_answer>;
+
+	void run(std::stop_token stop_token) noexcept;
+	// both with m_mutex held
+	void send(in_flight& query, clock::time_point now) noexcept;
+	void send_backlog(clock::time_point now) noexcept;
+	void receive(std::vector<finished>& done) noexcept;
+	void expire(clock::time_point now, std::vector<finished>& done) noexcept;
+	[[nodiscard]]
+	std::uint16_t new_id() noexcept;
+
+	native_socket m_socket;
+	std::mutex m_mutex;
+	std::unordered_map<std::uint16_t, in_flight> m_inFlight;
+	std::deque<std::pair<std::uint16_t, in_flight>> m_backlog;
+	std::mt19937 m_random{ std::random_device{}() };
+	std::jthread m_thread;
+};
+
+void ptr_lookup::await_suspend(std::coroutine_handle<> resume_handle)
+{
+	m_resume = resume_handle;
+	m_client.start(m_addr, *this);
+}
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <cstring>;
+import <fstream>;
+import <system_error>;
+#endif
+
+namespace {
+	constexpr std::uint16_t TYPE_PTR = 12;
+	constexpr std::uint16_t TYPE_SOA = 6;
+	constexpr std::uint16_t CLASS_IN = 1;
+	constexpr std::uint8_t RCODE_NOERROR = 0;
+	constexpr std::uint8_t RCODE_NXDOMAIN = 3;
+	constexpr std::size_t HEADER_SIZE = 12;
+	// plain DNS over UDP without EDNS never gets anything bigger
+	constexpr std::size_t MAX_MESSAGE = 512;
+	// how long the thread sleeps at most, so that new deadlines are noticed without a wakeup
+	constexpr auto TICK = std::chrono::milliseconds(50);
+
+#ifdef _WIN32
+	constexpr auto INVALID = INVALID_SOCKET;
+
+	int last_error() noexcept
+	{
+		return WSAGetLastError();
+	}
+
+	void close_socket(SOCKET s) noexcept
+	{
+		closesocket(s);
+	}
+
+	bool make_nonblocking(SOCKET s) noexcept
+	{
+		u_long on = 1;
+		return ioctlsocket(s, FIONBIO, &on) == 0;
+	}
+
+	int wait_readable(SOCKET s, int timeout_ms) noexcept
+	{
+		WSAPOLLFD fd{ .fd = s, .events = POLLRDNORM };
+		return WSAPoll(&fd, 1, timeout_ms);
+	}
+#else
+	constexpr auto INVALID = -1;
+
+	int last_error() noexcept
+	{
+		return errno;
+	}
+
+	void close_socket(int s) noexcept
+	{
+		::close(s);
+	}
+
+	bool make_nonblocking(int s) noexcept
+	{
+		return ::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL) | O_NONBLOCK) == 0;
+	}
+
+	int wait_readable(int s, int timeout_ms) noexcept
+	{
+		pollfd fd{ .fd = s, .events = POLLIN };
+		return ::poll(&fd, 1, timeout_ms);
+	}
+#endif
+
+	void put16(std::vector<std::uint8_t>& out, std::uint16_t value)
+	{
+		out.push_back(static_cast<std::uint8_t>(value >> 8));
+		out.push_back(static_cast<std::uint8_t>(value));
+	}
+
+	void put_label(std::vector<std::uint8_t>& out, std::string_view label)
+	{
+		out.push_back(static_cast<std::uint8_t>(label.size()));
+		out.insert(out.end(), label.begin(), label.end());
+	}
+
+	// the whole query but the ID, which goes in last
+	[[nodiscard]]
+	std::vector<std::uint8_t> make_query(const SOCKADDR_INET& addr)
+	{
+		std::vector<std::uint8_t> out;
+		out.reserve(HEADER_SIZE + 74 + 4);
+		put16(out, 0);
+		put16(out, 0x0100);	// a standard query, recursion desired
+		put16(out, 1);
+		put16(out, 0);
+		put16(out, 0);
+		put16(out, 0);
+		if (addr.si_family == AF_INET6) {
+			constexpr std::string_view HEX = "0123456789abcdef";
+			const auto bytes = reinterpret_cast<const std::uint8_t*>(&addr.Ipv6.sin6_addr);
+			for (int i = 15; i >= 0; --i) {
+				put_label(out, HEX.substr(bytes[i] & 0xf, 1));
+				put_label(out, HEX.substr(bytes[i] >> 4, 1));
+			}
+			put_label(out, "ip6");
+		}
+		else {
+			const auto bytes = reinterpret_cast<const std::uint8_t*>(&addr.Ipv4.sin_addr);
+			for (int i = 3; i >= 0; --i) {
+				put_label(out, std::to_string(bytes[i]));
+			}
+			put_label(out, "in-addr");
+		}
+		put_label(out, "arpa");
+		out.push_back(0);
+		put16(out, TYPE_PTR);
+		put16(out, CLASS_IN);
+		return out;
+	}
+
+	//*****************************************************************************
+	// CLASS:  message_reader
+	//
+	// Bounds checked all the way, a short or malformed answer just fails.
+	//*****************************************************************************
+	class message_reader final {
+		std::span<const std::uint8_t> m_message;
+		std::size_t m_at = HEADER_SIZE;
+	public:
+		explicit message_reader(std::span<const std::uint8_t> message) noexcept
+			:m_message(message)
+		{
+		}
+
+		[[nodiscard]] std::size_t position() const noexcept { return m_at; }
+		void seek(std::size_t at) noexcept { m_at = at; }
+
+		[[nodiscard]]
+		std::optional<std::uint16_t> u16() noexcept
+		{
+			if (m_at + 2 > m_message.size()) {
+				return std::nullopt;
+			}
+			const auto value = static_cast<std::uint16_t>(m_message[m_at] << 8 | m_message[m_at + 1]);
+			m_at += 2;
+			return value;
+		}
+
+		[[nodiscard]]
+		std::optional<std::uint32_t> u32() noexcept
+		{
+			const auto high = u16();
+			const auto low = u16();
+			if (!high || !low) {
+				return std::nullopt;
+			}
+			return static_cast<std::uint32_t>(*high) << 16 | *low;
+		}
+
+		// follows compression pointers, never more of them than there could be names
+		[[nodiscard]]
+		std::optional<std::wstring> name() noexcept
+		{
+			std::wstring text;
+			auto at = m_at;
+			std::optional<std::size_t> resume;
+			std::size_t length = 0;
+			for (int jumps = 0; jumps < 64;) {
+				if (at >= m_message.size()) {
+					return std::nullopt;
+				}
+				const auto label = m_message[at];
+				if (label == 0) {
+					m_at = resume.value_or(at + 1);
+					return text;
+				}
+				if ((label & 0xc0) == 0xc0) {
+					if (at + 1 >= m_message.size()) {
+						return std::nullopt;
+					}
+					if (!resume) {
+						resume = at + 2;
+					}
+					at = static_cast<std::size_t>(label & 0x3f) << 8 | m_message[at + 1];
+					++jumps;
+					continue;
+				}
+				if ((label & 0xc0) || at + 1 + label > m_message.size() || (length += label + 1u) > 255) {
+					return std::nullopt;
+				}
+				if (!text.empty()) {
+					text += L'.';
+				}
+				for (std::size_t i = 0; i < label; ++i) {
+					text += static_cast<wchar_t>(m_message[at + 1 + i]);
+				}
+				at += 1 + label;
+			}
+			return std::nullopt;
+		}
+
+		[[nodiscard]]
+		bool skip(std::size_t bytes) noexcept
+		{
+			if (m_at + bytes > m_message.size()) {
+				return false;
+			}
+			m_at += bytes;
+			return true;
+		}
+	};
+
+	[[nodiscard]]
+	bool same_question(std::span<const std::uint8_t> message, std::span<const std::uint8_t> query) noexcept
+	{
+		if (message.size() < query.size()) {
+			return false;
+		}
+		// servers may change the case of the name, nothing else
+		return std::equal(query.begin() + HEADER_SIZE, query.end(), message.begin() + HEADER_SIZE, [](std::uint8_t a, std::uint8_t b) noexcept {
+			const auto lower = [](std::uint8_t c) noexcept { return c >= 'A' && c <= 'Z' ? static_cast<std::uint8_t>(c - 'A' + 'a') : c; };
+			return lower(a) == lower(b);
+		});
+	}
+
+	// nullopt for anything that isn't an answer to this query at all
+	[[nodiscard]]
+	std::optional<ptr_answer> parse_answer(std::span<const std::uint8_t> message, std::span<const std::uint8_t> query) noexcept
+	{
+		message_reader reader(message);
+		if (message.size() < HEADER_SIZE || !(message[2] & 0x80) || !same_question(message, query)) {
+			return std::nullopt;
+		}
+		const auto rcode = static_cast<std::uint8_t>(message[3] & 0x0f);
+		const auto answers = static_cast<std::uint16_t>(message[6] << 8 | message[7]);
+		const auto authorities = static_cast<std::uint16_t>(message[8] << 8 | message[9]);
+		reader.seek(query.size());
+		ptr_answer answer;
+		if (rcode != RCODE_NOERROR && rcode != RCODE_NXDOMAIN) {
+			return answer;
+		}
+		for (unsigned i = 0; i < answers + authorities; ++i) {
+			const auto owner = reader.name();
+			const auto type = reader.u16();
+			const auto rclass = reader.u16();
+			const auto ttl = reader.u32();
+			const auto length = reader.u16();
+			if (!owner || !type || !rclass || !ttl || !length) {
+				break;
+			}
+			const auto next = reader.position() + *length;
+			if (*rclass == CLASS_IN && *type == TYPE_PTR && i < answers && rcode == RCODE_NOERROR) {
+				if (auto name = reader.name(); name && !name->empty()) {
+					return ptr_answer{ .outcome = ptr_outcome::name, .name = std::move(*name), .ttl = std::chrono::seconds(*ttl) };
+				}
+			}
+			// RFC 2308 section 5, the lesser of the SOA's own TTL and its minimum field
+			else if (*rclass == CLASS_IN && *type == TYPE_SOA && i >= answers) {
+				if (reader.name() && reader.name() && reader.skip(16)) {
+					if (const auto minimum = reader.u32()) {
+						answer.ttl = std::chrono::seconds(std::min(*ttl, *minimum));
+					}
+				}
+			}
+			reader.seek(next);
+		}
+		// a truncated answer may well have had the record we were after
+		if (!(message[2] & 0x02)) {
+			answer.outcome = ptr_outcome::no_name;
+		}
+		return answer;
+	}
+}
+
+dns_ptr_client::dns_ptr_client(const SOCKADDR_INET& server)
+	:m_socket(::socket(server.si_family, SOCK_DGRAM, IPPROTO_UDP))
+{
+	if (m_socket == INVALID) {
+		throw std::system_error(last_error(), std::system_category(), "DNS socket");
+	}
+	const auto size = static_cast<socklen_t>(server.si_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+	// connected, so that nothing but the server gets through to us
+	if (!make_nonblocking(m_socket) || ::connect(m_socket, reinterpret_cast<const sockaddr*>(&server), size) != 0) {
+		const auto error = last_error();
+		close_socket(m_socket);
+		throw std::system_error(error, std::system_category(), "DNS socket");
+	}
+	m_thread = std::jthread([this](std::stop_token stop_token) noexcept { this->run(stop_token); });
+}
+
+dns_ptr_client::~dns_ptr_client() noexcept
+{
+	m_thread.request_stop();
+	m_thread.join();
+	close_socket(m_socket);
+	// nobody is going to answer these any more
+	for (auto& [id, query] : m_inFlight) {
+		query.request->done({});
+	}
+	for (auto& [id, query] : m_backlog) {
+		query.request->done({});
+	}
+}
+
+std::optional<SOCKADDR_INET> dns_ptr_client::system_server()
+{
+	SOCKADDR_INET server{};
+#ifdef _WIN32
+	ULONG size = 0;
+	if (GetNetworkParams(nullptr, &size) != ERROR_BUFFER_OVERFLOW) {
+		return std::nullopt;
+	}
+	std::vector<std::byte> buffer(size);
+	const auto params = reinterpret_cast<FIXED_INFO*>(buffer.data());
+	if (GetNetworkParams(params, &size) != ERROR_SUCCESS) {
+		return std::nullopt;
+	}
+	const std::string_view text = params->DnsServerList.IpAddress.String;
+#else
+	std::ifstream resolv_conf("/etc/resolv.conf");
+	std::string text;
+	for (std::string line; std::getline(resolv_conf, line);) {
+		if (line.starts_with("nameserver")) {
+			text = line.substr(line.find_first_not_of(" \t", 10));
+			text = text.substr(0, text.find_first_of(" \t%"));
+			break;
+		}
+	}
+#endif
+	const std::string address(text);
+	if (inet_pton(AF_INET, address.c_str(), &server.Ipv4.sin_addr) == 1) {
+		server.Ipv4.sin_family = AF_INET;
+		server.Ipv4.sin_port = htons(53);
+		return server;
+	}
+	if (inet_pton(AF_INET6, address.c_str(), &server.Ipv6.sin6_addr) == 1) {
+		server.Ipv6.sin6_family = AF_INET6;
+		server.Ipv6.sin6_port = htons(53);
+		return server;
+	}
+	return std::nullopt;
+}
+
+std::uint16_t dns_ptr_client::new_id() noexcept
+{
+	std::uniform_int_distribution<unsigned> ids(0, 0xffff);
+	for (;;) {
+		const auto id = static_cast<std::uint16_t>(ids(m_random));
+		const auto queued = std::ranges::any_of(m_backlog, [id](const auto& query) noexcept { return query.first == id; });
+		if (!m_inFlight.contains(id) && !queued) {
+			return id;
+		}
+	}
+}
+
+void dns_ptr_client::start(const SOCKADDR_INET& addr, ptr_request& request)
+{
+	in_flight query{ .request = &request, .query = make_query(addr) };
+	std::scoped_lock lock(m_mutex);
+	const auto id = new_id();
+	query.query[0] = static_cast<std::uint8_t>(id >> 8);
+	query.query[1] = static_cast<std::uint8_t>(id);
+	if (m_inFlight.size() >= PTR_MAX_IN_FLIGHT) {
+		m_backlog.emplace_back(id, std::move(query));
+		return;
+	}
+	send(m_inFlight.emplace(id, std::move(query)).first->second, clock::now());
+}
+
+void dns_ptr_client::send(in_flight& query, clock::time_point now) noexcept
+{
+	// a send that fails is just a lost packet, the retry takes care of it
+	[[maybe_unused]] const auto sent = ::send(m_socket, reinterpret_cast<const char*>(query.query.data()), static_cast<int>(query.query.size()), 0);
+	query.deadline = now + PTR_QUERY_TIMEOUT * (1 << query.attempts);
+	++query.attempts;
+}
+
+void dns_ptr_client::send_backlog(clock::time_point now) noexcept
+{
+	while (!m_backlog.empty() && m_inFlight.size() < PTR_MAX_IN_FLIGHT) {
+		auto [id, query] = std::move(m_backlog.front());
+		m_backlog.pop_front();
+		send(m_inFlight.emplace(id, std::move(query)).first->second, now);
+	}
+}
+
+void dns_ptr_client::run(std::stop_token stop_token) noexcept
+{
+	std::vector<finished> done;
+	while (!stop_token.stop_requested()) {
+		clock::duration wait = TICK;
+		{
+			std::scoped_lock lock(m_mutex);
+			for (const auto& [id, query] : m_inFlight) {
+				wait = std::min(wait, query.deadline - clock::now());
+			}
+		}
+		const auto timeout = std::max<long long>(std::chrono::ceil<std::chrono::milliseconds>(wait).count(), 0);
+		const auto ready = wait_readable(m_socket, static_cast<int>(timeout));
+		{
+			std::scoped_lock lock(m_mutex);
+			if (ready > 0) {
+				receive(done);
+			}
+			const auto now = clock::now();
+			expire(now, done);
+			send_backlog(now);
+		}
+		// outside the lock, a resumed lookup may well start another one
+		for (auto& [request, answer] : done) {
+			request->done(std::move(answer));
+		}
+		done.clear();
+	}
+}
+
+void dns_ptr_client::receive(std::vector<finished>& done) noexcept
+{
+	std::array<std::uint8_t, MAX_MESSAGE> message;
+	for (;;) {
+		const auto received = ::recv(m_socket, reinterpret_cast<char*>(message.data()), static_cast<int>(message.size()), 0);
+		if (received < static_cast<int>(HEADER_SIZE)) {
+			// would block, or an ICMP error for an earlier send that the retries will cover
+			if (received < 0) {
+				return;
+			}
+			continue;
+		}
+		const auto id = static_cast<std::uint16_t>(message[0] << 8 | message[1]);
+		const auto found = m_inFlight.find(id);
+		if (found == m_inFlight.end()) {
+			continue;
+		}
+		const std::span<const std::uint8_t> reply(message.data(), static_cast<std::size_t>(received));
+		if (auto answer = parse_answer(reply, found->second.query)) {
+			done.emplace_back(found->second.request, std::move(*answer));
+			m_inFlight.erase(found);
+		}
+	}
+}
+
+void dns_ptr_client::expire(clock::time_point now, std::vector<finished>& done) noexcept
+{
+	for (auto query = m_inFlight.begin(); query != m_inFlight.end();) {
+		if (query->second.deadline > now) {
+			++query;
+		}
+		else if (query->second.attempts < PTR_QUERY_ATTEMPTS) {
+			send(query->second, now);
+			++query;
+		}
+		else {
+			done.emplace_back(query->second.request, ptr_answer{});
+			query = m_inFlight.erase(query);
+		}
+	}
+}
@@ -0,0 +1,593 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRReport.ixx
+//
+// DESCRIPTION:
+//   Report mode, like mtr's: trace for a number of cycles or seconds, print
+//   the report and exit with a status code, with no window at all.
+//   Or do the same for every trace a capture recorded, without sending
+//   anything. The report itself is written by WinMTR.ReportWriter, which
+//   the dialog's exports use as well.
+//
+// NOTES:
+//   Drives WinMTRNet directly and knows nothing of MFC. The caller hands in
+//   the arguments and the stream to print to, WinMTRMain attaches the
+//   console it was started from first, WinMTRLinuxMain has the terminal.
+//   The wait for the cycles runs on the backend's clock, so a simulated
+//   backend can drive a whole report.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <netdb.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <exception>
+#include <format>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.Report;
+
+#ifdef _WIN32
+import <chrono>;
+import <cstdint>;
+import <memory>;
+import <optional>;
+import <ostream>;
+import <span>;
+import <string>;
+import <string_view>;
+import <utility>;
+import <vector>;
+#endif
+import WinMTR.Net;
+import WinMTR.ProbeBackend;
+export import WinMTR.ReportWriter;
+import WinMTROptionsProvider;
+import WinMTRSNetHost;
+import WinMTRUtils;
+
+// what the process exits with in report mode
+export enum class report_status : int {
+	reached = 0,		// the destination answered
+	unreached = 1,		// the trace ran but the destination never answered
+	usage = 2,			// the command line didn't make sense
+	failed = 3			// the host didn't resolve or the trace couldn't start
+};
+
+// the options a report runs with, plain values since nothing changes them mid trace
+export struct report_options final : IWinMTROptionsProvider {
+	unsigned pingSize = WinMTRUtils::DEFAULT_PING_SIZE;
+	double interval = WinMTRUtils::DEFAULT_INTERVAL;
+	bool useDNS = true;
+	double ewmaWeight = WinMTRUtils::DEFAULT_EWMA_WEIGHT;
+	bool parisMode = false;
+	probe_protocol protocol = probe_protocol::icmp;
+	unsigned probePort = WinMTRUtils::DEFAULT_UDP_PORT;
+	unsigned maxProbeRate = WinMTRUtils::DEFAULT_MAX_PROBE_RATE;
+	unsigned maxByteRate = WinMTRUtils::DEFAULT_MAX_BYTE_RATE;
+	unsigned maxHops = WinMTRUtils::DEFAULT_MAX_HOPS;
+
+	unsigned getPingSize() const noexcept override { return pingSize; }
+	double getInterval() const noexcept override { return interval; }
+	bool getUseDNS() const noexcept override { return useDNS; }
+	double getEwmaWeight() const noexcept override { return ewmaWeight; }
+	// nothing in a report looks at single probes
+	unsigned getHistoryKiB() const noexcept override { return 0; }
+	bool getParisMode() const noexcept override { return parisMode; }
+	probe_protocol getProbeProtocol() const noexcept override { return protocol; }
+	unsigned getProbePort() const noexcept override { return probePort; }
+	unsigned getMaxProbeRate() const noexcept override { return maxProbeRate; }
+	unsigned getMaxByteRate() const noexcept override { return maxByteRate; }
+	unsigned getMaxHops() const noexcept override { return maxHops; }
+};
+
+export struct report_request final {
+	std::wstring host;
+	report_options options;
+	int family = AF_UNSPEC;
+	unsigned cycles = 10;							// probes per hop before the report is printed
+	std::chrono::seconds duration{ 0 };				// or for this long, if set, whatever the cycles
+	report_format format = report_format::text;
+	std::wstring eventLog;
+	std::wstring capture;
+	std::wstring replay;							// a capture to report on instead of a host
+};
+
+// true if the arguments ask for report mode, the dialog runs otherwise
+export [[nodiscard]] bool is_report_mode(std::span<const std::wstring_view> args) noexcept;
+
+// everything but the program name, nothing and a reason if they don't make sense
+export [[nodiscard]] std::optional<report_request> parse_report_args(std::span<const std::wstring_view> args, std::wstring& error);
+
+// resolves, traces and prints, or replays, blocks until it is all done. Only
+// the report goes to out, what went wrong goes to err.
+export [[nodiscard]] report_status run_report(const report_request& request, std::wostream& out, std::wostream& err);
+
+// What run_report does once the host resolved: traces the candidates on
+// backend until the cycles or the duration are done, prints the report and
+// sets status. The time to the first probe counts from requested.
+export [[nodiscard("The task should be awaited")]]
+trace_action report_trace(const report_request& request, std::vector<SOCKADDR_INET> candidates, std::shared_ptr<probe_backend> backend
+	, probe_backend::clock::time_point requested, std::wostream& out, std::wostream& err, report_status& status);
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
+import <cwchar>;
+import <format>;
+import <limits>;
+import <stop_token>;
+import <thread>;
+import <winrt/Windows.Foundation.h>;
+#endif
+import WinMTR.Capture;
+import WinMTR.EventLog;
+#ifdef _WIN32
+import WinMTRDnsUtil;
+import WinMTR.ProbeEngine;
+#else
+import WinMTR.ProbeBackend.Linux;
+#endif
+import WinMTRIPUtils;
+
+using namespace std::literals;
+
+namespace {
+	// the state is looked at this often while waiting for the cycles to complete
+	constexpr auto POLL_INTERVAL = 100ms;
+	// Counting cycles stops nowhere if the trace stops sending, so it is
+	// given up on after this many times what the cycles should take, plus
+	// the time resolving, discovery and the race take before the first one.
+	constexpr auto CYCLE_SAFETY_FACTOR = 4;
+	constexpr auto STARTUP_ALLOWANCE = 30s;
+
+	[[nodiscard]]
+	std::optional<double> parse_number(std::wstring_view text, double min, double max) noexcept
+	{
+		const std::wstring copy(text);
+		wchar_t* end = nullptr;
+		const auto parsed = std::wcstod(copy.c_str(), &end);
+		if (copy.empty() || *end != L'\0' || parsed < min || parsed > max) {
+			return std::nullopt;
+		}
+		return parsed;
+	}
+
+	[[nodiscard]]
+	std::optional<report_format> parse_format(std::wstring_view name) noexcept
+	{
+		constexpr std::array formats{ std::pair{ L"text"sv, report_format::text }
+			, std::pair{ L"html"sv, report_format::html }
+			, std::pair{ L"json"sv, report_format::json }
+			, std::pair{ L"csv"sv, report_format::csv }
+			, std::pair{ L"markdown"sv, report_format::markdown }
+			, std::pair{ L"md"sv, report_format::markdown }
+			, std::pair{ L"xml"sv, report_format::xml } };
+		const auto found = std::ranges::find(formats, name, &decltype(formats)::value_type::first);
+		return found == formats.end() ? std::nullopt : std::optional(found->second);
+	}
+
+	// the report in the format asked for, snapshot and text are kept from one trace to the next
+	void print(std::wostream& out, const report_request& request, std::wstring_view host, const WinMTRNet& net, report_snapshot& report, std::wstring& text)
+	{
+		report.take(net, host);
+		text.clear();
+		report.write(text, request.format);
+		out << text;
+		out.flush();
+	}
+
+	// the fewest probes any hop up to the destination has sent, paths of a hop added up
+	[[nodiscard]]
+	int completed_cycles(const std::vector<s_nethost>& hops) noexcept
+	{
+		if (hops.empty()) {
+			return 0;
+		}
+		auto fewest = std::numeric_limits<int>::max();
+		for (std::size_t i = 0; i < hops.size();) {
+			int sent = 0;
+			const auto ttl = hops[i].ttl;
+			for (; i < hops.size() && hops[i].ttl == ttl; ++i) {
+				sent += hops[i].xmit;
+			}
+			fewest = std::min(fewest, sent);
+		}
+		return fewest;
+	}
+
+#ifdef _WIN32
+	winrt::Windows::Foundation::IAsyncOperation<int> trace_and_print(const report_request& request, std::wostream& out, std::wostream& err)
+	{
+		const auto requested = probe_backend::clock::now();
+		timeval timeout{ .tv_sec = 30 };
+		auto candidates = co_await GetAddrInfoAsync(request.host, &timeout, request.family);
+		if (!candidates || candidates->empty()) {
+			err << std::format(L"Unable to resolve {}\n"sv, request.host);
+			co_return static_cast<int>(report_status::failed);
+		}
+		auto status = report_status::failed;
+		co_await report_trace(request, std::move(*candidates), probe_engine::instance(), requested, out, err, status);
+		co_return static_cast<int>(status);
+	}
+#else
+	// the addresses of host in the resolver's order, nothing if it doesn't resolve
+	[[nodiscard]]
+	std::optional<std::vector<SOCKADDR_INET>> resolve(std::wstring_view host, int family)
+	{
+		// a name that isn't ASCII has to be given in its IDNA form, like to the dialog's resolver
+		if (std::ranges::any_of(host, [](wchar_t c) noexcept { return c < 0 || c > 0x7F; })) {
+			return std::nullopt;
+		}
+		const std::string name(host.begin(), host.end());
+		addrinfo hints{};
+		hints.ai_flags = AI_ADDRCONFIG;
+		hints.ai_family = family;
+		hints.ai_socktype = SOCK_DGRAM;
+		addrinfo* found = nullptr;
+		if (::getaddrinfo(name.c_str(), nullptr, &hints, &found) != 0) {
+			return std::nullopt;
+		}
+		const std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> owner(found, &::freeaddrinfo);
+		std::vector<SOCKADDR_INET> candidates;
+		for (auto info = found; info; info = info->ai_next) {
+			if ((info->ai_family == AF_INET || info->ai_family == AF_INET6) && info->ai_addrlen <= sizeof(SOCKADDR_INET)) {
+				SOCKADDR_INET addr{};
+				std::memcpy(&addr, info->ai_addr, info->ai_addrlen);
+				candidates.push_back(addr);
+			}
+		}
+		return candidates;
+	}
+#endif
+
+	// every trace in the capture one after the other, reached only if all of them were
+	[[nodiscard]]
+	report_status replay_and_print(const report_request& request, std::wostream& out, std::wostream& err)
+	{
+		const auto capture = capture_file::open(request.replay);
+		if (!capture) {
+			err << std::format(L"Unable to read the capture {}\n"sv, request.replay);
+			return report_status::failed;
+		}
+		const auto traces = capture->traces();
+		if (traces.empty()) {
+			err << std::format(L"No traces in the capture {}\n"sv, request.replay);
+			return report_status::failed;
+		}
+		auto status = report_status::reached;
+		const auto net = std::make_shared<WinMTRNet>(&request.options);
+		report_snapshot report;
+		std::wstring text;
+		for (const auto from : traces) {
+			capture_file::cursor start(*capture, from);
+			capture_record trace;
+			(void)start.next(trace);
+			const auto destination = addr_to_string(trace.address);
+			if (request.format == report_format::text) {
+				const auto started = std::chrono::floor<std::chrono::seconds>(capture->started() + trace.time);
+				out << std::format(L"Trace of {} started {:%F %T} UTC\n"sv, destination, started);
+			}
+			net->Replay(*capture, from);
+			print(out, request, destination, *net, report, text);
+			if (!net->getDestinationReached()) {
+				status = report_status::unreached;
+			}
+		}
+		return status;
+	}
+}
+
+bool is_report_mode(std::span<const std::wstring_view> args) noexcept
+{
+	return std::ranges::any_of(args, [](std::wstring_view arg) noexcept {
+		return arg == L"--report"sv || arg == L"-R"sv || arg == L"/R"sv;
+	});
+}
+
+std::optional<report_request> parse_report_args(std::span<const std::wstring_view> args, std::wstring& error)
+{
+	report_request request;
+	bool portSet = false;
+	for (std::size_t i = 0; i < args.size(); ++i) {
+		auto arg = args[i];
+		// MFC's parser takes both, so this one does too
+		if (arg.size() > 1 && arg.front() == L'/') {
+			arg.remove_prefix(1);
+		}
+		else if (arg.starts_with(L"--"sv)) {
+			arg.remove_prefix(2);
+		}
+		else if (arg.size() > 1 && arg.front() == L'-') {
+			arg.remove_prefix(1);
+		}
+		else {
+			if (!request.host.empty()) {
+				error = std::format(L"Only one host can be traced, got {} and {}"sv, request.host, arg);
+				return std::nullopt;
+			}
+			request.host = arg;
+			continue;
+		}
+		// the ones that take a value
+		const auto value = [&](double min, double max) -> std::optional<double> {
+			if (i + 1 == args.size()) {
+				error = std::format(L"{} needs a value"sv, args[i]);
+				return std::nullopt;
+			}
+			const auto parsed = parse_number(args[++i], min, max);
+			if (!parsed) {
+				error = std::format(L"{} takes a number from {} to {}"sv, args[i - 1], min, max);
+			}
+			return parsed;
+		};
+		if (arg == L"R"sv || arg == L"report"sv) {
+			continue;
+		}
+		else if (arg == L"j"sv || arg == L"json"sv) {
+			request.format = report_format::json;
+		}
+		else if (arg == L"C"sv || arg == L"csv"sv) {
+			request.format = report_format::csv;
+		}
+		else if (arg == L"f"sv || arg == L"format"sv) {
+			if (i + 1 == args.size()) {
+				error = std::format(L"{} needs a format"sv, args[i]);
+				return std::nullopt;
+			}
+			const auto format = parse_format(args[++i]);
+			if (!format) {
+				error = std::format(L"{} takes text, html, json, csv, markdown or xml"sv, args[i - 1]);
+				return std::nullopt;
+			}
+			request.format = *format;
+		}
+		else if (arg == L"n"sv || arg == L"numeric"sv) {
+			request.options.useDNS = false;
+		}
+		else if (arg == L"p"sv || arg == L"paris"sv) {
+			request.options.parisMode = true;
+		}
+		else if (arg == L"4"sv) {
+			request.family = AF_INET;
+		}
+		else if (arg == L"6"sv) {
+			request.family = AF_INET6;
+		}
+		else if (arg == L"c"sv || arg == L"report-cycles"sv) {
+			const auto parsed = value(1, 1000000);
+			if (!parsed) return std::nullopt;
+			request.cycles = static_cast<unsigned>(*parsed);
+		}
+		else if (arg == L"d"sv || arg == L"duration"sv) {
+			const auto parsed = value(1, 31536000);
+			if (!parsed) return std::nullopt;
+			request.duration = std::chrono::seconds(static_cast<long long>(*parsed));
+		}
+		else if (arg == L"i"sv || arg == L"interval"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_INTERVAL, WinMTRUtils::MAX_INTERVAL);
+			if (!parsed) return std::nullopt;
+			request.options.interval = *parsed;
+		}
+		else if (arg == L"s"sv || arg == L"size"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_PING_SIZE, WinMTRUtils::MAX_PING_SIZE);
+			if (!parsed) return std::nullopt;
+			request.options.pingSize = static_cast<unsigned>(*parsed);
+		}
+		else if (arg == L"e"sv || arg == L"ewma"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_EWMA_WEIGHT, WinMTRUtils::MAX_EWMA_WEIGHT);
+			if (!parsed) return std::nullopt;
+			request.options.ewmaWeight = *parsed;
+		}
+		else if (arg == L"u"sv || arg == L"udp"sv || arg == L"t"sv || arg == L"tcp"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_PROBE_PORT, WinMTRUtils::MAX_PROBE_PORT);
+			if (!parsed) return std::nullopt;
+			request.options.protocol = arg.front() == L'u' ? probe_protocol::udp : probe_protocol::tcp;
+			request.options.probePort = static_cast<unsigned>(*parsed);
+			portSet = true;
+		}
+		else if (arg == L"r"sv || arg == L"rate"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_MAX_PROBE_RATE, WinMTRUtils::MAX_MAX_PROBE_RATE);
+			if (!parsed) return std::nullopt;
+			request.options.maxProbeRate = static_cast<unsigned>(*parsed);
+		}
+		else if (arg == L"b"sv || arg == L"bandwidth"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_MAX_BYTE_RATE, WinMTRUtils::MAX_MAX_BYTE_RATE);
+			if (!parsed) return std::nullopt;
+			request.options.maxByteRate = static_cast<unsigned>(*parsed);
+		}
+		else if (arg == L"x"sv || arg == L"maxhops"sv) {
+			const auto parsed = value(WinMTRUtils::MIN_MAX_HOPS, WinMTRUtils::MAX_MAX_HOPS);
+			if (!parsed) return std::nullopt;
+			request.options.maxHops = static_cast<unsigned>(*parsed);
+		}
+		else if (arg == L"l"sv || arg == L"log"sv) {
+			if (i + 1 == args.size()) {
+				error = std::format(L"{} needs a file"sv, args[i]);
+				return std::nullopt;
+			}
+			request.eventLog = args[++i];
+		}
+		else if (arg == L"w"sv || arg == L"capture"sv) {
+			if (i + 1 == args.size()) {
+				error = std::format(L"{} needs a file"sv, args[i]);
+				return std::nullopt;
+			}
+			request.capture = args[++i];
+		}
+		else if (arg == L"replay"sv) {
+			if (i + 1 == args.size()) {
+				error = std::format(L"{} needs a file"sv, args[i]);
+				return std::nullopt;
+			}
+			request.replay = args[++i];
+		}
+		else {
+			error = std::format(L"Unknown option {}"sv, args[i]);
+			return std::nullopt;
+		}
+	}
+	if (!request.replay.empty() && !request.host.empty()) {
+		error = std::format(L"Either trace {} or replay {}, not both"sv, request.host, request.replay);
+		return std::nullopt;
+	}
+	if (request.host.empty() && request.replay.empty()) {
+		error = L"No host specified"s;
+		return std::nullopt;
+	}
+	if (!portSet && request.options.protocol == probe_protocol::tcp) {
+		request.options.probePort = WinMTRUtils::DEFAULT_TCP_PORT;
+	}
+	return request;
+}
+
+trace_action report_trace(const report_request& request, std::vector<SOCKADDR_INET> candidates, std::shared_ptr<probe_backend> backend
+	, probe_backend::clock::time_point requested, std::wostream& out, std::wostream& err, report_status& status)
+{
+	status = report_status::failed;
+	const auto net = std::make_shared<WinMTRNet>(&request.options, backend);
+	std::stop_source stop;
+	const auto trace = net->DoTrace(stop.get_token(), std::move(candidates), requested);
+	const auto started = backend->now();
+	const auto deadline = request.duration > 0s ? started + request.duration
+		: started + STARTUP_ALLOWANCE + std::chrono::duration_cast<probe_backend::clock::duration>(std::chrono::duration<double>(request.options.getInterval() * request.cycles * CYCLE_SAFETY_FACTOR));
+	for (;;) {
+		co_await backend->resume_after(POLL_INTERVAL);
+		// it only ends by itself if it failed, co_await below says how
+		if (trace.Status() != trace_status::Started
+			|| backend->now() >= deadline
+			|| (request.duration == 0s && completed_cycles(net->getCurrentState()) >= static_cast<int>(request.cycles))) {
+			break;
+		}
+	}
+	stop.request_stop();
+	try {
+		co_await trace;
+	}
+#ifdef _WIN32
+	catch (const winrt::hresult_error& e) {
+		err << std::format(L"Trace failed: {}\n"sv, std::wstring_view(e.message()));
+		co_return;
+	}
+#else
+	catch (const std::exception& e) {
+		const std::string_view what(e.what());
+		err << std::format(L"Trace failed: {}\n"sv, std::wstring(what.begin(), what.end()));
+		co_return;
+	}
+#endif
+	report_snapshot report;
+	std::wstring text;
+	print(out, request, request.host, *net, report, text);
+	status = net->getDestinationReached() ? report_status::reached : report_status::unreached;
+}
+
+report_status run_report(const report_request& request, std::wostream& out, std::wostream& err)
+{
+	// nothing is sent, so there is nothing to log either
+	if (!request.replay.empty()) {
+		return replay_and_print(request, out, err);
+	}
+	if (!request.eventLog.empty()) {
+		auto log = event_log::open(request.eventLog);
+		if (!log) {
+			err << std::format(L"Unable to open the event log {}\n"sv, request.eventLog);
+			return report_status::failed;
+		}
+		event_log::install(std::move(log));
+	}
+	if (!request.capture.empty()) {
+		auto writer = capture_writer::open(request.capture);
+		if (!writer) {
+			err << std::format(L"Unable to open the capture {}\n"sv, request.capture);
+			event_log::install(nullptr);
+			return report_status::failed;
+		}
+		capture_writer::install(std::move(writer));
+	}
+	auto status = report_status::failed;
+#ifdef _WIN32
+	// the trace's coroutines want a multithreaded apartment, whatever the caller is in
+	std::jthread([&] {
+		winrt::init_apartment(winrt::apartment_type::multi_threaded);
+		try {
+			status = static_cast<report_status>(trace_and_print(request, out, err).get());
+		}
+		catch (const winrt::hresult_error& e) {
+			err << std::format(L"Trace failed: {}\n"sv, std::wstring_view(e.message()));
+		}
+		winrt::uninit_apartment();
+	}).join();
+#else
+	const auto requested = probe_backend::clock::now();
+	if (auto candidates = resolve(request.host, request.family); !candidates || candidates->empty()) {
+		err << std::format(L"Unable to resolve {}\n"sv, request.host);
+	}
+	else {
+		try {
+			// the trace ends on the backend's I/O thread, which must not be the one to let go of it last
+			const auto backend = linux_icmp_backend::instance();
+			report_trace(request, std::move(*candidates), backend, requested, out, err, status).get();
+		}
+		// the backend's sockets couldn't be opened
+		catch (const std::exception& e) {
+			const std::string_view what(e.what());
+			err << std::format(L"Trace failed: {}\n"sv, std::wstring(what.begin(), what.end()));
+		}
+	}
+#endif
+	// whatever was logged is written out before the process goes
+	event_log::install(nullptr);
+	capture_writer::install(nullptr);
+	return status;
+}
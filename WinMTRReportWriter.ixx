@@ -0,0 +1,771 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRReportWriter.ixx
+//
+// DESCRIPTION:
+//   The statistics of a trace as a report, in text, HTML, JSON, CSV,
+//   Markdown or XML. Report mode and the dialog's exports both go through
+//   here, so every format says the same thing.
+//
+// NOTES:
+//   A snapshot is taken once and then written in any number of formats. The
+//   snapshot keeps its rows and the caller keeps the buffer the report is
+//   written to, so a report that is no bigger than the one before allocates
+//   nothing. Numbers go through to_chars, never through a locale.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.ReportWriter;
+
+#ifdef _WIN32
+import <chrono>;
+import <cstddef>;
+import <cstdint>;
+import <optional>;
+import <span>;
+import <string>;
+import <string_view>;
+import <utility>;
+import <vector>;
+#endif
+import WinMTR.Net;
+import WinMTR.Capture;
+import WinMTR.EventLog;
+#ifdef _WIN32
+import WinMTR.Metrics;
+#endif
+import WinMTR.NameCache;
+import WinMTRSNetHost;
+
+export enum class report_format {
+	text,
+	html,
+	json,
+	csv,
+	markdown,
+	xml
+};
+
+// what the dialog's exports add about the machinery behind the trace
+export struct report_diagnostics final {
+	name_cache_stats names;
+	std::optional<event_log_stats> events;
+	std::optional<capture_stats> capture;
+#ifdef _WIN32
+	std::optional<metrics_stats> metrics;	// there is no metrics endpoint on Linux
+#endif
+};
+
+export struct report_style final {
+	std::wstring_view no_response = L"No response from host";
+	std::wstring_view eol = L"\n";		// text only, the other formats end their lines with \n
+	std::wstring_view footer;			// a last line for the text format, none if empty
+};
+
+//*****************************************************************************
+// CLASS:  report_snapshot
+//
+// One thread at a time.
+//*****************************************************************************
+export class report_snapshot final {
+public:
+	// the trace as of now, what was taken before is overwritten
+	void take(const WinMTRNet& net, std::wstring_view host);
+	// the name cache and whatever the probes are written to, until the next take
+	void take_diagnostics();
+	// the report in format, appended to out
+	void write(std::wstring& out, report_format format, const report_style& style = {}) const;
+
+	[[nodiscard]]
+	std::span<const s_nethost> hops() const noexcept
+	{
+		return { m_hops.data(), m_rows };
+	}
+	[[nodiscard]]
+	bool reached() const noexcept
+	{
+		return m_reached;
+	}
+private:
+	void write_text(std::wstring& out, const report_style& style) const;
+	void write_html(std::wstring& out, const report_style& style) const;
+	void write_json(std::wstring& out) const;
+	void write_csv(std::wstring& out) const;
+	void write_markdown(std::wstring& out, const report_style& style) const;
+	void write_xml(std::wstring& out) const;
+	// probes saved, how the trace started and the diagnostics, each between open and close
+	void write_notes(std::wstring& out, std::wstring_view open, std::wstring_view close) const;
+
+	std::wstring m_host;
+	// rows past m_rows are left over from a bigger trace, kept for their names' buffers
+	std::vector<s_nethost> m_hops;
+	std::size_t m_rows = 0;
+	// each AS on the path once, in the order the trace runs into them, with who runs it
+	std::vector<std::pair<std::uint32_t, std::wstring>> m_networks;
+	std::size_t m_networkCount = 0;
+	bool m_reached = false;
+	std::int64_t m_probesSaved = 0;
+	std::optional<std::chrono::microseconds> m_firstProbe;
+	int m_raceWinner = AF_UNSPEC;
+	std::optional<report_diagnostics> m_diagnostics;
+};
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <array>;
+import <charconv>;
+import <memory>;
+import <system_error>;
+#endif
+import WinMTR.AsnDatabase;
+import WinMTRIPUtils;
+
+using namespace std::literals;
+
+namespace {
+	// the columns every format has, in the order they come in
+	constexpr std::array TIME_COLUMNS{ L"best"sv, L"avg"sv, L"worst"sv, L"last"sv, L"p50"sv, L"p90"sv, L"p99"sv, L"p999"sv, L"stddev"sv, L"jitter"sv, L"ewma"sv };
+
+	// in milliseconds, like the columns above
+	[[nodiscard]]
+	std::array<double, TIME_COLUMNS.size()> times_of(const s_nethost& hop) noexcept
+	{
+		return { hop.best / 1000.0, hop.getAvg() / 1000.0, hop.worst / 1000.0, hop.last / 1000.0
+			, hop.p50 / 1000.0, hop.p90 / 1000.0, hop.p99 / 1000.0, hop.p999 / 1000.0
+			, hop.stddev / 1000.0, hop.jitter / 1000.0, hop.ewma / 1000.0 };
+	}
+
+	// the digits are ASCII whatever the format, so they are widened one by one
+	void append_ascii(std::wstring& out, const char* first, const char* last)
+	{
+		const auto at = out.size();
+		out.resize(at + static_cast<std::size_t>(last - first));
+		std::copy(first, last, out.begin() + static_cast<std::ptrdiff_t>(at));
+	}
+
+	void append_padding(std::wstring& out, std::size_t written, std::size_t width)
+	{
+		if (written < width) {
+			out.append(width - written, L' ');
+		}
+	}
+
+	// right aligned in width
+	void append_number(std::wstring& out, std::int64_t value, std::size_t width = 0)
+	{
+		std::array<char, 24> digits;
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		append_padding(out, static_cast<std::size_t>(end - digits.data()), width);
+		append_ascii(out, digits.data(), end);
+	}
+
+	void append_fixed(std::wstring& out, double value, int precision = 3, std::size_t width = 0)
+	{
+		std::array<char, 64> digits;
+		const auto [end, error] = std::to_chars(digits.data(), digits.data() + digits.size(), value, std::chars_format::fixed, precision);
+		if (error != std::errc{}) {
+			append_padding(out, 1, width);
+			out += L'0';
+			return;
+		}
+		append_padding(out, static_cast<std::size_t>(end - digits.data()), width);
+		append_ascii(out, digits.data(), end);
+	}
+
+	void append_address(std::wstring& out, const SOCKADDR_INET& addr)
+	{
+#ifdef _WIN32
+		std::array<wchar_t, INET6_ADDRSTRLEN> text{};
+		const wchar_t* printed = nullptr;
+		if (addr.si_family == AF_INET) {
+			printed = InetNtopW(AF_INET, &addr.Ipv4.sin_addr, text.data(), text.size());
+		}
+		else if (addr.si_family == AF_INET6) {
+			printed = InetNtopW(AF_INET6, &addr.Ipv6.sin6_addr, text.data(), text.size());
+		}
+		if (printed) {
+			out += printed;
+		}
+#else
+		std::array<char, INET6_ADDRSTRLEN> text{};
+		const char* printed = nullptr;
+		if (addr.si_family == AF_INET) {
+			printed = inet_ntop(AF_INET, &addr.Ipv4.sin_addr, text.data(), text.size());
+		}
+		else if (addr.si_family == AF_INET6) {
+			printed = inet_ntop(AF_INET6, &addr.Ipv6.sin6_addr, text.data(), text.size());
+		}
+		if (printed) {
+			append_ascii(out, printed, printed + std::char_traits<char>::length(printed));
+		}
+#endif
+	}
+
+	void append_bool(std::wstring& out, bool value)
+	{
+		out += value ? L"true"sv : L"false"sv;
+	}
+
+	// whatever the format needs escaped, nothing for plain text
+	void append_escaped(std::wstring& out, std::wstring_view text, report_format format)
+	{
+		for (const auto c : text) {
+			switch (format) {
+			case report_format::text:
+				out += c;
+				break;
+			case report_format::html:
+			case report_format::xml:
+				switch (c) {
+				case L'&': out += L"&amp;"sv; break;
+				case L'<': out += L"&lt;"sv; break;
+				case L'>': out += L"&gt;"sv; break;
+				case L'"': out += L"&quot;"sv; break;
+				case L'\'': out += L"&#39;"sv; break;
+				default:
+					// XML 1.0 has no way to write the other controls at all
+					if (c >= 0x20 || c == L'\t' || c == L'\n' || c == L'\r') {
+						out += c;
+					}
+					break;
+				}
+				break;
+			case report_format::json:
+				switch (c) {
+				case L'"': out += L"\\\""sv; break;
+				case L'\\': out += L"\\\\"sv; break;
+				case L'\n': out += L"\\n"sv; break;
+				case L'\r': out += L"\\r"sv; break;
+				case L'\t': out += L"\\t"sv; break;
+				default:
+					if (c < 0x20) {
+						constexpr auto hex = L"0123456789abcdef"sv;
+						out += L"\\u00"sv;
+						out += hex[(c >> 4) & 0xF];
+						out += hex[c & 0xF];
+					}
+					else {
+						out += c;
+					}
+					break;
+				}
+				break;
+			case report_format::csv:
+				// RFC 4180, the field itself is always quoted
+				if (c == L'"') {
+					out += L'"';
+				}
+				out += c;
+				break;
+			case report_format::markdown:
+				switch (c) {
+				case L'\\': case L'|': case L'*': case L'_': case L'`': case L'<': case L'>': case L'[': case L']':
+					out += L'\\';
+					out += c;
+					break;
+				case L'\n': case L'\r':
+					out += L' ';
+					break;
+				default:
+					out += c;
+					break;
+				}
+				break;
+			}
+		}
+	}
+
+	// the name, or the address if it has none, empty if it has neither
+	void append_host(std::wstring& out, const s_nethost& hop, report_format format)
+	{
+		if (!hop.name.empty()) {
+			append_escaped(out, hop.name, format);
+		}
+		else {
+			append_address(out, hop.addr);
+		}
+	}
+
+	// further responders of a hop are listed right under its first one
+	void append_label(std::wstring& out, const s_nethost& hop, std::wstring_view no_response, report_format format)
+	{
+		if (hop.path) {
+			append_escaped(out, L" \\_ "sv, format);
+		}
+		if (hop.name.empty() && !isValidAddress(hop.addr)) {
+			append_escaped(out, no_response, format);
+			return;
+		}
+		append_host(out, hop, format);
+	}
+
+	// AS and the number, right aligned in width, nothing for no AS
+	void append_asn(std::wstring& out, std::uint32_t asn, std::size_t width = 0)
+	{
+		std::array<char, 12> label{ 'A', 'S' };
+		const auto end = asn ? std::to_chars(label.data() + 2, label.data() + label.size(), asn).ptr : label.data();
+		append_padding(out, static_cast<std::size_t>(end - label.data()), width);
+		append_ascii(out, label.data(), end);
+	}
+}
+
+void report_snapshot::take(const WinMTRNet& net, std::wstring_view host)
+{
+	m_host.assign(host);
+	m_rows = 0;
+	net.getCurrentState(m_hops, m_rows);
+	m_reached = net.getDestinationReached();
+	m_probesSaved = net.getProbesSaved();
+	m_firstProbe = net.getTimeToFirstProbe();
+	m_raceWinner = net.getRaceWinner();
+	m_diagnostics.reset();
+	m_networkCount = 0;
+	const auto asns = asn_database::instance();
+	if (!asns) {
+		return;
+	}
+	for (const auto& hop : hops()) {
+		const auto known = std::span(m_networks).first(m_networkCount);
+		if (!hop.asn || std::ranges::any_of(known, [&hop](const auto& network) noexcept { return network.first == hop.asn; })) {
+			continue;
+		}
+		if (m_networkCount == m_networks.size()) {
+			m_networks.emplace_back();
+		}
+		auto& [asn, organization] = m_networks[m_networkCount++];
+		asn = hop.asn;
+		asns->organization(hop.asn, organization);
+	}
+}
+
+void report_snapshot::take_diagnostics()
+{
+	auto& diagnostics = m_diagnostics.emplace();
+	diagnostics.names = name_cache::instance()->stats();
+	if (const auto events = event_log::instance()) {
+		diagnostics.events = events->stats();
+	}
+	if (const auto writer = capture_writer::instance()) {
+		diagnostics.capture = writer->stats();
+	}
+#ifdef _WIN32
+	if (const auto server = metrics_server::instance()) {
+		diagnostics.metrics = server->stats();
+	}
+#endif
+}
+
+void report_snapshot::write(std::wstring& out, report_format format, const report_style& style) const
+{
+	switch (format) {
+	case report_format::text: write_text(out, style); break;
+	case report_format::html: write_html(out, style); break;
+	case report_format::json: write_json(out); break;
+	case report_format::csv: write_csv(out); break;
+	case report_format::markdown: write_markdown(out, style); break;
+	case report_format::xml: write_xml(out); break;
+	}
+}
+
+void report_snapshot::write_notes(std::wstring& out, std::wstring_view open, std::wstring_view close) const
+{
+	out += open;
+	out += L"Probes saved by stopping at the destination: "sv;
+	append_number(out, m_probesSaved);
+	out += close;
+	if (m_firstProbe) {
+		out += open;
+		out += L"First probe "sv;
+		append_fixed(out, static_cast<double>(m_firstProbe->count()) / 1000.0);
+		out += L" ms after the trace was started"sv;
+		switch (m_raceWinner) {
+		case AF_INET6:
+			out += L", IPv6 answered first"sv;
+			break;
+		case AF_INET:
+			out += L", IPv4 answered first"sv;
+			break;
+		}
+		out += close;
+	}
+	if (!m_diagnostics) {
+		return;
+	}
+	const auto& names = m_diagnostics->names;
+	out += open;
+	out += L"Name lookups: "sv;
+	append_number(out, static_cast<std::int64_t>(names.hits));
+	out += L" cached, "sv;
+	append_number(out, static_cast<std::int64_t>(names.joined));
+	out += L" shared, "sv;
+	append_number(out, static_cast<std::int64_t>(names.misses));
+	out += L" resolved ("sv;
+	append_fixed(out, names.hit_rate() * 100.0, 1);
+	out += L"% saved)"sv;
+	out += close;
+	if (const auto& events = m_diagnostics->events) {
+		out += open;
+		out += L"Probe events: "sv;
+		append_number(out, static_cast<std::int64_t>(events->written));
+		out += L" logged, "sv;
+		append_number(out, static_cast<std::int64_t>(events->dropped));
+		out += L" dropped"sv;
+		out += close;
+	}
+	if (const auto& capture = m_diagnostics->capture) {
+		out += open;
+		out += L"Capture: "sv;
+		append_number(out, static_cast<std::int64_t>(capture->records));
+		out += L" records, "sv;
+		append_number(out, static_cast<std::int64_t>(capture->bytes));
+		out += L" bytes, "sv;
+		append_number(out, static_cast<std::int64_t>(capture->dropped));
+		out += L" dropped"sv;
+		out += close;
+	}
+#ifdef _WIN32
+	if (const auto& metrics = m_diagnostics->metrics) {
+		out += open;
+		out += L"Metrics: "sv;
+		append_number(out, static_cast<std::int64_t>(metrics->scrapes));
+		out += L" scrapes, "sv;
+		append_number(out, static_cast<std::int64_t>(metrics->refused));
+		out += L" refused, last one took "sv;
+		append_number(out, metrics->last_scrape.count());
+		out += L" us"sv;
+		out += close;
+	}
+#endif
+}
+
+void report_snapshot::write_text(std::wstring& out, const report_style& style) const
+{
+	const auto eol = style.eol;
+	out += L"|-----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------|"sv;
+	out += eol;
+	out += L"|                                                                                           WinMTR statistics                                                                                               |"sv;
+	out += eol;
+	out += L"|                       Host              -   %%  |          ASN | Sent | Recv | Late |     Best |     Avrg |     Wrst |     Last |      p50 |      p90 |      p99 |    p99.9 |    StDev |   Jitter |     EWMA |"sv;
+	out += eol;
+	out += L"|-------------------------------------------------|--------------|------|------|------|----------|----------|----------|----------|----------|----------|----------|----------|----------|----------|----------|"sv;
+	out += eol;
+	for (const auto& hop : hops()) {
+		out += L"| "sv;
+		const auto label = out.size();
+		append_label(out, hop, style.no_response, report_format::text);
+		append_padding(out, out.size() - label, 40);
+		out += L" - "sv;
+		append_number(out, hop.getPercent(), 4);
+		out += L" | "sv;
+		append_asn(out, hop.asn, 12);
+		out += L" | "sv;
+		append_number(out, hop.xmit, 4);
+		out += L" | "sv;
+		append_number(out, hop.returned, 4);
+		out += L" | "sv;
+		append_number(out, hop.late, 4);
+		for (const auto time : times_of(hop)) {
+			out += L" | "sv;
+			append_fixed(out, time, 3, 8);
+		}
+		out += L" |"sv;
+		out += eol;
+	}
+	out += L"|_________________________________________________|______________|______|______|______|__________|__________|__________|__________|__________|__________|__________|__________|__________|__________|__________|"sv;
+	out += eol;
+	for (const auto& [asn, organization] : std::span(m_networks).first(m_networkCount)) {
+		out += L"   AS"sv;
+		append_number(out, asn);
+		out += L' ';
+		out += organization;
+		out += eol;
+	}
+	write_notes(out, L"   "sv, eol);
+	if (!style.footer.empty()) {
+		out += L"   "sv;
+		out += style.footer;
+	}
+}
+
+void report_snapshot::write_html(std::wstring& out, const report_style& style) const
+{
+	out += L"<table><thead><tr><th>Host</th><th>%</th><th>ASN</th><th>Sent</th><th>Recv</th><th>Late</th><th>Best</th><th>Avrg</th><th>Wrst</th><th>Last</th><th>p50</th><th>p90</th><th>p99</th><th>p99.9</th><th>StDev</th><th>Jitter</th><th>EWMA</th></tr></thead><tbody>"sv;
+	for (const auto& hop : hops()) {
+		out += L"<tr><td>"sv;
+		append_label(out, hop, style.no_response, report_format::html);
+		out += L"</td><td>"sv;
+		append_number(out, hop.getPercent());
+		out += L"</td><td>"sv;
+		append_asn(out, hop.asn);
+		out += L"</td><td>"sv;
+		append_number(out, hop.xmit);
+		out += L"</td><td>"sv;
+		append_number(out, hop.returned);
+		out += L"</td><td>"sv;
+		append_number(out, hop.late);
+		for (const auto time : times_of(hop)) {
+			out += L"</td><td>"sv;
+			append_fixed(out, time);
+		}
+		out += L"</td></tr>"sv;
+	}
+	out += L"</tbody></table>"sv;
+	if (m_networkCount) {
+		out += L"<ul>"sv;
+		for (const auto& [asn, organization] : std::span(m_networks).first(m_networkCount)) {
+			out += L"<li>AS"sv;
+			append_number(out, asn);
+			out += L' ';
+			append_escaped(out, organization, report_format::html);
+			out += L"</li>"sv;
+		}
+		out += L"</ul>"sv;
+	}
+	write_notes(out, L"<p>"sv, L"</p>"sv);
+}
+
+void report_snapshot::write_json(std::wstring& out) const
+{
+	out += L"{\"host\":\""sv;
+	append_escaped(out, m_host, report_format::json);
+	out += L"\",\"reached\":"sv;
+	append_bool(out, m_reached);
+	out += L",\"hops\":["sv;
+	bool first = true;
+	for (const auto& hop : hops()) {
+		out += first ? L"{"sv : L",{"sv;
+		first = false;
+		out += L"\"ttl\":"sv;
+		append_number(out, hop.ttl);
+		out += L",\"path\":"sv;
+		append_number(out, hop.path);
+		out += L",\"host\":\""sv;
+		append_host(out, hop, report_format::json);
+		out += L"\",\"address\":"sv;
+		if (isValidAddress(hop.addr)) {
+			out += L'"';
+			append_address(out, hop.addr);
+			out += L'"';
+		}
+		else {
+			out += L"null"sv;
+		}
+		out += L",\"asn\":"sv;
+		append_number(out, hop.asn);
+		out += L",\"loss_pct\":"sv;
+		append_number(out, hop.getPercent());
+		out += L",\"sent\":"sv;
+		append_number(out, hop.xmit);
+		out += L",\"recv\":"sv;
+		append_number(out, hop.returned);
+		out += L",\"late\":"sv;
+		append_number(out, hop.late);
+		const auto times = times_of(hop);
+		for (std::size_t i = 0; i < times.size(); ++i) {
+			out += L",\""sv;
+			out += TIME_COLUMNS[i];
+			out += L"_ms\":"sv;
+			append_fixed(out, times[i]);
+		}
+		out += L'}';
+	}
+	out += L"],\"networks\":["sv;
+	for (std::size_t i = 0; i < m_networkCount; ++i) {
+		out += i ? L",{\"asn\":"sv : L"{\"asn\":"sv;
+		append_number(out, m_networks[i].first);
+		out += L",\"organization\":\""sv;
+		append_escaped(out, m_networks[i].second, report_format::json);
+		out += L"\"}"sv;
+	}
+	out += L"],\"probes_saved\":"sv;
+	append_number(out, m_probesSaved);
+	out += L",\"first_probe_ms\":"sv;
+	if (m_firstProbe) {
+		append_fixed(out, static_cast<double>(m_firstProbe->count()) / 1000.0);
+	}
+	else {
+		out += L"null"sv;
+	}
+	out += L"}\n"sv;
+}
+
+void report_snapshot::write_csv(std::wstring& out) const
+{
+	out += L"target,ttl,path,host,address,asn,loss_pct,sent,recv,late"sv;
+	for (const auto column : TIME_COLUMNS) {
+		out += L',';
+		out += column;
+		out += L"_ms"sv;
+	}
+	out += L'\n';
+	for (const auto& hop : hops()) {
+		out += L'"';
+		append_escaped(out, m_host, report_format::csv);
+		out += L"\","sv;
+		append_number(out, hop.ttl);
+		out += L',';
+		append_number(out, hop.path);
+		out += L",\""sv;
+		append_host(out, hop, report_format::csv);
+		out += L"\","sv;
+		append_address(out, hop.addr);
+		out += L',';
+		append_number(out, hop.asn);
+		out += L',';
+		append_number(out, hop.getPercent());
+		out += L',';
+		append_number(out, hop.xmit);
+		out += L',';
+		append_number(out, hop.returned);
+		out += L',';
+		append_number(out, hop.late);
+		for (const auto time : times_of(hop)) {
+			out += L',';
+			append_fixed(out, time);
+		}
+		out += L'\n';
+	}
+}
+
+void report_snapshot::write_markdown(std::wstring& out, const report_style& style) const
+{
+	out += L"| Host | Loss % | ASN | Sent | Recv | Late | Best | Avrg | Wrst | Last | p50 | p90 | p99 | p99.9 | StDev | Jitter | EWMA |\n"sv;
+	out += L"|:-----|-------:|----:|-----:|-----:|-----:|-----:|-----:|-----:|-----:|----:|----:|----:|------:|------:|-------:|-----:|\n"sv;
+	for (const auto& hop : hops()) {
+		out += L"| "sv;
+		append_label(out, hop, style.no_response, report_format::markdown);
+		out += L" | "sv;
+		append_number(out, hop.getPercent());
+		out += L" | "sv;
+		append_asn(out, hop.asn);
+		out += L" | "sv;
+		append_number(out, hop.xmit);
+		out += L" | "sv;
+		append_number(out, hop.returned);
+		out += L" | "sv;
+		append_number(out, hop.late);
+		for (const auto time : times_of(hop)) {
+			out += L" | "sv;
+			append_fixed(out, time);
+		}
+		out += L" |\n"sv;
+	}
+	out += L'\n';
+	for (const auto& [asn, organization] : std::span(m_networks).first(m_networkCount)) {
+		out += L"- AS"sv;
+		append_number(out, asn);
+		out += L' ';
+		append_escaped(out, organization, report_format::markdown);
+		out += L'\n';
+	}
+	if (m_networkCount) {
+		out += L'\n';
+	}
+	write_notes(out, {}, L"\n\n"sv);
+}
+
+void report_snapshot::write_xml(std::wstring& out) const
+{
+	out += L"<?xml version=\"1.0\"?>\n<report host=\""sv;
+	append_escaped(out, m_host, report_format::xml);
+	out += L"\" reached=\""sv;
+	append_bool(out, m_reached);
+	out += L"\" probes_saved=\""sv;
+	append_number(out, m_probesSaved);
+	out += L'"';
+	if (m_firstProbe) {
+		out += L" first_probe_ms=\""sv;
+		append_fixed(out, static_cast<double>(m_firstProbe->count()) / 1000.0);
+		out += L'"';
+	}
+	out += L">\n"sv;
+	for (const auto& hop : hops()) {
+		out += L"  <hop ttl=\""sv;
+		append_number(out, hop.ttl);
+		out += L"\" path=\""sv;
+		append_number(out, hop.path);
+		out += L"\" host=\""sv;
+		append_host(out, hop, report_format::xml);
+		out += L"\" address=\""sv;
+		append_address(out, hop.addr);
+		out += L"\" asn=\""sv;
+		append_number(out, hop.asn);
+		out += L"\" loss_pct=\""sv;
+		append_number(out, hop.getPercent());
+		out += L"\" sent=\""sv;
+		append_number(out, hop.xmit);
+		out += L"\" recv=\""sv;
+		append_number(out, hop.returned);
+		out += L"\" late=\""sv;
+		append_number(out, hop.late);
+		const auto times = times_of(hop);
+		for (std::size_t i = 0; i < times.size(); ++i) {
+			out += L"\" "sv;
+			out += TIME_COLUMNS[i];
+			out += L"_ms=\""sv;
+			append_fixed(out, times[i]);
+		}
+		out += L"\"/>\n"sv;
+	}
+	for (const auto& [asn, organization] : std::span(m_networks).first(m_networkCount)) {
+		out += L"  <network asn=\""sv;
+		append_number(out, asn);
+		out += L"\" organization=\""sv;
+		append_escaped(out, organization, report_format::xml);
+		out += L"\"/>\n"sv;
+	}
+	out += L"</report>\n"sv;
+}
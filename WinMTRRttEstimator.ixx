@@ -0,0 +1,96 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRRttEstimator.ixx
+//
+// DESCRIPTION:
+//   The retransmission timeout estimator of RFC 6298, used to decide how long
+//   a hop's probe is worth waiting for. A hop that answers in 20 ms doesn't
+//   need to hold its trace loop for five seconds every time a probe is lost.
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#endif
+export module WinMTR.RttEstimator;
+
+#ifdef _WIN32
+import <algorithm>;
+import <chrono>;
+#endif
+
+//*****************************************************************************
+// CLASS:  rtt_estimator
+//
+// Not thread safe, each hop's trace loop keeps its own.
+//*****************************************************************************
+export class rtt_estimator final {
+public:
+	using duration = std::chrono::microseconds;
+
+	constexpr rtt_estimator(duration floor, duration ceiling) noexcept
+		:m_floor(floor)
+		, m_ceiling(std::max(floor, ceiling))
+		, m_rto(std::clamp<duration>(INITIAL_RTO, m_floor, m_ceiling))
+	{
+	}
+
+	// rounded up, the backends time out in whole milliseconds
+	[[nodiscard]]
+	constexpr std::chrono::milliseconds timeout() const noexcept
+	{
+		return std::chrono::ceil<std::chrono::milliseconds>(m_rto);
+	}
+
+	// RFC 6298 2.2 and 2.3, every probe is sent once so no sample is ambiguous
+	constexpr void sample(duration round_trip) noexcept
+	{
+		if (!m_measured) {
+			m_srtt = round_trip;
+			m_rttvar = round_trip / 2;
+			m_measured = true;
+		}
+		else {
+			const auto error = m_srtt > round_trip ? m_srtt - round_trip : round_trip - m_srtt;
+			m_rttvar += (error - m_rttvar) / 4;
+			m_srtt += (round_trip - m_srtt) / 8;
+		}
+		m_rto = std::clamp(m_srtt + std::max<duration>(GRANULARITY, 4 * m_rttvar), m_floor, m_ceiling);
+	}
+
+	// RFC 6298 5.5, until the next answer
+	constexpr void back_off() noexcept
+	{
+		m_rto = std::min(m_rto * 2, m_ceiling);
+	}
+private:
+	static constexpr duration INITIAL_RTO = std::chrono::seconds(1);
+	static constexpr duration GRANULARITY = std::chrono::milliseconds(1);
+
+	duration m_floor;
+	duration m_ceiling;
+	duration m_rto;
+	duration m_srtt{ 0 };
+	duration m_rttvar{ 0 };
+	bool m_measured = false;
+};
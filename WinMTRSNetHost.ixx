@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 module;
+#ifdef _WIN32
 #pragma warning (disable : 4005)
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN
@@ -32,28 +33,50 @@ module;
 #define NOMINMAX
 #include <WinSock2.h>
 #include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#endif
 export module WinMTRSNetHost;
 
 import WinMTRIPUtils;
+#ifdef _WIN32
+import <algorithm>;
 import <string>;
+import <cstdint>;
+#endif
 
 
 export struct s_nethost final {
 	SOCKADDR_INET addr = {};
 	std::wstring name;
+	std::uint32_t asn = 0;	// origin AS of addr, zero if there is no database or it doesn't know
+	int ttl = 0;			// hop number, the same on every path of a hop
+	int path = 0;			// zero for the hop's first responder, counting up for the others
 	int xmit = 0;			// number of PING packets sent
 	int returned = 0;		// number of ICMP echo replies received
-	unsigned long total = 0;	// total time
+	int late = 0;			// replies that came after their probe had timed out, not in returned
+	std::uint64_t total = 0;	// total time, all times are in microseconds
 	int last = 0;				// last time
 	int best = 0;				// best time
 	int worst = 0;			// worst time
+	int p50 = 0;			// latency percentiles, from the hop's histogram
+	int p90 = 0;
+	int p99 = 0;
+	int p999 = 0;
+	double stddev = 0.0;	// sample standard deviation of the round trip
+	double jitter = 0.0;	// RFC 3550 interarrival jitter
+	double ewma = 0.0;		// exponentially weighted moving average of the round trip
+	// a late reply still says the hop is there, it isn't counted as lost
 	[[nodiscard]]
 	inline auto getPercent() const noexcept {
-		return (xmit == 0) ? 0 : (100 - (100 * returned / xmit));
+		return (xmit == 0) ? 0 : std::max(0, 100 - (100 * (returned + late) / xmit));
 	}
 	[[nodiscard]]
 	inline int getAvg() const noexcept {
-		return returned == 0 ? 0 : total / returned;
+		return returned == 0 ? 0 : static_cast<int>(total / returned);
 	}
 	[[nodiscard]]
 	auto getName() const -> std::wstring {
@@ -0,0 +1,141 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSeqLock.ixx
+//
+// DESCRIPTION:
+//   A single-writer sequence lock. The writer never waits, readers retry
+//   until they get a copy no write overlapped with.
+//
+// NOTES:
+//   The payload is kept in relaxed atomic words so a torn read is a retry
+//   rather than a data race; on x86 and ARM64 those are plain loads and
+//   stores.
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#endif
+export module WinMTR.SeqLock;
+
+#ifdef _WIN32
+import <array>;
+import <atomic>;
+import <cstddef>;
+import <cstdint>;
+import <cstring>;
+import <type_traits>;
+#endif
+
+export template<class T>
+	requires std::is_trivially_copyable_v<T>
+class seqlock final {
+	using word = std::uintptr_t;
+	static constexpr auto WORDS = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+	using buffer = std::array<word, WORDS>;
+
+	std::atomic_uint32_t m_sequence{ 0 };
+	std::array<std::atomic<word>, WORDS> m_words{};
+
+	[[nodiscard]]
+	static T unpack(const buffer& words) noexcept
+	{
+		T value;
+		// through void*, T may have member initializers that make GCC think it is more than bytes
+		std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+		return value;
+	}
+
+	[[nodiscard]]
+	buffer read_words() const noexcept
+	{
+		buffer words;
+		for (std::size_t i = 0; i < WORDS; ++i) {
+			words[i] = m_words[i].load(std::memory_order_relaxed);
+		}
+		return words;
+	}
+public:
+	seqlock() noexcept
+		:seqlock(T{})
+	{
+	}
+
+	explicit seqlock(const T& value) noexcept
+	{
+		store(value);
+	}
+
+	seqlock(const seqlock&) = delete;
+	seqlock& operator=(const seqlock&) = delete;
+
+	// for any thread
+	[[nodiscard]]
+	T load() const noexcept
+	{
+		for (;;) {
+			const auto before = m_sequence.load(std::memory_order_acquire);
+			if (before & 1) {
+				continue;
+			}
+			const auto words = read_words();
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_sequence.load(std::memory_order_relaxed) == before) {
+				return unpack(words);
+			}
+		}
+	}
+
+	// the writer's own view, no retry needed since nobody else writes
+	[[nodiscard]]
+	T load_exclusive() const noexcept
+	{
+		return unpack(read_words());
+	}
+
+	// only ever from one thread at a time
+	void store(const T& value) noexcept
+	{
+		buffer words{};
+		std::memcpy(words.data(), &value, sizeof(T));
+		const auto sequence = m_sequence.load(std::memory_order_relaxed);
+		m_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (std::size_t i = 0; i < WORDS; ++i) {
+			m_words[i].store(words[i], std::memory_order_relaxed);
+		}
+		m_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	template<class F>
+	void update(F&& modify) noexcept
+	{
+		auto value = load_exclusive();
+		modify(value);
+		store(value);
+	}
+};
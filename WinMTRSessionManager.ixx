@@ -0,0 +1,243 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSessionManager.ixx
+//
+// DESCRIPTION:
+//   Runs many traces side by side in one process. Every session gets its own
+//   WinMTRNet, so its own hop table, and its own stop_source, while the
+//   probe backend (sockets, deadline heap, I/O thread), the system resolver
+//   and the thread pool the trace loops resume on are shared by all of them.
+//
+// NOTES:
+//   Sized for 1,000 concurrent sessions on one core at the default one
+//   second interval. A session costs a WinMTRNet and one suspended coroutine
+//   per hop up to the destination, never a thread, so what bounds it is the
+//   probe rate going through the shared backend, not the number of sessions.
+//   That rate is capped at 1,000 probes a second by default, as much as that
+//   many one hop sessions send on their own, so it has to be raised for them.
+//   session_manager_keeps_up_on_one_core holds the numbers to this.
+//
+//*****************************************************************************
+module;
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+export module WinMTR.SessionManager;
+
+import <condition_variable>;
+import <cstdint>;
+import <exception>;
+import <map>;
+import <memory>;
+import <mutex>;
+import <stop_token>;
+import <string>;
+import <vector>;
+import <winrt/Windows.Foundation.h>;
+import WinMTR.Net;
+import WinMTR.ProbeEngine;
+import WinMTROptionsProvider;
+
+//*****************************************************************************
+// CLASS:  session_manager
+//
+// Thread safe. A stopped session is dropped from the manager right away, its
+// WinMTRNet lives on until the trace loops have noticed and wound down.
+//*****************************************************************************
+export class session_manager final {
+	session_manager(const session_manager&) = delete;
+	session_manager& operator=(const session_manager&) = delete;
+public:
+	using session_id = std::uint32_t;
+
+	explicit session_manager(const IWinMTROptionsProvider* options, std::shared_ptr<probe_backend> backend = probe_engine::instance());
+	// stops every session and waits for their traces to finish
+	~session_manager() noexcept;
+
+	session_id start(SOCKADDR_INET address);
+
+	// resolves through the same asynchronous resolver the dialog uses, zero on failure
+	[[nodiscard("The task should be awaited")]]
+	winrt::Windows::Foundation::IAsyncOperation<session_id> start(std::wstring host, int family = AF_UNSPEC);
+
+	void stop(session_id id);
+	void stop_all();
+
+	[[nodiscard]]
+	std::shared_ptr<WinMTRNet> find(session_id id) const;
+	[[nodiscard]]
+	std::vector<session_id> sessions() const;
+	[[nodiscard]]
+	std::size_t size() const;
+
+	[[nodiscard]]
+	const std::shared_ptr<probe_backend>& backend() const noexcept
+	{
+		return m_backend;
+	}
+private:
+	struct session final {
+		std::shared_ptr<WinMTRNet> net;
+		std::stop_source stop;
+		winrt::Windows::Foundation::IAsyncAction trace{ nullptr };
+	};
+
+	// candidates in the resolver's order, the trace races the families if both are there
+	session_id launch(std::vector<SOCKADDR_INET> candidates, probe_backend::clock::time_point requested);
+	winrt::fire_and_forget retire(session finished);
+
+	const IWinMTROptionsProvider* m_options;
+	std::shared_ptr<probe_backend> m_backend;
+	mutable std::mutex m_mutex;
+	std::map<session_id, session> m_sessions;
+	std::condition_variable m_retired;
+	std::size_t m_retiring = 0;
+	session_id m_lastId = 0;
+};
+
+module : private;
+
+import <utility>;
+import WinMTRDnsUtil;
+
+session_manager::session_manager(const IWinMTROptionsProvider* options, std::shared_ptr<probe_backend> backend)
+	:m_options(options)
+	, m_backend(std::move(backend))
+{
+}
+
+session_manager::~session_manager() noexcept
+{
+	stop_all();
+	std::unique_lock lock(m_mutex);
+	m_retired.wait(lock, [this] { return m_retiring == 0; });
+}
+
+session_manager::session_id session_manager::start(SOCKADDR_INET address)
+{
+	return launch({ address }, m_backend->now());
+}
+
+winrt::Windows::Foundation::IAsyncOperation<session_manager::session_id> session_manager::start(std::wstring host, int family)
+{
+	const auto requested = m_backend->now();
+	timeval timeout{ .tv_sec = 30 };
+	auto result = co_await GetAddrInfoAsync(host, &timeout, family);
+	if (!result || result->empty()) {
+		co_return 0;
+	}
+	co_return launch(std::move(*result), requested);
+}
+
+session_manager::session_id session_manager::launch(std::vector<SOCKADDR_INET> candidates, probe_backend::clock::time_point requested)
+{
+	session started{ .net = std::make_shared<WinMTRNet>(m_options, m_backend) };
+	// DoTrace runs up to its first suspension, the first probes, before returning
+	started.trace = started.net->DoTrace(started.stop.get_token(), std::move(candidates), requested);
+	std::unique_lock lock(m_mutex);
+	const auto id = ++m_lastId;
+	m_sessions.emplace(id, std::move(started));
+	return id;
+}
+
+void session_manager::stop(session_id id)
+{
+	std::unique_lock lock(m_mutex);
+	auto it = m_sessions.find(id);
+	if (it == m_sessions.end()) {
+		return;
+	}
+	auto stopped = std::move(it->second);
+	m_sessions.erase(it);
+	lock.unlock();
+	stopped.stop.request_stop();
+	retire(std::move(stopped));
+}
+
+void session_manager::stop_all()
+{
+	std::map<session_id, session> stopped;
+	{
+		std::unique_lock lock(m_mutex);
+		std::swap(stopped, m_sessions);
+	}
+	for (auto& [id, s] : stopped) {
+		s.stop.request_stop();
+		retire(std::move(s));
+	}
+}
+
+std::shared_ptr<WinMTRNet> session_manager::find(session_id id) const
+{
+	std::unique_lock lock(m_mutex);
+	const auto it = m_sessions.find(id);
+	return it == m_sessions.end() ? nullptr : it->second.net;
+}
+
+std::vector<session_manager::session_id> session_manager::sessions() const
+{
+	std::unique_lock lock(m_mutex);
+	std::vector<session_id> ids;
+	ids.reserve(m_sessions.size());
+	for (const auto& [id, s] : m_sessions) {
+		ids.push_back(id);
+	}
+	return ids;
+}
+
+std::size_t session_manager::size() const
+{
+	std::unique_lock lock(m_mutex);
+	return m_sessions.size();
+}
+
+winrt::fire_and_forget session_manager::retire(session finished)
+{
+	// the trace loops still point into the WinMTRNet, hold on to it until they are done
+	{
+		std::unique_lock lock(m_mutex);
+		++m_retiring;
+	}
+	try {
+		co_await finished.trace;
+	}
+	catch (winrt::hresult_error const&) {
+		// canceled or failed, the session is gone either way
+	}
+	catch (std::exception const&) {
+		// same, and the count below has to come down no matter what
+	}
+	finished.net.reset();
+	// notify under the lock, the destructor may be waiting to free m_retired
+	std::unique_lock lock(m_mutex);
+	--m_retiring;
+	m_retired.notify_all();
+}
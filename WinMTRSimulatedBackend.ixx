@@ -0,0 +1,651 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSimulatedBackend.ixx
+//
+// DESCRIPTION:
+//   A probe backend that answers from a declarative topology instead of the
+//   network, on a virtual clock. Given the same topology and seed every run
+//   produces the same replies, and hours of tracing take seconds, which makes
+//   it the thing to put under WinMTRNet when load testing the stats code.
+//
+// NOTES:
+//   Topology format, one directive per line, '#' starts a comment:
+//
+//     seed 42
+//     hop 192.168.1.1 latency=fixed:0.4
+//     hop 10.0.0.1,10.0.0.2 latency=normal:8:1.5 loss=0.01 ecmp=packet
+//     hop *
+//     hop 203.0.113.9 latency=exp:20:4 ratelimit=10
+//     family inet6 loss=1
+//     family inet unreachable
+//
+//   Hops are listed in TTL order and the last one is the destination. '*'
+//   is a hop that never answers. Latency shapes are fixed:ms,
+//   uniform:low:high, normal:mean:stddev and exp:base:mean, all in
+//   milliseconds of round trip. ratelimit is ICMP replies per second per
+//   responder, ecmp picks between several responders per flow (default) or
+//   per packet.
+//
+//   The hops answer whatever address a probe was sent to. family only
+//   tells the two apart, for the race between them: loss drops probes to
+//   addresses of the family on top of the hop's own, and a family that is
+//   unreachable has no route, sending to it fails.
+//
+//*****************************************************************************
+module;
+#ifdef _WIN32
+#pragma warning (disable : 4005)
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMCX
+#define NOIME
+#define NOGDI
+#define NONLS
+#define NOSERVICE
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <WS2tcpip.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#endif
+export module WinMTR.ProbeBackend.Simulated;
+
+#ifdef _WIN32
+import <atomic>;
+import <chrono>;
+import <coroutine>;
+import <cstddef>;
+import <cstdint>;
+import <filesystem>;
+import <functional>;
+import <mutex>;
+import <queue>;
+import <random>;
+import <string_view>;
+import <vector>;
+#endif
+export import WinMTR.ProbeBackend;
+
+// round trip time of one hop, all parameters in milliseconds
+export struct sim_latency final {
+	enum class shape {
+		fixed,			// a
+		uniform,		// between a and b
+		normal,			// mean a, standard deviation b
+		exponential		// a plus an exponential tail with mean b
+	};
+	shape kind = shape::fixed;
+	double a = 0.0;
+	double b = 0.0;
+};
+
+export enum class sim_ecmp {
+	per_flow,
+	per_packet
+};
+
+export struct sim_hop final {
+	std::vector<SOCKADDR_INET> responders;	// empty for a hop that never answers
+	sim_latency latency;
+	double loss = 0.0;						// probability a probe or its reply is dropped
+	double rate_limit = 0.0;				// replies per second per responder, zero for unlimited
+	sim_ecmp ecmp = sim_ecmp::per_flow;
+};
+
+// what every probe to an address of one family goes through, on top of the hops
+export struct sim_family final {
+	ADDRESS_FAMILY family = AF_UNSPEC;
+	double loss = 0.0;
+	bool unreachable = false;				// no route, the probe can't be sent
+};
+
+export struct sim_topology final {
+	std::uint64_t seed = 0;
+	std::vector<sim_hop> hops;
+	std::vector<sim_family> families;
+
+	// throws std::invalid_argument naming the offending line
+	[[nodiscard]]
+	static sim_topology parse(std::string_view text);
+	[[nodiscard]]
+	static sim_topology load(const std::filesystem::path& path);
+
+	// the address to trace, the first responder of the last hop
+	[[nodiscard]]
+	SOCKADDR_INET destination() const noexcept;
+};
+
+//*****************************************************************************
+// CLASS:  simulated_backend
+//
+// Nothing happens until someone drives the clock with run_until() or
+// run_for(). Coroutines are resumed inline on the driving thread, one at a
+// time and in virtual time order, so as long as the trace loop only waits on
+// the backend the whole run is deterministic.
+//*****************************************************************************
+export class simulated_backend final : public probe_backend {
+	simulated_backend(const simulated_backend&) = delete;
+	simulated_backend& operator=(const simulated_backend&) = delete;
+public:
+	explicit simulated_backend(sim_topology topology);
+
+	[[nodiscard]]
+	clock::time_point now() const noexcept override;
+
+	// the virtual clock's time points mean nothing to the process' bucket
+	[[nodiscard]]
+	token_bucket& rate_limit() noexcept override
+	{
+		return m_rateLimit;
+	}
+
+	// every protocol gets the same answers, the topology has no filters
+	[[nodiscard]]
+	bool supports(probe_protocol) const noexcept override
+	{
+		return true;
+	}
+
+	[[nodiscard]]
+	std::uint64_t probes_sent() const noexcept override
+	{
+		return m_probesSent.load(std::memory_order_relaxed);
+	}
+
+	void submit(probe_request& request) override;
+	void schedule(probe_delay& delay) override;
+
+	// returns the number of coroutines resumed
+	std::size_t run_until(clock::time_point until);
+	std::size_t run_for(clock::duration duration)
+	{
+		return run_until(now() + duration);
+	}
+
+	[[nodiscard]]
+	std::size_t pending() const;
+private:
+	struct event final {
+		clock::time_point when;
+		std::uint64_t order;		// keeps events due at the same instant in submission order
+		std::coroutine_handle<> resume;
+
+		[[nodiscard]]
+		bool operator>(const event& rhs) const noexcept
+		{
+			return when != rhs.when ? when > rhs.when : order > rhs.order;
+		}
+	};
+
+	struct rate_bucket final {
+		double tokens = 0.0;
+		clock::time_point refilled;
+	};
+
+	[[nodiscard]]
+	clock::time_point answer(probe_request& request);
+	[[nodiscard]]
+	bool take_token(const sim_hop& hop, rate_bucket& bucket) const noexcept;
+	[[nodiscard]]
+	double sample(const sim_latency& latency);
+	void push(clock::time_point when, std::coroutine_handle<> resume);
+
+	mutable std::mutex m_mutex;
+	sim_topology m_topology;
+	std::vector<std::vector<rate_bucket>> m_buckets;
+	std::mt19937_64 m_random;
+	clock::time_point m_now;
+	std::uint64_t m_order = 0;
+	std::priority_queue<event, std::vector<event>, std::greater<>> m_events;
+	std::atomic_uint64_t m_probesSent{ 0 };
+	token_bucket m_rateLimit;
+};
+
+module : private;
+
+#ifdef _WIN32
+import <algorithm>;
+import <charconv>;
+import <cmath>;
+import <fstream>;
+import <iterator>;
+import <stdexcept>;
+import <string>;
+import <system_error>;
+import <utility>;
+#endif
+
+namespace {
+	[[nodiscard]]
+	std::invalid_argument topology_error(std::size_t line, std::string_view what) {
+		std::string message{ "topology line " };
+		message += std::to_string(line);
+		message += ": ";
+		message += what;
+		return std::invalid_argument(message);
+	}
+
+	[[nodiscard]]
+	constexpr std::string_view trim(std::string_view text) noexcept {
+		constexpr std::string_view whitespace = " \t\r";
+		const auto first = text.find_first_not_of(whitespace);
+		if (first == std::string_view::npos) {
+			return {};
+		}
+		return text.substr(first, text.find_last_not_of(whitespace) - first + 1);
+	}
+
+	// splits off the text up to the first separator, leaving the rest in text
+	[[nodiscard]]
+	constexpr std::string_view next_token(std::string_view& text, char separator) noexcept {
+		const auto end = text.find(separator);
+		const auto token = text.substr(0, end);
+		text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+		return token;
+	}
+
+	[[nodiscard]]
+	double parse_number(std::string_view text, std::size_t line) {
+		double value = 0.0;
+		const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		if (ec != std::errc{} || ptr != text.data() + text.size() || !std::isfinite(value) || value < 0.0) {
+			throw topology_error(line, "expected a non-negative number");
+		}
+		return value;
+	}
+
+	[[nodiscard]]
+	SOCKADDR_INET parse_address(std::string_view text, std::size_t line) {
+		const std::string address{ text };
+		SOCKADDR_INET result = {};
+		if (inet_pton(AF_INET, address.c_str(), &result.Ipv4.sin_addr) == 1) {
+			result.si_family = AF_INET;
+			return result;
+		}
+		if (inet_pton(AF_INET6, address.c_str(), &result.Ipv6.sin6_addr) == 1) {
+			result.si_family = AF_INET6;
+			return result;
+		}
+		throw topology_error(line, "not an IPv4 or IPv6 address");
+	}
+
+	[[nodiscard]]
+	sim_latency parse_latency(std::string_view text, std::size_t line) {
+		sim_latency latency;
+		const auto kind = next_token(text, ':');
+		if (kind == "fixed") {
+			latency.kind = sim_latency::shape::fixed;
+		}
+		else if (kind == "uniform") {
+			latency.kind = sim_latency::shape::uniform;
+		}
+		else if (kind == "normal") {
+			latency.kind = sim_latency::shape::normal;
+		}
+		else if (kind == "exp") {
+			latency.kind = sim_latency::shape::exponential;
+		}
+		else {
+			throw topology_error(line, "unknown latency shape");
+		}
+		latency.a = parse_number(next_token(text, ':'), line);
+		if (latency.kind != sim_latency::shape::fixed) {
+			latency.b = parse_number(next_token(text, ':'), line);
+		}
+		if (!text.empty()) {
+			throw topology_error(line, "too many latency parameters");
+		}
+		if (latency.kind == sim_latency::shape::uniform && latency.b < latency.a) {
+			throw topology_error(line, "uniform latency needs low:high");
+		}
+		return latency;
+	}
+
+	[[nodiscard]]
+	sim_hop parse_hop(std::string_view text, std::size_t line) {
+		sim_hop hop;
+		text = trim(text);
+		auto addresses = next_token(text, ' ');
+		if (addresses.empty()) {
+			throw topology_error(line, "hop needs an address or '*'");
+		}
+		if (addresses != "*") {
+			while (!addresses.empty()) {
+				hop.responders.push_back(parse_address(next_token(addresses, ','), line));
+			}
+		}
+
+		while (!(text = trim(text)).empty()) {
+			auto value = next_token(text, ' ');
+			const auto name = next_token(value, '=');
+			if (name == "latency") {
+				hop.latency = parse_latency(value, line);
+			}
+			else if (name == "loss") {
+				hop.loss = parse_number(value, line);
+				if (hop.loss > 1.0) {
+					throw topology_error(line, "loss is a probability between 0 and 1");
+				}
+			}
+			else if (name == "ratelimit") {
+				hop.rate_limit = parse_number(value, line);
+			}
+			else if (name == "ecmp") {
+				if (value == "flow") {
+					hop.ecmp = sim_ecmp::per_flow;
+				}
+				else if (value == "packet") {
+					hop.ecmp = sim_ecmp::per_packet;
+				}
+				else {
+					throw topology_error(line, "ecmp is either flow or packet");
+				}
+			}
+			else {
+				throw topology_error(line, "unknown hop attribute");
+			}
+		}
+		return hop;
+	}
+
+	[[nodiscard]]
+	sim_family parse_family(std::string_view text, std::size_t line) {
+		sim_family family;
+		text = trim(text);
+		const auto name = next_token(text, ' ');
+		if (name == "inet") {
+			family.family = AF_INET;
+		}
+		else if (name == "inet6") {
+			family.family = AF_INET6;
+		}
+		else {
+			throw topology_error(line, "family is either inet or inet6");
+		}
+
+		while (!(text = trim(text)).empty()) {
+			auto value = next_token(text, ' ');
+			const auto attribute = next_token(value, '=');
+			if (attribute == "loss") {
+				family.loss = parse_number(value, line);
+				if (family.loss > 1.0) {
+					throw topology_error(line, "loss is a probability between 0 and 1");
+				}
+			}
+			else if (attribute == "unreachable" && value.empty()) {
+				family.unreachable = true;
+			}
+			else {
+				throw topology_error(line, "unknown family attribute");
+			}
+		}
+		return family;
+	}
+
+	// what the send fails with when there is no route
+#ifdef _WIN32
+	constexpr int NETWORK_UNREACHABLE = WSAENETUNREACH;
+#else
+	constexpr int NETWORK_UNREACHABLE = ENETUNREACH;
+#endif
+
+	// splitmix64, a stable stand-in for the flow hash a router would apply
+	[[nodiscard]]
+	constexpr std::uint64_t flow_hash(std::uint64_t value) noexcept {
+		value += 0x9e3779b97f4a7c15ull;
+		value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+		value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+		return value ^ (value >> 31);
+	}
+}
+
+sim_topology sim_topology::parse(std::string_view text)
+{
+	sim_topology topology;
+	std::size_t lineNumber = 0;
+	while (!text.empty()) {
+		++lineNumber;
+		auto line = next_token(text, '\n');
+		line = trim(next_token(line, '#'));
+		if (line.empty()) {
+			continue;
+		}
+		const auto directive = next_token(line, ' ');
+		if (directive == "hop") {
+			topology.hops.push_back(parse_hop(line, lineNumber));
+		}
+		else if (directive == "family") {
+			topology.families.push_back(parse_family(line, lineNumber));
+		}
+		else if (directive == "seed") {
+			line = trim(line);
+			const auto [ptr, ec] = std::from_chars(line.data(), line.data() + line.size(), topology.seed);
+			if (ec != std::errc{} || ptr != line.data() + line.size()) {
+				throw topology_error(lineNumber, "seed is an unsigned integer");
+			}
+		}
+		else {
+			throw topology_error(lineNumber, "unknown directive");
+		}
+	}
+	if (topology.hops.empty() || topology.hops.back().responders.empty()) {
+		throw topology_error(lineNumber, "the last hop has to be an answering destination");
+	}
+	return topology;
+}
+
+sim_topology sim_topology::load(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), path.string());
+	}
+	const std::string text{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	return parse(text);
+}
+
+SOCKADDR_INET sim_topology::destination() const noexcept
+{
+	if (hops.empty() || hops.back().responders.empty()) {
+		return {};
+	}
+	return hops.back().responders.front();
+}
+
+simulated_backend::simulated_backend(sim_topology topology)
+	:m_topology(std::move(topology))
+	, m_random(m_topology.seed)
+{
+	m_buckets.reserve(m_topology.hops.size());
+	for (const auto& hop : m_topology.hops) {
+		// every limiter starts with a full burst, like a router that has been idle
+		m_buckets.emplace_back(hop.responders.size(), rate_bucket{ .tokens = std::max(hop.rate_limit, 1.0), .refilled = m_now });
+	}
+}
+
+probe_backend::clock::time_point simulated_backend::now() const noexcept
+{
+	std::unique_lock lock(m_mutex);
+	return m_now;
+}
+
+std::size_t simulated_backend::pending() const
+{
+	std::unique_lock lock(m_mutex);
+	return m_events.size();
+}
+
+void simulated_backend::submit(probe_request& request)
+{
+	std::unique_lock lock(m_mutex);
+	const auto when = answer(request);
+	if (!request.result().error) {
+		m_probesSent.fetch_add(1, std::memory_order_relaxed);
+	}
+	push(when, request.resume_handle());
+}
+
+void simulated_backend::schedule(probe_delay& delay)
+{
+	std::unique_lock lock(m_mutex);
+	push(m_now + delay.duration(), delay.resume_handle());
+}
+
+void simulated_backend::push(clock::time_point when, std::coroutine_handle<> resume)
+{
+	m_events.push({ when, m_order++, resume });
+}
+
+std::size_t simulated_backend::run_until(clock::time_point until)
+{
+	std::size_t resumed = 0;
+	for (;;) {
+		std::coroutine_handle<> resume;
+		{
+			std::unique_lock lock(m_mutex);
+			if (m_events.empty() || m_events.top().when > until) {
+				m_now = std::max(m_now, until);
+				return resumed;
+			}
+			m_now = m_events.top().when;
+			resume = m_events.top().resume;
+			m_events.pop();
+		}
+		// outside the lock, the coroutine will submit its next probe before it gives control back
+		resume();
+		++resumed;
+	}
+}
+
+probe_backend::clock::time_point simulated_backend::answer(probe_request& request)
+{
+	auto& result = request.result();
+	const auto timedOut = m_now + request.timeout();
+	result.reply_count = 0;
+	result.status = probe_status::timed_out;
+
+	const auto family = std::ranges::find(m_topology.families, request.dest().si_family, &sim_family::family);
+	if (family != m_topology.families.end()) {
+		if (family->unreachable) {
+			// failed on the spot, nothing went out
+			result.error = NETWORK_UNREACHABLE;
+			return m_now;
+		}
+		if (family->loss > 0.0 && std::bernoulli_distribution(family->loss)(m_random)) {
+			return timedOut;
+		}
+	}
+
+	const auto ttl = std::max<std::size_t>(request.key().ttl, 1);
+	const auto hopIndex = std::min(ttl, m_topology.hops.size()) - 1;
+	const auto& hop = m_topology.hops[hopIndex];
+	if (hop.responders.empty()) {
+		return timedOut;
+	}
+
+	std::size_t responder = 0;
+	if (hop.responders.size() > 1) {
+		if (hop.ecmp == sim_ecmp::per_packet) {
+			responder = std::uniform_int_distribution<std::size_t>(0, hop.responders.size() - 1)(m_random);
+		}
+		else {
+			responder = static_cast<std::size_t>(flow_hash((std::uint64_t{ request.key().session } << 16) | request.key().flow) % hop.responders.size());
+		}
+	}
+
+	if (hop.loss > 0.0 && std::bernoulli_distribution(hop.loss)(m_random)) {
+		return timedOut;
+	}
+	if (!take_token(hop, m_buckets[hopIndex][responder])) {
+		return timedOut;
+	}
+
+	const auto roundTrip = std::chrono::duration<double, std::milli>(sample(hop.latency));
+	const auto arrival = m_now + std::chrono::duration_cast<clock::duration>(roundTrip);
+	if (arrival > timedOut) {
+		// counted up front, the trace loop can't see the virtual clock run ahead of it
+		if (request.late() && arrival <= m_now + LATE_REPLY_WINDOW) {
+			request.late()->fetch_add(1, std::memory_order_relaxed);
+		}
+		return timedOut;
+	}
+	result.reply_count = 1;
+	result.responder = hop.responders[responder];
+	result.status = ttl >= m_topology.hops.size() ? probe_status::success : probe_status::ttl_expired;
+	result.round_trip_time = std::chrono::round<std::chrono::microseconds>(roundTrip);
+	return arrival;
+}
+
+bool simulated_backend::take_token(const sim_hop& hop, rate_bucket& bucket) const noexcept
+{
+	if (hop.rate_limit <= 0.0) {
+		return true;
+	}
+	const auto elapsed = std::chrono::duration<double>(m_now - bucket.refilled).count();
+	bucket.tokens = std::min(std::max(hop.rate_limit, 1.0), bucket.tokens + elapsed * hop.rate_limit);
+	bucket.refilled = m_now;
+	if (bucket.tokens < 1.0) {
+		return false;
+	}
+	bucket.tokens -= 1.0;
+	return true;
+}
+
+double simulated_backend::sample(const sim_latency& latency)
+{
+	switch (latency.kind) {
+	case sim_latency::shape::uniform:
+		return std::uniform_real_distribution<double>(latency.a, latency.b)(m_random);
+	case sim_latency::shape::normal:
+		return latency.b > 0.0 ? std::max(0.0, std::normal_distribution<double>(latency.a, latency.b)(m_random)) : latency.a;
+	case sim_latency::shape::exponential:
+		return latency.b > 0.0 ? latency.a + std::exponential_distribution<double>(1.0 / latency.b)(m_random) : latency.a;
+	case sim_latency::shape::fixed:
+	default:
+		return latency.a;
+	}
+}
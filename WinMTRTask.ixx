@@ -0,0 +1,199 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTask.ixx
+//
+// DESCRIPTION:
+//   The coroutine types the trace runs on. On Windows they are C++/WinRT's
+//   IAsyncAction and fire_and_forget, elsewhere a trace_action that does
+//   the little of IAsyncAction the trace and report mode use.
+//
+// NOTES:
+//   Both kinds start right away and run up to their first suspension on the
+//   caller's thread. A trace_action can be awaited once, and waited for with
+//   get() from a thread that isn't one it needs to finish. It resumes its
+//   awaiter on whatever thread it finished on, after its frame is gone.
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+#endif
+export module WinMTR.Task;
+
+#ifdef _WIN32
+import <winrt/Windows.Foundation.h>;
+
+export using trace_action = winrt::Windows::Foundation::IAsyncAction;
+export using trace_status = winrt::Windows::Foundation::AsyncStatus;
+export using detached_action = winrt::fire_and_forget;
+#else
+// spelled like AsyncStatus, so the code looking at it is the same everywhere
+export enum class trace_status {
+	Started,
+	Completed,
+	Canceled,
+	Error
+};
+
+//*****************************************************************************
+// CLASS:  trace_action
+//
+// A handle on a running coroutine, copies share it. The coroutine's frame
+// goes as soon as it finishes, what it ended with stays with the handles.
+//*****************************************************************************
+export class trace_action final {
+	struct state final {
+		std::mutex mutex;
+		std::condition_variable finished;
+		trace_status status = trace_status::Started;
+		std::exception_ptr error;
+		std::coroutine_handle<> awaiter;
+	};
+public:
+	struct promise_type final {
+		std::shared_ptr<state> m_state = std::make_shared<state>();
+
+		trace_action get_return_object() const noexcept
+		{
+			return trace_action{ m_state };
+		}
+		std::suspend_never initial_suspend() const noexcept
+		{
+			return {};
+		}
+		// the frame is gone before anyone waiting hears of it
+		struct final_awaiter final {
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finishing) const noexcept
+			{
+				const auto ended = std::move(finishing.promise().m_state);
+				finishing.destroy();
+				std::coroutine_handle<> awaiter;
+				{
+					std::scoped_lock lock(ended->mutex);
+					ended->status = ended->error ? trace_status::Error : trace_status::Completed;
+					awaiter = std::exchange(ended->awaiter, nullptr);
+				}
+				ended->finished.notify_all();
+				return awaiter ? awaiter : std::noop_coroutine();
+			}
+			void await_resume() const noexcept
+			{
+			}
+		};
+		final_awaiter final_suspend() const noexcept
+		{
+			return {};
+		}
+		void return_void() const noexcept
+		{
+		}
+		void unhandled_exception() const noexcept
+		{
+			m_state->error = std::current_exception();
+		}
+	};
+
+	trace_action(std::nullptr_t = nullptr) noexcept
+	{
+	}
+
+	[[nodiscard]]
+	trace_status Status() const
+	{
+		std::scoped_lock lock(m_state->mutex);
+		return m_state->status;
+	}
+
+	// blocks until the coroutine is done, rethrows what it failed with
+	void get() const
+	{
+		std::unique_lock lock(m_state->mutex);
+		m_state->finished.wait(lock, [this]() noexcept { return m_state->status != trace_status::Started; });
+		if (m_state->error) {
+			std::rethrow_exception(m_state->error);
+		}
+	}
+
+	[[nodiscard]]
+	bool await_ready() const
+	{
+		return Status() != trace_status::Started;
+	}
+	bool await_suspend(std::coroutine_handle<> awaiter) const
+	{
+		std::scoped_lock lock(m_state->mutex);
+		if (m_state->status != trace_status::Started) {
+			return false;
+		}
+		m_state->awaiter = awaiter;
+		return true;
+	}
+	void await_resume() const
+	{
+		if (m_state->error) {
+			std::rethrow_exception(m_state->error);
+		}
+	}
+private:
+	explicit trace_action(std::shared_ptr<state> started) noexcept
+		:m_state(std::move(started))
+	{
+	}
+
+	std::shared_ptr<state> m_state;
+};
+
+// nothing waits for it, an exception escaping it ends the process like it does for fire_and_forget
+export struct detached_action final {
+	struct promise_type final {
+		detached_action get_return_object() const noexcept
+		{
+			return {};
+		}
+		std::suspend_never initial_suspend() const noexcept
+		{
+			return {};
+		}
+		std::suspend_never final_suspend() const noexcept
+		{
+			return {};
+		}
+		void return_void() const noexcept
+		{
+		}
+		void unhandled_exception() const noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+#endif
@@ -0,0 +1,121 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTokenBucket.ixx
+//
+// DESCRIPTION:
+//   Caps what goes out in probes per second and bytes per second at once, no
+//   matter how many trace loops share it or how short their intervals are.
+//
+// NOTES:
+//   Written as the generic cell rate algorithm, which is a token bucket that
+//   keeps a single time point per rate instead of a token count. Callers
+//   reserve up front and are told how long to wait, so nobody ever blocks
+//   inside the bucket itself. A probe that never made it onto the wire is
+//   refunded, it would otherwise hold back the ones after it for nothing.
+//
+//*****************************************************************************
+module;
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#endif
+export module WinMTR.TokenBucket;
+
+#ifdef _WIN32
+import <algorithm>;
+import <chrono>;
+import <cstddef>;
+import <mutex>;
+#endif
+
+//*****************************************************************************
+// CLASS:  token_bucket
+//
+// Safe to share between threads. The caller passes the time in, so the
+// bucket runs on whatever clock the caller does, a virtual one included.
+// Everything on the steady clock goes through the one from process().
+//*****************************************************************************
+export class token_bucket final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	// how far ahead of the rate a burst may run, a full bucket in token terms
+	static constexpr clock::duration BURST = std::chrono::milliseconds(20);
+
+	// what reserve() took out of the bucket, and how long the probe waits for it
+	struct reservation final {
+		clock::duration wait{};
+		clock::duration probes{};
+		clock::duration bytes{};
+	};
+
+	// the caps are on what leaves the machine, however many backends and sessions that comes from
+	[[nodiscard]]
+	static token_bucket& process() noexcept
+	{
+		static token_bucket bucket;
+		return bucket;
+	}
+
+	// Takes one probe of the given size out of the bucket and says how long
+	// to hold it back. A rate of zero or less is no limit at all.
+	[[nodiscard]]
+	reservation reserve(clock::time_point now, double probes_per_second, double bytes_per_second, std::size_t bytes) noexcept
+	{
+		const auto probe_cost = cost(1.0, probes_per_second);
+		const auto byte_cost = cost(static_cast<double>(bytes), bytes_per_second);
+		std::scoped_lock lock(m_mutex);
+		const auto send = std::max({ now, m_probesDue - BURST, m_bytesDue - BURST });
+		// a cap that isn't one stays where it is, or a refund couldn't take back the wait the other cap made
+		if (probe_cost > clock::duration::zero()) {
+			m_probesDue = std::max(m_probesDue, send) + probe_cost;
+		}
+		if (byte_cost > clock::duration::zero()) {
+			m_bytesDue = std::max(m_bytesDue, send) + byte_cost;
+		}
+		return { .wait = send - now, .probes = probe_cost, .bytes = byte_cost };
+	}
+
+	// puts back what a probe that was never sent took, the ones reserved after it may go that much sooner
+	void refund(const reservation& taken) noexcept
+	{
+		std::scoped_lock lock(m_mutex);
+		m_probesDue -= taken.probes;
+		m_bytesDue -= taken.bytes;
+	}
+private:
+	[[nodiscard]]
+	static clock::duration cost(double units, double per_second) noexcept
+	{
+		if (per_second <= 0.0) {
+			return clock::duration::zero();
+		}
+		return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(units / per_second));
+	}
+
+	std::mutex m_mutex;
+	// when each bucket will have refilled for everything reserved so far
+	clock::time_point m_probesDue{};
+	clock::time_point m_bytesDue{};
+};
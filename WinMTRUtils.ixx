@@ -18,19 +18,56 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+module;
+#ifndef _WIN32
+#include <string_view>
+#endif
 export module WinMTRUtils;
+
+#ifdef _WIN32
 import <string_view>;
+#endif
 using namespace std::literals;
 export namespace WinMTRUtils {
-	export constexpr auto int_number_format = L"{:Ld}"sv;
-	export constexpr auto float_number_format = L"{:.1Lf}"sv;
-	export constexpr auto DEFAULT_PING_SIZE = 64u;
-	export constexpr auto MAX_PING_SIZE = 1u << 15u;
-	export constexpr auto MIN_PING_SIZE = DEFAULT_PING_SIZE;
-	export constexpr auto DEFAULT_INTERVAL = 1.0;
-	export constexpr auto MIN_INTERVAL = DEFAULT_INTERVAL;
-	export constexpr auto MAX_INTERVAL = 120.0;
-	export constexpr auto DEFAULT_MAX_LRU = 128u;
-	export constexpr auto MIN_MAX_LRU = 1u;
-	export constexpr auto MAX_MAX_LRU = 1024u;
+	constexpr auto int_number_format = L"{:Ld}"sv;
+	constexpr auto float_number_format = L"{:.1Lf}"sv;
+	// down to the millisecond
+	constexpr auto interval_number_format = L"{:.3Lf}"sv;
+	// round trips are kept in microseconds and shown in milliseconds
+	constexpr auto rtt_number_format = L"{:.3Lf}"sv;
+	// no digit grouping, AS numbers are identifiers
+	constexpr auto asn_format = L"AS{}"sv;
+	constexpr double microseconds_to_ms(double microseconds) noexcept { return microseconds / 1000.0; }
+	constexpr auto DEFAULT_PING_SIZE = 64u;
+	constexpr auto MAX_PING_SIZE = 1u << 15u;
+	constexpr auto MIN_PING_SIZE = DEFAULT_PING_SIZE;
+	constexpr auto DEFAULT_INTERVAL = 1.0;
+	constexpr auto MIN_INTERVAL = 0.001;
+	constexpr auto MAX_INTERVAL = 120.0;
+	constexpr auto DEFAULT_MAX_LRU = 128u;
+	constexpr auto MIN_MAX_LRU = 1u;
+	constexpr auto MAX_MAX_LRU = 1024u;
+	constexpr auto DEFAULT_EWMA_WEIGHT = 0.125;
+	constexpr auto MIN_EWMA_WEIGHT = 0.001;
+	constexpr auto MAX_EWMA_WEIGHT = 1.0;
+	// per trace, zero switches the probe history off
+	constexpr auto DEFAULT_HISTORY_KIB = 8192u;
+	constexpr auto MIN_HISTORY_KIB = 0u;
+	constexpr auto MAX_HISTORY_KIB = 1u << 20u;
+	// traceroute's, high enough that nothing listens there
+	constexpr auto DEFAULT_UDP_PORT = 33434u;
+	constexpr auto DEFAULT_TCP_PORT = 80u;
+	constexpr auto MIN_PROBE_PORT = 1u;
+	constexpr auto MAX_PROBE_PORT = 65535u;
+	// process wide, across every hop; bytes count the IP and ICMP, UDP or TCP headers too
+	constexpr auto DEFAULT_MAX_PROBE_RATE = 1000u;
+	constexpr auto MIN_MAX_PROBE_RATE = 1u;
+	constexpr auto MAX_MAX_PROBE_RATE = 1000000u;
+	constexpr auto DEFAULT_MAX_BYTE_RATE = 1000000u;
+	constexpr auto MIN_MAX_BYTE_RATE = 1000u;
+	constexpr auto MAX_MAX_BYTE_RATE = 1000000000u;
+	// the TTL field's range, hops are only allocated as far as the trace gets
+	constexpr auto DEFAULT_MAX_HOPS = 30u;
+	constexpr auto MIN_MAX_HOPS = 1u;
+	constexpr auto MAX_MAX_HOPS = 255u;
 }
\ No newline at end of file
@@ -48,6 +48,12 @@
 #define IDC_MFCLINK1                    1026
 #define IDC_IPV4_CHECK                  1027
 #define IDC_USEIPV6_CHECK               1028
+#define IDC_EDIT_PP50                   1029
+#define IDC_EDIT_PP90                   1030
+#define IDC_EDIT_PP99                   1031
+#define IDC_EDIT_PP999                  1032
+#define IDC_COMBO_PROTOCOL              1033
+#define IDC_EDIT_PORT                   1034
 
 // Next default values for new objects
 // 
@@ -55,7 +61,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        138
 #define _APS_NEXT_COMMAND_VALUE         32771
-#define _APS_NEXT_CONTROL_VALUE         1029
+#define _APS_NEXT_CONTROL_VALUE         1035
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -0,0 +1,241 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRAsnDatabase-test.cpp
+//
+//
+// DESCRIPTION:
+//   The ASN table built from a dump and mapped back in, the longest prefix
+//   it finds for either family, and the benchmark of lookups in a table the
+//   size of a full routing table dump.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.AsnDatabase;
+
+using namespace std::literals;
+
+namespace {
+	// about what an iptoasn.com dump holds
+	constexpr auto FULL_TABLE_IPV4 = 500'000;
+	constexpr auto FULL_TABLE_IPV6 = 150'000;
+	constexpr auto AUTONOMOUS_SYSTEMS = 75'000u;
+	constexpr auto LOOKUPS = 10'000'000;
+
+	using winmtr::test::address;
+
+	[[nodiscard]]
+	SOCKADDR_INET ipv4(std::uint32_t host) noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv4.sin_family = AF_INET;
+		addr.Ipv4.sin_addr.s_addr = htonl(host);
+		return addr;
+	}
+
+	// the upper half of the address, the lower one all zero or all ones
+	[[nodiscard]]
+	SOCKADDR_INET ipv6(std::uint64_t network, bool last = false) noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv6.sin6_family = AF_INET6;
+		auto bytes = reinterpret_cast<std::uint8_t*>(&addr.Ipv6.sin6_addr);
+		for (int i = 0; i < 8; ++i) {
+			bytes[i] = static_cast<std::uint8_t>(network >> (56 - 8 * i));
+			bytes[8 + i] = last ? 0xFF : 0x00;
+		}
+		return addr;
+	}
+
+	void append_address(std::string& out, const SOCKADDR_INET& addr)
+	{
+		std::array<char, INET6_ADDRSTRLEN> text{};
+		if (addr.si_family == AF_INET) {
+			out += inet_ntop(AF_INET, &addr.Ipv4.sin_addr, text.data(), text.size());
+		}
+		else {
+			out += inet_ntop(AF_INET6, &addr.Ipv6.sin6_addr, text.data(), text.size());
+		}
+	}
+
+	void append_row(std::string& out, const SOCKADDR_INET& first, const SOCKADDR_INET& last, std::uint32_t asn)
+	{
+		append_address(out, first);
+		out += '\t';
+		append_address(out, last);
+		out += '\t';
+		out += std::to_string(asn);
+		out += "\tZZ\tAS";
+		out += std::to_string(asn);
+		out += '\n';
+	}
+
+	// Back to back ranges of random size over the unicast space of both
+	// families, on /24 and /48 boundaries as in a real dump, with the
+	// addresses to look up in it drawn from the same space.
+	struct full_table final {
+		std::string tsv;
+		std::vector<SOCKADDR_INET> lookups;
+	};
+
+	[[nodiscard]]
+	full_table make_full_table()
+	{
+		std::mt19937_64 random{ 42 };
+		std::uniform_int_distribution<std::uint32_t> asns{ 1, AUTONOMOUS_SYSTEMS };
+		full_table table;
+		table.tsv.reserve(static_cast<std::size_t>(FULL_TABLE_IPV4 + FULL_TABLE_IPV6) * 64);
+
+		// 1.0.0.0 up to 224.0.0.0
+		std::vector<std::uint32_t> cuts(FULL_TABLE_IPV4);
+		std::uniform_int_distribution<std::uint32_t> v4{ 0x01000000u, 0xDFFFFFFFu };
+		std::ranges::generate(cuts, [&] { return v4(random) & 0xFFFFFF00u; });
+		cuts.push_back(0x01000000u);
+		std::ranges::sort(cuts);
+		cuts.erase(std::ranges::unique(cuts).begin(), cuts.end());
+		cuts.push_back(0xE0000000u);
+		for (std::size_t i = 0; i + 1 < cuts.size(); ++i) {
+			append_row(table.tsv, ipv4(cuts[i]), ipv4(cuts[i + 1] - 1), asns(random));
+		}
+
+		// 2000::/3
+		std::vector<std::uint64_t> networks(FULL_TABLE_IPV6);
+		std::uniform_int_distribution<std::uint64_t> v6{ 0x2000000000000000ull, 0x3FFFFFFFFFFFFFFFull };
+		std::ranges::generate(networks, [&] { return v6(random) & ~0xFFFFull; });
+		networks.push_back(0x2000000000000000ull);
+		std::ranges::sort(networks);
+		networks.erase(std::ranges::unique(networks).begin(), networks.end());
+		networks.push_back(0x4000000000000000ull);
+		for (std::size_t i = 0; i + 1 < networks.size(); ++i) {
+			append_row(table.tsv, ipv6(networks[i]), ipv6(networks[i + 1] - 1, true), asns(random));
+		}
+
+		// mostly IPv4, as most traces are
+		table.lookups.reserve(LOOKUPS);
+		std::bernoulli_distribution isV6{ 0.2 };
+		for (int i = 0; i < LOOKUPS; ++i) {
+			table.lookups.push_back(isV6(random) ? ipv6(v6(random)) : ipv4(v4(random)));
+		}
+		return table;
+	}
+}
+
+WINMTR_TEST(asn_database_finds_the_longest_prefix)
+{
+	const winmtr::test::scratch_path dir("winmtr-asn-test", winmtr::test::scratch_kind::directory);
+	{
+		std::ofstream tsv(dir.path() / "asn.tsv", std::ios::binary);
+		tsv << "10.0.0.0\t10.255.255.255\t64500\tZZ\tTen\n"
+			"10.1.0.0\t10.1.255.255\t64501\tZZ\tTen One\n"
+			"10.1.2.3\t10.1.2.3\t64502\tZZ\tA single host\n"
+			"192.0.2.0\t192.0.2.255\t0\tNone\tNot routed\n"
+			"2001:db8::\t2001:db8:ffff:ffff:ffff:ffff:ffff:ffff\t64510\tZZ\tDocumentation\n"
+			"2001:db8:1::\t2001:db8:1:ffff:ffff:ffff:ffff:ffff\t64511\tZZ\tDocumentation One\n";
+	}
+	WINMTR_REQUIRE(asn_database::build(dir.path() / "asn.tsv", dir.path() / "asn.bin"));
+	const auto database = asn_database::open(dir.path() / "asn.bin");
+	WINMTR_REQUIRE(database);
+
+	WINMTR_CHECK(database->lookup(address("10.200.0.1")).asn == 64500);
+	WINMTR_CHECK(database->lookup(address("10.1.0.0")).asn == 64501);
+	WINMTR_CHECK(database->lookup(address("10.1.255.255")).asn == 64501);
+	WINMTR_CHECK(database->lookup(address("10.1.2.3")).asn == 64502);
+	WINMTR_CHECK(database->lookup(address("10.1.2.4")).asn == 64501);
+	WINMTR_CHECK(database->lookup(address("10.1.2.3")).org == "A single host");
+	WINMTR_CHECK(database->lookup(address("11.0.0.0")).asn == 0);
+	// AS 0 rows are left out
+	WINMTR_CHECK(database->lookup(address("192.0.2.1")).asn == 0);
+
+	WINMTR_CHECK(database->lookup(address("2001:db8::1")).asn == 64510);
+	WINMTR_CHECK(database->lookup(address("2001:db8:1::1")).asn == 64511);
+	WINMTR_CHECK(database->lookup(address("2001:db8:2::1")).asn == 64510);
+	WINMTR_CHECK(database->lookup(address("2001:db9::1")).asn == 0);
+	WINMTR_CHECK(database->organization(64511) == L"Documentation One");
+	WINMTR_CHECK(database->organization(64999).empty());
+	WINMTR_CHECK(database->lookup(SOCKADDR_INET{}).asn == 0);
+}
+
+WINMTR_TEST(asn_database_opens_a_broken_file_as_nothing)
+{
+	const winmtr::test::scratch_path dir("winmtr-asn-broken", winmtr::test::scratch_kind::directory);
+	WINMTR_CHECK(!asn_database::open(dir.path() / "missing.bin"));
+	{
+		std::ofstream garbage(dir.path() / "garbage.bin", std::ios::binary);
+		garbage << "not a table at all, just some text long enough to pass for a header";
+	}
+	WINMTR_CHECK(!asn_database::open(dir.path() / "garbage.bin"));
+}
+
+WINMTR_BENCH(asn_lookup_throughput)
+{
+	const winmtr::test::scratch_path dir("winmtr-asn-bench", winmtr::test::scratch_kind::directory);
+	const auto table = make_full_table();
+	{
+		std::ofstream tsv(dir.path() / "asn.tsv", std::ios::binary);
+		tsv.write(table.tsv.data(), static_cast<std::streamsize>(table.tsv.size()));
+	}
+	const auto building = std::chrono::steady_clock::now();
+	WINMTR_REQUIRE(asn_database::build(dir.path() / "asn.tsv", dir.path() / "asn.bin"));
+	const auto built = std::chrono::steady_clock::now() - building;
+	const auto opening = std::chrono::steady_clock::now();
+	const auto database = asn_database::open(dir.path() / "asn.bin");
+	const auto opened = std::chrono::steady_clock::now() - opening;
+	WINMTR_REQUIRE(database);
+
+	const auto allocationsBefore = winmtr::test::allocations();
+	std::uint64_t found = 0;
+	const auto started = std::chrono::steady_clock::now();
+	for (const auto& addr : table.lookups) {
+		found += database->lookup(addr).asn != 0;
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - started;
+	const auto allocations = winmtr::test::allocations() - allocationsBefore;
+
+	winmtr::test::report("lookup", winmtr::test::seconds(elapsed) * 1e9 / LOOKUPS, "ns");
+	winmtr::test::report("lookups per second", LOOKUPS / winmtr::test::seconds(elapsed), "lookups/s");
+	winmtr::test::report("table size", static_cast<double>(database->size_bytes()) / (1 << 20), "MiB");
+	winmtr::test::report("build from the dump", winmtr::test::seconds(built), "s");
+	winmtr::test::report("open", winmtr::test::seconds(opened) * 1e6, "us");
+	winmtr::test::report("allocations while looking up", static_cast<double>(allocations), "allocations");
+	// every address drawn lies in a range
+	WINMTR_CHECK(found == LOOKUPS);
+	WINMTR_CHECK(allocations == 0);
+}
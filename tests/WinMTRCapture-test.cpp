@@ -0,0 +1,260 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRCapture-test.cpp
+//
+//
+// DESCRIPTION:
+//   The binary capture's records read back as they were written, a capture
+//   cut short by a crash, and what writing a day of probes and reading it
+//   back costs.
+//
+// NOTES:
+//    The read back benchmark counts the hops the way a replay does, with a
+//    running mean and variance per TTL. The replay through WinMTRNet itself
+//    is in WinMTRSimulatedBackend-test.cpp.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Capture;
+import WinMTR.EventLog;
+import WinMTR.ProbeBackend;
+import WinMTRIPUtils;
+
+using namespace std::literals;
+
+namespace {
+	// a day of a 30 hop trace at a probe a second
+	constexpr auto HOPS = 30;
+	constexpr auto DAY = 86'400;
+	constexpr auto RECORDING_THREADS = 8;
+
+	using winmtr::test::address;
+
+	// what a replay keeps per hop, Welford's running mean and variance
+	struct hop_tally final {
+		std::uint64_t sent = 0;
+		std::uint64_t returned = 0;
+		double mean = 0.0;
+		double m2 = 0.0;
+	};
+}
+
+WINMTR_TEST(capture_reads_back_what_was_written)
+{
+	const winmtr::test::scratch_path file("winmtr-capture-round-trip.cap");
+	const auto now = probe_backend::clock::now();
+	{
+		const auto writer = capture_writer::open(file.path());
+		WINMTR_REQUIRE(writer);
+		WINMTR_CHECK(writer->trace(7, now, address("192.0.2.1"), 30));
+		WINMTR_CHECK(writer->probe({ .time = now + 1ms, .responder = address("198.51.100.7"), .round_trip_time = 1234us, .session = 7, .ttl = 3, .status = probe_status::ttl_expired }));
+		WINMTR_CHECK(writer->probe({ .time = now + 2ms, .responder = address("2001:db8::7"), .round_trip_time = 99us, .session = 7, .ttl = 4, .status = probe_status::success }));
+		WINMTR_CHECK(writer->probe({ .time = now + 3ms, .session = 7, .ttl = 5 }));
+		WINMTR_CHECK(writer->name(7, now + 4ms, 3, address("198.51.100.7"), L"hop-3.example.net"));
+	}
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	WINMTR_CHECK(capture->records() == 5);
+	WINMTR_CHECK(capture->traces().size() == 1);
+
+	capture_file::cursor records(*capture);
+	capture_record record;
+	WINMTR_REQUIRE(records.next(record));
+	WINMTR_CHECK(record.kind == capture_kind::trace && record.session == 7 && record.ttl == 30);
+	WINMTR_CHECK(same_address(record.address, address("192.0.2.1")));
+	const auto started = record.time;
+
+	WINMTR_REQUIRE(records.next(record));
+	WINMTR_CHECK(record.kind == capture_kind::probe && record.ttl == 3 && record.status == probe_status::ttl_expired);
+	WINMTR_CHECK(same_address(record.address, address("198.51.100.7")));
+	WINMTR_CHECK(record.round_trip_time == 1234us);
+	// both cut down to the microsecond
+	WINMTR_CHECK(record.time - started >= 999us && record.time - started <= 1001us);
+
+	WINMTR_REQUIRE(records.next(record));
+	WINMTR_CHECK(record.status == probe_status::success && record.round_trip_time == 99us);
+	WINMTR_CHECK(same_address(record.address, address("2001:db8::7")));
+
+	WINMTR_REQUIRE(records.next(record));
+	WINMTR_CHECK(record.ttl == 5 && record.status == probe_status::timed_out);
+	WINMTR_CHECK(record.address.si_family == 0);
+
+	WINMTR_REQUIRE(records.next(record));
+	WINMTR_CHECK(record.kind == capture_kind::name && record.ttl == 3);
+	WINMTR_CHECK(record.name == L"hop-3.example.net");
+	WINMTR_CHECK(!records.next(record));
+}
+
+WINMTR_TEST(capture_cut_short_is_read_and_carried_on_to_its_last_whole_record)
+{
+	const winmtr::test::scratch_path file("winmtr-capture-torn.cap");
+	const auto now = probe_backend::clock::now();
+	{
+		const auto writer = capture_writer::open(file.path());
+		WINMTR_REQUIRE(writer);
+		writer->trace(1, now, address("192.0.2.1"), 30);
+		writer->probe({ .time = now, .responder = address("192.0.2.1"), .round_trip_time = 10us, .session = 1, .ttl = 1, .status = probe_status::success });
+	}
+	const auto whole = std::filesystem::file_size(file.path());
+	{
+		// half of the fixed part of a record, as a crash mid write leaves it
+		std::ofstream torn(file.path(), std::ios::binary | std::ios::app);
+		const std::array<char, 12> half{ 2 };
+		torn.write(half.data(), half.size());
+	}
+	std::chrono::system_clock::time_point started;
+	{
+		const auto capture = capture_file::open(file.path());
+		WINMTR_REQUIRE(capture);
+		WINMTR_CHECK(capture->records() == 2);
+		WINMTR_CHECK(capture->valid_bytes() == whole);
+		started = capture->started();
+	}
+	{
+		const auto writer = capture_writer::open(file.path());
+		WINMTR_REQUIRE(writer);
+		writer->probe({ .time = now, .session = 1, .ttl = 2 });
+	}
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	WINMTR_CHECK(capture->records() == 3);
+	WINMTR_CHECK(capture->valid_bytes() == std::filesystem::file_size(file.path()));
+	WINMTR_CHECK(capture->started() == started);
+}
+
+WINMTR_TEST(capture_rejects_what_is_not_one)
+{
+	const winmtr::test::scratch_path file("winmtr-capture-not.cap");
+	{
+		std::ofstream text(file.path(), std::ios::binary);
+		text << "time,session,ttl,responder,rtt_us,status\n";
+	}
+	WINMTR_CHECK(!capture_file::open(file.path()));
+	// and nothing is appended to it either
+	WINMTR_CHECK(!capture_writer::open(file.path()));
+}
+
+WINMTR_BENCH(capture_write_and_read_throughput)
+{
+	const winmtr::test::scratch_path file("winmtr-capture-bench.cap");
+	constexpr auto PROBES = HOPS * DAY;
+	constexpr auto PER_THREAD = PROBES / RECORDING_THREADS;
+	const auto base = probe_backend::clock::now();
+
+	const auto opened = std::chrono::steady_clock::now();
+	// room for the whole day, on fewer cores than threads the writer would not get a look in and records would be dropped
+	auto writer = capture_writer::open(file.path(), { .buffer_bytes = std::size_t{ 128 } << 20 });
+	WINMTR_REQUIRE(writer);
+	writer->trace(1, base, address("192.0.2.1"), HOPS);
+	// each thread is a trace loop with its own share of the day, every tenth round goes unanswered
+	std::vector<std::thread> loops;
+	std::vector<std::chrono::steady_clock::duration> recording(RECORDING_THREADS);
+	for (int t = 0; t < RECORDING_THREADS; ++t) {
+		loops.emplace_back([&writer, &recording, base, t] {
+			const auto started = std::chrono::steady_clock::now();
+			for (int i = t * PER_THREAD; i < (t + 1) * PER_THREAD; ++i) {
+				const auto ttl = static_cast<UCHAR>(i % HOPS + 1);
+				probe_event event{ .time = base + std::chrono::seconds(i / HOPS), .session = 1, .ttl = ttl };
+				if ((i / HOPS) % 10) {
+					event.responder.Ipv4.sin_family = AF_INET;
+					event.responder.Ipv4.sin_addr.s_addr = htonl(0xC6336400u + ttl);
+					event.round_trip_time = std::chrono::microseconds(1000 * ttl + i % 997);
+					event.status = ttl == HOPS ? probe_status::success : probe_status::ttl_expired;
+				}
+				writer->probe(event);
+			}
+			recording[t] = std::chrono::steady_clock::now() - started;
+		});
+	}
+	for (auto& loop : loops) {
+		loop.join();
+	}
+	const auto stats = writer->stats();
+	// the last of it goes out as the writer goes
+	writer.reset();
+	const auto written = std::chrono::steady_clock::now() - opened;
+
+	const auto mapping = std::chrono::steady_clock::now();
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	const auto validated = std::chrono::steady_clock::now() - mapping;
+
+	std::array<hop_tally, HOPS> hops{};
+	const auto scanning = std::chrono::steady_clock::now();
+	capture_file::cursor records(*capture);
+	capture_record record;
+	std::uint64_t read = 0;
+	while (records.next(record)) {
+		++read;
+		if (record.kind != capture_kind::probe || !record.ttl || record.ttl > HOPS) {
+			continue;
+		}
+		auto& hop = hops[record.ttl - 1];
+		++hop.sent;
+		if (record.status == probe_status::timed_out) {
+			continue;
+		}
+		++hop.returned;
+		const auto rtt = static_cast<double>(record.round_trip_time.count());
+		const auto delta = rtt - hop.mean;
+		hop.mean += delta / static_cast<double>(hop.returned);
+		hop.m2 += delta * (rtt - hop.mean);
+	}
+	const auto scanned = std::chrono::steady_clock::now() - scanning;
+
+	auto slowest = std::chrono::steady_clock::duration::zero();
+	for (const auto& loop : recording) {
+		slowest = std::max(slowest, loop);
+	}
+	const auto size = std::filesystem::file_size(file.path());
+	winmtr::test::report("probes in the day", PROBES, "records");
+	winmtr::test::report("capture size", static_cast<double>(size) / (1 << 20), "MiB");
+	winmtr::test::report("bytes per probe", static_cast<double>(size) / PROBES, "bytes");
+	winmtr::test::report("record, from a trace loop", winmtr::test::seconds(slowest) * 1e9 / PER_THREAD, "ns");
+	winmtr::test::report("written to disk, all threads", PROBES / winmtr::test::seconds(written), "records/s");
+	winmtr::test::report("open and validate", winmtr::test::seconds(validated) * 1e3, "ms");
+	winmtr::test::report("scan with per hop stats", winmtr::test::seconds(scanned) * 1e3, "ms");
+	winmtr::test::report("read back", static_cast<double>(read) / winmtr::test::seconds(scanned), "records/s");
+	WINMTR_CHECK(stats.dropped == 0);
+	WINMTR_CHECK(read == capture->records());
+	WINMTR_CHECK(read == PROBES + 1);
+	WINMTR_CHECK(hops[HOPS - 1].returned > 0 && hops[HOPS - 1].mean > 1000.0 * (HOPS - 1));
+}
@@ -0,0 +1,186 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTREventLog-test.cpp
+//
+//
+// DESCRIPTION:
+//   The event log's bounded queue dropping and counting what it has no room
+//   for, and the log rotating its file once it reaches a size or an age.
+//
+// NOTES:
+//    Each case gets a directory of its own, the rotated files land next to
+//    the log. Rotation is looked at between batches, so the cases wait for
+//    each event to be written before pushing the next.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.EventLog;
+import WinMTR.ProbeBackend;
+
+using namespace std::literals;
+
+namespace {
+	[[nodiscard]]
+	probe_event answered() noexcept
+	{
+		probe_event event{ .time = probe_backend::clock::now(), .round_trip_time = 1500us, .session = 1, .ttl = 3, .status = probe_status::ttl_expired };
+		event.responder.Ipv4.sin_family = AF_INET;
+		event.responder.Ipv4.sin_addr.s_addr = htonl(0xC0000201u);
+		return event;
+	}
+
+	// the writer picks a trickle up every FLUSH_INTERVAL
+	[[nodiscard]]
+	bool written(const event_log& log, std::uint64_t count)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + 5s;
+		while (log.stats().written < count) {
+			if (std::chrono::steady_clock::now() > deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(10ms);
+		}
+		return true;
+	}
+
+	[[nodiscard]]
+	std::vector<std::filesystem::path> files_in(const std::filesystem::path& dir)
+	{
+		std::vector<std::filesystem::path> files;
+		for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+			files.push_back(entry.path());
+		}
+		return files;
+	}
+
+	[[nodiscard]]
+	std::vector<std::string> lines_of(const std::filesystem::path& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::vector<std::string> lines;
+		for (std::string line; std::getline(in, line);) {
+			lines.push_back(line);
+		}
+		return lines;
+	}
+}
+
+WINMTR_TEST(event_log_drops_and_counts_what_it_has_no_room_for)
+{
+	constexpr std::uint64_t PUSHES = 1'000'000;
+	const winmtr::test::scratch_path dir("winmtr-event-log-drops", winmtr::test::scratch_kind::directory);
+	const auto path = dir.path() / "events.ndjson";
+	std::uint64_t accepted = 0;
+	{
+		// a batch of a few events, flushed to disk, takes far longer than pushing them
+		const auto log = event_log::open(path, { .queue = 16, .max_bytes = 0, .max_age = 0s });
+		WINMTR_REQUIRE(log);
+		const auto event = answered();
+		for (std::uint64_t i = 0; i < PUSHES; ++i) {
+			accepted += log->push(event);
+		}
+		const auto stats = log->stats();
+		WINMTR_CHECK(stats.dropped > 0);
+		WINMTR_CHECK(stats.dropped == PUSHES - accepted);
+		WINMTR_REQUIRE(written(*log, accepted));
+		// nothing more went missing than was turned away
+		WINMTR_CHECK(log->stats().written == accepted);
+		WINMTR_CHECK(log->stats().dropped == PUSHES - accepted);
+	}
+	WINMTR_CHECK(lines_of(path).size() == accepted);
+}
+
+WINMTR_TEST(event_log_rotates_by_size)
+{
+	const winmtr::test::scratch_path dir("winmtr-event-log-size", winmtr::test::scratch_kind::directory);
+	const auto path = dir.path() / "events.csv";
+	{
+		// the header and one record fit, the next batch goes to a new file
+		const auto log = event_log::open(path, { .max_bytes = 100, .max_age = 0s });
+		WINMTR_REQUIRE(log);
+		for (std::uint64_t i = 1; i <= 3; ++i) {
+			WINMTR_REQUIRE(log->push(answered()));
+			WINMTR_REQUIRE(written(*log, i));
+		}
+		WINMTR_CHECK(log->stats().rotations == 2);
+		WINMTR_CHECK(log->stats().dropped == 0);
+	}
+	// the log and two rotated files next to it, each a CSV of its own
+	const auto files = files_in(dir.path());
+	WINMTR_REQUIRE(files.size() == 3);
+	for (const auto& file : files) {
+		WINMTR_CHECK(file.extension() == ".csv");
+		WINMTR_CHECK(file.stem().string().starts_with("events"));
+		const auto lines = lines_of(file);
+		WINMTR_REQUIRE(lines.size() == 2);
+		WINMTR_CHECK(lines[0] == "time,session,ttl,responder,rtt_us,status");
+		WINMTR_CHECK(lines[1].ends_with(",1,3,192.0.2.1,1500,ttl_expired"));
+	}
+}
+
+WINMTR_TEST(event_log_rotates_by_age)
+{
+	const winmtr::test::scratch_path dir("winmtr-event-log-age", winmtr::test::scratch_kind::directory);
+	const auto path = dir.path() / "events.ndjson";
+	{
+		const auto log = event_log::open(path, { .max_bytes = 0, .max_age = 1s });
+		WINMTR_REQUIRE(log);
+		WINMTR_REQUIRE(log->push(answered()));
+		WINMTR_REQUIRE(written(*log, 1));
+		// young enough still
+		WINMTR_REQUIRE(log->push(answered()));
+		WINMTR_REQUIRE(written(*log, 2));
+		WINMTR_CHECK(log->stats().rotations == 0);
+		std::this_thread::sleep_for(1100ms);
+		WINMTR_REQUIRE(log->push(answered()));
+		WINMTR_REQUIRE(written(*log, 3));
+		WINMTR_CHECK(log->stats().rotations == 1);
+	}
+	// the two before on the rotated file, the one after on a fresh log
+	WINMTR_CHECK(lines_of(path).size() == 1);
+	const auto files = files_in(dir.path());
+	WINMTR_REQUIRE(files.size() == 2);
+	for (const auto& file : files) {
+		if (file != path) {
+			WINMTR_CHECK(file.stem().string().starts_with("events-"));
+			WINMTR_CHECK(lines_of(file).size() == 2);
+		}
+	}
+}
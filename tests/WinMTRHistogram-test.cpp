@@ -0,0 +1,146 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRHistogram-test.cpp
+//
+//
+// DESCRIPTION:
+//   The latency histogram's buckets and percentiles, and what recording into
+//   it and reading percentiles out of it costs.
+//
+//*****************************************************************************
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Histogram;
+
+using namespace std::literals;
+
+namespace {
+	// microseconds, like the round trips the hops record
+	constexpr double EXPONENTIAL_MEAN = 20000.0;
+	constexpr auto SAMPLES = 10'000'000;
+
+	// a percentile is reported as the middle of its bucket, which is 1/SUB_BUCKETS wide
+	[[nodiscard]]
+	bool within_bucket(double reported, double expected, double slack = 0.0) noexcept
+	{
+		return std::abs(reported - expected) <= expected / latency_histogram::SUB_BUCKETS + slack;
+	}
+
+	// drawn up front, so the benchmark times the histogram rather than the generator
+	[[nodiscard]]
+	std::vector<std::uint32_t> exponential_samples(std::size_t count)
+	{
+		std::mt19937_64 random{ 42 };
+		std::exponential_distribution<double> latency{ 1.0 / EXPONENTIAL_MEAN };
+		std::vector<std::uint32_t> samples(count);
+		for (auto& sample : samples) {
+			sample = static_cast<std::uint32_t>(latency(random));
+		}
+		return samples;
+	}
+}
+
+WINMTR_TEST(histogram_buckets_hold_their_values)
+{
+	// exact below SUB_BUCKETS, within a bucket's width above
+	for (std::uint32_t value = 0; value < latency_histogram::SUB_BUCKETS; ++value) {
+		WINMTR_CHECK(latency_histogram::value_of(latency_histogram::bucket_of(value)) == value);
+	}
+	for (std::uint32_t value = latency_histogram::SUB_BUCKETS; value < (1u << latency_histogram::MAX_VALUE_BITS); value += value / 7 + 1) {
+		const auto bucket = latency_histogram::bucket_of(value);
+		WINMTR_REQUIRE(bucket < latency_histogram::BUCKETS);
+		WINMTR_CHECK(within_bucket(latency_histogram::value_of(bucket), value));
+		// and the buckets go up with the values
+		WINMTR_CHECK(bucket >= latency_histogram::bucket_of(value - 1));
+	}
+	WINMTR_CHECK(latency_histogram::bucket_of(0xFFFFFFFFu) == latency_histogram::BUCKETS - 1);
+	WINMTR_CHECK(latency_histogram::bucket_of(1u << latency_histogram::MAX_VALUE_BITS) == latency_histogram::BUCKETS - 1);
+}
+
+WINMTR_TEST(histogram_percentiles_match_the_distribution)
+{
+	const auto histogram = std::make_unique<latency_histogram>();
+	const auto empty = histogram->percentiles();
+	WINMTR_CHECK(empty.p50 == 0 && empty.p999 == 0);
+
+	for (const auto sample : exponential_samples(1'000'000)) {
+		histogram->record(sample);
+	}
+	// the exponential's quantiles are mean * ln(1 / (1 - q)), a million samples pin them down to well under a percent
+	const auto percentiles = histogram->percentiles();
+	WINMTR_CHECK(within_bucket(percentiles.p50, EXPONENTIAL_MEAN * std::log(2.0), EXPONENTIAL_MEAN * 0.01));
+	WINMTR_CHECK(within_bucket(percentiles.p90, EXPONENTIAL_MEAN * std::log(10.0), EXPONENTIAL_MEAN * 0.02));
+	WINMTR_CHECK(within_bucket(percentiles.p99, EXPONENTIAL_MEAN * std::log(100.0), EXPONENTIAL_MEAN * 0.05));
+	WINMTR_CHECK(within_bucket(percentiles.p999, EXPONENTIAL_MEAN * std::log(1000.0), EXPONENTIAL_MEAN * 0.2));
+
+	histogram->reset();
+	WINMTR_CHECK(histogram->percentiles().p50 == 0);
+}
+
+WINMTR_TEST(histogram_ranks_round_up)
+{
+	const auto histogram = std::make_unique<latency_histogram>();
+	for (std::uint32_t value = 1; value <= 10; ++value) {
+		histogram->record(value);
+	}
+	// with ten samples the ninth is p90 and the tenth is everything above
+	const auto percentiles = histogram->percentiles();
+	WINMTR_CHECK(percentiles.p50 == 5);
+	WINMTR_CHECK(percentiles.p90 == 9);
+	WINMTR_CHECK(percentiles.p99 == 10);
+	WINMTR_CHECK(percentiles.p999 == 10);
+}
+
+WINMTR_BENCH(histogram_recording)
+{
+	const auto samples = exponential_samples(SAMPLES);
+	const auto histogram = std::make_unique<latency_histogram>();
+	const auto allocationsBefore = winmtr::test::allocations();
+	const auto started = std::chrono::steady_clock::now();
+	for (const auto sample : samples) {
+		histogram->record(sample);
+	}
+	const auto recorded = std::chrono::steady_clock::now() - started;
+	const auto allocations = winmtr::test::allocations() - allocationsBefore;
+
+	// what a refresh of the dialog costs per hop
+	constexpr auto QUERIES = 100'000;
+	std::uint64_t sink = 0;
+	const auto queried = std::chrono::steady_clock::now();
+	for (int i = 0; i < QUERIES; ++i) {
+		sink += histogram->percentiles().p99;
+	}
+	const auto read = std::chrono::steady_clock::now() - queried;
+
+	winmtr::test::report("record", winmtr::test::seconds(recorded) * 1e9 / SAMPLES, "ns");
+	winmtr::test::report("records per second", SAMPLES / winmtr::test::seconds(recorded), "records/s");
+	winmtr::test::report("percentiles", winmtr::test::seconds(read) * 1e9 / QUERIES, "ns");
+	winmtr::test::report("size per hop", sizeof(latency_histogram), "bytes");
+	winmtr::test::report("allocations while recording", static_cast<double>(allocations), "allocations");
+	WINMTR_CHECK(allocations == 0);
+	WINMTR_CHECK(sink > 0);
+}
@@ -0,0 +1,522 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRLinuxProbeBackend-test.cpp
+//
+//
+// DESCRIPTION:
+//   The Linux backend against the loopback interface, ICMP, UDP and TCP,
+//   and how its round trips compare with what the caller sees. The echo
+//   requests it builds, whose checksum stays put for as long as the flow does.
+//
+// NOTES:
+//    ICMP needs net.ipv4.ping_group_range to include the caller, the ICMP
+//    tests skip themselves when it doesn't.
+//
+//*****************************************************************************
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.ProbeBackend.Linux;
+
+using namespace std::literals;
+
+namespace {
+	using clock = probe_backend::clock;
+
+	const std::array<std::byte, 32> PAYLOAD{};
+
+	// runs until its first suspension on the calling thread, the rest on the backend's
+	struct detached final {
+		struct promise_type final {
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	detached probe(probe_backend& backend, probe_key key, SOCKADDR_INET dest, std::chrono::milliseconds timeout, std::promise<probe_result>& done)
+	{
+		try {
+			done.set_value(co_await backend.send(key, dest, PAYLOAD, timeout));
+		}
+		catch (...) {
+			done.set_exception(std::current_exception());
+		}
+	}
+
+	detached sleep_on(probe_backend& backend, clock::duration duration, std::promise<clock::time_point>& done)
+	{
+		co_await backend.resume_after(duration);
+		done.set_value(clock::now());
+	}
+
+	using winmtr::test::address;
+
+	// TEST-NET-2 from RFC 5737, nothing should answer from there
+	[[nodiscard]]
+	SOCKADDR_INET unanswered() noexcept
+	{
+		return address("198.51.100.1");
+	}
+
+	[[nodiscard]]
+	bool same_host(const SOCKADDR_INET& lhs, const SOCKADDR_INET& rhs) noexcept
+	{
+		if (lhs.si_family != rhs.si_family) {
+			return false;
+		}
+		if (lhs.si_family == AF_INET) {
+			return lhs.Ipv4.sin_addr.s_addr == rhs.Ipv4.sin_addr.s_addr;
+		}
+		return std::memcmp(&lhs.Ipv6.sin6_addr, &rhs.Ipv6.sin6_addr, sizeof(in6_addr)) == 0;
+	}
+
+	// one probe from start to finish, skipping the case if the machine won't let us send it
+	[[nodiscard]]
+	probe_result probe_once(probe_backend& backend, probe_key key, const SOCKADDR_INET& dest, std::chrono::milliseconds timeout = 1000ms)
+	{
+		std::promise<probe_result> done;
+		auto result = done.get_future();
+		probe(backend, key, dest, timeout, done);
+		WINMTR_REQUIRE(result.wait_for(timeout + 2s) == std::future_status::ready);
+		try {
+			return result.get();
+		}
+		catch (const std::system_error& e) {
+			const auto err = e.code().value();
+			if (err == EACCES || err == EPERM) {
+				WINMTR_SKIP("not allowed to open ICMP sockets, see net.ipv4.ping_group_range");
+			}
+			if (err == EAFNOSUPPORT || err == EADDRNOTAVAIL) {
+				WINMTR_SKIP("no loopback for this address family");
+			}
+			throw;
+		}
+	}
+
+	// a loopback socket of the given type bound to a port of its own, closed with the object
+	class loopback_socket final {
+		loopback_socket(const loopback_socket&) = delete;
+		loopback_socket& operator=(const loopback_socket&) = delete;
+	public:
+		explicit loopback_socket(int type) noexcept
+			:m_fd(::socket(AF_INET, type | SOCK_CLOEXEC, 0))
+		{
+			sockaddr_in local{ .sin_family = AF_INET, .sin_port = 0, .sin_addr = { htonl(INADDR_LOOPBACK) }, .sin_zero = {} };
+			socklen_t length = sizeof(local);
+			if (m_fd < 0 || ::bind(m_fd, reinterpret_cast<const sockaddr*>(&local), sizeof(local))
+				|| ::getsockname(m_fd, reinterpret_cast<sockaddr*>(&local), &length)) {
+				return;
+			}
+			m_port = ntohs(local.sin_port);
+		}
+		~loopback_socket() noexcept
+		{
+			if (m_fd >= 0) {
+				::close(m_fd);
+			}
+		}
+		[[nodiscard]] int fd() const noexcept { return m_fd; }
+		[[nodiscard]] std::uint16_t port() const noexcept { return m_port; }
+	private:
+		int m_fd;
+		std::uint16_t m_port = 0;
+	};
+
+	// a port nothing listens on, for as long as nobody else takes it in the meantime
+	[[nodiscard]]
+	std::uint16_t closed_port(int type) noexcept
+	{
+		return loopback_socket(type).port();
+	}
+
+	// what the backend reported against what the caller saw from co_await to resume, in microseconds
+	struct calibration final {
+		std::vector<std::int64_t> reported;
+		std::vector<std::int64_t> observed;
+		int failed = 0;
+	};
+
+	detached calibrate(probe_backend& backend, SOCKADDR_INET dest, int probes, calibration& result, std::promise<void>& done)
+	{
+		probe_key key{ .session = backend.new_session(), .ttl = 64 };
+		try {
+			for (int i = 0; i < probes; ++i) {
+				++key.sequence;
+				const auto sent = clock::now();
+				const auto answer = co_await backend.send(key, dest, PAYLOAD, 1000ms);
+				const auto observed = clock::now() - sent;
+				if (answer.status != probe_status::success) {
+					++result.failed;
+					continue;
+				}
+				result.reported.push_back(answer.round_trip_time.count());
+				result.observed.push_back(std::chrono::duration_cast<std::chrono::microseconds>(observed).count());
+			}
+			done.set_value();
+		}
+		catch (...) {
+			done.set_exception(std::current_exception());
+		}
+	}
+
+	[[nodiscard]]
+	calibration calibrate_loopback(int probes)
+	{
+		linux_icmp_backend backend;
+		calibration result;
+		std::promise<void> done;
+		auto finished = done.get_future();
+		result.reported.reserve(probes);
+		result.observed.reserve(probes);
+		calibrate(backend, address("127.0.0.1"), probes, result, done);
+		WINMTR_REQUIRE(finished.wait_for(probes * 10ms + 5s) == std::future_status::ready);
+		try {
+			finished.get();
+		}
+		catch (const std::system_error& e) {
+			if (e.code().value() == EACCES || e.code().value() == EPERM) {
+				WINMTR_SKIP("not allowed to open ICMP sockets, see net.ipv4.ping_group_range");
+			}
+			throw;
+		}
+		return result;
+	}
+
+	// RFC 1071, over the ICMP message alone, the identifier the kernel fills in is the same for all of them
+	[[nodiscard]]
+	std::uint16_t internet_checksum(std::span<const std::byte> message) noexcept
+	{
+		std::uint32_t sum = 0;
+		for (std::size_t i = 0; i < message.size(); i += 2) {
+			sum += std::to_integer<std::uint32_t>(message[i]) << 8;
+			if (i + 1 < message.size()) {
+				sum += std::to_integer<std::uint32_t>(message[i + 1]);
+			}
+		}
+		while (sum >> 16) {
+			sum = (sum & 0xffffu) + (sum >> 16);
+		}
+		return static_cast<std::uint16_t>(~sum);
+	}
+
+	[[nodiscard]]
+	std::uint16_t checksum_of(ADDRESS_FAMILY af, std::uint16_t sequence, std::uint16_t flow, std::span<const std::byte> payload)
+	{
+		std::vector<std::byte> packet;
+		write_echo_request(packet, af, sequence, flow, payload);
+		return internet_checksum(packet);
+	}
+
+	[[nodiscard]]
+	std::int64_t percentile(std::vector<std::int64_t> values, double rank)
+	{
+		if (values.empty()) {
+			return 0;
+		}
+		const auto at = values.begin() + static_cast<std::ptrdiff_t>(rank * static_cast<double>(values.size() - 1));
+		std::ranges::nth_element(values, at);
+		return *at;
+	}
+}
+
+WINMTR_TEST(linux_backend_echoes_loopback)
+{
+	linux_icmp_backend backend;
+	const auto dest = address("127.0.0.1");
+	const auto result = probe_once(backend, { .session = backend.new_session(), .ttl = 64, .sequence = 7 }, dest);
+	WINMTR_CHECK(result.error == 0);
+	WINMTR_CHECK(result.reply_count == 1);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(same_host(result.responder, dest));
+	WINMTR_CHECK(result.key.sequence == 7);
+	WINMTR_CHECK(result.round_trip_time < 1s);
+	WINMTR_CHECK(backend.probes_sent() == 1);
+}
+
+WINMTR_TEST(linux_backend_echoes_loopback_ipv6)
+{
+	linux_icmp_backend backend;
+	const auto dest = address("::1");
+	const auto result = probe_once(backend, { .session = backend.new_session(), .ttl = 64 }, dest);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(same_host(result.responder, dest));
+}
+
+WINMTR_TEST(linux_backend_sequences_many_in_flight)
+{
+	constexpr auto PROBES = 200;
+	// outlive the backend, the first result may skip the case while its I/O thread still sets the rest
+	std::array<std::promise<probe_result>, PROBES> done;
+	linux_icmp_backend backend;
+	const auto dest = address("127.0.0.1");
+	const auto session = backend.new_session();
+	for (int i = 0; i < PROBES; ++i) {
+		probe(backend, { .session = session, .ttl = 64, .sequence = static_cast<std::uint16_t>(i) }, dest, 2000ms, done[i]);
+	}
+	for (int i = 0; i < PROBES; ++i) {
+		auto result = done[i].get_future();
+		WINMTR_REQUIRE(result.wait_for(5s) == std::future_status::ready);
+		try {
+			const auto answer = result.get();
+			WINMTR_CHECK(answer.status == probe_status::success);
+			WINMTR_CHECK(answer.key.sequence == i);
+		}
+		catch (const std::system_error& e) {
+			if (e.code().value() == EACCES || e.code().value() == EPERM) {
+				WINMTR_SKIP("not allowed to open ICMP sockets, see net.ipv4.ping_group_range");
+			}
+			throw;
+		}
+	}
+}
+
+WINMTR_TEST(linux_backend_delay_waits)
+{
+	linux_icmp_backend backend;
+	std::promise<clock::time_point> done;
+	auto finished = done.get_future();
+	const auto started = clock::now();
+	sleep_on(backend, 50ms, done);
+	WINMTR_REQUIRE(finished.wait_for(2s) == std::future_status::ready);
+	WINMTR_CHECK(finished.get() - started >= 50ms);
+}
+
+WINMTR_TEST(linux_backend_shutdown_cancels_in_flight)
+{
+	// outlive the backend, its I/O thread sets them on the way out
+	std::promise<probe_result> probeDone;
+	std::promise<clock::time_point> delayDone;
+	auto probed = probeDone.get_future();
+	auto slept = delayDone.get_future();
+	auto backend = std::make_unique<linux_icmp_backend>();
+	probe(*backend, { .session = backend->new_session(), .ttl = 64 }, unanswered(), 5000ms, probeDone);
+	sleep_on(*backend, 1min, delayDone);
+	std::this_thread::sleep_for(100ms);
+	// something on the way may have answered or refused it already
+	const auto answered = probed.wait_for(0s) == std::future_status::ready;
+	const auto shutdown = clock::now();
+	backend.reset();
+	WINMTR_REQUIRE(probed.wait_for(0s) == std::future_status::ready);
+	WINMTR_REQUIRE(slept.wait_for(0s) == std::future_status::ready);
+	WINMTR_CHECK(slept.get() >= shutdown);
+	try {
+		(void)probed.get();
+		WINMTR_CHECK(answered);
+	}
+	catch (const std::system_error& e) {
+		const auto err = e.code().value();
+		WINMTR_CHECK(err == ECANCELED || err == EACCES || err == EPERM);
+	}
+}
+
+WINMTR_TEST(linux_backend_shutdown_cancels_queued)
+{
+	std::promise<probe_result> done;
+	auto result = done.get_future();
+	{
+		linux_icmp_backend backend;
+		// most likely still in the submit queue when the I/O thread is told to stop
+		probe(backend, { .session = backend.new_session(), .ttl = 64 }, unanswered(), 5000ms, done);
+	}
+	WINMTR_CHECK(result.wait_for(0s) == std::future_status::ready);
+}
+
+WINMTR_TEST(linux_backend_calibrates_on_loopback)
+{
+	const auto result = calibrate_loopback(2000);
+	WINMTR_CHECK(result.failed == 0);
+	WINMTR_REQUIRE(!result.reported.empty());
+	// loopback is well under a millisecond, and not rounded to one either
+	WINMTR_CHECK(percentile(result.reported, 0.5) < 1000);
+	WINMTR_CHECK(std::ranges::any_of(result.reported, [](std::int64_t rtt) noexcept { return rtt % 1000 != 0; }));
+	// the backend times less of the round trip than the caller does, never more
+	WINMTR_CHECK(percentile(result.reported, 0.5) <= percentile(result.observed, 0.5));
+	WINMTR_CHECK(percentile(result.reported, 0.99) <= percentile(result.observed, 0.99));
+}
+
+WINMTR_BENCH(linux_backend_measurement_overhead)
+{
+	const auto result = calibrate_loopback(20000);
+	std::vector<std::int64_t> overhead(result.reported.size());
+	for (std::size_t i = 0; i < overhead.size(); ++i) {
+		overhead[i] = result.observed[i] - result.reported[i];
+	}
+	winmtr::test::report("reported round trip, p50", static_cast<double>(percentile(result.reported, 0.5)), "us");
+	winmtr::test::report("reported round trip, p99", static_cast<double>(percentile(result.reported, 0.99)), "us");
+	winmtr::test::report("co_await to resume, p50", static_cast<double>(percentile(result.observed, 0.5)), "us");
+	winmtr::test::report("co_await to resume, p99", static_cast<double>(percentile(result.observed, 0.99)), "us");
+	winmtr::test::report("overhead outside the measurement, p50", static_cast<double>(percentile(overhead, 0.5)), "us");
+	winmtr::test::report("overhead outside the measurement, p99", static_cast<double>(percentile(overhead, 0.99)), "us");
+	WINMTR_CHECK(result.failed == 0);
+}
+
+WINMTR_TEST(linux_backend_udp_port_unreachable_is_an_answer)
+{
+	linux_icmp_backend backend;
+	const auto port = closed_port(SOCK_DGRAM);
+	WINMTR_REQUIRE(port != 0);
+	const auto dest = address("127.0.0.1", port);
+	const auto result = probe_once(backend, { .session = backend.new_session(), .ttl = 64, .protocol = probe_protocol::udp }, dest);
+	// only the destination says the port is closed, so that is as good as an echo reply
+	WINMTR_CHECK(result.error == 0);
+	WINMTR_CHECK(result.reply_count == 1);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(same_host(result.responder, dest));
+	WINMTR_CHECK(result.round_trip_time < 1s);
+}
+
+WINMTR_TEST(linux_backend_udp_reply_is_an_answer)
+{
+	linux_icmp_backend backend;
+	const loopback_socket service(SOCK_DGRAM);
+	WINMTR_REQUIRE(service.port() != 0);
+	// echoes the one datagram it gets back to where it came from
+	std::thread echo([&service] {
+		std::array<std::byte, 512> buffer;
+		sockaddr_storage from{};
+		socklen_t length = sizeof(from);
+		const auto received = ::recvfrom(service.fd(), buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&from), &length);
+		if (received >= 0) {
+			(void)::sendto(service.fd(), buffer.data(), static_cast<std::size_t>(received), 0, reinterpret_cast<const sockaddr*>(&from), length);
+		}
+	});
+	const auto dest = address("127.0.0.1", service.port());
+	std::promise<probe_result> done;
+	auto result = done.get_future();
+	probe(backend, { .session = backend.new_session(), .ttl = 64, .protocol = probe_protocol::udp }, dest, 1000ms, done);
+	const auto ready = result.wait_for(3s) == std::future_status::ready;
+	if (!ready) {
+		// let the echo thread go
+		::shutdown(service.fd(), SHUT_RDWR);
+	}
+	echo.join();
+	WINMTR_REQUIRE(ready);
+	const auto answer = result.get();
+	WINMTR_CHECK(answer.status == probe_status::success);
+	WINMTR_CHECK(same_host(answer.responder, dest));
+}
+
+WINMTR_TEST(linux_backend_tcp_reset_is_an_answer)
+{
+	linux_icmp_backend backend;
+	const auto port = closed_port(SOCK_STREAM);
+	WINMTR_REQUIRE(port != 0);
+	const auto dest = address("127.0.0.1", port);
+	const auto result = probe_once(backend, { .session = backend.new_session(), .ttl = 64, .protocol = probe_protocol::tcp }, dest);
+	// the RST comes from the destination, the same as a SYN-ACK would
+	WINMTR_CHECK(result.error == 0);
+	WINMTR_CHECK(result.reply_count == 1);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(same_host(result.responder, dest));
+	WINMTR_CHECK(result.round_trip_time < 1s);
+}
+
+WINMTR_TEST(linux_backend_tcp_syn_ack_is_an_answer)
+{
+	linux_icmp_backend backend;
+	const loopback_socket listener(SOCK_STREAM);
+	WINMTR_REQUIRE(listener.port() != 0);
+	WINMTR_REQUIRE(::listen(listener.fd(), 4) == 0);
+	const auto dest = address("127.0.0.1", listener.port());
+	const auto result = probe_once(backend, { .session = backend.new_session(), .ttl = 64, .protocol = probe_protocol::tcp }, dest);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(same_host(result.responder, dest));
+}
+
+WINMTR_TEST(linux_backend_sequences_udp_and_tcp_in_flight)
+{
+	constexpr auto PROBES = 50;
+	// outlive the backend, a failed check may end the case while its I/O thread still sets the rest
+	std::array<std::promise<probe_result>, PROBES * 2> done;
+	linux_icmp_backend backend;
+	const auto udp = address("127.0.0.1", closed_port(SOCK_DGRAM));
+	const auto tcp = address("127.0.0.1", closed_port(SOCK_STREAM));
+	const auto session = backend.new_session();
+	for (int i = 0; i < PROBES; ++i) {
+		const auto sequence = static_cast<std::uint16_t>(i);
+		// every probe a flow and so a source port of its own
+		probe(backend, { .session = session, .ttl = 64, .sequence = sequence, .flow = sequence, .protocol = probe_protocol::udp }, udp, 2000ms, done[i * 2]);
+		probe(backend, { .session = session, .ttl = 64, .sequence = sequence, .flow = static_cast<std::uint16_t>(sequence + PROBES), .protocol = probe_protocol::tcp }, tcp, 2000ms, done[i * 2 + 1]);
+	}
+	for (auto& promise : done) {
+		auto result = promise.get_future();
+		WINMTR_REQUIRE(result.wait_for(5s) == std::future_status::ready);
+		const auto answer = result.get();
+		WINMTR_CHECK(answer.status == probe_status::success);
+	}
+	WINMTR_CHECK(backend.probes_sent() == PROBES * 2);
+}
+
+WINMTR_TEST(linux_backend_echo_request_carries_the_sequence_and_payload)
+{
+	const std::array<std::byte, 6> payload{ std::byte{ 1 }, std::byte{ 2 }, std::byte{ 3 }, std::byte{ 4 }, std::byte{ 5 }, std::byte{ 6 } };
+	std::vector<std::byte> packet;
+	write_echo_request(packet, AF_INET, 0x1234, 7, payload);
+	WINMTR_REQUIRE(packet.size() == 8 + payload.size());
+	WINMTR_CHECK(std::to_integer<int>(packet[0]) == ICMP_ECHO);
+	WINMTR_CHECK(std::to_integer<int>(packet[6]) == 0x12);
+	WINMTR_CHECK(std::to_integer<int>(packet[7]) == 0x34);
+	// the first two bytes are the flow's, the rest is left alone
+	WINMTR_CHECK(std::equal(payload.begin() + 2, payload.end(), packet.begin() + 10));
+	write_echo_request(packet, AF_INET6, 0x1234, 7, payload);
+	WINMTR_CHECK(std::to_integer<int>(packet[0]) == ICMP6_ECHO_REQUEST);
+}
+
+WINMTR_TEST(linux_backend_echo_checksum_holds_still_for_a_flow)
+{
+	// whatever the sequence, the ones' complement sum comes out where the flow puts it
+	const std::array<std::byte, 33> odd{};
+	for (const auto af : { AF_INET, AF_INET6 }) {
+		for (const std::uint16_t flow : { 0, 1, 0x7777, 0xfffe, 0xffff }) {
+			const auto expected = checksum_of(static_cast<ADDRESS_FAMILY>(af), 0, flow, PAYLOAD);
+			auto held = true;
+			for (std::uint32_t sequence = 0; sequence <= 0xffff; ++sequence) {
+				held = held && checksum_of(static_cast<ADDRESS_FAMILY>(af), static_cast<std::uint16_t>(sequence), flow, PAYLOAD) == expected;
+			}
+			WINMTR_CHECK(held);
+			WINMTR_CHECK(checksum_of(static_cast<ADDRESS_FAMILY>(af), 0x4321, flow, odd) == checksum_of(static_cast<ADDRESS_FAMILY>(af), 9, flow, odd));
+		}
+	}
+	// and another flow hashes elsewhere
+	WINMTR_CHECK(checksum_of(AF_INET, 5, 1, PAYLOAD) != checksum_of(AF_INET, 5, 2, PAYLOAD));
+	WINMTR_CHECK(checksum_of(AF_INET, 5, 1, PAYLOAD) != checksum_of(AF_INET, 6, 2, PAYLOAD));
+}
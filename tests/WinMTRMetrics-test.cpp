@@ -0,0 +1,278 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRMetrics-test.cpp
+//
+//
+// DESCRIPTION:
+//   The OpenMetrics endpoint scraped over loopback while simulated traces
+//   run, and the benchmark of a scrape of 1,000 of them.
+//
+// NOTES:
+//    The traces only move when the test runs their backends, so what a
+//    scrape reads is known exactly. The client is plain blocking Winsock,
+//    one connection per scrape as Prometheus does it.
+//
+//*****************************************************************************
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "WinMTRTest.h"
+import <winrt/Windows.Foundation.h>;
+import WinMTR.Metrics;
+import WinMTR.Net;
+import WinMTR.ProbeBackend.Simulated;
+import WinMTR.Test.Options;
+import WinMTRSNetHost;
+
+using namespace std::literals;
+
+namespace {
+	// a gateway, a lossy hop and the destination
+	constexpr std::string_view TOPOLOGY = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.1 latency=normal:10:2 loss=0.5
+		hop 203.0.113.9 latency=fixed:20
+	)";
+	constexpr auto WARM_UP = 1min;
+	constexpr auto BENCH_SESSIONS = 1000;
+	constexpr auto BENCH_SCRAPES = 200;
+
+	// Traces that stay listed in WinMTRNet::running() until it goes, each on
+	// a simulated network of its own. Only moves in run_for().
+	class simulated_traces final {
+		simulated_traces(const simulated_traces&) = delete;
+		simulated_traces& operator=(const simulated_traces&) = delete;
+	public:
+		explicit simulated_traces(int count)
+		{
+			const auto topology = sim_topology::parse(TOPOLOGY);
+			m_traces.reserve(count);
+			for (int i = 0; i < count; ++i) {
+				auto backend = std::make_shared<simulated_backend>(topology);
+				auto net = std::make_shared<WinMTRNet>(&m_options, backend);
+				auto tracer = net->DoTrace(m_stop.get_token(), { topology.destination() }, backend->now());
+				m_traces.push_back({ std::move(backend), std::move(net), std::move(tracer) });
+			}
+		}
+		~simulated_traces() noexcept
+		{
+			m_stop.request_stop();
+			// long enough for every loop to come out of its wait and see the stop
+			run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		}
+
+		void run_for(std::chrono::milliseconds duration)
+		{
+			for (auto& trace : m_traces) {
+				trace.backend->run_for(duration);
+			}
+		}
+		[[nodiscard]]
+		const WinMTRNet& net(std::size_t i) const noexcept
+		{
+			return *m_traces[i].net;
+		}
+	private:
+		struct trace final {
+			std::shared_ptr<simulated_backend> backend;
+			std::shared_ptr<WinMTRNet> net;
+			winrt::Windows::Foundation::IAsyncAction tracer;
+		};
+		const winmtr::test::options m_options;
+		std::stop_source m_stop;
+		std::vector<trace> m_traces;
+	};
+
+	// one request on a connection of its own, the whole response in response
+	[[nodiscard]]
+	bool request(const SOCKADDR_INET& server, std::string_view text, std::string& response)
+	{
+		response.clear();
+		const auto client = socket(server.si_family, SOCK_STREAM, IPPROTO_TCP);
+		if (client == INVALID_SOCKET) {
+			return false;
+		}
+		const DWORD timeout = 5000;
+		(void)setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+		const auto length = server.si_family == AF_INET6 ? sizeof(server.Ipv6) : sizeof(server.Ipv4);
+		bool done = connect(client, reinterpret_cast<const sockaddr*>(&server), static_cast<int>(length)) != SOCKET_ERROR
+			&& send(client, text.data(), static_cast<int>(text.size()), 0) == static_cast<int>(text.size());
+		// the server closes once it has said all it has to say
+		while (done) {
+			std::array<char, 16384> buffer;
+			const auto received = recv(client, buffer.data(), static_cast<int>(buffer.size()), 0);
+			if (received <= 0) {
+				done = received == 0;
+				break;
+			}
+			response.append(buffer.data(), static_cast<std::size_t>(received));
+		}
+		closesocket(client);
+		return done;
+	}
+
+	[[nodiscard]]
+	std::string_view status_of(std::string_view response) noexcept
+	{
+		return response.substr(0, response.find("\r\n"sv));
+	}
+
+	[[nodiscard]]
+	std::string_view body_of(std::string_view response) noexcept
+	{
+		const auto headers = response.find("\r\n\r\n"sv);
+		return headers == std::string_view::npos ? std::string_view{} : response.substr(headers + 4);
+	}
+
+	[[nodiscard]]
+	bool contains(std::string_view text, std::string_view what) noexcept
+	{
+		return text.find(what) != std::string_view::npos;
+	}
+
+	constexpr auto SCRAPE = "GET /metrics HTTP/1.1\r\nHost: localhost\r\nAccept: application/openmetrics-text\r\n\r\n"sv;
+}
+
+WINMTR_TEST(metrics_endpoint_reads_address_and_port)
+{
+	const auto port_only = metrics_server::endpoint(L"9464");
+	WINMTR_REQUIRE(port_only);
+	WINMTR_CHECK(port_only->si_family == AF_INET);
+	WINMTR_CHECK(port_only->Ipv4.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+	WINMTR_CHECK(port_only->Ipv4.sin_port == htons(9464));
+
+	const auto any = metrics_server::endpoint(L"0.0.0.0:80");
+	WINMTR_REQUIRE(any);
+	WINMTR_CHECK(any->Ipv4.sin_addr.s_addr == htonl(INADDR_ANY));
+	WINMTR_CHECK(any->Ipv4.sin_port == htons(80));
+
+	const auto v6 = metrics_server::endpoint(L"[::1]:0");
+	WINMTR_REQUIRE(v6);
+	WINMTR_CHECK(v6->si_family == AF_INET6);
+	WINMTR_CHECK(v6->Ipv6.sin6_port == 0);
+
+	WINMTR_CHECK(!metrics_server::endpoint(L""));
+	WINMTR_CHECK(!metrics_server::endpoint(L"65536"));
+	WINMTR_CHECK(!metrics_server::endpoint(L"http"));
+	WINMTR_CHECK(!metrics_server::endpoint(L"example.com:9464"));
+}
+
+WINMTR_TEST(metrics_server_answers_scrapes_on_loopback)
+{
+	simulated_traces traces(2);
+	traces.run_for(WARM_UP);
+	const auto address = metrics_server::endpoint(L"127.0.0.1:0");
+	WINMTR_REQUIRE(address);
+	const auto server = metrics_server::open(*address);
+	WINMTR_REQUIRE(server);
+	WINMTR_REQUIRE(server->address().Ipv4.sin_port != 0);
+
+	std::string response;
+	WINMTR_REQUIRE(request(server->address(), SCRAPE, response));
+	WINMTR_CHECK(status_of(response) == "HTTP/1.1 200 OK"sv);
+	WINMTR_CHECK(contains(response, "\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"sv));
+	const auto body = body_of(response);
+	WINMTR_CHECK(contains(response, "\r\nContent-Length: "s + std::to_string(body.size()) + "\r\n"));
+	WINMTR_CHECK(body.starts_with("# TYPE winmtr_sessions gauge\n"sv));
+	WINMTR_CHECK(body.ends_with("\n# EOF\n"sv));
+	WINMTR_CHECK(contains(body, "\nwinmtr_sessions 2\n"sv));
+
+	// the traces stood still while it was scraped, the counters are what they hold
+	std::vector<WinMTRNet::running_trace> running;
+	WinMTRNet::running(running);
+	WINMTR_REQUIRE(running.size() == 2);
+	for (const auto& trace : running) {
+		const auto labels = "{session=\""s + std::to_string(trace.session) + "\",target=\"203.0.113.9\",ttl=\"";
+		for (const auto& hop : trace.net->getCurrentState()) {
+			const auto row = labels + std::to_string(hop.ttl) + "\",path=\"" + std::to_string(hop.path) + "\"}";
+			WINMTR_CHECK(contains(body, "\nwinmtr_probes_sent_total" + row + " " + std::to_string(hop.xmit) + "\n"));
+			WINMTR_CHECK(contains(body, "\nwinmtr_probes_received_total" + row + " " + std::to_string(hop.returned) + "\n"));
+			WINMTR_CHECK(contains(body, "\nwinmtr_rtt_seconds_count" + row + " " + std::to_string(hop.returned) + "\n"));
+		}
+		WINMTR_CHECK(contains(body, "\nwinmtr_rtt_seconds" + labels + "1\",path=\"0\",quantile=\"0.99\"} "));
+		WINMTR_CHECK(contains(body, "\nwinmtr_responder_info" + labels + "3\",path=\"0\",responder=\"203.0.113.9\"} 1\n"));
+	}
+
+	// anything but a GET of /metrics gets no scrape
+	WINMTR_REQUIRE(request(server->address(), "GET /other HTTP/1.1\r\n\r\n"sv, response));
+	WINMTR_CHECK(status_of(response) == "HTTP/1.1 404 Not Found"sv);
+	WINMTR_REQUIRE(request(server->address(), "POST /metrics HTTP/1.1\r\nContent-Length: 0\r\n\r\n"sv, response));
+	WINMTR_CHECK(status_of(response) == "HTTP/1.1 405 Method Not Allowed"sv);
+	WINMTR_CHECK(contains(response, "\r\nAllow: GET\r\n"sv));
+
+	const auto stats = server->stats();
+	WINMTR_CHECK(stats.scrapes == 1);
+	WINMTR_CHECK(stats.refused == 2);
+}
+
+WINMTR_BENCH(metrics_scrape_latency_at_1000_sessions)
+{
+	simulated_traces traces(BENCH_SESSIONS);
+	traces.run_for(WARM_UP);
+	const auto address = metrics_server::endpoint(L"127.0.0.1:0");
+	WINMTR_REQUIRE(address);
+	const auto server = metrics_server::open(*address);
+	WINMTR_REQUIRE(server);
+
+	// the first one grows the server's buffers and the client's to what a scrape takes
+	std::string response;
+	WINMTR_REQUIRE(request(server->address(), SCRAPE, response));
+	WINMTR_REQUIRE(status_of(response) == "HTTP/1.1 200 OK"sv);
+	const auto bytes = body_of(response).size();
+	WINMTR_CHECK(contains(response, "\nwinmtr_sessions "s + std::to_string(BENCH_SESSIONS) + "\n"));
+
+	std::vector<std::chrono::steady_clock::duration> latencies(BENCH_SCRAPES);
+	auto serverTime = std::chrono::microseconds::zero();
+	const auto allocationsBefore = winmtr::test::allocations();
+	for (auto& latency : latencies) {
+		const auto started = std::chrono::steady_clock::now();
+		WINMTR_REQUIRE(request(server->address(), SCRAPE, response));
+		latency = std::chrono::steady_clock::now() - started;
+		serverTime += server->stats().last_scrape;
+	}
+	const auto allocations = winmtr::test::allocations() - allocationsBefore;
+	std::ranges::sort(latencies);
+
+	winmtr::test::report("sessions", BENCH_SESSIONS, "sessions");
+	winmtr::test::report("rows", static_cast<double>(traces.net(0).getCurrentState().size()) * BENCH_SESSIONS, "rows");
+	winmtr::test::report("scrape size", static_cast<double>(bytes) / 1024, "KiB");
+	winmtr::test::report("snapshot and render, on the server", winmtr::test::seconds(serverTime) * 1e3 / BENCH_SCRAPES, "ms");
+	winmtr::test::report("scrape over loopback, median", winmtr::test::seconds(latencies[latencies.size() / 2]) * 1e3, "ms");
+	winmtr::test::report("scrape over loopback, p99", winmtr::test::seconds(latencies[latencies.size() * 99 / 100]) * 1e3, "ms");
+	winmtr::test::report("scrape over loopback, slowest", winmtr::test::seconds(latencies.back()) * 1e3, "ms");
+	winmtr::test::report("allocations per scrape, both ends", static_cast<double>(allocations) / BENCH_SCRAPES, "allocations");
+	WINMTR_CHECK(server->stats().scrapes == BENCH_SCRAPES + 1);
+	WINMTR_CHECK(server->stats().refused == 0);
+}
@@ -0,0 +1,333 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRNameCache-test.cpp
+//
+//
+// DESCRIPTION:
+//   The name cache against a resolver of its own making: how long answers
+//   and the lack of them are kept, what goes when it is full, lookups of one
+//   address sharing a query, its counters, and saving and loading it.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.NameCache;
+import WinMTRIPUtils;
+
+using namespace std::literals;
+
+namespace {
+	constexpr auto SHORT_TTL = 100ms;
+	constexpr auto LOOKUP_THREADS = 8;
+
+	// runs until its first suspension on the calling thread, the rest on whichever completes the query
+	struct detached final {
+		struct promise_type final {
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	detached resolve(name_cache& cache, SOCKADDR_INET addr, std::promise<cached_name>& done)
+	{
+		done.set_value(co_await cache.lookup(addr));
+	}
+
+	using winmtr::test::address;
+
+	//*****************************************************************************
+	// CLASS:  fake_resolver
+	//
+	// Answers what it was told to on the spot, from inside start(), and
+	// leaves anything else in flight for the test to complete.
+	//*****************************************************************************
+	class fake_resolver final : public ptr_resolver {
+		struct answer final {
+			SOCKADDR_INET addr;
+			cached_name name;
+			name_cache::clock::duration ttl;
+		};
+	public:
+		void answer_with(const SOCKADDR_INET& addr, cached_name name, name_cache::clock::duration ttl)
+		{
+			std::scoped_lock lock(m_mutex);
+			m_answers.push_back({ addr, std::move(name), ttl });
+		}
+
+		void start(name_cache& cache, const SOCKADDR_INET& addr) noexcept override
+		{
+			m_started.fetch_add(1, std::memory_order_relaxed);
+			std::unique_lock lock(m_mutex);
+			for (const auto& known : m_answers) {
+				if (same_address(known.addr, addr)) {
+					const auto name = known.name;
+					const auto ttl = known.ttl;
+					lock.unlock();
+					cache.complete(addr, name, ttl);
+					return;
+				}
+			}
+		}
+
+		[[nodiscard]]
+		unsigned started() const noexcept
+		{
+			return m_started.load(std::memory_order_relaxed);
+		}
+	private:
+		std::mutex m_mutex;
+		std::vector<answer> m_answers;
+		std::atomic_uint m_started{ 0 };
+	};
+
+	// the cache keeps the resolver, the test keeps a look at it
+	struct faked final {
+		fake_resolver* resolver;
+		name_cache cache;
+
+		explicit faked(std::size_t capacity = NAME_CACHE_CAPACITY)
+			:faked(std::make_unique<fake_resolver>(), capacity)
+		{
+		}
+	private:
+		faked(std::unique_ptr<fake_resolver> owned, std::size_t capacity)
+			:resolver(owned.get())
+			, cache(std::move(owned), capacity)
+		{
+		}
+	};
+
+	// for lookups the cache or the resolver answers before they would suspend
+	[[nodiscard]]
+	cached_name lookup_now(name_cache& cache, const SOCKADDR_INET& addr)
+	{
+		std::promise<cached_name> done;
+		auto answer = done.get_future();
+		resolve(cache, addr, done);
+		WINMTR_REQUIRE(answer.wait_for(0s) == std::future_status::ready);
+		return answer.get();
+	}
+
+	[[nodiscard]]
+	cached_name named(const wchar_t* name)
+	{
+		return std::make_shared<const std::wstring>(name);
+	}
+}
+
+WINMTR_TEST(name_cache_expires_positive_and_negative_answers)
+{
+	faked fake;
+	const auto named_host = address("192.0.2.1");
+	const auto nameless = address("2001:db8::1");
+	fake.resolver->answer_with(named_host, named(L"router.example.net"), SHORT_TTL);
+	fake.resolver->answer_with(nameless, nullptr, SHORT_TTL);
+
+	const auto name = lookup_now(fake.cache, named_host);
+	WINMTR_REQUIRE(name);
+	WINMTR_CHECK(*name == L"router.example.net");
+	WINMTR_CHECK(!lookup_now(fake.cache, nameless));
+	WINMTR_CHECK(fake.resolver->started() == 2);
+
+	// both kept, the name and that there is none
+	WINMTR_CHECK(lookup_now(fake.cache, named_host) == name);
+	WINMTR_CHECK(!lookup_now(fake.cache, nameless));
+	WINMTR_CHECK(fake.resolver->started() == 2);
+
+	std::this_thread::sleep_for(SHORT_TTL * 2);
+	WINMTR_CHECK(*lookup_now(fake.cache, named_host) == L"router.example.net");
+	WINMTR_CHECK(!lookup_now(fake.cache, nameless));
+	WINMTR_CHECK(fake.resolver->started() == 4);
+	// asked again in place, not as new entries
+	WINMTR_CHECK(fake.cache.stats().entries == 2);
+}
+
+WINMTR_TEST(name_cache_counts_hits_and_misses)
+{
+	faked fake;
+	const auto named_host = address("192.0.2.1");
+	const auto nameless = address("192.0.2.2");
+	fake.resolver->answer_with(named_host, named(L"router.example.net"), 1h);
+	fake.resolver->answer_with(nameless, nullptr, 1h);
+
+	WINMTR_CHECK(fake.cache.stats().hit_rate() == 0.0);
+	(void)lookup_now(fake.cache, named_host);
+	(void)lookup_now(fake.cache, nameless);
+	for (int i = 0; i < 3; ++i) {
+		(void)lookup_now(fake.cache, named_host);
+	}
+	(void)lookup_now(fake.cache, nameless);
+
+	const auto stats = fake.cache.stats();
+	WINMTR_CHECK(stats.misses == 2);
+	WINMTR_CHECK(stats.hits == 4);
+	WINMTR_CHECK(stats.negative_hits == 1);
+	WINMTR_CHECK(stats.joined == 0);
+	WINMTR_CHECK(stats.evictions == 0);
+	WINMTR_CHECK(stats.entries == 2);
+	WINMTR_CHECK(stats.hit_rate() == 4.0 / 6.0);
+}
+
+WINMTR_TEST(name_cache_evicts_the_least_recently_used)
+{
+	constexpr std::size_t CAPACITY = 4;
+	faked fake(CAPACITY);
+	std::array<SOCKADDR_INET, CAPACITY + 1> hosts;
+	for (std::size_t i = 0; i < hosts.size(); ++i) {
+		hosts[i] = address(("192.0.2." + std::to_string(i + 1)).c_str());
+		fake.resolver->answer_with(hosts[i], named((L"hop" + std::to_wstring(i + 1)).c_str()), 1h);
+	}
+	for (std::size_t i = 0; i < CAPACITY; ++i) {
+		(void)lookup_now(fake.cache, hosts[i]);
+	}
+	// the first is used again, so the second is now the oldest
+	(void)lookup_now(fake.cache, hosts[0]);
+	(void)lookup_now(fake.cache, hosts[CAPACITY]);
+	auto stats = fake.cache.stats();
+	WINMTR_CHECK(stats.evictions == 1);
+	WINMTR_CHECK(stats.entries == CAPACITY);
+	WINMTR_CHECK(fake.resolver->started() == CAPACITY + 1);
+
+	WINMTR_CHECK(*lookup_now(fake.cache, hosts[0]) == L"hop1");
+	WINMTR_CHECK(fake.resolver->started() == CAPACITY + 1);
+	// gone, so it takes a query of its own, and the third goes in its place
+	WINMTR_CHECK(*lookup_now(fake.cache, hosts[1]) == L"hop2");
+	WINMTR_CHECK(fake.resolver->started() == CAPACITY + 2);
+	stats = fake.cache.stats();
+	WINMTR_CHECK(stats.evictions == 2);
+	WINMTR_CHECK(stats.entries == CAPACITY);
+	(void)lookup_now(fake.cache, hosts[2]);
+	WINMTR_CHECK(fake.resolver->started() == CAPACITY + 3);
+}
+
+WINMTR_TEST(name_cache_joins_lookups_of_one_address)
+{
+	faked fake;
+	const auto addr = address("2001:db8::7");
+	std::array<std::promise<cached_name>, LOOKUP_THREADS> done;
+	std::atomic_int ready{ 0 };
+	{
+		std::vector<std::jthread> threads;
+		for (auto& answer : done) {
+			threads.emplace_back([&, promise = &answer] {
+				// all of them at once, as far as that goes
+				ready.fetch_add(1);
+				while (ready.load() < LOOKUP_THREADS) {
+					std::this_thread::yield();
+				}
+				resolve(fake.cache, addr, *promise);
+			});
+		}
+	}
+	// every one of them waits on the one query
+	auto stats = fake.cache.stats();
+	WINMTR_CHECK(fake.resolver->started() == 1);
+	WINMTR_CHECK(stats.misses == 1);
+	WINMTR_CHECK(stats.joined == LOOKUP_THREADS - 1);
+	WINMTR_CHECK(stats.hit_rate() == static_cast<double>(LOOKUP_THREADS - 1) / LOOKUP_THREADS);
+	std::vector<std::future<cached_name>> answers;
+	for (auto& answer : done) {
+		answers.push_back(answer.get_future());
+		WINMTR_CHECK(answers.back().wait_for(0s) == std::future_status::timeout);
+	}
+
+	const auto name = named(L"shared.example.net");
+	fake.cache.complete(addr, name, 1h);
+	for (auto& answer : answers) {
+		WINMTR_REQUIRE(answer.wait_for(0s) == std::future_status::ready);
+		WINMTR_CHECK(answer.get() == name);
+	}
+	WINMTR_CHECK(lookup_now(fake.cache, addr) == name);
+	WINMTR_CHECK(fake.resolver->started() == 1);
+}
+
+WINMTR_TEST(name_cache_saves_and_loads_what_has_not_expired)
+{
+	const winmtr::test::scratch_path file("WinMTRNameCache-test.bin");
+	const auto named_host = address("192.0.2.1");
+	const auto nameless = address("2001:db8::1");
+	const auto expired = address("192.0.2.3");
+	{
+		faked fake;
+		fake.resolver->answer_with(named_host, named(L"router.example.net"), 1h);
+		fake.resolver->answer_with(nameless, nullptr, 1h);
+		fake.resolver->answer_with(expired, named(L"gone.example.net"), 1ms);
+		(void)lookup_now(fake.cache, named_host);
+		(void)lookup_now(fake.cache, nameless);
+		(void)lookup_now(fake.cache, expired);
+		std::this_thread::sleep_for(10ms);
+		WINMTR_REQUIRE(fake.cache.save(file.path()));
+	}
+
+	faked fake;
+	WINMTR_REQUIRE(fake.cache.load(file.path()));
+	WINMTR_CHECK(fake.cache.stats().entries == 2);
+	const auto name = lookup_now(fake.cache, named_host);
+	WINMTR_REQUIRE(name);
+	WINMTR_CHECK(*name == L"router.example.net");
+	WINMTR_CHECK(!lookup_now(fake.cache, nameless));
+	WINMTR_CHECK(fake.resolver->started() == 0);
+	const auto stats = fake.cache.stats();
+	WINMTR_CHECK(stats.hits == 2);
+	WINMTR_CHECK(stats.negative_hits == 1);
+
+	// left out of the file, so it is asked for again
+	fake.resolver->answer_with(expired, named(L"back.example.net"), 1h);
+	WINMTR_CHECK(*lookup_now(fake.cache, expired) == L"back.example.net");
+	WINMTR_CHECK(fake.resolver->started() == 1);
+}
+
+WINMTR_TEST(name_cache_rejects_what_it_did_not_save)
+{
+	const winmtr::test::scratch_path file("WinMTRNameCache-test.txt");
+	faked fake;
+	WINMTR_CHECK(!fake.cache.load(file.path()));
+	std::ofstream(file.path(), std::ios::binary) << "not a name cache, too short to tell";
+	WINMTR_CHECK(!fake.cache.load(file.path()));
+	WINMTR_CHECK(fake.cache.stats().entries == 0);
+}
@@ -0,0 +1,276 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRNet-test.cpp
+//
+//
+// DESCRIPTION:
+//   What WinMTRNet makes of a hop's round trips: the mean and standard
+//   deviation, the RFC 3550 jitter and the moving average, against values
+//   worked out by hand. And the window of recent probes getWindowAt looks
+//   back over.
+//
+// NOTES:
+//    The round trips come from a capture written for the case and replayed,
+//    which counts them with the same code as a live trace, in the order
+//    they were written. The windows are of a simulated trace, they are
+//    taken on the backend's clock. An IPv6 trace is replayed with the names
+//    it was written with, a capture keeps no scopes to match them by.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stop_token>
+#include <string_view>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Capture;
+import WinMTR.EventLog;
+import WinMTR.Net;
+import WinMTR.ProbeBackend.Simulated;
+import WinMTR.Test.Options;
+import WinMTRIPUtils;
+import WinMTRSNetHost;
+
+using namespace std::literals;
+
+namespace {
+	// the replay only needs a backend to hand the WinMTRNet, nothing is sent
+	constexpr std::string_view TOPOLOGY = R"(
+		seed 7
+		hop 203.0.113.9 latency=fixed:1
+	)";
+
+	// The row of a one hop trace whose destination answered with each of
+	// round_trips in turn, a timeout where there is none.
+	[[nodiscard]]
+	s_nethost counted(const std::vector<std::optional<std::chrono::microseconds>>& round_trips, double ewmaWeight = 0.25)
+	{
+		const winmtr::test::scratch_path file("winmtr-net-stats.cap");
+		SOCKADDR_INET destination{};
+		destination.Ipv4.sin_family = AF_INET;
+		destination.Ipv4.sin_addr.s_addr = htonl(0xCB007109u);
+		{
+			const auto writer = capture_writer::open(file.path());
+			WINMTR_REQUIRE(writer);
+			const auto base = probe_backend::clock::now();
+			WINMTR_REQUIRE(writer->trace(1, base, destination, 1));
+			auto sent = base;
+			for (const auto& round_trip : round_trips) {
+				sent += 1s;
+				probe_event event{ .time = sent, .session = 1, .ttl = 1 };
+				if (round_trip) {
+					event.responder = destination;
+					event.round_trip_time = *round_trip;
+					event.status = probe_status::success;
+				}
+				WINMTR_REQUIRE(writer->probe(event));
+			}
+		}
+		const auto capture = capture_file::open(file.path());
+		WINMTR_REQUIRE(capture);
+		const auto traces = capture->traces();
+		WINMTR_REQUIRE(traces.size() == 1);
+
+		winmtr::test::options options;
+		options.ewmaWeight = ewmaWeight;
+		const auto net = std::make_shared<WinMTRNet>(&options, std::make_shared<simulated_backend>(sim_topology::parse(TOPOLOGY)));
+		net->Replay(*capture, traces.front());
+		const auto state = net->getCurrentState();
+		WINMTR_REQUIRE(state.size() == 1);
+		return state.front();
+	}
+
+	// a one hop trace of TOPOLOGY run for duration with historyKiB of history, still running
+	struct live_trace final {
+		std::shared_ptr<simulated_backend> backend;
+		std::shared_ptr<WinMTRNet> net;
+		std::stop_source stop;
+		trace_action tracer{ nullptr };
+
+		live_trace(const winmtr::test::options& options, std::chrono::seconds duration)
+			:backend(std::make_shared<simulated_backend>(sim_topology::parse(TOPOLOGY)))
+			, net(std::make_shared<WinMTRNet>(&options, backend))
+		{
+			tracer = net->DoTrace(stop.get_token(), { sim_topology::parse(TOPOLOGY).destination() }, backend->now());
+			backend->run_for(duration);
+		}
+		~live_trace()
+		{
+			stop.request_stop();
+			backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		}
+	};
+
+	[[nodiscard]]
+	bool near(double value, double expected) noexcept
+	{
+		return std::abs(value - expected) < 1e-6;
+	}
+
+	[[nodiscard]]
+	SOCKADDR_INET ipv6(const char* text, std::uint32_t scope) noexcept
+	{
+		auto addr = winmtr::test::address(text);
+		WINMTR_CHECK(addr.si_family == AF_INET6);
+		addr.Ipv6.sin6_scope_id = scope;
+		return addr;
+	}
+
+	// 10, 20, 30 and 20 ms
+	const std::vector<std::optional<std::chrono::microseconds>> UP_AND_DOWN{ 10ms, 20ms, 30ms, 20ms };
+}
+
+WINMTR_TEST(net_counts_the_mean_and_standard_deviation)
+{
+	const auto hop = counted(UP_AND_DOWN);
+	WINMTR_CHECK(hop.xmit == 4);
+	WINMTR_CHECK(hop.returned == 4);
+	WINMTR_CHECK(hop.getAvg() == 20000);
+	WINMTR_CHECK(hop.best == 10000);
+	WINMTR_CHECK(hop.worst == 30000);
+	WINMTR_CHECK(hop.last == 20000);
+	// deviations of -10, 0, 10 and 0 ms, squared and over n - 1
+	WINMTR_CHECK(near(hop.stddev, std::sqrt(2e8 / 3.0)));
+	// one round trip has nothing to deviate from, the same one every time doesn't
+	WINMTR_CHECK(counted({ 15ms }).stddev == 0.0);
+	WINMTR_CHECK(counted({ 15ms, 15ms, 15ms }).stddev == 0.0);
+}
+
+WINMTR_TEST(net_counts_jitter_like_rfc_3550)
+{
+	// J += (|D| - J) / 16 with |D| 10 ms every time after the first
+	const auto hop = counted(UP_AND_DOWN);
+	WINMTR_CHECK(near(hop.jitter, 1760.25390625));
+	WINMTR_CHECK(counted({ 15ms }).jitter == 0.0);
+	WINMTR_CHECK(counted({ 15ms, 15ms, 15ms }).jitter == 0.0);
+}
+
+WINMTR_TEST(net_counts_the_moving_average_at_the_weight_asked_for)
+{
+	// starts at the first round trip, then moves a quarter of the way to each
+	WINMTR_CHECK(near(counted(UP_AND_DOWN).ewma, 17656.25));
+	// all the way is the last round trip, none of the way the first
+	WINMTR_CHECK(near(counted(UP_AND_DOWN, 1.0).ewma, 20000.0));
+	WINMTR_CHECK(near(counted(UP_AND_DOWN, 0.0).ewma, 10000.0));
+}
+
+WINMTR_TEST(net_leaves_timeouts_out_of_the_round_trip_statistics)
+{
+	const auto hop = counted({ 10ms, std::nullopt, 20ms, std::nullopt });
+	WINMTR_CHECK(hop.xmit == 4);
+	WINMTR_CHECK(hop.returned == 2);
+	WINMTR_CHECK(hop.getAvg() == 15000);
+	WINMTR_CHECK(hop.last == 20000);
+	WINMTR_CHECK(near(hop.stddev, std::sqrt(5e7)));
+	WINMTR_CHECK(near(hop.jitter, 625.0));
+	WINMTR_CHECK(near(hop.ewma, 12500.0));
+}
+
+WINMTR_TEST(net_window_covers_the_probes_of_its_last_seconds)
+{
+	winmtr::test::options options;
+	options.historyKiB = 64;
+	const live_trace traced(options, 1min);
+	// a probe a second, the one at the window's edge may or may not be in it
+	const auto window = traced.net->getWindowAt(0, 10s);
+	WINMTR_CHECK(window.sent >= 10);
+	WINMTR_CHECK(window.sent <= 11);
+	WINMTR_CHECK(window.returned == window.sent);
+	WINMTR_CHECK(window.average == 1ms);
+	WINMTR_CHECK(window.getPercent() == 0);
+	// every probe of the trace, discovery's aside
+	const auto hop = traced.net->getCurrentState().at(0);
+	WINMTR_CHECK(traced.net->getWindowAt(0, 1h).sent == static_cast<unsigned>(hop.xmit));
+}
+
+WINMTR_TEST(net_window_larger_than_the_history_is_all_of_it)
+{
+	// a KiB over the thirty hops of the default limit is four probes a hop
+	winmtr::test::options options;
+	options.historyKiB = 1;
+	const live_trace traced(options, 1min);
+	WINMTR_CHECK(traced.net->getWindowAt(0, 1h).sent == 4);
+	WINMTR_CHECK(traced.net->getWindowAt(0, 1min).sent == 4);
+	WINMTR_CHECK(traced.net->getWindowAt(0, 2s).sent < 4);
+	// and none at all is nothing to look back over
+	options.historyKiB = 0;
+	const live_trace untracked(options, 10s);
+	WINMTR_CHECK(untracked.net->getWindowAt(0, 1h).sent == 0);
+}
+
+WINMTR_TEST(net_replays_an_ipv6_trace_with_its_names)
+{
+	const winmtr::test::scratch_path file("winmtr-net-ipv6.cap");
+	// a link-local first hop, answering on its interface's scope and with a flow label
+	auto gateway = ipv6("fe80::1", 3);
+	gateway.Ipv6.sin6_flowinfo = htonl(0x12345u);
+	const auto destination = ipv6("2001:db8::9", 0);
+	{
+		const auto writer = capture_writer::open(file.path());
+		WINMTR_REQUIRE(writer);
+		const auto base = probe_backend::clock::now();
+		WINMTR_REQUIRE(writer->trace(1, base, destination, 2));
+		for (int i = 1; i <= 3; ++i) {
+			WINMTR_REQUIRE(writer->probe({ .time = base + std::chrono::seconds(i), .responder = gateway, .round_trip_time = 2ms, .session = 1, .ttl = 1, .status = probe_status::ttl_expired }));
+			WINMTR_REQUIRE(writer->probe({ .time = base + std::chrono::seconds(i), .responder = destination, .round_trip_time = 9ms, .session = 1, .ttl = 2, .status = probe_status::success }));
+		}
+		// the resolver's copy of the address, without the scope the replies came on
+		WINMTR_REQUIRE(writer->name(1, base + 4s, 1, ipv6("fe80::1", 0), L"gateway.example.net"));
+		WINMTR_REQUIRE(writer->name(1, base + 4s, 2, destination, L"host.example.net"));
+	}
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	const auto traces = capture->traces();
+	WINMTR_REQUIRE(traces.size() == 1);
+
+	const winmtr::test::options options;
+	const auto net = std::make_shared<WinMTRNet>(&options, std::make_shared<simulated_backend>(sim_topology::parse(TOPOLOGY)));
+	net->Replay(*capture, traces.front());
+	const auto state = net->getCurrentState();
+	// one path a hop, the names on them
+	WINMTR_REQUIRE(state.size() == 2);
+	WINMTR_CHECK(same_address(state[0].addr, gateway));
+	WINMTR_CHECK(state[0].name == L"gateway.example.net");
+	WINMTR_CHECK(state[0].xmit == 3);
+	WINMTR_CHECK(state[0].returned == 3);
+	WINMTR_CHECK(same_address(state[1].addr, destination));
+	WINMTR_CHECK(state[1].name == L"host.example.net");
+	WINMTR_CHECK(state[1].returned == 3);
+	// the scope and flow label don't make it another host, the address does
+	WINMTR_CHECK(same_address(gateway, ipv6("fe80::1", 0)));
+	WINMTR_CHECK(!same_address(gateway, ipv6("fe80::2", 3)));
+	WINMTR_CHECK(!same_address(gateway, SOCKADDR_INET{}));
+}
@@ -0,0 +1,436 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRProbeEngine-test.cpp
+//
+//
+// DESCRIPTION:
+//   The shared ICMP engine against the loopback interface, how its round
+//   trips compare with what the caller sees, that a trace on it allocates
+//   nothing once it has settled, and the benchmark that compares it with
+//   the event and thread-pool wait per probe it replaced.
+//
+//*****************************************************************************
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
+#include <icmpapi.h>
+#include <tlhelp32.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stop_token>
+#include <system_error>
+#include <vector>
+#include "WinMTRTest.h"
+import <winrt/Windows.Foundation.h>;
+import WinMTR.AsnDatabase;
+import WinMTR.EventLog;
+import WinMTR.NameCache;
+import WinMTR.Net;
+import WinMTR.ProbeEngine;
+import WinMTR.Test.Options;
+import WinMTRSNetHost;
+
+using namespace std::literals;
+using winrt::Windows::Foundation::IAsyncAction;
+
+namespace {
+	using clock = probe_backend::clock;
+
+	// the loops of a 30 hop trace
+	constexpr auto IN_FLIGHT = 30;
+	constexpr auto BENCH_TIME = 3s;
+	const std::array<std::byte, 32> PAYLOAD{};
+	// more than the engine's ring of waiting handles starts out with
+	constexpr auto MANY_WAITERS = 5000;
+	constexpr auto STEADY_TIME = 3s;
+
+	// every lookup SetAddr makes switched on, probing a lot faster than the default
+	[[nodiscard]]
+	winmtr::test::options steady_options()
+	{
+		winmtr::test::options options;
+		options.interval = 0.02;
+		options.useDNS = true;
+		options.maxProbeRate = 0;
+		options.maxByteRate = 0;
+		return options;
+	}
+
+	// an ASN table and an event log installed for the process, both gone again with it
+	class steady_fixture final {
+		steady_fixture(const steady_fixture&) = delete;
+		steady_fixture& operator=(const steady_fixture&) = delete;
+	public:
+		steady_fixture()
+			:m_dir(std::filesystem::temp_directory_path() / L"winmtr-steady-state")
+		{
+			std::filesystem::create_directories(m_dir);
+			{
+				std::ofstream tsv(m_dir / L"asn.tsv");
+				tsv << "127.0.0.0\t127.255.255.255\t64512\tZZ\tLoopback\n";
+			}
+			if (asn_database::build(m_dir / L"asn.tsv", m_dir / L"asn.bin")) {
+				asn_database::install(asn_database::open(m_dir / L"asn.bin"));
+			}
+			event_log::install(event_log::open(m_dir / L"events.ndjson"));
+		}
+		~steady_fixture() noexcept
+		{
+			event_log::install(nullptr);
+			asn_database::install(nullptr);
+			std::error_code ignored;
+			std::filesystem::remove_all(m_dir, ignored);
+		}
+		[[nodiscard]]
+		explicit operator bool() const noexcept
+		{
+			return asn_database::instance() && event_log::instance();
+		}
+	private:
+		std::filesystem::path m_dir;
+	};
+
+	[[nodiscard]]
+	SOCKADDR_INET loopback() noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv4.sin_family = AF_INET;
+		addr.Ipv4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return addr;
+	}
+
+	// TEST-NET-1 from RFC 5737, nothing ever answers from there
+	[[nodiscard]]
+	SOCKADDR_INET unanswered() noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv4.sin_family = AF_INET;
+		addr.Ipv4.sin_addr.s_addr = htonl(0xC0000201);
+		return addr;
+	}
+
+	[[nodiscard]]
+	unsigned process_threads() noexcept
+	{
+		const auto snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+		if (snapshot == INVALID_HANDLE_VALUE) {
+			return 0;
+		}
+		const auto self = GetCurrentProcessId();
+		THREADENTRY32 entry{ .dwSize = sizeof(entry) };
+		unsigned count = 0;
+		for (auto more = Thread32First(snapshot, &entry); more; more = Thread32Next(snapshot, &entry)) {
+			count += entry.th32OwnerProcessID == self;
+		}
+		CloseHandle(snapshot);
+		return count;
+	}
+
+	IAsyncAction ping(probe_backend& backend, SOCKADDR_INET dest, probe_result& result)
+	{
+		co_await winrt::resume_background();
+		result = co_await backend.send({ .session = backend.new_session(), .ttl = 64 }, dest, PAYLOAD, 1000ms);
+	}
+
+	// doesn't hold on to the engine, the test has to be able to destroy it underneath
+	IAsyncAction ping_until_aborted(probe_backend& backend, int& error, clock::time_point& finished)
+	{
+		try {
+			(void)co_await backend.send({ .session = backend.new_session(), .ttl = 64 }, unanswered(), PAYLOAD, 5000ms);
+			error = 0;
+		}
+		catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+		finished = clock::now();
+	}
+
+	IAsyncAction sleep_on(probe_backend& backend, clock::duration duration, clock::time_point& finished)
+	{
+		co_await backend.resume_after(duration);
+		finished = clock::now();
+	}
+
+	IAsyncAction wait_on(probe_backend& backend, std::atomic_int& resumed)
+	{
+		co_await backend.resume_after(10ms);
+		resumed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	IAsyncAction engine_loop(probe_backend& backend, UCHAR ttl, clock::time_point until, std::atomic_uint64_t& answered)
+	{
+		co_await winrt::resume_background();
+		const auto session = backend.new_session();
+		for (std::uint16_t sequence = 0; clock::now() < until; ++sequence) {
+			const auto result = co_await backend.send({ .session = session, .ttl = ttl, .sequence = sequence }, loopback(), PAYLOAD, 1000ms);
+			answered.fetch_add(result.reply_count ? 1 : 0, std::memory_order_relaxed);
+		}
+	}
+
+	// what every hop's loop did before the engine: its own handle and event,
+	// and a thread-pool wait on that event for every single probe
+	IAsyncAction per_probe_wait_loop(UCHAR ttl, clock::time_point until, std::atomic_uint64_t& answered)
+	{
+		co_await winrt::resume_background();
+		const auto icmp = IcmpCreateFile();
+		winrt::handle event{ CreateEventW(nullptr, FALSE, FALSE, nullptr) };
+		std::array<std::byte, sizeof(ICMP_ECHO_REPLY) + PAYLOAD.size() + 8 + sizeof(IO_STATUS_BLOCK)> reply;
+		IP_OPTION_INFORMATION options{ .Ttl = ttl };
+		const auto dest = loopback().Ipv4.sin_addr.s_addr;
+		while (clock::now() < until) {
+			const auto sent = IcmpSendEcho2Ex(icmp, event.get(), nullptr, nullptr, INADDR_ANY, dest, const_cast<std::byte*>(PAYLOAD.data()), static_cast<WORD>(PAYLOAD.size()), &options, reply.data(), static_cast<DWORD>(reply.size()), 1000);
+			if (sent == 0 && GetLastError() != ERROR_IO_PENDING) {
+				break;
+			}
+			co_await winrt::resume_on_signal(event.get(), 5s);
+			answered.fetch_add(IcmpParseReplies(reply.data(), static_cast<DWORD>(reply.size())) ? 1 : 0, std::memory_order_relaxed);
+		}
+		IcmpCloseHandle(icmp);
+	}
+
+	// what the engine reported against what the caller saw from co_await to resume, in microseconds
+	struct calibration final {
+		std::vector<std::int64_t> reported;
+		std::vector<std::int64_t> observed;
+		int failed = 0;
+	};
+
+	IAsyncAction calibrate(probe_backend& backend, int probes, calibration& result)
+	{
+		co_await winrt::resume_background();
+		probe_key key{ .session = backend.new_session(), .ttl = 64 };
+		for (int i = 0; i < probes; ++i) {
+			++key.sequence;
+			const auto sent = clock::now();
+			const auto answer = co_await backend.send(key, loopback(), PAYLOAD, 1000ms);
+			const auto observed = clock::now() - sent;
+			if (answer.status != probe_status::success) {
+				++result.failed;
+				continue;
+			}
+			result.reported.push_back(answer.round_trip_time.count());
+			result.observed.push_back(std::chrono::duration_cast<std::chrono::microseconds>(observed).count());
+		}
+	}
+
+	[[nodiscard]]
+	calibration calibrate_loopback(int probes)
+	{
+		const auto engine = std::make_shared<probe_engine>();
+		calibration result;
+		result.reported.reserve(probes);
+		result.observed.reserve(probes);
+		calibrate(*engine, probes, result).get();
+		return result;
+	}
+
+	[[nodiscard]]
+	std::int64_t percentile(std::vector<std::int64_t> values, double rank)
+	{
+		if (values.empty()) {
+			return 0;
+		}
+		const auto at = values.begin() + static_cast<std::ptrdiff_t>(rank * static_cast<double>(values.size() - 1));
+		std::ranges::nth_element(values, at);
+		return *at;
+	}
+
+	template<class F>
+	void measure(const char* label, F start_loop)
+	{
+		std::atomic_uint64_t answered{ 0 };
+		const auto threadsBefore = process_threads();
+		const auto started = clock::now();
+		const auto until = started + BENCH_TIME;
+		std::vector<IAsyncAction> loops;
+		for (int ttl = 1; ttl <= IN_FLIGHT; ++ttl) {
+			loops.push_back(start_loop(static_cast<UCHAR>(ttl), until, answered));
+		}
+		Sleep(static_cast<DWORD>(std::chrono::milliseconds(BENCH_TIME).count() / 2));
+		const auto threadsDuring = process_threads();
+		for (const auto& loop : loops) {
+			loop.get();
+		}
+		const auto elapsed = winmtr::test::seconds(clock::now() - started);
+		std::printf("  %s\n", label);
+		winmtr::test::report("probes answered per second", static_cast<double>(answered.load()) / elapsed, "probes/s");
+		winmtr::test::report("threads while running", threadsDuring, "threads");
+		winmtr::test::report("threads added", static_cast<double>(threadsDuring) - threadsBefore, "threads");
+		WINMTR_CHECK(answered.load() > 0);
+	}
+}
+
+WINMTR_TEST(probe_engine_echoes_loopback)
+{
+	const auto engine = std::make_shared<probe_engine>();
+	probe_result result;
+	ping(*engine, loopback(), result).get();
+	WINMTR_CHECK(result.error == 0);
+	WINMTR_CHECK(result.reply_count > 0);
+	WINMTR_CHECK(result.status == probe_status::success);
+	WINMTR_CHECK(result.responder.Ipv4.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+	WINMTR_CHECK(engine->probes_sent() == 1);
+}
+
+WINMTR_TEST(probe_engine_shutdown_resumes_waiters)
+{
+	auto engine = std::make_shared<probe_engine>();
+	int error = -1;
+	clock::time_point probeFinished;
+	clock::time_point delayFinished;
+	const auto probe = ping_until_aborted(*engine, error, probeFinished);
+	const auto delay = sleep_on(*engine, 1min, delayFinished);
+	Sleep(200);
+	const auto shutdown = clock::now();
+	engine.reset();
+	// neither may be left waiting on the engine that is gone
+	WINMTR_REQUIRE(probe.wait_for(1s) == winrt::Windows::Foundation::AsyncStatus::Completed);
+	WINMTR_REQUIRE(delay.wait_for(1s) == winrt::Windows::Foundation::AsyncStatus::Completed);
+	// unless something answered or refused it before the shutdown, the probe was aborted
+	WINMTR_CHECK(error == ERROR_OPERATION_ABORTED || (error != -1 && probeFinished < shutdown));
+	WINMTR_CHECK(delayFinished >= shutdown);
+}
+
+WINMTR_TEST(probe_engine_shutdown_drains_queued_work)
+{
+	auto engine = std::make_shared<probe_engine>();
+	clock::time_point finished;
+	// queued to the I/O thread right as it is told to stop, it still has to resume
+	const auto delay = sleep_on(*engine, 1min, finished);
+	engine.reset();
+	WINMTR_CHECK(delay.wait_for(1s) == winrt::Windows::Foundation::AsyncStatus::Completed);
+}
+
+WINMTR_TEST(probe_engine_calibrates_on_loopback)
+{
+	const auto result = calibrate_loopback(2000);
+	WINMTR_CHECK(result.failed == 0);
+	WINMTR_REQUIRE(!result.reported.empty());
+	// loopback is well under a millisecond, and no longer rounded to one
+	WINMTR_CHECK(percentile(result.reported, 0.5) < 1000);
+	WINMTR_CHECK(std::ranges::any_of(result.reported, [](std::int64_t rtt) noexcept { return rtt % 1000 != 0; }));
+	// the engine times less of the round trip than the caller does, never more
+	WINMTR_CHECK(percentile(result.reported, 0.5) <= percentile(result.observed, 0.5));
+	WINMTR_CHECK(percentile(result.reported, 0.99) <= percentile(result.observed, 0.99));
+}
+
+WINMTR_TEST(probe_engine_resumes_more_waiters_than_it_started_with)
+{
+	const auto engine = std::make_shared<probe_engine>();
+	std::atomic_int resumed{ 0 };
+	std::vector<IAsyncAction> waiters;
+	waiters.reserve(MANY_WAITERS);
+	for (int i = 0; i < MANY_WAITERS; ++i) {
+		waiters.push_back(wait_on(*engine, resumed));
+	}
+	for (const auto& waiter : waiters) {
+		WINMTR_REQUIRE(waiter.wait_for(5s) == winrt::Windows::Foundation::AsyncStatus::Completed);
+	}
+	WINMTR_CHECK(resumed.load() == MANY_WAITERS);
+}
+
+WINMTR_TEST(probe_engine_trace_allocates_nothing_once_settled)
+{
+	const steady_fixture fixture;
+	WINMTR_REQUIRE(fixture);
+	const auto options = steady_options();
+	const auto engine = probe_engine::instance();
+	const auto net = std::make_shared<WinMTRNet>(&options, engine);
+	std::stop_source stop;
+	const auto tracer = net->DoTrace(stop.get_token(), { loopback() }, engine->now());
+
+	// settled once the hop has its address, its AS and its name, whichever way the name came
+	const auto settleBy = clock::now() + 10s;
+	bool settled = false;
+	while (!settled && clock::now() < settleBy) {
+		Sleep(50);
+		const auto hop = net->getStateAt(0);
+		settled = hop.xmit > 10 && hop.asn == 64512 && !hop.name.empty();
+	}
+	WINMTR_REQUIRE(settled);
+	// the cached name, the way SetAddr asks for it, answered on the spot
+	auto cached = name_cache::instance()->lookup(loopback());
+	WINMTR_REQUIRE(cached.await_ready() || !cached.await_suspend(std::noop_coroutine()));
+	(void)cached.await_resume();
+
+	// nothing but the trace runs in here, so anything allocated is the trace's
+	const auto probesBefore = engine->probes_sent();
+	const auto allocationsBefore = winmtr::test::allocations();
+	Sleep(static_cast<DWORD>(std::chrono::milliseconds(STEADY_TIME).count()));
+	// what SetAddr does for an address it hasn't seen, once more for good measure
+	const auto asns = asn_database::instance();
+	const auto record = asns->lookup(loopback());
+	auto lookup = name_cache::instance()->lookup(loopback());
+	const auto answered = lookup.await_ready() || !lookup.await_suspend(std::noop_coroutine());
+	const auto name = lookup.await_resume();
+	const auto allocations = winmtr::test::allocations() - allocationsBefore;
+	const auto probes = engine->probes_sent() - probesBefore;
+
+	stop.request_stop();
+	WINMTR_REQUIRE(tracer.wait_for(5s) == winrt::Windows::Foundation::AsyncStatus::Completed);
+	winmtr::test::report("probes while measuring", static_cast<double>(probes), "probes");
+	winmtr::test::report("allocations while measuring", static_cast<double>(allocations), "allocations");
+	WINMTR_CHECK(record.asn == 64512);
+	WINMTR_CHECK(answered);
+	WINMTR_CHECK(probes > 50);
+	WINMTR_CHECK(allocations == 0);
+	WINMTR_CHECK(event_log::instance()->stats().written > 0);
+}
+
+WINMTR_BENCH(probe_engine_measurement_overhead)
+{
+	const auto result = calibrate_loopback(20000);
+	std::vector<std::int64_t> overhead(result.reported.size());
+	for (std::size_t i = 0; i < overhead.size(); ++i) {
+		overhead[i] = result.observed[i] - result.reported[i];
+	}
+	winmtr::test::report("reported round trip, p50", static_cast<double>(percentile(result.reported, 0.5)), "us");
+	winmtr::test::report("reported round trip, p99", static_cast<double>(percentile(result.reported, 0.99)), "us");
+	winmtr::test::report("co_await to resume, p50", static_cast<double>(percentile(result.observed, 0.5)), "us");
+	winmtr::test::report("co_await to resume, p99", static_cast<double>(percentile(result.observed, 0.99)), "us");
+	winmtr::test::report("overhead outside the measurement, p50", static_cast<double>(percentile(overhead, 0.5)), "us");
+	winmtr::test::report("overhead outside the measurement, p99", static_cast<double>(percentile(overhead, 0.99)), "us");
+	WINMTR_CHECK(result.failed == 0);
+}
+
+WINMTR_BENCH(probe_engine_vs_per_probe_wait)
+{
+	{
+		const auto engine = std::make_shared<probe_engine>();
+		measure("shared probe engine", [&engine](UCHAR ttl, clock::time_point until, std::atomic_uint64_t& answered) {
+			return engine_loop(*engine, ttl, until, answered);
+		});
+	}
+	measure("event and thread-pool wait per probe", [](UCHAR ttl, clock::time_point until, std::atomic_uint64_t& answered) {
+		return per_probe_wait_loop(ttl, until, answered);
+	});
+}
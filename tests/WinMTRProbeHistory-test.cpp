@@ -0,0 +1,127 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRProbeHistory-test.cpp
+//
+//
+// DESCRIPTION:
+//   The probe history's ring: its capacity, the window it summarizes, what
+//   is left of it once it wrapped around, and a window reaching back past
+//   the oldest probe it still has.
+//
+//*****************************************************************************
+#include <chrono>
+#include "WinMTRTest.h"
+import WinMTR.ProbeHistory;
+
+using namespace std::literals;
+
+namespace {
+	using clock = probe_backend::clock;
+
+	const clock::time_point EPOCH = clock::time_point{} + 1h;
+
+	// a probe a second from the epoch on, the odd ones answered after as many milliseconds as their number
+	void record_seconds(probe_history& history, int first, int last)
+	{
+		for (int second = first; second <= last; ++second) {
+			if (second % 2) {
+				history.record(EPOCH + std::chrono::seconds(second), probe_status::success, std::chrono::milliseconds(second));
+			}
+			else {
+				history.record(EPOCH + std::chrono::seconds(second), probe_status::timed_out, {});
+			}
+		}
+	}
+}
+
+WINMTR_TEST(probe_history_rounds_its_capacity_down)
+{
+	WINMTR_CHECK(probe_history(100, EPOCH).capacity() == 64);
+	WINMTR_CHECK(probe_history(64, EPOCH).capacity() == 64);
+	WINMTR_CHECK(probe_history(0, EPOCH).capacity() == 1);
+	const probe_history empty(16, EPOCH);
+	WINMTR_CHECK(empty.size() == 0);
+	WINMTR_CHECK(empty.summarize(EPOCH).sent == 0);
+	WINMTR_CHECK(empty.summarize(EPOCH).getPercent() == 0);
+}
+
+WINMTR_TEST(probe_history_summarizes_the_window)
+{
+	probe_history history(64, EPOCH);
+	record_seconds(history, 1, 10);
+	WINMTR_CHECK(history.size() == 10);
+	// 6 to 10, of which 7 and 9 answered
+	const auto window = history.summarize(EPOCH + 6s);
+	WINMTR_CHECK(window.sent == 5);
+	WINMTR_CHECK(window.returned == 2);
+	WINMTR_CHECK(window.average == 8ms);
+	WINMTR_CHECK(window.getPercent() == 60);
+	// the edge is in the window, a millisecond past it isn't
+	WINMTR_CHECK(history.summarize(EPOCH + 10s).sent == 1);
+	WINMTR_CHECK(history.summarize(EPOCH + 10s + 1ms).sent == 0);
+}
+
+WINMTR_TEST(probe_history_keeps_the_newest_once_it_wrapped)
+{
+	probe_history history(8, EPOCH);
+	record_seconds(history, 1, 20);
+	WINMTR_CHECK(history.size() == 8);
+	// 13 to 20 are left, 13, 15, 17 and 19 answered
+	const auto all = history.summarize(EPOCH);
+	WINMTR_CHECK(all.sent == 8);
+	WINMTR_CHECK(all.returned == 4);
+	WINMTR_CHECK(all.average == 16ms);
+	// a window inside what is left straddles where the ring started over
+	const auto recent = history.summarize(EPOCH + 16s);
+	WINMTR_CHECK(recent.sent == 5);
+	WINMTR_CHECK(recent.returned == 2);
+	WINMTR_CHECK(recent.average == 18ms);
+}
+
+WINMTR_TEST(probe_history_window_larger_than_the_history)
+{
+	probe_history history(8, EPOCH);
+	record_seconds(history, 1, 5);
+	// back to before the trace started, all five
+	const auto before = history.summarize(EPOCH - 1h);
+	WINMTR_CHECK(before.sent == 5);
+	WINMTR_CHECK(before.returned == 3);
+	WINMTR_CHECK(before.average == 3ms);
+	// and once it wrapped, no more than it holds however far back it is asked for
+	record_seconds(history, 6, 100);
+	WINMTR_CHECK(history.summarize(EPOCH - 1h).sent == 8);
+	WINMTR_CHECK(history.summarize(EPOCH + 50s).sent == 8);
+}
+
+WINMTR_TEST(probe_history_clamps_what_does_not_fit)
+{
+	probe_history history(8, EPOCH);
+	// over two minutes, and negative
+	history.record(EPOCH + 1s, probe_status::success, 10min);
+	WINMTR_CHECK(history.summarize(EPOCH).average == std::chrono::microseconds((1 << 27) - 1));
+	history.record(EPOCH + 2s, probe_status::ttl_expired, -5ms);
+	WINMTR_CHECK(history.summarize(EPOCH + 2s).returned == 1);
+	WINMTR_CHECK(history.summarize(EPOCH + 2s).average == 0us);
+	// a probe from before the epoch counts as sent at it
+	history.record(EPOCH - 1s, probe_status::timed_out, {});
+	WINMTR_CHECK(history.summarize(EPOCH).sent == 3);
+}
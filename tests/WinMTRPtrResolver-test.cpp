@@ -0,0 +1,447 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRPtrResolver-test.cpp
+//
+//
+// DESCRIPTION:
+//   The PTR client against a DNS server of its own on loopback: answers,
+//   retries and their backoff, giving up, answers that belong to no query,
+//   and more queries than it puts in flight at once.
+//
+// NOTES:
+//   The retry cases wait out the real timeouts, giving up takes the whole
+//   seven seconds of PTR_QUERY_ATTEMPTS.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.PtrResolver;
+
+using namespace std::literals;
+
+namespace {
+	using clock = std::chrono::steady_clock;
+	using message = std::vector<std::uint8_t>;
+
+	constexpr std::size_t HEADER_SIZE = 12;
+	constexpr auto ANSWER_WAIT = 3s;
+	// a little early is the poll's rounding, a lot late is the machine
+	constexpr auto SLACK = 100ms;
+
+#ifdef _WIN32
+	using native_socket = SOCKET;
+	constexpr auto INVALID = INVALID_SOCKET;
+
+	int last_error() noexcept
+	{
+		return WSAGetLastError();
+	}
+
+	void close_socket(SOCKET s) noexcept
+	{
+		closesocket(s);
+	}
+
+	int wait_readable(SOCKET s, int timeout_ms) noexcept
+	{
+		WSAPOLLFD fd{ .fd = s, .events = POLLRDNORM, .revents = 0 };
+		return WSAPoll(&fd, 1, timeout_ms);
+	}
+#else
+	using native_socket = int;
+	constexpr auto INVALID = -1;
+
+	int last_error() noexcept
+	{
+		return errno;
+	}
+
+	void close_socket(int s) noexcept
+	{
+		::close(s);
+	}
+
+	int wait_readable(int s, int timeout_ms) noexcept
+	{
+		pollfd fd{ .fd = s, .events = POLLIN, .revents = 0 };
+		return ::poll(&fd, 1, timeout_ms);
+	}
+#endif
+
+	// runs until its first suspension on the calling thread, the rest on the client's
+	struct detached final {
+		struct promise_type final {
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	detached resolve(dns_ptr_client& client, SOCKADDR_INET addr, std::promise<ptr_answer>& done)
+	{
+		done.set_value(co_await client.lookup(addr));
+	}
+
+	// for the queries that go in through start() instead of being awaited
+	struct awaited final : ptr_request {
+		std::promise<ptr_answer> answer;
+
+		void done(ptr_answer result) noexcept override
+		{
+			answer.set_value(std::move(result));
+		}
+	};
+
+	using winmtr::test::address;
+
+	// the question's name, dotted, without the trailing dot
+	[[nodiscard]]
+	std::string question_name(std::span<const std::uint8_t> query)
+	{
+		std::string name;
+		for (auto at = HEADER_SIZE; at < query.size() && query[at];) {
+			if (!name.empty()) {
+				name += '.';
+			}
+			name.append(reinterpret_cast<const char*>(&query[at + 1]), query[at]);
+			at += 1 + query[at];
+		}
+		return name;
+	}
+
+	// the query turned into an answer with one PTR record for name
+	[[nodiscard]]
+	message ptr_reply(std::span<const std::uint8_t> query, std::string_view name, std::uint32_t ttl)
+	{
+		message reply(query.begin(), query.end());
+		reply[2] |= 0x80;	// a response
+		reply[3] = 0x80;	// recursion available, no error
+		reply[7] = 1;		// one answer
+		const std::uint8_t record[] = { 0xc0, 0x0c, 0, 12, 0, 1
+			, static_cast<std::uint8_t>(ttl >> 24), static_cast<std::uint8_t>(ttl >> 16), static_cast<std::uint8_t>(ttl >> 8), static_cast<std::uint8_t>(ttl) };
+		reply.insert(reply.end(), std::begin(record), std::end(record));
+		message rdata;
+		for (std::size_t at = 0; at <= name.size();) {
+			const auto dot = std::min(name.find('.', at), name.size());
+			rdata.push_back(static_cast<std::uint8_t>(dot - at));
+			rdata.insert(rdata.end(), name.begin() + at, name.begin() + dot);
+			at = dot + 1;
+		}
+		rdata.push_back(0);
+		reply.push_back(static_cast<std::uint8_t>(rdata.size() >> 8));
+		reply.push_back(static_cast<std::uint8_t>(rdata.size()));
+		reply.insert(reply.end(), rdata.begin(), rdata.end());
+		return reply;
+	}
+
+	//*****************************************************************************
+	// CLASS:  dns_stub
+	//
+	// A DNS server on a loopback port that answers whatever its policy says,
+	// any number of datagrams or none, for each query in the order they come
+	// in. While held it only counts and keeps them, release() answers them.
+	//*****************************************************************************
+	class dns_stub final {
+		dns_stub(const dns_stub&) = delete;
+		dns_stub& operator=(const dns_stub&) = delete;
+	public:
+		using policy = std::function<std::vector<message>(std::span<const std::uint8_t> query, int nth)>;
+
+		struct received final {
+			message query;
+			clock::time_point when;
+		};
+
+		explicit dns_stub(policy answer)
+			:m_answer(std::move(answer))
+			, m_socket(::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))
+		{
+			m_address.Ipv4.sin_family = AF_INET;
+			m_address.Ipv4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			socklen_t size = sizeof(m_address.Ipv4);
+			if (m_socket == INVALID || ::bind(m_socket, reinterpret_cast<const sockaddr*>(&m_address.Ipv4), size) != 0
+				|| ::getsockname(m_socket, reinterpret_cast<sockaddr*>(&m_address.Ipv4), &size) != 0) {
+				throw std::system_error(last_error(), std::system_category(), "DNS stub socket");
+			}
+			m_thread = std::jthread([this](std::stop_token stop_token) { this->run(stop_token); });
+		}
+
+		~dns_stub() noexcept
+		{
+			m_thread.request_stop();
+			m_thread.join();
+			close_socket(m_socket);
+		}
+
+		[[nodiscard]]
+		const SOCKADDR_INET& address() const noexcept
+		{
+			return m_address;
+		}
+
+		[[nodiscard]]
+		std::vector<received> queries() const
+		{
+			std::scoped_lock lock(m_mutex);
+			return m_received;
+		}
+
+		[[nodiscard]]
+		std::size_t query_count() const
+		{
+			std::scoped_lock lock(m_mutex);
+			return m_received.size();
+		}
+
+		void hold() noexcept
+		{
+			m_holding = true;
+		}
+
+		void release() noexcept
+		{
+			m_holding = false;
+		}
+	private:
+		void run(std::stop_token stop_token)
+		{
+			std::vector<std::pair<message, int>> held;
+			sockaddr_in peer{};
+			while (!stop_token.stop_requested()) {
+				if (!m_holding) {
+					for (const auto& [query, nth] : held) {
+						send(query, nth, peer);
+					}
+					held.clear();
+				}
+				if (wait_readable(m_socket, 20) <= 0) {
+					continue;
+				}
+				message query(512);
+				socklen_t size = sizeof(peer);
+				const auto length = ::recvfrom(m_socket, reinterpret_cast<char*>(query.data()), static_cast<int>(query.size()), 0, reinterpret_cast<sockaddr*>(&peer), &size);
+				if (length < static_cast<int>(HEADER_SIZE)) {
+					continue;
+				}
+				query.resize(static_cast<std::size_t>(length));
+				int nth = 0;
+				{
+					std::scoped_lock lock(m_mutex);
+					nth = static_cast<int>(m_received.size());
+					m_received.push_back({ query, clock::now() });
+				}
+				if (m_holding) {
+					held.emplace_back(std::move(query), nth);
+				}
+				else {
+					send(query, nth, peer);
+				}
+			}
+		}
+
+		void send(const message& query, int nth, const sockaddr_in& peer)
+		{
+			for (const auto& reply : m_answer(query, nth)) {
+				::sendto(m_socket, reinterpret_cast<const char*>(reply.data()), static_cast<int>(reply.size()), 0, reinterpret_cast<const sockaddr*>(&peer), sizeof(peer));
+			}
+		}
+
+		policy m_answer;
+		native_socket m_socket;
+		SOCKADDR_INET m_address{};
+		std::atomic_bool m_holding{ false };
+		mutable std::mutex m_mutex;
+		std::vector<received> m_received;
+		std::jthread m_thread;
+	};
+
+	[[nodiscard]]
+	std::vector<message> answer_with_name(std::span<const std::uint8_t> query)
+	{
+		return { ptr_reply(query, "router.example.net", 3600) };
+	}
+}
+
+WINMTR_TEST(ptr_client_reads_the_name_and_ttl)
+{
+	const dns_stub stub([](std::span<const std::uint8_t> query, int) { return answer_with_name(query); });
+	dns_ptr_client client(stub.address());
+	std::promise<ptr_answer> done;
+	auto answer = done.get_future();
+	resolve(client, address("192.0.2.1"), done);
+	WINMTR_REQUIRE(answer.wait_for(ANSWER_WAIT) == std::future_status::ready);
+	const auto result = answer.get();
+	WINMTR_CHECK(result.outcome == ptr_outcome::name);
+	WINMTR_CHECK(result.name == L"router.example.net");
+	WINMTR_CHECK(result.ttl == 3600s);
+
+	const auto queries = stub.queries();
+	WINMTR_REQUIRE(queries.size() == 1);
+	WINMTR_CHECK(question_name(queries[0].query) == "1.2.0.192.in-addr.arpa");
+}
+
+WINMTR_TEST(ptr_client_retries_with_backoff)
+{
+	// the first two attempts go unanswered
+	const dns_stub stub([](std::span<const std::uint8_t> query, int nth) {
+		return nth < 2 ? std::vector<message>{} : answer_with_name(query);
+	});
+	dns_ptr_client client(stub.address());
+	std::promise<ptr_answer> done;
+	auto answer = done.get_future();
+	resolve(client, address("2001:db8::1"), done);
+	WINMTR_REQUIRE(answer.wait_for(PTR_QUERY_TIMEOUT * 3 + ANSWER_WAIT) == std::future_status::ready);
+	const auto result = answer.get();
+	WINMTR_CHECK(result.outcome == ptr_outcome::name);
+	WINMTR_CHECK(result.name == L"router.example.net");
+
+	const auto queries = stub.queries();
+	WINMTR_REQUIRE(queries.size() == 3);
+	// the same query each time, ID included
+	WINMTR_CHECK(queries[1].query == queries[0].query);
+	WINMTR_CHECK(queries[2].query == queries[0].query);
+	WINMTR_CHECK(question_name(queries[0].query).ends_with(".8.b.d.0.1.0.0.2.ip6.arpa"));
+	// and twice as long to wait after every retry
+	const auto first = queries[1].when - queries[0].when;
+	const auto second = queries[2].when - queries[1].when;
+	WINMTR_CHECK(first >= PTR_QUERY_TIMEOUT - SLACK && first < PTR_QUERY_TIMEOUT * 2 - SLACK);
+	WINMTR_CHECK(second >= PTR_QUERY_TIMEOUT * 2 - SLACK && second < PTR_QUERY_TIMEOUT * 4 - SLACK);
+}
+
+WINMTR_TEST(ptr_client_gives_up_after_the_last_attempt)
+{
+	const dns_stub stub([](std::span<const std::uint8_t>, int) { return std::vector<message>{}; });
+	dns_ptr_client client(stub.address());
+	awaited request;
+	auto answer = request.answer.get_future();
+	const auto started = clock::now();
+	client.start(address("192.0.2.9"), request);
+	// one second, then two, then four
+	const auto allowed = PTR_QUERY_TIMEOUT * ((1 << PTR_QUERY_ATTEMPTS) - 1);
+	WINMTR_REQUIRE(answer.wait_for(allowed + ANSWER_WAIT) == std::future_status::ready);
+	const auto took = clock::now() - started;
+	const auto result = answer.get();
+	WINMTR_CHECK(result.outcome == ptr_outcome::failed);
+	WINMTR_CHECK(result.name.empty());
+	WINMTR_CHECK(took >= allowed - SLACK);
+	WINMTR_CHECK(stub.query_count() == PTR_QUERY_ATTEMPTS);
+}
+
+WINMTR_TEST(ptr_client_ignores_answers_to_other_queries)
+{
+	// the first attempt only gets answers to some other query, the retry gets
+	// the real one, with the question in another case as some servers do
+	const dns_stub stub([](std::span<const std::uint8_t> query, int nth) {
+		if (nth == 0) {
+			auto wrongId = ptr_reply(query, "wrong-id.example.net", 60);
+			wrongId[1] ^= 1;
+			auto wrongQuestion = ptr_reply(query, "wrong-question.example.net", 60);
+			// the first octet of the reversed address
+			wrongQuestion[HEADER_SIZE + 1] ^= 1;
+			return std::vector<message>{ std::move(wrongId), std::move(wrongQuestion) };
+		}
+		auto reply = ptr_reply(query, "right.example.net", 60);
+		for (auto at = HEADER_SIZE; at < query.size(); ++at) {
+			if (reply[at] >= 'a' && reply[at] <= 'z') {
+				reply[at] = static_cast<std::uint8_t>(reply[at] - 'a' + 'A');
+			}
+		}
+		return std::vector<message>{ std::move(reply) };
+	});
+	dns_ptr_client client(stub.address());
+	std::promise<ptr_answer> done;
+	auto answer = done.get_future();
+	resolve(client, address("192.0.2.1"), done);
+	WINMTR_REQUIRE(answer.wait_for(PTR_QUERY_TIMEOUT + ANSWER_WAIT) == std::future_status::ready);
+	const auto result = answer.get();
+	WINMTR_CHECK(result.outcome == ptr_outcome::name);
+	WINMTR_CHECK(result.name == L"right.example.net");
+	WINMTR_CHECK(stub.query_count() == 2);
+}
+
+WINMTR_TEST(ptr_client_queues_past_the_in_flight_limit)
+{
+	constexpr auto QUERIES = PTR_MAX_IN_FLIGHT * 4;
+	// the answer names the question, so every one can be told apart
+	dns_stub stub([](std::span<const std::uint8_t> query, int) {
+		return std::vector<message>{ ptr_reply(query, question_name(query), 60) };
+	});
+	dns_ptr_client client(stub.address());
+	std::vector<std::unique_ptr<awaited>> requests;
+	std::vector<std::future<ptr_answer>> answers;
+	stub.hold();
+	for (std::size_t i = 0; i < QUERIES; ++i) {
+		requests.push_back(std::make_unique<awaited>());
+		answers.push_back(requests.back()->answer.get_future());
+		const auto text = "10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+		client.start(address(text.c_str()), *requests.back());
+	}
+	// the first PTR_MAX_IN_FLIGHT go out, the rest wait for them to be answered
+	const auto sentBy = clock::now() + ANSWER_WAIT;
+	while (stub.query_count() < PTR_MAX_IN_FLIGHT && clock::now() < sentBy) {
+		std::this_thread::sleep_for(10ms);
+	}
+	std::this_thread::sleep_for(200ms);
+	WINMTR_CHECK(stub.query_count() == PTR_MAX_IN_FLIGHT);
+	stub.release();
+
+	for (std::size_t i = 0; i < QUERIES; ++i) {
+		WINMTR_REQUIRE(answers[i].wait_for(ANSWER_WAIT) == std::future_status::ready);
+		const auto result = answers[i].get();
+		const auto expected = std::to_wstring(i % 256) + L"." + std::to_wstring(i / 256) + L".0.10.in-addr.arpa";
+		WINMTR_CHECK(result.outcome == ptr_outcome::name);
+		WINMTR_CHECK(result.name == expected);
+	}
+	// lost answers would have been asked again
+	WINMTR_CHECK(stub.query_count() >= QUERIES);
+}
@@ -0,0 +1,225 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRReport-test.cpp
+//
+//
+// DESCRIPTION:
+//   Report mode from the command line to the printed report, on a simulated
+//   network: the cycles and the duration it traces for, the formats it
+//   prints in, the status it ends with, and a capture of a report replayed
+//   to the same report.
+//
+// NOTES:
+//    report_trace is what run_report does once the host resolved. It waits
+//    on the backend's clock, so the test drives it from run_for() like the
+//    trace itself.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Capture;
+import WinMTR.Net;
+import WinMTR.ProbeBackend.Simulated;
+import WinMTR.Report;
+
+using namespace std::literals;
+
+namespace {
+	// a gateway, a router, one that never answers and the destination, nothing ever late
+	constexpr std::string_view TOPOLOGY = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.1 latency=fixed:5
+		hop *
+		hop 203.0.113.9 latency=fixed:10
+	)";
+	// the same, with a destination that never answers
+	constexpr std::string_view UNREACHABLE = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.1 latency=fixed:5
+		hop *
+		hop 203.0.113.9 latency=fixed:10 loss=1
+	)";
+	// far longer than any of the reports below should take
+	constexpr auto GIVE_UP = 10min;
+
+	struct reported final {
+		report_status status = report_status::failed;
+		std::wstring out;
+		probe_backend::clock::duration took{};	// on the virtual clock
+	};
+
+	// report mode with args, on text, run to the end
+	[[nodiscard]]
+	reported report(std::vector<std::wstring_view> args, std::string_view text = TOPOLOGY)
+	{
+		std::wstring error;
+		const auto request = parse_report_args(args, error);
+		WINMTR_REQUIRE(request);
+		const auto topology = sim_topology::parse(text);
+		const auto backend = std::make_shared<simulated_backend>(topology);
+		std::wostringstream out;
+		std::wostringstream err;
+		reported result;
+		const auto started = backend->now();
+		const auto reporting = report_trace(*request, { topology.destination() }, backend, started, out, err, result.status);
+		while (reporting.Status() == trace_status::Started && backend->now() - started < GIVE_UP) {
+			backend->run_for(1s);
+		}
+		WINMTR_REQUIRE(reporting.Status() == trace_status::Completed);
+		result.took = backend->now() - started;
+		result.out = out.str();
+		WINMTR_CHECK(err.str().empty());
+		return result;
+	}
+
+	// the sent column of every row of a CSV report
+	[[nodiscard]]
+	std::vector<int> sent_of(std::wstring_view csv)
+	{
+		constexpr auto SENT_COLUMN = 7;
+		std::vector<int> sent;
+		// past the header
+		auto line = csv.find(L'\n');
+		while (line != std::wstring_view::npos && line + 1 < csv.size()) {
+			const auto end = csv.find(L'\n', line + 1);
+			auto row = csv.substr(line + 1, end - line - 1);
+			for (int column = 0; column < SENT_COLUMN; ++column) {
+				row.remove_prefix(row.find(L',') + 1);
+			}
+			sent.push_back(std::stoi(std::wstring(row.substr(0, row.find(L',')))));
+			line = end;
+		}
+		return sent;
+	}
+}
+
+WINMTR_TEST(report_runs_the_cycles_asked_for)
+{
+	const auto result = report({ L"-n"sv, L"-c"sv, L"5"sv, L"-C"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(result.status == report_status::reached);
+	const auto sent = sent_of(result.out);
+	// A row per hop. The slowest of them, the silent one backing off, has
+	// sent as many as asked for, and maybe the one that was out when the
+	// trace stopped.
+	WINMTR_REQUIRE(sent.size() == 4);
+	WINMTR_CHECK(std::ranges::min(sent) >= 5);
+	WINMTR_CHECK(std::ranges::min(sent) <= 6);
+	// at a probe a second, with discovery and the silent hop's timeouts on top
+	WINMTR_CHECK(result.took < 30s);
+}
+
+WINMTR_TEST(report_runs_for_the_duration_asked_for)
+{
+	const auto result = report({ L"-n"sv, L"-c"sv, L"5"sv, L"-d"sv, L"20"sv, L"--csv"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(result.status == report_status::reached);
+	// the cycles don't count once there is a duration, winding down takes a probe's timeout at most
+	WINMTR_CHECK(result.took >= 20s);
+	WINMTR_CHECK(result.took <= 20s + DEFAULT_PROBE_TIMEOUT + 2s);
+	const auto sent = sent_of(result.out);
+	WINMTR_REQUIRE(!sent.empty());
+	// the gateway, a probe a second after discovery took one
+	WINMTR_CHECK(sent.front() >= 17);
+	WINMTR_CHECK(sent.front() <= 21);
+}
+
+WINMTR_TEST(report_prints_the_format_asked_for)
+{
+	const auto text = report({ L"-n"sv, L"-c"sv, L"2"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(text.out.find(L"WinMTR statistics"sv) != std::wstring::npos);
+	WINMTR_CHECK(text.out.find(L"198.51.100.1"sv) != std::wstring::npos);
+
+	const auto json = report({ L"-n"sv, L"-c"sv, L"2"sv, L"-j"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(json.out.starts_with(L"{\"host\":\"203.0.113.9\",\"reached\":true,\"hops\":[{\"ttl\":1,\"path\":0,\"host\":\"192.0.2.1\""sv));
+	WINMTR_CHECK(json.out.ends_with(L"}\n"sv));
+
+	const auto csv = report({ L"-n"sv, L"-c"sv, L"2"sv, L"-C"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(csv.out.starts_with(L"target,ttl,path,host,address,asn,loss_pct,sent,recv,late,best_ms,"sv));
+	WINMTR_CHECK(csv.out.find(L"\n\"203.0.113.9\",4,0,\"203.0.113.9\",203.0.113.9,0,0,"sv) != std::wstring::npos);
+
+	const auto xml = report({ L"-n"sv, L"-c"sv, L"2"sv, L"-f"sv, L"xml"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(xml.out.starts_with(L"<?xml version=\"1.0\"?>\n<report host=\"203.0.113.9\" reached=\"true\""sv));
+	WINMTR_CHECK(xml.out.ends_with(L"</report>\n"sv));
+}
+
+WINMTR_TEST(report_says_whether_the_destination_answered)
+{
+	const auto reached = report({ L"-n"sv, L"-c"sv, L"3"sv, L"-C"sv, L"203.0.113.9"sv });
+	WINMTR_CHECK(reached.status == report_status::reached);
+	// without a destination the trace goes as far as it may, the cycles still end it
+	const auto unreached = report({ L"-n"sv, L"-c"sv, L"3"sv, L"-x"sv, L"6"sv, L"-C"sv, L"203.0.113.9"sv }, UNREACHABLE);
+	WINMTR_CHECK(unreached.status == report_status::unreached);
+	const auto sent = sent_of(unreached.out);
+	WINMTR_CHECK(sent.size() == 6);
+	WINMTR_CHECK(std::ranges::min(sent) >= 3);
+}
+
+WINMTR_TEST(report_replays_a_capture_to_the_same_report)
+{
+	const winmtr::test::scratch_path file("winmtr-report-replay.cap");
+	auto writer = capture_writer::open(file.path());
+	WINMTR_REQUIRE(writer);
+	capture_writer::install(writer);
+	const auto live = report({ L"-n"sv, L"-c"sv, L"5"sv, L"-C"sv, L"203.0.113.9"sv });
+	capture_writer::install(nullptr);
+	// whatever is still queued goes out as the last of it lets go
+	writer.reset();
+	WINMTR_REQUIRE(live.status == report_status::reached);
+
+	const auto path = file.path().wstring();
+	std::wstring error;
+	const auto request = parse_report_args(std::vector{ L"-C"sv, L"--replay"sv, std::wstring_view(path) }, error);
+	WINMTR_REQUIRE(request);
+	std::wostringstream out;
+	std::wostringstream err;
+	WINMTR_CHECK(run_report(*request, out, err) == report_status::reached);
+	// nothing was late, so every column comes out of the same counts
+	WINMTR_CHECK(out.str() == live.out);
+	WINMTR_CHECK(err.str().empty());
+
+	// what went wrong is kept out of the report
+	std::wostringstream missing;
+	std::wostringstream why;
+	const auto nowhere = parse_report_args(std::vector{ L"--replay"sv, L"/nonexistent/winmtr.cap"sv }, error);
+	WINMTR_REQUIRE(nowhere);
+	WINMTR_CHECK(run_report(*nowhere, missing, why) == report_status::failed);
+	WINMTR_CHECK(missing.str().empty());
+	WINMTR_CHECK(why.str().starts_with(L"Unable to read the capture"sv));
+}
@@ -0,0 +1,234 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRReportWriter-test.cpp
+//
+//
+// DESCRIPTION:
+//   The report of a simulated trace in every format, what they escape, and
+//   the benchmark of how many reports a second each format renders into a
+//   buffer that is reused.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "WinMTRTest.h"
+import WinMTR.Net;
+import WinMTR.ProbeBackend.Simulated;
+import WinMTR.ReportWriter;
+import WinMTR.Test.Options;
+
+using namespace std::literals;
+
+namespace {
+	// ten routers, one of them silent and one of them two, and a destination
+	constexpr std::string_view TOPOLOGY = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 10.0.0.2 latency=normal:5:1
+		hop 10.0.0.3 latency=normal:6:1 loss=0.1
+		hop *
+		hop 10.0.0.5,10.0.0.55 latency=fixed:8 ecmp=packet
+		hop 10.0.0.6 latency=normal:9:2
+		hop 10.0.0.7 latency=normal:10:2
+		hop 10.0.0.8 latency=normal:11:2
+		hop 10.0.0.9 latency=normal:12:2
+		hop 10.0.0.10 latency=exp:10:5
+		hop 203.0.113.9 latency=exp:12:5
+	)";
+	constexpr auto TRACE_TIME = 10min;
+	constexpr auto RENDERS = 20'000;
+
+	constexpr std::array FORMATS{ std::pair{ report_format::text, "text" }
+		, std::pair{ report_format::html, "html" }
+		, std::pair{ report_format::json, "json" }
+		, std::pair{ report_format::csv, "csv" }
+		, std::pair{ report_format::markdown, "markdown" }
+		, std::pair{ report_format::xml, "xml" } };
+
+	// a finished trace of TOPOLOGY, for snapshots to be taken of
+	[[nodiscard]]
+	std::shared_ptr<WinMTRNet> traced(const winmtr::test::options& options)
+	{
+		const auto topology = sim_topology::parse(TOPOLOGY);
+		const auto backend = std::make_shared<simulated_backend>(topology);
+		auto net = std::make_shared<WinMTRNet>(&options, backend);
+		std::stop_source stop;
+		const auto tracer = net->DoTrace(stop.get_token(), { topology.destination() }, backend->now());
+		backend->run_for(TRACE_TIME);
+		stop.request_stop();
+		// long enough for every loop to come out of its wait and see the stop
+		backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+		return net;
+	}
+
+	[[nodiscard]]
+	bool contains(std::wstring_view text, std::wstring_view what) noexcept
+	{
+		return text.find(what) != std::wstring_view::npos;
+	}
+}
+
+WINMTR_TEST(report_writer_writes_every_format)
+{
+	const winmtr::test::options options;
+	const auto net = traced(options);
+	report_snapshot snapshot;
+	snapshot.take(*net, L"example.net");
+	// a row per router, two for the hop with two
+	WINMTR_REQUIRE(snapshot.hops().size() == 12);
+	WINMTR_CHECK(snapshot.reached());
+
+	std::wstring out;
+	snapshot.write(out, report_format::text);
+	WINMTR_CHECK(contains(out, L"WinMTR statistics"sv));
+	WINMTR_CHECK(contains(out, L"203.0.113.9"sv));
+	WINMTR_CHECK(contains(out, L"No response from host"sv));
+	WINMTR_CHECK(contains(out, L" \\_ 10.0.0."sv));
+
+	out.clear();
+	snapshot.write(out, report_format::html);
+	WINMTR_CHECK(contains(out, L"<table><thead>"sv));
+	WINMTR_CHECK(contains(out, L"</tbody></table>"sv));
+
+	out.clear();
+	snapshot.write(out, report_format::json);
+	WINMTR_CHECK(out.starts_with(L"{\"host\":\"example.net\",\"reached\":true,\"hops\":[{\"ttl\":1,\"path\":0,\"host\":\"192.0.2.1\""sv));
+	WINMTR_CHECK(contains(out, L"\"address\":null"sv));
+	WINMTR_CHECK(out.ends_with(L"}\n"sv));
+
+	out.clear();
+	snapshot.write(out, report_format::csv);
+	// the header and a line per row
+	WINMTR_CHECK(std::ranges::count(out, L'\n') == 13);
+	WINMTR_CHECK(out.starts_with(L"target,ttl,path,host,address,asn,loss_pct,sent,recv,late,best_ms,"sv));
+	WINMTR_CHECK(contains(out, L"\n\"example.net\",1,0,\"192.0.2.1\",192.0.2.1,0,0,"sv));
+
+	out.clear();
+	snapshot.write(out, report_format::markdown);
+	WINMTR_CHECK(out.starts_with(L"| Host | Loss % |"sv));
+	WINMTR_CHECK(contains(out, L"\n| 192.0.2.1 | 0 | "sv));
+
+	out.clear();
+	snapshot.write(out, report_format::xml);
+	WINMTR_CHECK(out.starts_with(L"<?xml version=\"1.0\"?>\n<report host=\"example.net\" reached=\"true\""sv));
+	WINMTR_CHECK(out.ends_with(L"</report>\n"sv));
+}
+
+WINMTR_TEST(report_writer_escapes_what_each_format_needs)
+{
+	const winmtr::test::options options;
+	const auto net = traced(options);
+	report_snapshot snapshot;
+	snapshot.take(*net, L"a\"<b>&c|");
+
+	std::wstring out;
+	snapshot.write(out, report_format::json);
+	WINMTR_CHECK(out.starts_with(L"{\"host\":\"a\\\"<b>&c|\""sv));
+	out.clear();
+	snapshot.write(out, report_format::xml);
+	WINMTR_CHECK(contains(out, L"<report host=\"a&quot;&lt;b&gt;&amp;c|\""sv));
+	out.clear();
+	snapshot.write(out, report_format::csv);
+	WINMTR_CHECK(contains(out, L"\n\"a\"\"<b>&c|\",1,"sv));
+}
+
+WINMTR_TEST(report_writer_allocates_nothing_the_second_time)
+{
+	const winmtr::test::options options;
+	const auto net = traced(options);
+	report_snapshot snapshot;
+	std::wstring out;
+	// the first round grows the rows and the buffer to what this trace takes
+	snapshot.take(*net, L"example.net");
+	for (const auto& [format, name] : FORMATS) {
+		out.clear();
+		snapshot.write(out, format);
+	}
+	const auto allocationsBefore = winmtr::test::allocations();
+	for (const auto& [format, name] : FORMATS) {
+		out.clear();
+		snapshot.write(out, format);
+	}
+	WINMTR_CHECK(winmtr::test::allocations() == allocationsBefore);
+}
+
+WINMTR_BENCH(report_rendering_throughput)
+{
+	const winmtr::test::options options;
+	const auto net = traced(options);
+	report_snapshot snapshot;
+	std::wstring out;
+	snapshot.take(*net, L"example.net");
+	for (const auto& [format, name] : FORMATS) {
+		out.clear();
+		snapshot.write(out, format);
+	}
+	std::printf("  %zu rows\n", snapshot.hops().size());
+
+	for (const auto& [format, name] : FORMATS) {
+		const auto allocationsBefore = winmtr::test::allocations();
+		const auto started = std::chrono::steady_clock::now();
+		for (int i = 0; i < RENDERS; ++i) {
+			out.clear();
+			snapshot.write(out, format);
+		}
+		const auto elapsed = winmtr::test::seconds(std::chrono::steady_clock::now() - started);
+		const auto allocations = winmtr::test::allocations() - allocationsBefore;
+		std::printf("  %s, %zu characters\n", name, out.size());
+		winmtr::test::report("reports per second", RENDERS / elapsed, "reports/s");
+		winmtr::test::report("report", elapsed * 1e6 / RENDERS, "us");
+		winmtr::test::report("allocations", static_cast<double>(allocations), "allocations");
+		WINMTR_CHECK(allocations == 0);
+	}
+
+	// what an export or a report mode run does, a fresh snapshot then the report
+	const auto allocationsBefore = winmtr::test::allocations();
+	const auto started = std::chrono::steady_clock::now();
+	for (int i = 0; i < RENDERS; ++i) {
+		snapshot.take(*net, L"example.net");
+		out.clear();
+		snapshot.write(out, report_format::text);
+	}
+	const auto elapsed = winmtr::test::seconds(std::chrono::steady_clock::now() - started);
+	std::printf("  snapshot and text\n");
+	winmtr::test::report("reports per second", RENDERS / elapsed, "reports/s");
+	winmtr::test::report("allocations per report", static_cast<double>(winmtr::test::allocations() - allocationsBefore) / RENDERS, "allocations");
+}
@@ -0,0 +1,118 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRRttEstimator-test.cpp
+//
+//
+// DESCRIPTION:
+//   The RFC 6298 timeout a hop's probes wait for: before any answer, after
+//   the first and a later one, backing off, and held between the floor and
+//   the ceiling.
+//
+//*****************************************************************************
+#include <chrono>
+#include "WinMTRTest.h"
+import WinMTR.RttEstimator;
+
+using namespace std::literals;
+
+namespace {
+	// what the trace loops use
+	constexpr auto FLOOR = 250ms;
+	constexpr auto CEILING = 5000ms;
+}
+
+WINMTR_TEST(rtt_estimator_starts_at_a_second)
+{
+	WINMTR_CHECK(rtt_estimator(FLOOR, CEILING).timeout() == 1000ms);
+	// unless the limits say otherwise
+	WINMTR_CHECK(rtt_estimator(2s, CEILING).timeout() == 2000ms);
+	WINMTR_CHECK(rtt_estimator(100ms, 500ms).timeout() == 500ms);
+}
+
+WINMTR_TEST(rtt_estimator_takes_its_first_sample_whole)
+{
+	// SRTT = R, RTTVAR = R / 2, RTO = SRTT + 4 RTTVAR
+	rtt_estimator rto(FLOOR, CEILING);
+	rto.sample(100ms);
+	WINMTR_CHECK(rto.timeout() == 300ms);
+}
+
+WINMTR_TEST(rtt_estimator_moves_a_fraction_of_the_way_on_later_samples)
+{
+	rtt_estimator rto(FLOOR, CEILING);
+	rto.sample(100ms);
+	// RTTVAR = 3/4 50 + 1/4 |100 - 200| = 62.5, SRTT = 7/8 100 + 1/8 200 = 112.5,
+	// RTO = 112.5 + 4 * 62.5 = 362.5, rounded up to the millisecond
+	rto.sample(200ms);
+	WINMTR_CHECK(rto.timeout() == 363ms);
+	// right on SRTT, only the variation shrinks: RTTVAR = 3/4 62.5 = 46.875, RTO = 112.5 + 187.5
+	rto.sample(112500us);
+	WINMTR_CHECK(rto.timeout() == 300ms);
+}
+
+WINMTR_TEST(rtt_estimator_backs_off_up_to_the_ceiling)
+{
+	rtt_estimator rto(FLOOR, CEILING);
+	rto.sample(100ms);
+	rto.sample(200ms);
+	// doubled from the unrounded 362.5 each time
+	rto.back_off();
+	WINMTR_CHECK(rto.timeout() == 725ms);
+	rto.back_off();
+	WINMTR_CHECK(rto.timeout() == 1450ms);
+	rto.back_off();
+	WINMTR_CHECK(rto.timeout() == 2900ms);
+	rto.back_off();
+	WINMTR_CHECK(rto.timeout() == CEILING);
+	rto.back_off();
+	WINMTR_CHECK(rto.timeout() == CEILING);
+	// the next answer starts it over from the estimate
+	rto.sample(112500us);
+	WINMTR_CHECK(rto.timeout() == 300ms);
+	// and with nothing measured yet it backs off from the second it started at
+	rtt_estimator fresh(FLOOR, CEILING);
+	fresh.back_off();
+	WINMTR_CHECK(fresh.timeout() == 2000ms);
+}
+
+WINMTR_TEST(rtt_estimator_keeps_to_the_floor_and_the_ceiling)
+{
+	// 1 + 4 * 0.5 ms is well under the floor
+	rtt_estimator fast(FLOOR, CEILING);
+	fast.sample(1ms);
+	WINMTR_CHECK(fast.timeout() == FLOOR);
+	// 3 + 4 * 1.5 s is well over the ceiling
+	rtt_estimator slow(FLOOR, CEILING);
+	slow.sample(3s);
+	WINMTR_CHECK(slow.timeout() == CEILING);
+	// without a floor the clock granularity is the least the variation adds: 0.1 + 1 ms, rounded up
+	rtt_estimator unbounded(0ms, CEILING);
+	unbounded.sample(100us);
+	WINMTR_CHECK(unbounded.timeout() == 2ms);
+	// a ceiling under the floor is the floor
+	rtt_estimator pinned(1s, 500ms);
+	WINMTR_CHECK(pinned.timeout() == 1000ms);
+	pinned.sample(1ms);
+	WINMTR_CHECK(pinned.timeout() == 1000ms);
+	pinned.back_off();
+	WINMTR_CHECK(pinned.timeout() == 1000ms);
+}
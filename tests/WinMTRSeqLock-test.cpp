@@ -0,0 +1,199 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSeqLock-test.cpp
+//
+//
+// DESCRIPTION:
+//   The seqlock under a writer that never lets up, and the benchmark of a
+//   hop table behind one seqlock per hop against one behind a single mutex,
+//   the way the trace was guarded before.
+//
+// NOTES:
+//    The writers never let up, a real trace loop writes once per answer. On
+//    fewer cores than hops the seqlock's writers, which never wait, crowd
+//    the reader out, where the mutex's writers would have taken turns with
+//    it. The snapshot numbers mean the most with a core per writer.
+//
+//*****************************************************************************
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.SeqLock;
+
+using namespace std::literals;
+
+namespace {
+	// a trace loop per hop of a long trace
+	constexpr auto HOPS = 30;
+	constexpr auto BENCH_TIME = 2s;
+
+	// shaped like the hop counters, every field follows from xmit so a torn copy shows
+	struct counters final {
+		int xmit = 0;
+		int returned = 0;
+		std::uint64_t total = 0;
+		int last = 0;
+		int best = 0;
+		int worst = 0;
+		double mean = 0.0;
+		double m2 = 0.0;
+		double jitter = 0.0;
+		double ewma = 0.0;
+
+		void count() noexcept
+		{
+			++xmit;
+			returned = xmit;
+			total = std::uint64_t{ 7 } * static_cast<std::uint64_t>(xmit);
+			last = best = worst = xmit;
+			mean = m2 = jitter = ewma = xmit;
+		}
+
+		[[nodiscard]]
+		bool consistent() const noexcept
+		{
+			return returned == xmit && total == std::uint64_t{ 7 } * static_cast<std::uint64_t>(xmit)
+				&& last == xmit && best == xmit && worst == xmit
+				&& mean == xmit && m2 == xmit && jitter == xmit && ewma == xmit;
+		}
+	};
+
+	// how the hop table is guarded, the two contenders of the benchmark
+	struct seqlock_table final {
+		// a cache line each, as the hop slots are
+		struct alignas(64) slot final {
+			seqlock<counters> value;
+		};
+		std::array<slot, HOPS> hops;
+
+		void count(int hop) noexcept
+		{
+			hops[hop].value.update([](counters& c) noexcept { c.count(); });
+		}
+		[[nodiscard]]
+		counters read(int hop) const noexcept
+		{
+			return hops[hop].value.load();
+		}
+	};
+
+	struct mutex_table final {
+		mutable std::mutex lock;
+		std::array<counters, HOPS> hops;
+
+		void count(int hop)
+		{
+			std::scoped_lock guard(lock);
+			hops[hop].count();
+		}
+		[[nodiscard]]
+		counters read(int hop) const
+		{
+			std::scoped_lock guard(lock);
+			return hops[hop];
+		}
+	};
+
+	// one writer per hop flat out, one reader taking snapshots of the whole table
+	template<class Table>
+	void contend(const char* label)
+	{
+		const auto table = std::make_unique<Table>();
+		std::atomic_bool running{ true };
+		std::vector<std::thread> writers;
+		for (int hop = 0; hop < HOPS; ++hop) {
+			writers.emplace_back([&table, &running, hop] {
+				while (running.load(std::memory_order_relaxed)) {
+					table->count(hop);
+				}
+			});
+		}
+		std::uint64_t snapshots = 0;
+		std::uint64_t torn = 0;
+		auto slowest = std::chrono::steady_clock::duration::zero();
+		const auto started = std::chrono::steady_clock::now();
+		for (auto now = started; now - started < BENCH_TIME; ++snapshots) {
+			for (int hop = 0; hop < HOPS; ++hop) {
+				torn += table->read(hop).consistent() ? 0 : 1;
+			}
+			const auto taken = std::chrono::steady_clock::now();
+			slowest = std::max(slowest, taken - now);
+			now = taken;
+		}
+		running = false;
+		for (auto& writer : writers) {
+			writer.join();
+		}
+		const auto elapsed = winmtr::test::seconds(std::chrono::steady_clock::now() - started);
+		std::uint64_t updates = 0;
+		for (int hop = 0; hop < HOPS; ++hop) {
+			updates += static_cast<std::uint64_t>(table->read(hop).xmit);
+		}
+		std::printf("  %s\n", label);
+		winmtr::test::report("hop updates per second, all writers", static_cast<double>(updates) / elapsed, "updates/s");
+		winmtr::test::report("table snapshots per second", static_cast<double>(snapshots) / elapsed, "snapshots/s");
+		winmtr::test::report("slowest snapshot", winmtr::test::seconds(slowest) * 1e6, "us");
+		WINMTR_CHECK(torn == 0);
+	}
+}
+
+WINMTR_TEST(seqlock_reads_are_never_torn)
+{
+	seqlock<counters> shared;
+	std::atomic_bool running{ true };
+	std::thread writer([&shared, &running] {
+		while (running.load(std::memory_order_relaxed)) {
+			shared.update([](counters& c) noexcept { c.count(); });
+		}
+	});
+	std::uint64_t torn = 0;
+	int previous = 0;
+	bool forward = true;
+	const auto started = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - started < 500ms) {
+		const auto value = shared.load();
+		torn += value.consistent() ? 0 : 1;
+		// one writer, so nobody ever sees it go back
+		forward = forward && value.xmit >= previous;
+		previous = value.xmit;
+	}
+	running = false;
+	writer.join();
+	WINMTR_CHECK(torn == 0);
+	WINMTR_CHECK(forward);
+	WINMTR_CHECK(shared.load().consistent());
+	WINMTR_CHECK(shared.load_exclusive().xmit == shared.load().xmit);
+}
+
+WINMTR_BENCH(seqlock_vs_mutex_contention)
+{
+	contend<seqlock_table>("one seqlock per hop");
+	contend<mutex_table>("one mutex for the whole trace");
+}
@@ -0,0 +1,159 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSessionManager-test.cpp
+//
+//
+// DESCRIPTION:
+//   The session manager under the load it is sized for, 1,000 traces of the
+//   loopback interface at the default interval with the whole process held
+//   to one core.
+//
+//*****************************************************************************
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Net;
+import WinMTR.SessionManager;
+import WinMTR.Test.Options;
+import WinMTRSNetHost;
+
+using namespace std::literals;
+
+namespace {
+	constexpr auto SESSIONS = 1000;
+	constexpr auto LOAD_TIME = 10s;
+	// discovery and the first round of a thousand traces take a moment to settle
+	constexpr auto SETTLE_TIME = 2s;
+
+	// the defaults, but for the probe rate cap the load would run into
+	[[nodiscard]]
+	winmtr::test::options load_options()
+	{
+		winmtr::test::options options;
+		options.maxProbeRate = 0;
+		options.maxByteRate = 0;
+		return options;
+	}
+
+	[[nodiscard]]
+	SOCKADDR_INET loopback() noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv4.sin_family = AF_INET;
+		addr.Ipv4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return addr;
+	}
+
+	// kernel and user time of the whole process so far
+	[[nodiscard]]
+	std::chrono::nanoseconds cpu_time() noexcept
+	{
+		FILETIME created, exited, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+			return {};
+		}
+		const auto ticks = [](const FILETIME& time) noexcept {
+			return (std::uint64_t{ time.dwHighDateTime } << 32) | time.dwLowDateTime;
+		};
+		// in units of 100 ns
+		return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+	}
+
+	// every thread of the process on the first core it may run on, until it goes out of scope
+	class one_core final {
+		one_core(const one_core&) = delete;
+		one_core& operator=(const one_core&) = delete;
+	public:
+		one_core() noexcept
+		{
+			DWORD_PTR system = 0;
+			if (GetProcessAffinityMask(GetCurrentProcess(), &m_previous, &system) && m_previous) {
+				m_pinned = SetProcessAffinityMask(GetCurrentProcess(), m_previous & (~m_previous + 1));
+			}
+		}
+		~one_core() noexcept
+		{
+			if (m_pinned) {
+				SetProcessAffinityMask(GetCurrentProcess(), m_previous);
+			}
+		}
+		[[nodiscard]]
+		explicit operator bool() const noexcept
+		{
+			return m_pinned;
+		}
+	private:
+		DWORD_PTR m_previous = 0;
+		bool m_pinned = false;
+	};
+}
+
+WINMTR_TEST(session_manager_keeps_up_on_one_core)
+{
+	const one_core pinned;
+	WINMTR_REQUIRE(pinned);
+	const auto options = load_options();
+	std::optional<session_manager> manager{ std::in_place, &options };
+	std::vector<session_manager::session_id> ids;
+	ids.reserve(SESSIONS);
+	for (int i = 0; i < SESSIONS; ++i) {
+		ids.push_back(manager->start(loopback()));
+	}
+	WINMTR_REQUIRE(manager->size() == SESSIONS);
+
+	Sleep(static_cast<DWORD>(std::chrono::milliseconds(SETTLE_TIME).count()));
+	const auto cpuBefore = cpu_time();
+	const auto started = std::chrono::steady_clock::now();
+	Sleep(static_cast<DWORD>(std::chrono::milliseconds(LOAD_TIME).count()));
+	const auto cpuUsed = cpu_time() - cpuBefore;
+	const auto elapsed = std::chrono::steady_clock::now() - started;
+
+	// loopback answers at the first TTL, each session is a single hop
+	std::uint64_t sent = 0;
+	std::uint64_t lost = 0;
+	int behind = 0;
+	for (const auto id : ids) {
+		const auto net = manager->find(id);
+		WINMTR_REQUIRE(net);
+		const auto hop = net->getStateAt(0);
+		sent += hop.xmit;
+		lost += static_cast<std::uint64_t>(hop.xmit - hop.returned);
+		// a session that kept up probed once a second all along, give or take the one in flight
+		behind += hop.xmit < static_cast<int>(std::chrono::duration_cast<std::chrono::seconds>(SETTLE_TIME + LOAD_TIME).count()) - 2;
+	}
+	const auto cpuShare = winmtr::test::seconds(cpuUsed) / winmtr::test::seconds(elapsed);
+	winmtr::test::report("probes per second, all sessions", static_cast<double>(sent) / winmtr::test::seconds(SETTLE_TIME + LOAD_TIME), "probes/s");
+	winmtr::test::report("share of the core used", cpuShare * 100.0, "%");
+	winmtr::test::report("sessions that fell behind", behind, "sessions");
+	WINMTR_CHECK(behind == 0);
+	WINMTR_CHECK(lost * 100 <= sent);
+
+	manager.reset();
+}
@@ -0,0 +1,676 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRSimulatedBackend-test.cpp
+//
+//
+// DESCRIPTION:
+//   WinMTRNet tracing a simulated network, an hour of it on the virtual
+//   clock, and the per hop loss, round trip and late counts it ends up with.
+//   A capture of a trace replayed to the same counts. The race between a
+//   destination's IPv6 and IPv4 address and the time to the first probe.
+//   The hop count discovery finds and the probes it saves. Load balanced
+//   hops on rows of their own, and the probe sequences the trace loops keep
+//   clear of discovery's.
+//   And the benchmarks of
+//   what a trace costs to start at 30 and 255 hops, and what replaying a
+//   day's capture costs.
+//
+// NOTES:
+//    Everything runs on the test's thread, the backend resumes the trace
+//    loops from run_for() and the trace's own awaits complete inline.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "WinMTRTest.h"
+import WinMTR.Capture;
+import WinMTR.EventLog;
+import WinMTR.Net;
+import WinMTR.ProbeBackend.Simulated;
+import WinMTR.Test.Options;
+import WinMTRSNetHost;
+import WinMTRUtils;
+
+using namespace std::literals;
+
+namespace {
+	// a gateway, a lossy hop, one that never answers, two routers sharing
+	// a TTL and a destination whose slowest answers outrun the timeout
+	constexpr std::string_view TOPOLOGY = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.1 latency=normal:10:2 loss=0.5
+		hop *
+		hop 198.51.100.21,198.51.100.22 latency=fixed:20 ecmp=packet
+		hop 203.0.113.9 latency=exp:0:100
+	)";
+	// A gateway slower than the first timeout, which is always a second, and
+	// two routers that share the destination's tail between them. The
+	// gateway's first probe is late every time, its first answer the second.
+	constexpr std::string_view SLOW_START = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1500
+		hop 198.51.100.21,198.51.100.22 latency=exp:0:100 ecmp=packet
+		hop 203.0.113.9 latency=fixed:5
+	)";
+	// a destination with an address in each family, the family lines decide which of them get through
+	constexpr std::string_view DUAL_STACK = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 203.0.113.9 latency=fixed:20
+	)";
+	// ten routers behind one TTL, two more than there are rows for
+	constexpr std::string_view WIDE_ECMP = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.1,198.51.100.2,198.51.100.3,198.51.100.4,198.51.100.5,198.51.100.6,198.51.100.7,198.51.100.8,198.51.100.9,198.51.100.10 latency=fixed:5 ecmp=packet
+		hop 203.0.113.9 latency=fixed:10
+	)";
+	// two routers a flow hash picks between
+	constexpr std::string_view PER_FLOW = R"(
+		seed 7
+		hop 192.0.2.1 latency=fixed:1
+		hop 198.51.100.21,198.51.100.22 latency=fixed:5 ecmp=flow
+		hop 203.0.113.9 latency=fixed:10
+	)";
+	// the destination right away, for as many probes as the clock can take
+	constexpr std::string_view ONE_HOP = R"(
+		seed 7
+		hop 203.0.113.9 latency=fixed:1
+	)";
+	// the race, discovery and a few rounds of the winner
+	constexpr auto RACE_TIME = 10s;
+	constexpr auto TRACE_TIME = 1h;
+	// a day of a 30 hop trace at a probe a second, for the replay
+	constexpr auto DAY_HOPS = 30;
+	constexpr auto DAY = 86'400;
+	// discovery and a few rounds of every hop it spawned
+	constexpr auto STARTUP_TIME = 10s;
+
+	// every row of the trace after it ran for duration of virtual time and wound down
+	[[nodiscard]]
+	std::vector<s_nethost> trace(std::chrono::seconds duration, std::string_view text = TOPOLOGY, const winmtr::test::options& options = {})
+	{
+		const auto topology = sim_topology::parse(text);
+		const auto backend = std::make_shared<simulated_backend>(topology);
+		const auto net = std::make_shared<WinMTRNet>(&options, backend);
+		std::stop_source stop;
+		const auto tracer = net->DoTrace(stop.get_token(), { topology.destination() }, backend->now());
+		backend->run_for(duration);
+		stop.request_stop();
+		// long enough for every loop to come out of its wait and see the stop
+		backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+		return net->getCurrentState();
+	}
+
+	// the simulated backend, counting the probes that go out by their sequence
+	class counting_backend final : public probe_backend {
+	public:
+		explicit counting_backend(sim_topology topology)
+			:m_backend(std::move(topology))
+		{
+		}
+
+		[[nodiscard]]
+		clock::time_point now() const noexcept override
+		{
+			return m_backend.now();
+		}
+		[[nodiscard]]
+		token_bucket& rate_limit() noexcept override
+		{
+			return m_backend.rate_limit();
+		}
+		[[nodiscard]]
+		bool supports(probe_protocol protocol) const noexcept override
+		{
+			return m_backend.supports(protocol);
+		}
+		[[nodiscard]]
+		std::uint64_t probes_sent() const noexcept override
+		{
+			return m_backend.probes_sent();
+		}
+		void submit(probe_request& request) override
+		{
+			++m_sent[request.key().sequence];
+			m_backend.submit(request);
+		}
+		void schedule(probe_delay& delay) override
+		{
+			m_backend.schedule(delay);
+		}
+
+		std::size_t run_for(clock::duration duration)
+		{
+			return m_backend.run_for(duration);
+		}
+		[[nodiscard]]
+		std::uint32_t sent(std::uint16_t sequence) const noexcept
+		{
+			return m_sent[sequence];
+		}
+	private:
+		simulated_backend m_backend;
+		std::vector<std::uint32_t> m_sent = std::vector<std::uint32_t>(0x10000);
+	};
+
+	[[nodiscard]]
+	SOCKADDR_INET ipv4_destination() noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv4.sin_family = AF_INET;
+		addr.Ipv4.sin_addr.s_addr = htonl(0xCB007109u);
+		return addr;
+	}
+
+	// 2001:db8::9
+	[[nodiscard]]
+	SOCKADDR_INET ipv6_destination() noexcept
+	{
+		SOCKADDR_INET addr{};
+		addr.Ipv6.sin6_family = AF_INET6;
+		addr.Ipv6.sin6_addr.s6_addr[0] = 0x20;
+		addr.Ipv6.sin6_addr.s6_addr[1] = 0x01;
+		addr.Ipv6.sin6_addr.s6_addr[2] = 0x0d;
+		addr.Ipv6.sin6_addr.s6_addr[3] = 0xb8;
+		addr.Ipv6.sin6_addr.s6_addr[15] = 0x09;
+		return addr;
+	}
+
+	struct dual_stack_trace final {
+		std::shared_ptr<simulated_backend> backend;
+		std::shared_ptr<WinMTRNet> net;
+	};
+
+	// DUAL_STACK and families traced for RACE_TIME, IPv6 first as a resolver
+	// would have it, with resolving having taken the given time before that
+	[[nodiscard]]
+	dual_stack_trace race(std::string_view families, std::chrono::milliseconds resolving = {})
+	{
+		// outlives the WinMTRNet handed back
+		static const winmtr::test::options options;
+		const auto topology = sim_topology::parse(std::string{ DUAL_STACK } + std::string{ families });
+		dual_stack_trace traced{ .backend = std::make_shared<simulated_backend>(topology) };
+		traced.net = std::make_shared<WinMTRNet>(&options, traced.backend);
+		std::stop_source stop;
+		const auto tracer = traced.net->DoTrace(stop.get_token(), { ipv6_destination(), ipv4_destination() }, traced.backend->now() - resolving);
+		// nothing goes out before the backend runs
+		WINMTR_CHECK(!traced.net->getTimeToFirstProbe());
+		traced.backend->run_for(RACE_TIME);
+		stop.request_stop();
+		traced.backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+		return traced;
+	}
+
+	[[nodiscard]]
+	std::vector<s_nethost> rows_at(const std::vector<s_nethost>& state, int ttl)
+	{
+		std::vector<s_nethost> rows;
+		for (const auto& row : state) {
+			if (row.ttl == ttl) {
+				rows.push_back(row);
+			}
+		}
+		return rows;
+	}
+
+	[[nodiscard]]
+	double returned_share(const s_nethost& row, int xmit) noexcept
+	{
+		return xmit ? static_cast<double>(row.returned) / xmit : 0.0;
+	}
+
+	// Eleven routers and a destination, which with loss=1 never answers and
+	// leaves the trace to go out as far as it may.
+	[[nodiscard]]
+	std::string twelve_hops(bool reachable)
+	{
+		std::string text = "seed 7\n";
+		for (int ttl = 1; ttl < 12; ++ttl) {
+			text += "hop 10.0.0." + std::to_string(ttl) + " latency=fixed:5\n";
+		}
+		text += reachable ? "hop 203.0.113.9 latency=fixed:5\n" : "hop 203.0.113.9 latency=fixed:5 loss=1\n";
+		return text;
+	}
+
+	// the wall time and memory from a new WinMTRNet to STARTUP_TIME into its trace
+	void startup(const char* label, unsigned maxHops, bool reachable)
+	{
+		winmtr::test::options options;
+		options.maxHops = maxHops;
+		const auto topology = sim_topology::parse(twelve_hops(reachable));
+		const auto backend = std::make_shared<simulated_backend>(topology);
+
+		const auto allocationsBefore = winmtr::test::allocations();
+		const auto bytesBefore = winmtr::test::allocated_bytes();
+		const auto started = std::chrono::steady_clock::now();
+		const auto net = std::make_shared<WinMTRNet>(&options, backend);
+		const auto constructed = std::chrono::steady_clock::now() - started;
+		const auto constructedBytes = winmtr::test::allocated_bytes() - bytesBefore;
+
+		std::stop_source stop;
+		const auto tracer = net->DoTrace(stop.get_token(), { topology.destination() }, backend->now());
+		backend->run_for(STARTUP_TIME);
+		const auto running = std::chrono::steady_clock::now() - started;
+		const auto allocations = winmtr::test::allocations() - allocationsBefore;
+		const auto bytes = winmtr::test::allocated_bytes() - bytesBefore;
+		const auto rows = net->getCurrentState().size();
+
+		stop.request_stop();
+		backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+		WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+
+		std::printf("  %s\n", label);
+		winmtr::test::report("construction", winmtr::test::seconds(constructed) * 1e6, "us");
+		winmtr::test::report("bytes allocated by construction", static_cast<double>(constructedBytes), "bytes");
+		winmtr::test::report("construction and the first 10 s of the trace", winmtr::test::seconds(running) * 1e3, "ms");
+		winmtr::test::report("bytes allocated by then", static_cast<double>(bytes), "bytes");
+		winmtr::test::report("allocations by then", static_cast<double>(allocations), "allocations");
+		winmtr::test::report("rows by then", static_cast<double>(rows), "rows");
+		WINMTR_CHECK(rows <= maxHops);
+	}
+}
+
+WINMTR_TEST(simulated_trace_finds_every_hop)
+{
+	const auto state = trace(TRACE_TIME);
+	// one row per hop, two for the hop with two routers
+	WINMTR_REQUIRE(state.size() == 6);
+	for (int ttl = 1; ttl <= 5; ++ttl) {
+		WINMTR_CHECK(!rows_at(state, ttl).empty());
+	}
+	WINMTR_CHECK(rows_at(state, 4).size() == 2);
+}
+
+WINMTR_TEST(simulated_trace_counts_loss)
+{
+	const auto state = trace(TRACE_TIME);
+	const auto gateway = rows_at(state, 1).at(0);
+	WINMTR_CHECK(gateway.xmit > 3000);
+	WINMTR_CHECK(gateway.returned == gateway.xmit);
+	WINMTR_CHECK(gateway.late == 0);
+
+	// half of it, give or take six standard deviations of a few thousand coin flips
+	const auto lossy = rows_at(state, 2).at(0);
+	WINMTR_CHECK(lossy.xmit > 1000);
+	WINMTR_CHECK(returned_share(lossy, lossy.xmit) > 0.42);
+	WINMTR_CHECK(returned_share(lossy, lossy.xmit) < 0.58);
+	WINMTR_CHECK(lossy.late == 0);
+
+	const auto silent = rows_at(state, 3).at(0);
+	WINMTR_CHECK(silent.xmit > 0);
+	WINMTR_CHECK(silent.returned == 0);
+	WINMTR_CHECK(silent.getPercent() == 100);
+
+	// per packet, each router takes about half and nothing is lost
+	const auto paths = rows_at(state, 4);
+	WINMTR_REQUIRE(paths.size() == 2);
+	const auto xmit = paths[0].xmit + paths[1].xmit;
+	WINMTR_CHECK(paths[0].returned + paths[1].returned == xmit);
+	WINMTR_CHECK(returned_share(paths[0], xmit) > 0.4);
+	WINMTR_CHECK(returned_share(paths[1], xmit) > 0.4);
+}
+
+WINMTR_TEST(simulated_trace_measures_round_trips)
+{
+	const auto state = trace(TRACE_TIME);
+	// microseconds, a fixed latency leaves nothing to spread
+	const auto gateway = rows_at(state, 1).at(0);
+	WINMTR_CHECK(gateway.best == 1000);
+	WINMTR_CHECK(gateway.worst == 1000);
+	WINMTR_CHECK(gateway.getAvg() == 1000);
+	WINMTR_CHECK(gateway.stddev == 0.0);
+
+	// whether or not its first probe was lost
+	const auto lossy = rows_at(state, 2).at(0);
+	WINMTR_CHECK(lossy.best > 0);
+	WINMTR_CHECK(lossy.best <= lossy.getAvg());
+	WINMTR_CHECK(lossy.getAvg() > 9500);
+	WINMTR_CHECK(lossy.getAvg() < 10500);
+	WINMTR_CHECK(lossy.stddev > 1500.0);
+	WINMTR_CHECK(lossy.stddev < 2500.0);
+
+	for (const auto& path : rows_at(state, 4)) {
+		WINMTR_CHECK(path.getAvg() == 20000);
+	}
+
+	// the tail past the timeout is missing from the average, it can only come out lower
+	const auto destination = rows_at(state, 5).at(0);
+	WINMTR_CHECK(destination.getAvg() > 70000);
+	WINMTR_CHECK(destination.getAvg() < 105000);
+	WINMTR_CHECK(destination.p50 < destination.p99);
+}
+
+WINMTR_TEST(simulated_trace_counts_late_replies)
+{
+	const auto state = trace(TRACE_TIME);
+	// the destination never drops anything, every probe it didn't answer in time it answered late
+	const auto destination = rows_at(state, 5).at(0);
+	WINMTR_CHECK(destination.xmit > 3000);
+	WINMTR_CHECK(destination.late > 0);
+	WINMTR_CHECK(destination.returned + destination.late == destination.xmit);
+	// an exponential tail past a timeout fitted to it is a few percent at most
+	WINMTR_CHECK(destination.late < destination.xmit / 10);
+}
+
+WINMTR_TEST(simulated_trace_does_not_count_late_replies_as_lost)
+{
+	// the gateway answers every probe, its first one after the timeout
+	const auto state = trace(10min, SLOW_START);
+	const auto gateway = rows_at(state, 1).at(0);
+	WINMTR_REQUIRE(gateway.late >= 1);
+	WINMTR_CHECK(gateway.returned < gateway.xmit);
+	WINMTR_CHECK(gateway.getPercent() == 0);
+	// and a destination whose tail outruns the timeout loses nothing either
+	const auto destination = rows_at(trace(TRACE_TIME), 5).at(0);
+	WINMTR_REQUIRE(destination.late > 0);
+	WINMTR_CHECK(destination.getPercent() == 0);
+}
+
+WINMTR_TEST(simulated_trace_keeps_best_after_a_timeout)
+{
+	const auto state = trace(10min, SLOW_START);
+	const auto gateway = rows_at(state, 1).at(0);
+	WINMTR_CHECK(gateway.late >= 1);
+	WINMTR_CHECK(gateway.returned + gateway.late == gateway.xmit);
+	WINMTR_CHECK(gateway.best == 1'500'000);
+	WINMTR_CHECK(gateway.worst == 1'500'000);
+}
+
+WINMTR_TEST(simulated_trace_counts_late_replies_per_path)
+{
+	const auto state = trace(TRACE_TIME, SLOW_START);
+	const auto paths = rows_at(state, 2);
+	WINMTR_REQUIRE(paths.size() == 2);
+	// each on its own row, and with nothing lost each row adds up on its own
+	for (const auto& path : paths) {
+		WINMTR_CHECK(path.late > 0);
+		WINMTR_CHECK(path.returned + path.late == path.xmit);
+	}
+}
+
+WINMTR_TEST(simulated_trace_is_deterministic)
+{
+	const auto first = trace(10min);
+	const auto second = trace(10min);
+	WINMTR_REQUIRE(first.size() == second.size());
+	for (std::size_t i = 0; i < first.size(); ++i) {
+		WINMTR_CHECK(first[i].xmit == second[i].xmit);
+		WINMTR_CHECK(first[i].returned == second[i].returned);
+		WINMTR_CHECK(first[i].late == second[i].late);
+		WINMTR_CHECK(first[i].total == second[i].total);
+	}
+}
+
+WINMTR_TEST(simulated_trace_replays_to_the_same_counts)
+{
+	const winmtr::test::scratch_path file("winmtr-simulated-replay.cap");
+	auto writer = capture_writer::open(file.path());
+	WINMTR_REQUIRE(writer);
+	capture_writer::install(writer);
+	const auto live = trace(10min);
+	capture_writer::install(nullptr);
+	// whatever is still queued goes out as the last of it lets go
+	writer.reset();
+
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	const auto traces = capture->traces();
+	WINMTR_REQUIRE(traces.size() == 1);
+	const winmtr::test::options options;
+	const auto net = std::make_shared<WinMTRNet>(&options, std::make_shared<simulated_backend>(sim_topology::parse(TOPOLOGY)));
+	net->Replay(*capture, traces.front());
+	const auto replayed = net->getCurrentState();
+	// late replies aren't captured, everything else is counted by the same code
+	WINMTR_REQUIRE(replayed.size() == live.size());
+	for (std::size_t i = 0; i < live.size(); ++i) {
+		WINMTR_CHECK(replayed[i].ttl == live[i].ttl);
+		WINMTR_CHECK(replayed[i].xmit == live[i].xmit);
+		WINMTR_CHECK(replayed[i].returned == live[i].returned);
+		WINMTR_CHECK(replayed[i].total == live[i].total);
+		WINMTR_CHECK(replayed[i].best == live[i].best);
+		WINMTR_CHECK(replayed[i].worst == live[i].worst);
+	}
+}
+
+WINMTR_TEST(simulated_discovery_finds_the_hop_count_and_saves_probes)
+{
+	// twelve hops under the default limit of thirty
+	const winmtr::test::options options;
+	const auto topology = sim_topology::parse(twelve_hops(true));
+	const auto backend = std::make_shared<simulated_backend>(topology);
+	const auto net = std::make_shared<WinMTRNet>(&options, backend);
+	std::stop_source stop;
+	const auto tracer = net->DoTrace(stop.get_token(), { topology.destination() }, backend->now());
+	backend->run_for(10min);
+	stop.request_stop();
+	backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+	WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+
+	WINMTR_CHECK(net->getDestinationReached());
+	WINMTR_CHECK(net->GetMax() == 12);
+	const auto state = net->getCurrentState();
+	WINMTR_REQUIRE(state.size() == 12);
+	// the loops sent what the rows counted, discovery one probe a TTL up to the limit and found it in one round
+	int xmit = 0;
+	for (const auto& row : state) {
+		xmit += row.xmit;
+	}
+	constexpr auto limit = static_cast<int>(WinMTRUtils::DEFAULT_MAX_HOPS);
+	WINMTR_CHECK(backend->probes_sent() == static_cast<std::uint64_t>(xmit + limit));
+	// each probe to the destination is one the eighteen TTLs past it went without
+	const auto destination = state.back();
+	WINMTR_CHECK(destination.xmit > 500);
+	WINMTR_CHECK(net->getProbesSaved() == std::int64_t{ limit - 12 } * destination.xmit - limit);
+}
+
+WINMTR_TEST(simulated_trace_keeps_ecmp_paths_apart_up_to_the_limit)
+{
+	const auto state = trace(10min, WIDE_ECMP);
+	const auto paths = rows_at(state, 2);
+	// the first seven get a row each, the last row is shared by the rest
+	WINMTR_REQUIRE(paths.size() == WinMTRNet::MAX_PATHS);
+	int xmit = 0;
+	for (const auto& path : paths) {
+		WINMTR_CHECK(path.returned == path.xmit);
+		xmit += path.xmit;
+	}
+	// every probe of the hop on one row or another, as many as the gateway's give or take the one in flight
+	const auto gateway = rows_at(state, 1).at(0);
+	WINMTR_CHECK(xmit >= gateway.xmit - 1);
+	WINMTR_CHECK(xmit <= gateway.xmit + 1);
+	// three routers' worth on the last row against one on the others
+	for (std::size_t i = 0; i + 1 < paths.size(); ++i) {
+		WINMTR_CHECK(returned_share(paths[i], xmit) < 0.15);
+	}
+	WINMTR_CHECK(returned_share(paths.back(), xmit) > 0.2);
+}
+
+WINMTR_TEST(simulated_trace_paris_mode_stays_on_one_path)
+{
+	// a flow of every probe finds both routers, one flow for the whole trace only one of them
+	WINMTR_CHECK(rows_at(trace(10min, PER_FLOW), 2).size() == 2);
+	winmtr::test::options options;
+	options.parisMode = true;
+	const auto paris = rows_at(trace(10min, PER_FLOW, options), 2);
+	WINMTR_REQUIRE(paris.size() == 1);
+	WINMTR_CHECK(paris[0].returned == paris[0].xmit);
+}
+
+WINMTR_TEST(simulated_trace_sequences_wrap_clear_of_discovery)
+{
+	// a probe every millisecond, the loop's sequences come round again in a little over a minute
+	winmtr::test::options options;
+	options.interval = 0.001;
+	options.maxProbeRate = 0;
+	options.maxByteRate = 0;
+	const auto topology = sim_topology::parse(ONE_HOP);
+	const auto backend = std::make_shared<counting_backend>(topology);
+	const auto net = std::make_shared<WinMTRNet>(&options, backend);
+	std::stop_source stop;
+	const auto tracer = net->DoTrace(stop.get_token(), { topology.destination() }, backend->now());
+	backend->run_for(70s);
+	stop.request_stop();
+	backend->run_for(DEFAULT_PROBE_TIMEOUT * 2);
+	WINMTR_REQUIRE(tracer.Status() == trace_status::Completed);
+
+	// round the loop went, from 1 to the last before discovery's and back to 1, never 0
+	WINMTR_CHECK(backend->sent(0) == 0);
+	WINMTR_CHECK(backend->sent(1) == 2);
+	WINMTR_CHECK(backend->sent(0xFDFF) == 1);
+	// what is left is discovery's single round, one probe a TTL, and nothing else
+	WINMTR_CHECK(backend->sent(0xFE00) == WinMTRUtils::DEFAULT_MAX_HOPS);
+	std::uint64_t reserved = 0;
+	for (std::uint32_t sequence = 0xFE01; sequence <= 0xFFFF; ++sequence) {
+		reserved += backend->sent(static_cast<std::uint16_t>(sequence));
+	}
+	WINMTR_CHECK(reserved == 0);
+}
+
+WINMTR_TEST(simulated_race_goes_to_the_first_choice_on_a_tie)
+{
+	const auto traced = race("");
+	WINMTR_CHECK(traced.net->getRaceWinner() == AF_INET6);
+	WINMTR_CHECK(traced.net->getDestinationReached());
+}
+
+WINMTR_TEST(simulated_race_follows_the_family_that_answers)
+{
+	const auto traced = race("family inet6 loss=1\n");
+	WINMTR_CHECK(traced.net->getRaceWinner() == AF_INET);
+	WINMTR_CHECK(traced.net->getDestinationReached());
+	WINMTR_CHECK(traced.net->GetMax() == 2);
+}
+
+WINMTR_TEST(simulated_race_survives_a_family_that_cannot_be_sent_to)
+{
+	// the IPv6 racer's send throws, which must neither take the process down nor keep the race from ending
+	const auto traced = race("family inet6 unreachable\n");
+	WINMTR_CHECK(traced.net->getRaceWinner() == AF_INET);
+	WINMTR_CHECK(traced.net->getDestinationReached());
+}
+
+WINMTR_TEST(simulated_race_nobody_wins_goes_on_with_the_first_choice)
+{
+	// IPv6 is black holed and IPv4 can't be sent to, the trace still starts once both racers gave up
+	const auto traced = race("family inet6 loss=1\nfamily inet unreachable\n");
+	WINMTR_CHECK(traced.net->getRaceWinner() == AF_UNSPEC);
+	WINMTR_CHECK(!traced.net->getDestinationReached());
+	// the IPv6 racer, and then discovery and the loops on IPv6
+	WINMTR_CHECK(traced.backend->probes_sent() > 1 + WinMTRUtils::DEFAULT_MAX_HOPS);
+}
+
+WINMTR_TEST(simulated_trace_times_its_first_probe)
+{
+	// the racers go out as soon as the trace starts, so all of it is the resolving
+	const auto traced = race("", 40ms);
+	const auto first = traced.net->getTimeToFirstProbe();
+	WINMTR_REQUIRE(first);
+	WINMTR_CHECK(*first == 40ms);
+	// a racer that fails to send still counts as the first probe
+	const auto failed = race("family inet6 unreachable\n", 40ms);
+	WINMTR_REQUIRE(failed.net->getTimeToFirstProbe());
+	WINMTR_CHECK(*failed.net->getTimeToFirstProbe() == 40ms);
+}
+
+WINMTR_BENCH(simulated_trace_startup_at_30_and_255_hops)
+{
+	// hop slots and trace loops come as the path needs them, the limit shouldn't matter to a short one
+	startup("destination at hop 12, limit 30", 30, true);
+	startup("destination at hop 12, limit 255", 255, true);
+	// with no destination to stop at they go out to the limit
+	startup("destination never answers, limit 30", 30, false);
+	startup("destination never answers, limit 255", 255, false);
+}
+
+WINMTR_BENCH(capture_replay_of_a_day)
+{
+	const winmtr::test::scratch_path file("winmtr-simulated-day.cap");
+	{
+		// room for all of it, the writer has nothing to keep up with here
+		const auto writer = capture_writer::open(file.path(), { .buffer_bytes = std::size_t{ 128 } << 20 });
+		WINMTR_REQUIRE(writer);
+		const auto base = probe_backend::clock::now();
+		SOCKADDR_INET destination{};
+		destination.Ipv4.sin_family = AF_INET;
+		destination.Ipv4.sin_addr.s_addr = htonl(0xCB007109u);
+		writer->trace(1, base, destination, DAY_HOPS);
+		// every tenth round goes unanswered
+		for (int i = 0; i < DAY_HOPS * DAY; ++i) {
+			const auto ttl = static_cast<UCHAR>(i % DAY_HOPS + 1);
+			probe_event event{ .time = base + std::chrono::seconds(i / DAY_HOPS), .session = 1, .ttl = ttl };
+			if ((i / DAY_HOPS) % 10) {
+				event.responder = destination;
+				if (ttl < DAY_HOPS) {
+					event.responder.Ipv4.sin_addr.s_addr = htonl(0xC6336400u + ttl);
+				}
+				event.round_trip_time = std::chrono::microseconds(1000 * ttl + i % 997);
+				event.status = ttl == DAY_HOPS ? probe_status::success : probe_status::ttl_expired;
+			}
+			WINMTR_REQUIRE(writer->probe(event));
+		}
+	}
+	const auto opening = std::chrono::steady_clock::now();
+	const auto capture = capture_file::open(file.path());
+	WINMTR_REQUIRE(capture);
+	const auto traces = capture->traces();
+	WINMTR_REQUIRE(traces.size() == 1);
+	const auto opened = std::chrono::steady_clock::now() - opening;
+
+	winmtr::test::options options;
+	options.maxHops = DAY_HOPS;
+	const auto net = std::make_shared<WinMTRNet>(&options, std::make_shared<simulated_backend>(sim_topology::parse(TOPOLOGY)));
+	const auto replaying = std::chrono::steady_clock::now();
+	net->Replay(*capture, traces.front());
+	const auto replayed = std::chrono::steady_clock::now() - replaying;
+	const auto state = net->getCurrentState();
+
+	winmtr::test::report("probes in the day", static_cast<double>(capture->records() - 1), "records");
+	winmtr::test::report("capture size", static_cast<double>(capture->valid_bytes()) / (1 << 20), "MiB");
+	winmtr::test::report("open, validate and find the traces", winmtr::test::seconds(opened) * 1e3, "ms");
+	winmtr::test::report("replay through WinMTRNet", winmtr::test::seconds(replayed) * 1e3, "ms");
+	winmtr::test::report("replayed", static_cast<double>(capture->records()) / winmtr::test::seconds(replayed), "records/s");
+	WINMTR_CHECK(capture->records() == DAY_HOPS * DAY + 1);
+	WINMTR_REQUIRE(!rows_at(state, DAY_HOPS).empty());
+	const auto destination = rows_at(state, DAY_HOPS).at(0);
+	WINMTR_CHECK(destination.xmit == DAY);
+	WINMTR_CHECK(destination.returned == DAY - DAY / 10);
+}
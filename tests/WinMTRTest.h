@@ -0,0 +1,204 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTest.h
+//
+//
+// DESCRIPTION:
+//   Just enough of a test runner for the tests and benchmarks under tests/.
+//   Cases register themselves at static initialization, WinMTRTestMain.cpp
+//   runs them.
+//
+// NOTES:
+//    Benchmarks only run when asked for with --bench, they print what they
+//    measured and only fail if something they rely on breaks.
+//
+//*****************************************************************************
+#pragma once
+#ifndef WINMTR_TEST_H_
+#define WINMTR_TEST_H_
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <arpa/inet.h>
+#endif
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace winmtr::test {
+	enum class case_kind {
+		test,
+		bench
+	};
+
+	struct test_case final {
+		const char* name;
+		case_kind kind;
+		void (*run)();
+	};
+
+	[[nodiscard]]
+	inline std::vector<test_case>& registry()
+	{
+		static std::vector<test_case> cases;
+		return cases;
+	}
+
+	struct registrar final {
+		registrar(const char* name, case_kind kind, void (*run)())
+		{
+			registry().push_back({ name, kind, run });
+		}
+	};
+
+	// thrown to abandon the running case, by WINMTR_REQUIRE and WINMTR_SKIP
+	struct case_failed final {};
+	struct case_skipped final {
+		std::string reason;
+	};
+
+	// checks may fail on any thread the case starts
+	[[nodiscard]]
+	inline std::atomic_uint& failures() noexcept
+	{
+		static std::atomic_uint count{ 0 };
+		return count;
+	}
+
+	inline void fail(const char* file, int line, const char* what) noexcept
+	{
+		failures().fetch_add(1, std::memory_order_relaxed);
+		std::fprintf(stderr, "%s(%d): failed: %s\n", file, line, what);
+	}
+
+	// every allocation made through operator new in the whole process so far,
+	// counted by the replacement in WinMTRTestMain.cpp
+	[[nodiscard]]
+	std::uint64_t allocations() noexcept;
+	// and the bytes they asked for, nothing taken off for what was freed since
+	[[nodiscard]]
+	std::uint64_t allocated_bytes() noexcept;
+
+	// one line of benchmark output
+	inline void report(const char* what, double value, const char* unit) noexcept
+	{
+		std::printf("    %-44s %14.2f %s\n", what, value, unit);
+		std::fflush(stdout);
+	}
+
+	enum class scratch_kind {
+		file,
+		directory	// there, and empty, for the case to put files in
+	};
+
+	// a path in the temp directory for a case to write to, cleared of whatever
+	// an earlier run left there and of whatever this one leaves
+	class scratch_path final {
+		scratch_path(const scratch_path&) = delete;
+		scratch_path& operator=(const scratch_path&) = delete;
+	public:
+		explicit scratch_path(const char* name, scratch_kind kind = scratch_kind::file)
+			:m_path(std::filesystem::temp_directory_path() / name)
+		{
+			std::error_code ignored;
+			std::filesystem::remove_all(m_path, ignored);
+			if (kind == scratch_kind::directory) {
+				std::filesystem::create_directories(m_path, ignored);
+			}
+		}
+		~scratch_path() noexcept
+		{
+			std::error_code ignored;
+			std::filesystem::remove_all(m_path, ignored);
+		}
+		[[nodiscard]]
+		const std::filesystem::path& path() const noexcept
+		{
+			return m_path;
+		}
+	private:
+		std::filesystem::path m_path;
+	};
+
+	// an IPv4 or IPv6 address spelled out, and the port if there is one,
+	// nothing valid if it isn't either
+	[[nodiscard]]
+	inline SOCKADDR_INET address(const char* text, std::uint16_t port = 0) noexcept
+	{
+		SOCKADDR_INET addr{};
+		if (inet_pton(AF_INET, text, &addr.Ipv4.sin_addr) == 1) {
+			addr.Ipv4.sin_family = AF_INET;
+			addr.Ipv4.sin_port = htons(port);
+		}
+		else if (inet_pton(AF_INET6, text, &addr.Ipv6.sin6_addr) == 1) {
+			addr.Ipv6.sin6_family = AF_INET6;
+			addr.Ipv6.sin6_port = htons(port);
+		}
+		return addr;
+	}
+
+	template<class Rep, class Period>
+	[[nodiscard]]
+	constexpr double seconds(std::chrono::duration<Rep, Period> elapsed) noexcept
+	{
+		return std::chrono::duration<double>(elapsed).count();
+	}
+}
+
+#define WINMTR_TEST_CASE_(name, kind) \
+	static void name(); \
+	static const ::winmtr::test::registrar name##_registrar{ #name, kind, &name }; \
+	static void name()
+
+#define WINMTR_TEST(name) WINMTR_TEST_CASE_(name, ::winmtr::test::case_kind::test)
+#define WINMTR_BENCH(name) WINMTR_TEST_CASE_(name, ::winmtr::test::case_kind::bench)
+
+#define WINMTR_CHECK(expression) \
+	((expression) ? void() : ::winmtr::test::fail(__FILE__, __LINE__, #expression))
+
+#define WINMTR_REQUIRE(expression) \
+	do { \
+		if (!(expression)) { \
+			::winmtr::test::fail(__FILE__, __LINE__, #expression); \
+			throw ::winmtr::test::case_failed{}; \
+		} \
+	} while (false)
+
+// for cases the machine can't run, like raw sockets nobody is allowed to open
+#define WINMTR_SKIP(reason) throw ::winmtr::test::case_skipped{ reason }
+
+#endif // ifndef WINMTR_TEST_H_
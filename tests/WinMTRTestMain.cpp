@@ -0,0 +1,219 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTestMain.cpp
+//
+//
+// DESCRIPTION:
+//   Runs the cases registered through WinMTRTest.h.
+//
+//     WinMTRTests [name...]           every test, or only the named ones
+//     WinMTRTests --bench [name...]   every benchmark, or only the named ones
+//     WinMTRTests --list              the names of all of them
+//
+//   Exits with 0 when nothing failed.
+//
+// NOTES:
+//   Replaces the global operator new so the tests can count allocations.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <string_view>
+#include <vector>
+#include "WinMTRTest.h"
+
+namespace {
+	std::atomic_uint64_t g_allocations{ 0 };
+	std::atomic_uint64_t g_allocatedBytes{ 0 };
+
+	[[nodiscard]]
+	void* counted_alloc(std::size_t size) noexcept
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+		return std::malloc(size ? size : 1);
+	}
+
+	[[nodiscard]]
+	void* counted_aligned_alloc(std::size_t size, std::align_val_t alignment) noexcept
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+		const auto align = static_cast<std::size_t>(alignment);
+		// aligned_alloc wants the size rounded up to the alignment
+		const auto rounded = (std::max<std::size_t>(size, 1) + align - 1) & ~(align - 1);
+#ifdef _WIN32
+		return _aligned_malloc(rounded, align);
+#else
+		return std::aligned_alloc(align, rounded);
+#endif
+	}
+
+	void aligned_free(void* p) noexcept
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+}
+
+std::uint64_t winmtr::test::allocations() noexcept
+{
+	return g_allocations.load(std::memory_order_relaxed);
+}
+
+std::uint64_t winmtr::test::allocated_bytes() noexcept
+{
+	return g_allocatedBytes.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+	if (auto p = counted_alloc(size)) [[likely]] {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (auto p = counted_aligned_alloc(size, alignment)) [[likely]] {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return ::operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { aligned_free(p); }
+
+int main(int argc, char* argv[])
+{
+	using namespace winmtr::test;
+	auto kind = case_kind::test;
+	auto list = false;
+	std::vector<std::string_view> names;
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		if (arg == "--bench") {
+			kind = case_kind::bench;
+		}
+		else if (arg == "--list") {
+			list = true;
+		}
+		else {
+			names.push_back(arg);
+		}
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData)) {
+		std::fputs("WSAStartup failed\n", stderr);
+		return 1;
+	}
+#endif
+
+	unsigned ran = 0;
+	unsigned failed = 0;
+	unsigned skipped = 0;
+	for (const auto& current : registry()) {
+		if (list) {
+			std::printf("%s%s\n", current.name, current.kind == case_kind::bench ? " (bench)" : "");
+			continue;
+		}
+		if (current.kind != kind || (!names.empty() && std::ranges::find(names, current.name) == names.end())) {
+			continue;
+		}
+		std::printf("[ RUN      ] %s\n", current.name);
+		std::fflush(stdout);
+		const auto before = failures().load();
+		try {
+			current.run();
+		}
+		catch (const case_failed&) {
+		}
+		catch (const case_skipped& skip) {
+			++skipped;
+			std::printf("[ SKIPPED  ] %s: %s\n", current.name, skip.reason.c_str());
+			continue;
+		}
+		catch (const std::exception& e) {
+			fail(__FILE__, __LINE__, e.what());
+		}
+		catch (...) {
+			fail(__FILE__, __LINE__, "unknown exception");
+		}
+		++ran;
+		const auto ok = failures().load() == before;
+		failed += ok ? 0 : 1;
+		std::printf("[ %s ] %s\n", ok ? "      OK" : "  FAILED", current.name);
+		std::fflush(stdout);
+	}
+	if (!list) {
+		std::printf("%u ran, %u failed, %u skipped\n", ran, failed, skipped);
+	}
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTestOptions.ixx
+//
+//
+// DESCRIPTION:
+//   The options every test that runs a WinMTRNet hands it. The defaults of
+//   the dialog, but for the names, which a simulated router doesn't have.
+//   A case changes whatever it is about before the trace starts.
+//
+// NOTES:
+//    Plain members, nobody writes them while a trace reads them.
+//
+//*****************************************************************************
+export module WinMTR.Test.Options;
+
+import WinMTR.ProbeBackend;
+import WinMTROptionsProvider;
+import WinMTRUtils;
+
+export namespace winmtr::test {
+	struct options final : IWinMTROptionsProvider {
+		unsigned pingSize = WinMTRUtils::DEFAULT_PING_SIZE;
+		double interval = WinMTRUtils::DEFAULT_INTERVAL;
+		bool useDNS = false;
+		double ewmaWeight = WinMTRUtils::DEFAULT_EWMA_WEIGHT;
+		unsigned historyKiB = 0;
+		bool parisMode = false;
+		probe_protocol protocol = probe_protocol::icmp;
+		unsigned probePort = WinMTRUtils::DEFAULT_UDP_PORT;
+		unsigned maxProbeRate = WinMTRUtils::DEFAULT_MAX_PROBE_RATE;
+		unsigned maxByteRate = WinMTRUtils::DEFAULT_MAX_BYTE_RATE;
+		unsigned maxHops = WinMTRUtils::DEFAULT_MAX_HOPS;
+
+		unsigned getPingSize() const noexcept override { return pingSize; }
+		double getInterval() const noexcept override { return interval; }
+		bool getUseDNS() const noexcept override { return useDNS; }
+		double getEwmaWeight() const noexcept override { return ewmaWeight; }
+		unsigned getHistoryKiB() const noexcept override { return historyKiB; }
+		bool getParisMode() const noexcept override { return parisMode; }
+		probe_protocol getProbeProtocol() const noexcept override { return protocol; }
+		unsigned getProbePort() const noexcept override { return probePort; }
+		unsigned getMaxProbeRate() const noexcept override { return maxProbeRate; }
+		unsigned getMaxByteRate() const noexcept override { return maxByteRate; }
+		unsigned getMaxHops() const noexcept override { return maxHops; }
+	};
+}
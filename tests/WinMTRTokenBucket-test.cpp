@@ -0,0 +1,170 @@
+/*
+WinMTR
+Copyright (C)  2010-2019 Appnor MSP S.A. - http://www.appnor.com
+Copyright (C) 2019-2023 Leetsoftwerx
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+//*****************************************************************************
+// FILE:            WinMTRTokenBucket-test.cpp
+//
+//
+// DESCRIPTION:
+//   The token bucket's caps, the refund of a probe that never went out, and
+//   the one bucket every backend on the steady clock paces through.
+//
+// NOTES:
+//    The process' bucket outlives every test, whatever a test reserves in it
+//    is refunded before the test ends so the next one finds it empty.
+//
+//*****************************************************************************
+#ifdef _WIN32
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include "WinMTRPosixCompat.h"
+#include <cerrno>
+#endif
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <system_error>
+#include "WinMTRTest.h"
+import WinMTR.ProbeBackend;
+
+using namespace std::literals;
+
+namespace {
+	using clock = token_bucket::clock;
+
+	const std::array<std::byte, 32> PAYLOAD{};
+	constexpr double PROBES_PER_SECOND = 10.0;
+	constexpr auto PROBE_COST = 100ms;
+
+#ifdef _WIN32
+	constexpr int SEND_FAILED = ERROR_NETWORK_UNREACHABLE;
+#else
+	constexpr int SEND_FAILED = ENETUNREACH;
+#endif
+
+	// a network that refuses every probe on the spot, on the steady clock
+	class refusing_backend final : public probe_backend {
+	public:
+		[[nodiscard]]
+		std::uint64_t probes_sent() const noexcept override
+		{
+			return 0;
+		}
+
+		void submit(probe_request& request) override
+		{
+			request.result().error = SEND_FAILED;
+			request.complete();
+		}
+
+		void schedule(probe_delay& delay) override
+		{
+			delay.complete();
+		}
+	};
+
+	// runs to completion on the calling thread, the backend above never suspends for real
+	struct detached final {
+		struct promise_type final {
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	detached send_paced(probe_backend& backend, token_bucket::reservation paced, int& error)
+	{
+		try {
+			(void)co_await backend.send(probe_key{ .ttl = 1 }, SOCKADDR_INET{}, PAYLOAD, DEFAULT_PROBE_TIMEOUT, nullptr, paced);
+		}
+		catch (const std::system_error& e) {
+			error = e.code().value();
+		}
+	}
+}
+
+WINMTR_TEST(token_bucket_caps_probes_and_bytes)
+{
+	token_bucket bucket;
+	const clock::time_point now{ 1h };
+	// the first goes right away, the next a probe's worth later, less the burst
+	WINMTR_CHECK(bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64).wait == clock::duration::zero());
+	WINMTR_CHECK(bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64).wait == PROBE_COST - token_bucket::BURST);
+	WINMTR_CHECK(bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64).wait == 2 * PROBE_COST - token_bucket::BURST);
+
+	// whichever cap is tighter holds the probe back, here 1,000 bytes at 10,000 a second
+	token_bucket bytes;
+	WINMTR_CHECK(bytes.reserve(now, 1000.0, 10'000.0, 1000).wait == clock::duration::zero());
+	WINMTR_CHECK(bytes.reserve(now, 1000.0, 10'000.0, 1000).wait == PROBE_COST - token_bucket::BURST);
+
+	token_bucket unlimited;
+	for (int i = 0; i < 1000; ++i) {
+		WINMTR_CHECK(unlimited.reserve(now, 0.0, 0.0, 64).wait == clock::duration::zero());
+	}
+}
+
+WINMTR_TEST(token_bucket_refunds_what_was_not_sent)
+{
+	token_bucket bucket;
+	const clock::time_point now{ 1h };
+	(void)bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64);
+	const auto lost = bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64);
+	WINMTR_CHECK(lost.probes == PROBE_COST);
+	bucket.refund(lost);
+	// as if the refunded one had never been reserved
+	WINMTR_CHECK(bucket.reserve(now, PROBES_PER_SECOND, 0.0, 64).wait == lost.wait);
+}
+
+WINMTR_TEST(token_bucket_is_one_per_process)
+{
+	refusing_backend first;
+	refusing_backend second;
+	WINMTR_CHECK(&first.rate_limit() == &token_bucket::process());
+	WINMTR_CHECK(&second.rate_limit() == &token_bucket::process());
+
+	// what one backend reserves holds back the other
+	const auto taken = first.pace(64, PROBES_PER_SECOND, 0.0);
+	const auto held = second.pace(64, PROBES_PER_SECOND, 0.0);
+	WINMTR_CHECK(held.wait > clock::duration::zero());
+	token_bucket::process().refund(held);
+	token_bucket::process().refund(taken);
+}
+
+WINMTR_TEST(probe_backend_refunds_a_failed_send)
+{
+	refusing_backend backend;
+	const auto paced = backend.pace(64, PROBES_PER_SECOND, 0.0);
+	int error = 0;
+	send_paced(backend, paced, error);
+	WINMTR_CHECK(error == SEND_FAILED);
+	// the refused probe took nothing, so the next one goes right away too
+	const auto next = backend.pace(64, PROBES_PER_SECOND, 0.0);
+	WINMTR_CHECK(next.wait == clock::duration::zero());
+	token_bucket::process().refund(next);
+}